@@ -0,0 +1,138 @@
+// Code generated by protoc-gen-go-grpc. DO NOT EDIT.
+// versions:
+// - protoc-gen-go-grpc v1.3.0
+// - protoc             v4.25.1
+// source: embedding.proto
+
+package scalellm
+
+import (
+	context "context"
+	grpc "google.golang.org/grpc"
+	codes "google.golang.org/grpc/codes"
+	status "google.golang.org/grpc/status"
+)
+
+// This is a compile-time assertion to ensure that this generated file
+// is compatible with the grpc package it is being compiled against.
+// Requires gRPC-Go v1.32.0 or later.
+const _ = grpc.SupportPackageIsVersion7
+
+const (
+	Embeddings_Embed_FullMethodName = "/llm.proto.Embeddings/Embed"
+)
+
+// EmbeddingsClient is the client API for Embeddings service.
+//
+// For semantics around ctx use and closing/ending streaming RPCs, please refer to https://pkg.go.dev/google.golang.org/grpc/?tab=doc#ClientConn.NewStream.
+type EmbeddingsClient interface {
+	// the response is sent in one message once the embedding is ready
+	Embed(ctx context.Context, in *EmbeddingRequest, opts ...grpc.CallOption) (Embeddings_EmbedClient, error)
+}
+
+type embeddingsClient struct {
+	cc grpc.ClientConnInterface
+}
+
+func NewEmbeddingsClient(cc grpc.ClientConnInterface) EmbeddingsClient {
+	return &embeddingsClient{cc}
+}
+
+func (c *embeddingsClient) Embed(ctx context.Context, in *EmbeddingRequest, opts ...grpc.CallOption) (Embeddings_EmbedClient, error) {
+	stream, err := c.cc.NewStream(ctx, &Embeddings_ServiceDesc.Streams[0], Embeddings_Embed_FullMethodName, opts...)
+	if err != nil {
+		return nil, err
+	}
+	x := &embeddingsEmbedClient{stream}
+	if err := x.ClientStream.SendMsg(in); err != nil {
+		return nil, err
+	}
+	if err := x.ClientStream.CloseSend(); err != nil {
+		return nil, err
+	}
+	return x, nil
+}
+
+type Embeddings_EmbedClient interface {
+	Recv() (*EmbeddingResponse, error)
+	grpc.ClientStream
+}
+
+type embeddingsEmbedClient struct {
+	grpc.ClientStream
+}
+
+func (x *embeddingsEmbedClient) Recv() (*EmbeddingResponse, error) {
+	m := new(EmbeddingResponse)
+	if err := x.ClientStream.RecvMsg(m); err != nil {
+		return nil, err
+	}
+	return m, nil
+}
+
+// EmbeddingsServer is the server API for Embeddings service.
+// All implementations must embed UnimplementedEmbeddingsServer
+// for forward compatibility
+type EmbeddingsServer interface {
+	// the response is sent in one message once the embedding is ready
+	Embed(*EmbeddingRequest, Embeddings_EmbedServer) error
+	mustEmbedUnimplementedEmbeddingsServer()
+}
+
+// UnimplementedEmbeddingsServer must be embedded to have forward compatible implementations.
+type UnimplementedEmbeddingsServer struct {
+}
+
+func (UnimplementedEmbeddingsServer) Embed(*EmbeddingRequest, Embeddings_EmbedServer) error {
+	return status.Errorf(codes.Unimplemented, "method Embed not implemented")
+}
+func (UnimplementedEmbeddingsServer) mustEmbedUnimplementedEmbeddingsServer() {}
+
+// UnsafeEmbeddingsServer may be embedded to opt out of forward compatibility for this service.
+// Use of this interface is not recommended, as added methods to EmbeddingsServer will
+// result in compilation errors.
+type UnsafeEmbeddingsServer interface {
+	mustEmbedUnimplementedEmbeddingsServer()
+}
+
+func RegisterEmbeddingsServer(s grpc.ServiceRegistrar, srv EmbeddingsServer) {
+	s.RegisterService(&Embeddings_ServiceDesc, srv)
+}
+
+func _Embeddings_Embed_Handler(srv interface{}, stream grpc.ServerStream) error {
+	m := new(EmbeddingRequest)
+	if err := stream.RecvMsg(m); err != nil {
+		return err
+	}
+	return srv.(EmbeddingsServer).Embed(m, &embeddingsEmbedServer{stream})
+}
+
+type Embeddings_EmbedServer interface {
+	Send(*EmbeddingResponse) error
+	grpc.ServerStream
+}
+
+type embeddingsEmbedServer struct {
+	grpc.ServerStream
+}
+
+func (x *embeddingsEmbedServer) Send(m *EmbeddingResponse) error {
+	return x.ServerStream.SendMsg(m)
+}
+
+// Embeddings_ServiceDesc is the grpc.ServiceDesc for Embeddings service.
+// It's only intended for direct use with grpc.RegisterService,
+// and not to be introspected or modified (even as a copy)
+var Embeddings_ServiceDesc = grpc.ServiceDesc{
+	ServiceName: "llm.proto.Embeddings",
+	HandlerType: (*EmbeddingsServer)(nil),
+	Methods:     []grpc.MethodDesc{},
+	Streams: []grpc.StreamDesc{
+		{
+			StreamName:    "Embed",
+			Handler:       _Embeddings_Embed_Handler,
+			ServerStreams: true,
+		},
+	},
+	Metadata: "embedding.proto",
+}
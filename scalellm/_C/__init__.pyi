@@ -1,5 +1,5 @@
 from enum import Enum
-from typing import Callable, List, Optional
+from typing import Callable, Dict, List, Optional, Tuple, overload
 
 # Defined in scalellm/csrc/scalellm.cpp
 def get_metrics() -> str: ...
@@ -20,6 +20,15 @@ class SamplingParams:
         ignore_eos: bool = False,
         stop: Optional[List[str]] = None,
         stop_token_ids: Optional[List[int]] = None,
+        num_beams: int = 1,
+        length_penalty: float = 1.0,
+        early_stopping: bool = False,
+        logprobs: bool = False,
+        top_logprobs: int = 0,
+        prompt_logprobs: bool = False,
+        logit_bias: Optional[Dict[int, float]] = None,
+        banned_token_ids: Optional[List[int]] = None,
+        session_id: Optional[str] = None,
     ) -> None: ...
     # number of tokens to generate. truncted to model's max context length.
     max_tokens: int
@@ -48,6 +57,38 @@ class SamplingParams:
     stop: Optional[List[str]]
     # the list of token ids to stop generating further tokens.
     stop_token_ids: Optional[List[int]]
+    #  ############ beam search. ############
+    # number of beams for beam search, the best n of them are returned. default = 1 to disable.
+    num_beams: int
+    # exponential penalty to the length for beam search. values > 0.0 promote longer sequences.
+    length_penalty: float
+    # whether to stop beam search as soon as there are num_beams finished candidates.
+    early_stopping: bool
+    #  ############ logprobs. ############
+    # whether to return logprobs of generated tokens.
+    logprobs: bool
+    # number of most likely alternatives to return with each logprob, between [0, 20].
+    top_logprobs: int
+    # whether to return logprobs of prompt tokens.
+    prompt_logprobs: bool
+    #  ############ logit bias. ############
+    # biases added to logits of tokens before sampling, between [-100, 100].
+    logit_bias: Optional[Dict[int, float]]
+    # the list of token ids that are never generated.
+    banned_token_ids: Optional[List[int]]
+    # the id of the chat session, whose last turn's token ids are reused.
+    session_id: Optional[str]
+
+class EmbeddingParams:
+    def __init__(
+        self,
+        pooling: str = "last",
+        normalize: bool = True,
+    ) -> None: ...
+    # how to pool hidden states of prompt tokens, one of "last", "mean" and "cls".
+    pooling: str
+    # whether to normalize the embedding to unit length.
+    normalize: bool
 
 class Message:
     def __init__(self, role: str, content: str) -> None: ...
@@ -66,17 +107,37 @@ class Usage:
     num_generated_tokens: int
     num_total_tokens: int
 
+class LogProbData:
+    def __init__(self) -> None: ...
+    token: str
+    token_id: int
+    logprob: float
+
+class LogProb:
+    def __init__(self) -> None: ...
+    token: str
+    token_id: int
+    logprob: float
+    # the most likely tokens at the position in descending order of logprob.
+    top_logprobs: List[LogProbData]
+
 class SequenceOutput:
     def __init__(self) -> None: ...
     index: int
     text: str
     finish_reason: Optional[str]
+    # the embedding of the prompt for embedding requests.
+    embedding: List[float]
+    # logprobs of the generated/delta tokens if requested.
+    logprobs: Optional[List[LogProb]]
 
 class RequestOutput:
     def __init__(self) -> None: ...
     prompt: Optional[str]
     status: Optional[Status]
     outputs: List[SequenceOutput]
+    # logprobs of prompt tokens except the first one if requested.
+    prompt_logprobs: Optional[List[LogProb]]
     usage: Optional[Usage]
     finished: bool
 
@@ -100,6 +161,20 @@ class Status:
     @property
     def ok(self) -> bool: ...
 
+# Delivers outputs of requests to an event loop, signaled through an eventfd.
+class OutputBridge:
+    def __init__(self, capacity: int = 65536) -> None: ...
+    # the eventfd readable when there are outputs to drain
+    @property
+    def fd(self) -> int: ...
+    # the number of streams that have not finished or been cancelled
+    @property
+    def num_streams(self) -> int: ...
+    # pending outputs with their stream ids, in the order they were pushed
+    def drain(self) -> List[Tuple[int, RequestOutput]]: ...
+    # cancel the request of the stream on its next output
+    def cancel(self, stream_id: int) -> None: ...
+
 class LLMHandler:
     class Options:
         def __init__(self) -> None: ...
@@ -107,20 +182,33 @@ class LLMHandler:
         devices: Optional[str]
         draft_model_path: Optional[str]
         draft_devices: Optional[str]
+        prefill_devices: Optional[str]
         block_size: int
         max_cache_size: int
         max_memory_utilization: float
         enable_prefix_cache: bool
         enable_cuda_graph: bool
+        max_cpu_activation_cache_size: int
         cuda_graph_max_seq_len: int
         cuda_graph_batch_sizes: Optional[List[int]]
         draft_cuda_graph_batch_sizes: Optional[List[int]]
+        enable_vocab_parallel_sampling: bool
         max_tokens_per_batch: int
         max_seqs_per_batch: int
         num_speculative_tokens: int
+        num_decode_steps: int
+        max_queue_wait_high: float
+        max_queue_wait_normal: float
+        max_queue_wait_low: float
+        max_kv_demand_high: float
+        max_kv_demand_normal: float
+        max_kv_demand_low: float
         num_handling_threads: int
+        num_replicas: int
+        max_chat_sessions: int
 
     def __init__(self, options: Options) -> None: ...
+    @overload
     def schedule_async(
         self,
         prompt: str,
@@ -129,6 +217,17 @@ class LLMHandler:
         stream: bool,
         callback: Callable[[RequestOutput], bool],
     ) -> None: ...
+    @overload
+    def schedule_async(
+        self,
+        prompt: str,
+        sp: SamplingParams,
+        priority: Priority,
+        stream: bool,
+        bridge: OutputBridge,
+        stream_id: int,
+    ) -> None: ...
+    @overload
     def schedule_chat_async(
         self,
         messages: List[Message],
@@ -137,6 +236,16 @@ class LLMHandler:
         stream: bool,
         callback: Callable[[RequestOutput], bool],
     ) -> None: ...
+    @overload
+    def schedule_chat_async(
+        self,
+        messages: List[Message],
+        sp: SamplingParams,
+        priority: Priority,
+        stream: bool,
+        bridge: OutputBridge,
+        stream_id: int,
+    ) -> None: ...
     def schedule_batch_async(
         self,
         prompts: List[str],
@@ -153,6 +262,35 @@ class LLMHandler:
         stream: bool,
         callback: Callable[[int, RequestOutput], bool],
     ) -> None: ...
+    def embed_async(
+        self,
+        prompt: str,
+        ep: EmbeddingParams,
+        priority: Priority,
+        callback: Callable[[RequestOutput], bool],
+    ) -> None: ...
+    def embed_batch_async(
+        self,
+        prompts: List[str],
+        ep: EmbeddingParams,
+        priority: Priority,
+        callback: Callable[[int, RequestOutput], bool],
+    ) -> None: ...
+    def generate(
+        self,
+        prompts: List[str],
+        sampling_params: List[SamplingParams],
+        priority: Priority = Priority.NORMAL,
+    ) -> List[RequestOutput]: ...
+    def generate_chat(
+        self,
+        conversations: List[List[Message]],
+        sampling_params: List[SamplingParams],
+        priority: Priority = Priority.NORMAL,
+    ) -> List[RequestOutput]: ...
+    def embed(
+        self, prompts: List[str], embedding_params: EmbeddingParams
+    ) -> List[RequestOutput]: ...
     def start(self) -> None: ...
     def stop(self) -> None: ...
     def run_until_complete(self) -> None: ...
@@ -5,14 +5,18 @@ try:
 except ImportError:
     pass
 
-from scalellm._C import (LLMHandler, Message, Priority, RequestOutput,
-                         SamplingParams, SequenceOutput, Status, StatusCode,
-                         Usage, get_metrics)
+from scalellm._C import (EmbeddingParams, LLMHandler, LogProb, LogProbData,
+                         Message, Priority, RequestOutput, SamplingParams,
+                         SequenceOutput, Status, StatusCode, Usage,
+                         get_metrics)
 from scalellm.errors import ValidationError
 from scalellm.llm import LLM
 from scalellm.llm_engine import AsyncLLMEngine, OutputAsyncStream, OutputStream
 
 __all__ = [
+    "EmbeddingParams",
+    "LogProb",
+    "LogProbData",
     "Message",
     "LLM",
     "AsyncLLMEngine",
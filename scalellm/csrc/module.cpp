@@ -4,7 +4,9 @@
 #include <pybind11/stl.h>
 
 #include "common/metrics.h"
+#include "handlers/embedding_params.h"
 #include "handlers/llm_handler.h"
+#include "handlers/output_bridge.h"
 #include "handlers/sampling_params.h"
 #include "request/status.h"
 
@@ -35,7 +37,16 @@ PYBIND11_MODULE(PY_MODULE_NAME, m) {
                     bool,
                     bool,
                     std::optional<std::vector<std::string>>,
-                    std::optional<std::vector<int32_t>>>(),
+                    std::optional<std::vector<int32_t>>,
+                    uint32_t,
+                    float,
+                    bool,
+                    bool,
+                    uint32_t,
+                    bool,
+                    std::optional<std::unordered_map<int32_t, float>>,
+                    std::optional<std::vector<int32_t>>,
+                    std::optional<std::string>>(),
            py::arg("max_tokens") = 16,
            py::arg("n") = 1,
            py::arg("echo") = false,
@@ -48,7 +59,16 @@ PYBIND11_MODULE(PY_MODULE_NAME, m) {
            py::arg("skip_special_tokens") = true,
            py::arg("ignore_eos") = false,
            py::arg("stop") = std::nullopt,
-           py::arg("stop_token_ids") = std::nullopt)
+           py::arg("stop_token_ids") = std::nullopt,
+           py::arg("num_beams") = 1,
+           py::arg("length_penalty") = 1.0,
+           py::arg("early_stopping") = false,
+           py::arg("logprobs") = false,
+           py::arg("top_logprobs") = 0,
+           py::arg("prompt_logprobs") = false,
+           py::arg("logit_bias") = std::nullopt,
+           py::arg("banned_token_ids") = std::nullopt,
+           py::arg("session_id") = std::nullopt)
       .def_readwrite("max_tokens", &SamplingParams::max_tokens)
       .def_readwrite("n", &SamplingParams::n)
       .def_readwrite("echo", &SamplingParams::echo)
@@ -62,7 +82,23 @@ PYBIND11_MODULE(PY_MODULE_NAME, m) {
                      &SamplingParams::skip_special_tokens)
       .def_readwrite("ignore_eos", &SamplingParams::ignore_eos)
       .def_readwrite("stop", &SamplingParams::stop)
-      .def_readwrite("stop_token_ids", &SamplingParams::stop_token_ids);
+      .def_readwrite("stop_token_ids", &SamplingParams::stop_token_ids)
+      .def_readwrite("num_beams", &SamplingParams::num_beams)
+      .def_readwrite("length_penalty", &SamplingParams::length_penalty)
+      .def_readwrite("early_stopping", &SamplingParams::early_stopping)
+      .def_readwrite("logprobs", &SamplingParams::logprobs)
+      .def_readwrite("top_logprobs", &SamplingParams::top_logprobs)
+      .def_readwrite("prompt_logprobs", &SamplingParams::prompt_logprobs)
+      .def_readwrite("logit_bias", &SamplingParams::logit_bias)
+      .def_readwrite("banned_token_ids", &SamplingParams::banned_token_ids)
+      .def_readwrite("session_id", &SamplingParams::session_id);
+
+  py::class_<EmbeddingParams>(m, "EmbeddingParams")
+      .def(py::init<std::string, bool>(),
+           py::arg("pooling") = "last",
+           py::arg("normalize") = true)
+      .def_readwrite("pooling", &EmbeddingParams::pooling)
+      .def_readwrite("normalize", &EmbeddingParams::normalize);
 
   py::class_<Message>(m, "Message")
       .def(py::init<const std::string&, const std::string&>(),
@@ -104,35 +140,144 @@ PYBIND11_MODULE(PY_MODULE_NAME, m) {
       .def_property_readonly("message", &Status::message)
       .def_property_readonly("ok", &Status::ok);
 
+  py::class_<LogProbData>(m, "LogProbData")
+      .def(py::init())
+      .def_readwrite("token", &LogProbData::token)
+      .def_readwrite("token_id", &LogProbData::token_id)
+      .def_readwrite("logprob", &LogProbData::logprob);
+
+  py::class_<LogProb>(m, "LogProb")
+      .def(py::init())
+      .def_readwrite("token", &LogProb::token)
+      .def_readwrite("token_id", &LogProb::token_id)
+      .def_readwrite("logprob", &LogProb::logprob)
+      .def_readwrite("top_logprobs", &LogProb::top_logprobs);
+
   py::class_<SequenceOutput>(m, "SequenceOutput")
       .def(py::init())
       .def_readwrite("index", &SequenceOutput::index)
       .def_readwrite("text", &SequenceOutput::text)
-      .def_readwrite("finish_reason", &SequenceOutput::finish_reason);
+      .def_readwrite("finish_reason", &SequenceOutput::finish_reason)
+      .def_readwrite("embedding", &SequenceOutput::embedding)
+      .def_readwrite("logprobs", &SequenceOutput::logprobs);
 
   py::class_<RequestOutput>(m, "RequestOutput")
       .def(py::init())
       .def_readwrite("prompt", &RequestOutput::prompt)
       .def_readwrite("status", &RequestOutput::status)
       .def_readwrite("outputs", &RequestOutput::outputs)
+      .def_readwrite("prompt_logprobs", &RequestOutput::prompt_logprobs)
       .def_readwrite("usage", &RequestOutput::usage)
       .def_readwrite("finished", &RequestOutput::finished);
 
+  py::class_<OutputBridge>(m, "OutputBridge")
+      .def(py::init<size_t>(), py::arg("capacity") = 65536)
+      .def_property_readonly("fd", &OutputBridge::fd)
+      .def_property_readonly("num_streams", &OutputBridge::num_streams)
+      // pending outputs are moved out without the GIL, then converted at once
+      .def("drain",
+           [](OutputBridge& self) {
+             std::vector<OutputBridge::Item> items;
+             {
+               py::gil_scoped_release release;
+               items = self.drain();
+             }
+             return items;
+           })
+      .def("cancel",
+           &OutputBridge::cancel,
+           py::arg("stream_id"),
+           py::call_guard<py::gil_scoped_release>());
+
   auto llm_handler =
       py::class_<LLMHandler>(m, "LLMHandler")
           .def(py::init<const LLMHandler::Options&>(), py::arg("options"))
-          .def("schedule_async",
-               &LLMHandler::schedule_async,
-               py::call_guard<py::gil_scoped_release>())
-          .def("schedule_chat_async",
-               &LLMHandler::schedule_chat_async,
-               py::call_guard<py::gil_scoped_release>())
+          // requests from python are not traced
+          .def(
+              "schedule_async",
+              [](LLMHandler& self,
+                 std::string prompt,
+                 SamplingParams sp,
+                 Priority priority,
+                 bool stream,
+                 OutputCallback callback) {
+                self.schedule_async(std::move(prompt),
+                                    std::move(sp),
+                                    priority,
+                                    stream,
+                                    std::move(callback));
+              },
+              py::call_guard<py::gil_scoped_release>())
+          // outputs are delivered through the bridge without the GIL
+          .def(
+              "schedule_async",
+              [](LLMHandler& self,
+                 std::string prompt,
+                 SamplingParams sp,
+                 Priority priority,
+                 bool stream,
+                 OutputBridge& bridge,
+                 uint64_t stream_id) {
+                self.schedule_async(std::move(prompt),
+                                    std::move(sp),
+                                    priority,
+                                    stream,
+                                    bridge.callback(stream_id));
+              },
+              py::call_guard<py::gil_scoped_release>())
+          .def(
+              "schedule_chat_async",
+              [](LLMHandler& self,
+                 std::vector<Message> messages,
+                 SamplingParams sp,
+                 Priority priority,
+                 bool stream,
+                 OutputCallback callback) {
+                self.schedule_chat_async(std::move(messages),
+                                         std::move(sp),
+                                         priority,
+                                         stream,
+                                         std::move(callback));
+              },
+              py::call_guard<py::gil_scoped_release>())
+          .def(
+              "schedule_chat_async",
+              [](LLMHandler& self,
+                 std::vector<Message> messages,
+                 SamplingParams sp,
+                 Priority priority,
+                 bool stream,
+                 OutputBridge& bridge,
+                 uint64_t stream_id) {
+                self.schedule_chat_async(std::move(messages),
+                                         std::move(sp),
+                                         priority,
+                                         stream,
+                                         bridge.callback(stream_id));
+              },
+              py::call_guard<py::gil_scoped_release>())
           .def("schedule_batch_async",
                &LLMHandler::schedule_batch_async,
                py::call_guard<py::gil_scoped_release>())
           .def("schedule_chat_batch_async",
                &LLMHandler::schedule_chat_batch_async,
                py::call_guard<py::gil_scoped_release>())
+          .def(
+              "embed_async",
+              [](LLMHandler& self,
+                 std::string prompt,
+                 EmbeddingParams ep,
+                 Priority priority,
+                 OutputCallback callback) {
+                self.embed_async(std::move(prompt),
+                                 std::move(ep),
+                                 priority,
+                                 std::move(callback));
+              },
+              py::call_guard<py::gil_scoped_release>())
+          .def("embed_batch_async",
+               &LLMHandler::embed_batch_async,
+               py::call_guard<py::gil_scoped_release>())
           .def("start",
                &LLMHandler::start,
                py::call_guard<py::gil_scoped_release>())
@@ -141,6 +286,23 @@ PYBIND11_MODULE(PY_MODULE_NAME, m) {
                py::call_guard<py::gil_scoped_release>())
           .def("run_until_complete",
                &LLMHandler::run_until_complete,
+               py::call_guard<py::gil_scoped_release>())
+          .def("generate",
+               &LLMHandler::generate,
+               py::arg("prompts"),
+               py::arg("sampling_params"),
+               py::arg("priority") = Priority::NORMAL,
+               py::call_guard<py::gil_scoped_release>())
+          .def("generate_chat",
+               &LLMHandler::generate_chat,
+               py::arg("conversations"),
+               py::arg("sampling_params"),
+               py::arg("priority") = Priority::NORMAL,
+               py::call_guard<py::gil_scoped_release>())
+          .def("embed",
+               &LLMHandler::embed,
+               py::arg("prompts"),
+               py::arg("embedding_params"),
                py::call_guard<py::gil_scoped_release>());
 
   // LLMHandler::Options
@@ -151,6 +313,8 @@ PYBIND11_MODULE(PY_MODULE_NAME, m) {
       .def_readwrite("draft_model_path",
                      &LLMHandler::Options::draft_model_path_)
       .def_readwrite("draft_devices", &LLMHandler::Options::draft_devices_)
+      .def_readwrite("prefill_devices",
+                     &LLMHandler::Options::prefill_devices_)
       .def_readwrite("block_size", &LLMHandler::Options::block_size_)
       .def_readwrite("max_cache_size", &LLMHandler::Options::max_cache_size_)
       .def_readwrite("max_memory_utilization",
@@ -159,20 +323,41 @@ PYBIND11_MODULE(PY_MODULE_NAME, m) {
                      &LLMHandler::Options::enable_prefix_cache_)
       .def_readwrite("enable_cuda_graph",
                      &LLMHandler::Options::enable_cuda_graph_)
+      .def_readwrite("max_cpu_activation_cache_size",
+                     &LLMHandler::Options::max_cpu_activation_cache_size_)
       .def_readwrite("cuda_graph_max_seq_len",
                      &LLMHandler::Options::cuda_graph_max_seq_len_)
       .def_readwrite("cuda_graph_batch_sizes",
                      &LLMHandler::Options::cuda_graph_batch_sizes_)
       .def_readwrite("draft_cuda_graph_batch_sizes",
                      &LLMHandler::Options::draft_cuda_graph_batch_sizes_)
+      .def_readwrite("enable_vocab_parallel_sampling",
+                     &LLMHandler::Options::enable_vocab_parallel_sampling_)
       .def_readwrite("max_tokens_per_batch",
                      &LLMHandler::Options::max_tokens_per_batch_)
       .def_readwrite("max_seqs_per_batch",
                      &LLMHandler::Options::max_seqs_per_batch_)
       .def_readwrite("num_speculative_tokens",
                      &LLMHandler::Options::num_speculative_tokens_)
+      .def_readwrite("num_decode_steps",
+                     &LLMHandler::Options::num_decode_steps_)
+      .def_readwrite("max_queue_wait_high",
+                     &LLMHandler::Options::max_queue_wait_high_)
+      .def_readwrite("max_queue_wait_normal",
+                     &LLMHandler::Options::max_queue_wait_normal_)
+      .def_readwrite("max_queue_wait_low",
+                     &LLMHandler::Options::max_queue_wait_low_)
+      .def_readwrite("max_kv_demand_high",
+                     &LLMHandler::Options::max_kv_demand_high_)
+      .def_readwrite("max_kv_demand_normal",
+                     &LLMHandler::Options::max_kv_demand_normal_)
+      .def_readwrite("max_kv_demand_low",
+                     &LLMHandler::Options::max_kv_demand_low_)
       .def_readwrite("num_handling_threads",
-                     &LLMHandler::Options::num_handling_threads_);
+                     &LLMHandler::Options::num_handling_threads_)
+      .def_readwrite("num_replicas", &LLMHandler::Options::num_replicas_)
+      .def_readwrite("max_chat_sessions",
+                     &LLMHandler::Options::max_chat_sessions_);
 }
 
 }  // namespace llm::csrc
\ No newline at end of file
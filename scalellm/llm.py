@@ -1,7 +1,8 @@
 import os
 from typing import List, Optional, Union
 
-from scalellm._C import LLMHandler, Priority, RequestOutput, SamplingParams
+from scalellm._C import (EmbeddingParams, LLMHandler, Priority, RequestOutput,
+                         SamplingParams)
 from scalellm.downloader import download_hf_model
 from scalellm.errors import ValidationError
 
@@ -17,6 +18,7 @@ class LLM:
         cache_dir: Optional[str] = None,
         devices: Optional[str] = None,
         draft_devices: Optional[str] = None,
+        prefill_devices: Optional[str] = None,
         block_size: int = 16,
         max_cache_size: int = 20 * 1024 * 1024 * 1024,
         max_memory_utilization: float = 0.9,
@@ -25,10 +27,13 @@ class LLM:
         cuda_graph_max_seq_len: int = 2048,
         cuda_graph_batch_sizes: Optional[List[int]] = None,
         draft_cuda_graph_batch_sizes: Optional[List[int]] = None,
+        enable_vocab_parallel_sampling: bool = False,
         max_tokens_per_batch: int = 409600, # a big number to disable chunked prefill
         max_seqs_per_batch: int = 2048, # a big number for better throughput
         num_speculative_tokens: int = 0,
+        num_decode_steps: int = 1,
         num_handling_threads: int = 4,
+        num_replicas: int = 1,
     ) -> None:
         # download hf model if it does not exist
         model_path = model
@@ -53,6 +58,7 @@ class LLM:
         options.devices = devices
         options.draft_model_path = draft_model_path
         options.draft_devices = draft_devices
+        options.prefill_devices = prefill_devices
         options.block_size = block_size
         options.max_cache_size = max_cache_size
         options.max_memory_utilization = max_memory_utilization
@@ -61,10 +67,13 @@ class LLM:
         options.cuda_graph_max_seq_len = cuda_graph_max_seq_len
         options.cuda_graph_batch_sizes = cuda_graph_batch_sizes
         options.draft_cuda_graph_batch_sizes = draft_cuda_graph_batch_sizes
+        options.enable_vocab_parallel_sampling = enable_vocab_parallel_sampling
         options.max_tokens_per_batch = max_tokens_per_batch
         options.max_seqs_per_batch = max_seqs_per_batch
         options.num_speculative_tokens = num_speculative_tokens
+        options.num_decode_steps = num_decode_steps
         options.num_handling_threads = num_handling_threads
+        options.num_replicas = num_replicas
         # create the LLM handler
         self._handler = LLMHandler(options)
 
@@ -86,23 +95,39 @@ class LLM:
         if len(sampling_params) != len(prompts) and len(sampling_params) != 1:
             raise ValueError("The number of prompts and sampling parameters must match")
 
-        outputs = [None] * len(prompts)
+        # offline batch inference: prompts are tokenized up front and reordered
+        # to share prefix cache, outputs are returned in the original order.
+        outputs = self._handler.generate(prompts, sampling_params, priority)
 
-        def callback(index: int, output: RequestOutput) -> bool:
-            outputs[index] = output
-            return True
+        # throw an exception if there is any error
+        for index, output in enumerate(outputs):
+            if output.status is None:
+                raise RuntimeError("Request failed, no output received")
+            if output.status is not None and not output.status.ok:
+                raise ValidationError(output.status.code, output.status.message)
+            # carry over the prompt to the output
+            output.prompt = prompts[index]
+        return outputs
 
-        # schedule the batch requests
-        self._handler.schedule_batch_async(
-            prompts, sampling_params, priority, False, callback
-        )
+    def embed(
+        self,
+        prompts: Union[str, List[str]],
+        embedding_params: Optional[EmbeddingParams] = None,
+    ) -> List[RequestOutput]:
+        # use default embedding parameters if not provided
+        if embedding_params is None:
+            embedding_params = EmbeddingParams()
+        # convert single prompt to list
+        if isinstance(prompts, str):
+            prompts = [prompts]
 
-        # run until all scheduled requsts complete
-        self._handler.run_until_complete()
+        # prompts are run through prefill only, the embedding of each prompt
+        # is returned in outputs[0].embedding of its request output.
+        outputs = self._handler.embed(prompts, embedding_params)
 
         # throw an exception if there is any error
         for index, output in enumerate(outputs):
-            if output is None:
+            if output.status is None:
                 raise RuntimeError("Request failed, no output received")
             if output.status is not None and not output.status.ok:
                 raise ValidationError(output.status.code, output.status.message)
@@ -1,10 +1,11 @@
 import asyncio
+import itertools
 import os
 import queue
-from typing import List, Optional
+from typing import Callable, Dict, List, Optional
 
-from scalellm._C import (LLMHandler, Message, Priority, RequestOutput,
-                         SamplingParams)
+from scalellm._C import (LLMHandler, Message, OutputBridge, Priority,
+                         RequestOutput, SamplingParams)
 from scalellm.downloader import download_hf_model
 from scalellm.errors import ValidationError
 
@@ -54,10 +55,18 @@ class OutputAsyncStream:
     """A stream of RequestOutput objects, which can be used to
     send responses to the client asynchronously."""
 
-    def __init__(self) -> None:
+    def __init__(
+        self,
+        prompt: Optional[str] = None,
+        on_cancel: Optional[Callable[[], None]] = None,
+    ) -> None:
         # asyncio.Queue is used to store the items in the stream
         self._queue = asyncio.Queue()
         self._cancelled = False
+        # the prompt to set on outputs
+        self._prompt = prompt
+        # called once the stream is cancelled
+        self._on_cancel = on_cancel
 
     # put item into the stream
     # None to indicate the end of the stream
@@ -73,6 +82,8 @@ class OutputAsyncStream:
             return False
 
         # put the item into the queue
+        if self._prompt is not None:
+            item.prompt = self._prompt
         self._queue.put_nowait(item)
         if item.finished:
             self._queue.put_nowait(StopAsyncIteration())
@@ -85,7 +96,11 @@ class OutputAsyncStream:
 
     # cancel the stream
     def cancel(self) -> None:
+        if self._cancelled:
+            return
         self._cancelled = True
+        if self._on_cancel is not None:
+            self._on_cancel()
         self._queue.put_nowait(StopAsyncIteration())
 
     def __aiter__(self):
@@ -122,7 +137,14 @@ class AsyncLLMEngine:
         max_tokens_per_batch: int = 512,
         max_seqs_per_batch: int = 128,
         num_speculative_tokens: int = 0,
+        num_decode_steps: int = 1,
         num_handling_threads: int = 4,
+        max_queue_wait_high: float = 0.0,
+        max_queue_wait_normal: float = 0.0,
+        max_queue_wait_low: float = 0.0,
+        max_kv_demand_high: float = 0.0,
+        max_kv_demand_normal: float = 0.0,
+        max_kv_demand_low: float = 0.0,
     ) -> None:
         # download hf model if it does not exist
         model_path = model
@@ -158,10 +180,55 @@ class AsyncLLMEngine:
         options.max_tokens_per_batch = max_tokens_per_batch
         options.max_seqs_per_batch = max_seqs_per_batch
         options.num_speculative_tokens = num_speculative_tokens
+        options.num_decode_steps = num_decode_steps
         options.num_handling_threads = num_handling_threads
+        options.max_queue_wait_high = max_queue_wait_high
+        options.max_queue_wait_normal = max_queue_wait_normal
+        options.max_queue_wait_low = max_queue_wait_low
+        options.max_kv_demand_high = max_kv_demand_high
+        options.max_kv_demand_normal = max_kv_demand_normal
+        options.max_kv_demand_low = max_kv_demand_low
         # create the LLM handler
         self._handler = LLMHandler(options)
 
+        # outputs of async streams are pushed into the bridge from response
+        # threads, and drained on the event loop once signaled, so streams
+        # are only touched on the loop thread and the GIL is acquired once
+        # for all outputs of a step.
+        self._bridge = OutputBridge()
+        self._streams: Dict[int, OutputAsyncStream] = {}
+        self._stream_ids = itertools.count()
+        self._loop: Optional[asyncio.AbstractEventLoop] = None
+
+    # create a stream receiving outputs through the bridge
+    def _open_stream(self, prompt: Optional[str] = None) -> int:
+        loop = asyncio.get_running_loop()
+        if self._loop is not loop:
+            if self._loop is not None and not self._loop.is_closed():
+                self._loop.remove_reader(self._bridge.fd)
+            loop.add_reader(self._bridge.fd, self._drain_outputs)
+            self._loop = loop
+
+        stream_id = next(self._stream_ids)
+        self._streams[stream_id] = OutputAsyncStream(
+            prompt=prompt, on_cancel=lambda: self._cancel_stream(stream_id)
+        )
+        return stream_id
+
+    def _cancel_stream(self, stream_id: int) -> None:
+        self._streams.pop(stream_id, None)
+        self._bridge.cancel(stream_id)
+
+    # dispatch all pending outputs to their streams
+    def _drain_outputs(self) -> None:
+        for stream_id, output in self._bridge.drain():
+            output_stream = self._streams.get(stream_id)
+            # the stream has been cancelled
+            if output_stream is None:
+                continue
+            if not output_stream.put(output) or output.finished:
+                del self._streams[stream_id]
+
     # schedule a request to the engine, and return a stream to receive output
     async def schedule_async(
         self,
@@ -170,16 +237,13 @@ class AsyncLLMEngine:
         priority: Priority = Priority.NORMAL,
         stream: bool = False,
     ) -> OutputAsyncStream:
-        output_stream = OutputAsyncStream()
-
-        def callback(output: RequestOutput) -> bool:
-            output.prompt = prompt
-            return output_stream.put(output)
+        stream_id = self._open_stream(prompt)
+        output_stream = self._streams[stream_id]
 
         # use default sampling parameters if not provided
         sampling_params = sampling_params or SamplingParams()
         self._handler.schedule_async(
-            prompt, sampling_params, priority, stream, callback
+            prompt, sampling_params, priority, stream, self._bridge, stream_id
         )
         return output_stream
 
@@ -190,15 +254,13 @@ class AsyncLLMEngine:
         priority: Priority = Priority.NORMAL,
         stream: bool = False,
     ) -> OutputAsyncStream:
-        output_stream = OutputAsyncStream()
-
-        def callback(output: RequestOutput) -> bool:
-            return output_stream.put(output)
+        stream_id = self._open_stream()
+        output_stream = self._streams[stream_id]
 
         # use default sampling parameters if not provided
         sampling_params = sampling_params or SamplingParams()
         self._handler.schedule_chat_async(
-            messages, sampling_params, priority, stream, callback
+            messages, sampling_params, priority, stream, self._bridge, stream_id
         )
         return output_stream
 
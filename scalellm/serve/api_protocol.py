@@ -54,6 +54,21 @@ class LogProbs(BaseModel):
     top_logprobs: List[Optional[Dict[str, float]]] = Field(default_factory=list)
 
 
+class ChatTopLogProb(BaseModel):
+    token: str
+    logprob: float
+
+
+class ChatLogProb(BaseModel):
+    token: str
+    logprob: float
+    top_logprobs: List[ChatTopLogProb] = Field(default_factory=list)
+
+
+class ChatLogProbs(BaseModel):
+    content: List[ChatLogProb] = Field(default_factory=list)
+
+
 class ChatCompletionMessage(BaseModel):
     role: Literal["user", "system", "assistant"]
     content: str
@@ -77,6 +92,16 @@ class ChatCompletionRequest(BaseModel):
     ignore_eos: Optional[bool] = False
     stop: Optional[Union[str, List[str]]] = None
     stop_token_ids: Optional[List[int]] = None
+    num_beams: Optional[int] = 1
+    length_penalty: Optional[float] = 1.0
+    early_stopping: Optional[bool] = False
+    logprobs: Optional[bool] = False
+    top_logprobs: Optional[int] = 0
+    # token ids as keys, validated as integers
+    logit_bias: Optional[Dict[int, float]] = None
+    banned_token_ids: Optional[List[int]] = None
+    # reuses token ids of the last turn of the session
+    session_id: Optional[str] = None
 
 
 class ChatMessage(BaseModel):
@@ -87,6 +112,7 @@ class ChatMessage(BaseModel):
 class ChatCompletionResponseChoice(BaseModel):
     index: int
     message: ChatMessage
+    logprobs: Optional[ChatLogProbs] = None
     finish_reason: Optional[Literal["stop", "length"]] = None
 
 
@@ -107,7 +133,7 @@ class DeltaMessage(BaseModel):
 class ChatCompletionResponseStreamChoice(BaseModel):
     index: int
     delta: DeltaMessage
-    logprobs: Optional[LogProbs] = None
+    logprobs: Optional[ChatLogProbs] = None
     finish_reason: Optional[Literal["stop", "length"]] = None
 
 
@@ -128,7 +154,7 @@ class CompletionRequest(BaseModel):
     n: Optional[int] = 1
     max_tokens: Optional[int] = 16
     stream: Optional[bool] = False
-    # logprobs: Optional[int] = None
+    logprobs: Optional[int] = None
     echo: Optional[bool] = False
     temperature: Optional[float] = 0.7
     presence_penalty: Optional[float] = 0.0
@@ -141,6 +167,13 @@ class CompletionRequest(BaseModel):
     ignore_eos: Optional[bool] = False
     stop: Optional[Union[str, List[str]]] = None
     stop_token_ids: Optional[List[int]] = None
+    num_beams: Optional[int] = 1
+    length_penalty: Optional[float] = 1.0
+    early_stopping: Optional[bool] = False
+    prompt_logprobs: Optional[bool] = False
+    # token ids as keys, validated as integers
+    logit_bias: Optional[Dict[int, float]] = None
+    banned_token_ids: Optional[List[int]] = None
     # use_beam_search: Optional[bool] = False
     # best_of: Optional[int] = None
 
@@ -158,6 +191,7 @@ class CompletionResponse(BaseModel):
     created: int = Field(default_factory=lambda: int(time.time()))
     model: str
     choices: List[CompletionResponseChoice]
+    prompt_logprobs: Optional[LogProbs] = None
     usage: Optional[UsageInfo] = None
 
 
@@ -174,4 +208,5 @@ class CompletionStreamResponse(BaseModel):
     created: int = Field(default_factory=lambda: int(time.time()))
     model: str
     choices: List[CompletionResponseStreamChoice]
+    prompt_logprobs: Optional[LogProbs] = None
     usage: Optional[UsageInfo] = None
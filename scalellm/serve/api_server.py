@@ -137,6 +137,13 @@ if __name__ == "__main__":
         max_tokens_per_batch=args.max_tokens_per_batch,
         max_seqs_per_batch=args.max_seqs_per_batch,
         num_speculative_tokens=args.num_speculative_tokens,
+        num_decode_steps=args.num_decode_steps,
+        max_queue_wait_high=args.max_queue_wait_high,
+        max_queue_wait_normal=args.max_queue_wait_normal,
+        max_queue_wait_low=args.max_queue_wait_low,
+        max_kv_demand_high=args.max_kv_demand_high,
+        max_kv_demand_normal=args.max_kv_demand_normal,
+        max_kv_demand_low=args.max_kv_demand_low,
     )
 
     try:
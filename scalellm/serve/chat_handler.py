@@ -1,16 +1,18 @@
 import time
-from typing import List
+from typing import List, Optional
 
 import shortuuid
 
-from scalellm import AsyncLLMEngine, Message, SamplingParams
+from scalellm import AsyncLLMEngine, LogProb, Message, SamplingParams
 from scalellm.serve.api_protocol import (ChatCompletionMessage,
                                          ChatCompletionRequest,
                                          ChatCompletionResponse,
                                          ChatCompletionResponseChoice,
                                          ChatCompletionResponseStreamChoice,
                                          ChatCompletionStreamResponse,
-                                         ChatMessage, DeltaMessage, UsageInfo)
+                                         ChatLogProb, ChatLogProbs,
+                                         ChatMessage, ChatTopLogProb,
+                                         DeltaMessage, UsageInfo)
 from scalellm.serve.common import jsonify_model, to_priority
 from scalellm.serve.streaming_response import SafeStreamingResponse
 
@@ -31,9 +33,35 @@ def to_sampling_params(request: ChatCompletionRequest) -> SamplingParams:
     sp.stop = request.stop
     sp.ignore_eos = request.ignore_eos
     sp.stop_token_ids = request.stop_token_ids
+    sp.num_beams = request.num_beams
+    sp.length_penalty = request.length_penalty
+    sp.early_stopping = request.early_stopping
+    sp.logprobs = request.logprobs
+    sp.top_logprobs = request.top_logprobs
+    sp.logit_bias = request.logit_bias
+    sp.banned_token_ids = request.banned_token_ids
+    sp.session_id = request.session_id
     return sp
 
 
+def to_logprobs(logprobs: Optional[List[LogProb]]) -> Optional[ChatLogProbs]:
+    if logprobs is None:
+        return None
+    return ChatLogProbs(
+        content=[
+            ChatLogProb(
+                token=logprob.token,
+                logprob=logprob.logprob,
+                top_logprobs=[
+                    ChatTopLogProb(token=top.token, logprob=top.logprob)
+                    for top in logprob.top_logprobs
+                ],
+            )
+            for logprob in logprobs
+        ]
+    )
+
+
 def to_messages(messages: List[ChatCompletionMessage]) -> List[Message]:
     return [Message(role=msg.role, content=msg.content) for msg in messages]
 
@@ -70,6 +98,7 @@ async def generate_chat_response(
             ChatCompletionResponseChoice(
                 index=seq_output.index,
                 message=ChatMessage(role="assistant", content=seq_output.text),
+                logprobs=to_logprobs(seq_output.logprobs),
                 finish_reason=seq_output.finish_reason,
             )
         )
@@ -135,7 +164,7 @@ async def generate_chat_stream_response(
                         ChatCompletionResponseStreamChoice(
                             index=index,
                             delta=DeltaMessage(content=seq_output.text),
-                            logprobs=None,
+                            logprobs=to_logprobs(seq_output.logprobs),
                             finish_reason=None,
                         )
                     ],
@@ -1,12 +1,14 @@
 import time
+from typing import List, Optional
 
 import shortuuid
 
-from scalellm import AsyncLLMEngine, SamplingParams
+from scalellm import AsyncLLMEngine, LogProb, SamplingParams
 from scalellm.serve.api_protocol import (CompletionRequest, CompletionResponse,
                                          CompletionResponseChoice,
                                          CompletionResponseStreamChoice,
-                                         CompletionStreamResponse, UsageInfo)
+                                         CompletionStreamResponse, LogProbs,
+                                         UsageInfo)
 from scalellm.serve.common import jsonify_model, to_priority
 from scalellm.serve.streaming_response import SafeStreamingResponse
 
@@ -26,9 +28,32 @@ def to_sampling_params(request: CompletionRequest) -> SamplingParams:
     sp.stop = request.stop
     sp.ignore_eos = request.ignore_eos
     sp.stop_token_ids = request.stop_token_ids
+    sp.num_beams = request.num_beams
+    sp.length_penalty = request.length_penalty
+    sp.early_stopping = request.early_stopping
+    if request.logprobs is not None:
+        # logprobs of chosen tokens with the given number of alternatives
+        sp.logprobs = True
+        sp.top_logprobs = request.logprobs
+    sp.prompt_logprobs = request.prompt_logprobs
+    sp.logit_bias = request.logit_bias
+    sp.banned_token_ids = request.banned_token_ids
     return sp
 
 
+def to_logprobs(logprobs: Optional[List[LogProb]]) -> Optional[LogProbs]:
+    if logprobs is None:
+        return None
+    return LogProbs(
+        tokens=[logprob.token for logprob in logprobs],
+        token_logprobs=[logprob.logprob for logprob in logprobs],
+        top_logprobs=[
+            {top.token: top.logprob for top in logprob.top_logprobs}
+            for logprob in logprobs
+        ],
+    )
+
+
 async def generate_completion_response(
     request: CompletionRequest, engine: AsyncLLMEngine
 ) -> CompletionResponse:
@@ -62,6 +87,7 @@ async def generate_completion_response(
             CompletionResponseChoice(
                 index=seq_output.index,
                 text=seq_output.text,
+                logprobs=to_logprobs(seq_output.logprobs),
                 finish_reason=seq_output.finish_reason,
             )
         )
@@ -71,6 +97,7 @@ async def generate_completion_response(
         created=created_time,
         model=model,
         choices=choices,
+        prompt_logprobs=to_logprobs(output.prompt_logprobs),
         usage=usage,
     )
 
@@ -96,6 +123,17 @@ async def generate_completion_stream_response(
 
     async def generate_stream_content():
         async for output in output_stream:
+            # send prompt logprobs as a separate chunk
+            if output.prompt_logprobs is not None:
+                response = CompletionStreamResponse(
+                    id=request_id,
+                    object=chunk_object_type,
+                    created=created_time,
+                    model=model,
+                    choices=[],
+                    prompt_logprobs=to_logprobs(output.prompt_logprobs),
+                )
+                yield f"data: {jsonify_model(response)}\n\n"
             for seq_output in output.outputs:
                 # send chunk with delta message
                 response = CompletionStreamResponse(
@@ -107,7 +145,7 @@ async def generate_completion_stream_response(
                         CompletionResponseStreamChoice(
                             index=seq_output.index,
                             text=seq_output.text,
-                            logprobs=None,
+                            logprobs=to_logprobs(seq_output.logprobs),
                             finish_reason=None,
                         )
                     ],
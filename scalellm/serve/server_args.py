@@ -104,4 +104,64 @@ def parse_args():
         default=0,
         help="Number of speculative tokens.",
     )
+    parser.add_argument(
+        "--num_decode_steps",
+        type=int,
+        default=1,
+        help="Number of decode steps to run back to back for decode batches.",
+    )
+    parser.add_argument(
+        "--max_queue_wait_high",
+        type=float,
+        default=0.0,
+        help=(
+            "Max estimated seconds a prompt waits before new high "
+            "priority requests are rejected, 0 for no limit."
+        ),
+    )
+    parser.add_argument(
+        "--max_queue_wait_normal",
+        type=float,
+        default=0.0,
+        help=(
+            "Max estimated seconds a prompt waits before new normal "
+            "priority requests are rejected, 0 for no limit."
+        ),
+    )
+    parser.add_argument(
+        "--max_queue_wait_low",
+        type=float,
+        default=0.0,
+        help=(
+            "Max estimated seconds a prompt waits before new low "
+            "priority requests are rejected, 0 for no limit."
+        ),
+    )
+    parser.add_argument(
+        "--max_kv_demand_high",
+        type=float,
+        default=0.0,
+        help=(
+            "Max ratio of kv cache demand to its capacity before new high "
+            "priority requests are rejected, 0 for no limit."
+        ),
+    )
+    parser.add_argument(
+        "--max_kv_demand_normal",
+        type=float,
+        default=0.0,
+        help=(
+            "Max ratio of kv cache demand to its capacity before new normal "
+            "priority requests are rejected, 0 for no limit."
+        ),
+    )
+    parser.add_argument(
+        "--max_kv_demand_low",
+        type=float,
+        default=0.0,
+        help=(
+            "Max ratio of kv cache demand to its capacity before new low "
+            "priority requests are rejected, 0 for no limit."
+        ),
+    )
     return parser.parse_args()
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""Benchmark delivering streamed outputs to thousands of concurrent asyncio
+streams, through the output bridge of AsyncLLMEngine, or through a python
+callback for each output as a baseline. It reports the output throughput and
+the lag of the event loop, which is blocked while outputs are dispatched.
+
+Example:
+  python src/benchmark/async_stream_benchmark.py --model=gpt2 --devices=cuda \
+      --num_streams=4096 --max_tokens=64
+"""
+
+import argparse
+import asyncio
+import statistics
+import time
+from typing import List
+
+from scalellm import (AsyncLLMEngine, OutputAsyncStream, Priority,
+                      RequestOutput, SamplingParams)
+
+
+def schedule_with_callback(
+    engine: AsyncLLMEngine, prompt: str, sp: SamplingParams
+) -> OutputAsyncStream:
+    loop = asyncio.get_running_loop()
+    output_stream = OutputAsyncStream(prompt=prompt)
+
+    # one GIL acquisition and one wakeup of the loop for each output
+    def callback(output: RequestOutput) -> bool:
+        loop.call_soon_threadsafe(output_stream.put, output)
+        return True
+
+    engine._handler.schedule_async(prompt, sp, Priority.NORMAL, True, callback)
+    return output_stream
+
+
+async def consume(output_stream: OutputAsyncStream) -> int:
+    num_outputs = 0
+    async for output in output_stream:
+        num_outputs += len(output.outputs)
+    return num_outputs
+
+
+async def measure_loop_lag(
+    interval: float, lags: List[float], done: asyncio.Event
+) -> None:
+    while not done.is_set():
+        start = time.perf_counter()
+        await asyncio.sleep(interval)
+        lags.append(time.perf_counter() - start - interval)
+
+
+def percentile(values: List[float], q: float) -> float:
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(q * len(values)))]
+
+
+async def run(engine: AsyncLLMEngine, args, use_bridge: bool) -> None:
+    sp = SamplingParams(
+        max_tokens=args.max_tokens, ignore_eos=True, temperature=0.0
+    )
+    prompts = [f"{args.prompt} {i}" for i in range(args.num_streams)]
+
+    lags: List[float] = []
+    done = asyncio.Event()
+    ticker = asyncio.create_task(measure_loop_lag(0.001, lags, done))
+
+    start = time.perf_counter()
+    if use_bridge:
+        streams = [
+            await engine.schedule_async(prompt, sp, stream=True)
+            for prompt in prompts
+        ]
+    else:
+        streams = [schedule_with_callback(engine, prompt, sp) for prompt in prompts]
+    num_outputs = sum(await asyncio.gather(*(consume(s) for s in streams)))
+    elapsed = time.perf_counter() - start
+    done.set()
+    await ticker
+
+    mode = "bridge" if use_bridge else "callback"
+    print(
+        f"{mode:>8}: {args.num_streams} streams, {num_outputs} outputs in "
+        f"{elapsed:.2f}s, {num_outputs / elapsed:.0f} outputs/s, loop lag "
+        f"mean {statistics.fmean(lags) * 1e3:.2f}ms "
+        f"p99 {percentile(lags, 0.99) * 1e3:.2f}ms "
+        f"max {max(lags, default=0.0) * 1e3:.2f}ms"
+    )
+
+
+async def main(args) -> None:
+    engine = AsyncLLMEngine(
+        model=args.model,
+        devices=args.devices,
+        max_seqs_per_batch=args.max_seqs_per_batch,
+        max_tokens_per_batch=args.max_tokens_per_batch,
+    )
+    engine.start()
+    try:
+        for _ in range(args.num_rounds):
+            if not args.skip_callback:
+                await run(engine, args, use_bridge=False)
+            await run(engine, args, use_bridge=True)
+    finally:
+        engine.stop()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--model", type=str, default="gpt2")
+    parser.add_argument("--devices", type=str, default="cuda")
+    parser.add_argument("--num_streams", type=int, default=4096)
+    parser.add_argument("--max_tokens", type=int, default=64)
+    parser.add_argument("--prompt", type=str, default="hello")
+    parser.add_argument("--max_seqs_per_batch", type=int, default=1024)
+    parser.add_argument("--max_tokens_per_batch", type=int, default=8192)
+    parser.add_argument("--num_rounds", type=int, default=1)
+    parser.add_argument(
+        "--skip_callback",
+        action="store_true",
+        help="only run through the output bridge",
+    )
+    asyncio.run(main(parser.parse_args()))
@@ -1,30 +1,85 @@
 #include <benchmark/benchmark.h>
+#include <torch/torch.h>
 
+#include <cmath>
 
-static void BM_varlen_masked_self_attention(benchmark::State& state) {
-  // Perform setup here
+#include "layers/attention/cpu_attention.h"
 
-  for (auto _ : state) {
-    // Call the implementation function
+using namespace llm;
+
+namespace {
+constexpr int64_t kNumHeads = 16;
+constexpr int64_t kHeadDim = 128;
+
+// the einsum path of the ref handler: batched matmuls with a materialized
+// causal mask, plus materialized biases for alibi
+torch::Tensor einsum_attention(const torch::Tensor& query,
+                               const torch::Tensor& key,
+                               const torch::Tensor& value,
+                               const torch::optional<torch::Tensor>& slopes,
+                               float scale) {
+  const int64_t q_len = query.size(0);
+  const int64_t kv_len = key.size(0);
+  auto scores = torch::einsum("qhd,khd->hqk",
+                              {query.to(torch::kFloat), key.to(torch::kFloat)});
+  scores *= scale;
+  if (slopes.has_value()) {
+    const auto distance = torch::arange(0, kv_len, query.options());
+    scores += distance.view({1, 1, kv_len}) * slopes->view({-1, 1, 1});
   }
+  auto mask = torch::ones({1, q_len, kv_len}, torch::kBool);
+  mask = torch::tril(mask, /*diagonal=*/kv_len - q_len).to(query);
+  scores = scores.masked_fill(mask == 0, -INFINITY);
+  scores = torch::softmax(scores, /*dim=*/-1);
+  return torch::einsum("hqk,khd->qhd", {scores, value.to(torch::kFloat)})
+      .type_as(query);
 }
+}  // namespace
 
-static void BM_single_query_masked_self_attention(benchmark::State& state) {
-  // Perform setup here
+// state.range(0): q_len, state.range(1): kv_len, state.range(2): alibi,
+// state.range(3): fused
+static void BM_attention_cpu(benchmark::State& state) {
+  const int64_t q_len = state.range(0);
+  const int64_t kv_len = state.range(1);
+  const bool alibi = state.range(2) != 0;
+  const bool fused = state.range(3) != 0;
+  const float scale = 1.0f / std::sqrt(static_cast<float>(kHeadDim));
+
+  const auto options = torch::dtype(torch::kFloat);
+  const auto query = torch::randn({q_len, kNumHeads, kHeadDim}, options);
+  const auto key = torch::randn({kv_len, kNumHeads, kHeadDim}, options);
+  const auto value = torch::randn({kv_len, kNumHeads, kHeadDim}, options);
+  torch::optional<torch::Tensor> slopes;
+  if (alibi) {
+    slopes = torch::rand({kNumHeads}, options);
+  }
+  const auto q_cu_seq_lens = torch::tensor({0L, q_len}, torch::kInt);
+  const auto kv_cu_seq_lens = torch::tensor({0L, kv_len}, torch::kInt);
+  torch::Tensor output = torch::empty_like(query);
 
   for (auto _ : state) {
-    // Call the implementation function
+    if (fused) {
+      cpu_varlen_attention(query,
+                           key,
+                           value,
+                           q_cu_seq_lens,
+                           kv_cu_seq_lens,
+                           slopes,
+                           scale,
+                           output);
+    } else {
+      output = einsum_attention(query, key, value, slopes, scale);
+    }
+    // don't optimize out the output
+    benchmark::DoNotOptimize(output);
   }
+  state.SetLabel(fused ? "fused" : "einsum");
+  state.SetItemsProcessed(state.iterations() * q_len);
 }
 
-// Register functions as benchmarks
-BENCHMARK(BM_varlen_masked_self_attention)
-    ->ArgNames({"dim", "cuda", "slow"})
-    ->Args({/*dim=*/32, /*device=cpu*/ 0, /*slow=*/0})
-    ->Args({/*dim=*/32, /*device=cuda*/ 1, /*slow=*/0})
-    ->Args({/*dim=*/32, /*device=cuda*/ 1, /*slow=*/1});
-
-BENCHMARK(BM_single_query_masked_self_attention)
-    ->ArgNames({"dim", "cuda"})
-    ->Args({/*dim=*/32, /*device=cpu*/ 0})
-    ->Args({/*dim=*/32, /*device=cuda*/ 1});
+// decode, chunked prefill and full prefill against 4k-16k contexts, with
+// and without alibi
+BENCHMARK(BM_attention_cpu)
+    ->ArgNames({"q_len", "kv_len", "alibi", "fused"})
+    ->ArgsProduct({{1, 256, 4096}, {4096, 8192, 16384}, {0, 1}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
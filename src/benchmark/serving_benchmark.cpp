@@ -0,0 +1,510 @@
+// End-to-end serving benchmark. It replays a request trace against LLMHandler
+// in process or against a running grpc server, and reports TTFT, inter-token
+// and end-to-end latency percentiles, token throughput and goodput under SLOs.
+//
+// The trace is a jsonl file, one request per line:
+//   {"timestamp": 0.5, "prompt_len": 512, "output_len": 128, "n": 1,
+//    "stream": true}
+// where timestamp is the arrival time in seconds since the start.
+//
+// Examples:
+//   # scheduler + serving stack with a fake engine, open loop poisson arrivals
+//   serving_benchmark --mode=poisson --request_rate=20 --num_requests=1000
+//   # replay a trace against a grpc server
+//   serving_benchmark --backend=grpc --address=localhost:8888 --trace=t.jsonl
+#include <absl/random/random.h>
+#include <absl/strings/str_format.h>
+#include <absl/synchronization/blocking_counter.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <grpcpp/grpcpp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "completion.grpc.pb.h"
+#include "engine/fake_engine.h"
+#include "handlers/llm_handler.h"
+
+// workload
+DEFINE_string(trace, "", "path to the jsonl trace, synthesized if empty.");
+DEFINE_int32(num_requests, 1000, "number of requests for synthesized trace.");
+DEFINE_int32(prompt_len, 512, "prompt length for synthesized trace.");
+DEFINE_int32(output_len, 128, "output length for synthesized trace.");
+DEFINE_int32(n, 1, "number of sequences per request for synthesized trace.");
+DEFINE_bool(stream, true, "stream flag for synthesized trace.");
+
+// arrival
+DEFINE_string(mode,
+              "poisson",
+              "trace: replay timestamps, poisson: open loop poisson arrivals, "
+              "closed: closed loop with fixed concurrency.");
+DEFINE_double(request_rate, 10.0, "request rate for poisson mode.");
+DEFINE_int32(concurrency, 32, "number of outstanding requests in closed mode.");
+DEFINE_int32(seed, 0, "random seed.");
+
+// slo for goodput, 0 to disable
+DEFINE_double(slo_ttft_ms, 1000, "SLO of time to first token in ms.");
+DEFINE_double(slo_itl_ms, 100, "SLO of average inter-token latency in ms.");
+DEFINE_double(slo_e2e_ms, 0, "SLO of end to end latency in ms.");
+
+// backend
+DEFINE_string(backend, "inproc", "inproc: LLMHandler in process, grpc.");
+DEFINE_string(address, "localhost:8888", "grpc server address.");
+DEFINE_string(model, "", "model name for grpc requests.");
+DEFINE_string(model_path,
+              "",
+              "model path for inproc backend, use a fake engine if empty.");
+DEFINE_string(device, "auto", "devices for inproc backend with a model.");
+DEFINE_int32(max_tokens_per_batch, 512, "max number of tokens per batch");
+DEFINE_int32(max_seqs_per_batch, 128, "max number of sequences per batch");
+DEFINE_int32(num_decode_steps, 1, "number of decode steps per round.");
+
+// fake engine
+DEFINE_int32(fake_num_blocks, 8192, "number of kv cache blocks.");
+DEFINE_int32(fake_step_cost_us, 2000, "fixed cost per step in us.");
+DEFINE_int32(fake_prefill_token_cost_us, 50, "cost per prefill token in us.");
+DEFINE_int32(fake_decode_token_cost_us, 100, "cost per decode token in us.");
+
+namespace llm {
+namespace {
+
+struct TraceEntry {
+  double timestamp = 0;
+  int32_t prompt_len = 0;
+  int32_t output_len = 0;
+  int32_t n = 1;
+  bool stream = true;
+};
+
+// latency record of a request, updated sequentially by its callbacks
+struct RequestRecord {
+  absl::Time sent;
+  std::optional<absl::Time> first_token;
+  absl::Time last_token;
+  absl::Time done;
+  std::vector<double> itl_ms;
+  size_t num_output_tokens = 0;
+  bool ok = false;
+
+  void on_token(absl::Time now) {
+    if (!first_token.has_value()) {
+      first_token = now;
+    } else {
+      itl_ms.push_back(absl::ToDoubleMilliseconds(now - last_token));
+    }
+    last_token = now;
+  }
+
+  void on_finish(bool succeeded, size_t output_tokens, absl::Time now) {
+    ok = succeeded;
+    num_output_tokens = output_tokens;
+    done = now;
+    if (!first_token.has_value()) {
+      // non-streaming request
+      first_token = now;
+    }
+  }
+
+  double ttft_ms() const {
+    return absl::ToDoubleMilliseconds(first_token.value_or(done) - sent);
+  }
+
+  double e2e_ms() const { return absl::ToDoubleMilliseconds(done - sent); }
+
+  double mean_itl_ms() const {
+    if (itl_ms.empty()) {
+      return 0;
+    }
+    double sum = 0;
+    for (const double v : itl_ms) {
+      sum += v;
+    }
+    return sum / static_cast<double>(itl_ms.size());
+  }
+};
+
+std::vector<TraceEntry> load_trace(const std::string& path) {
+  std::vector<TraceEntry> entries;
+  std::ifstream file(path);
+  CHECK(file.is_open()) << "Failed to open trace file: " << path;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    const auto j = nlohmann::json::parse(line);
+    TraceEntry entry;
+    entry.timestamp = j.value("timestamp", 0.0);
+    entry.prompt_len = j.at("prompt_len").get<int32_t>();
+    entry.output_len = j.at("output_len").get<int32_t>();
+    entry.n = j.value("n", 1);
+    entry.stream = j.value("stream", true);
+    entries.push_back(entry);
+  }
+  std::stable_sort(entries.begin(),
+                   entries.end(),
+                   [](const TraceEntry& a, const TraceEntry& b) {
+                     return a.timestamp < b.timestamp;
+                   });
+  return entries;
+}
+
+std::vector<TraceEntry> synthesize_trace() {
+  std::vector<TraceEntry> entries(FLAGS_num_requests);
+  for (auto& entry : entries) {
+    entry.prompt_len = FLAGS_prompt_len;
+    entry.output_len = FLAGS_output_len;
+    entry.n = FLAGS_n;
+    entry.stream = FLAGS_stream;
+  }
+  return entries;
+}
+
+// a prompt of random words, one token per word with the fake tokenizer
+std::string make_prompt(int32_t prompt_len, absl::BitGen& gen) {
+  std::string prompt;
+  prompt.reserve(prompt_len * 6);
+  for (int32_t i = 0; i < prompt_len; ++i) {
+    absl::StrAppendFormat(&prompt, "w%d ", absl::Uniform(gen, 0, 1000000));
+  }
+  return prompt;
+}
+
+class Backend {
+ public:
+  virtual ~Backend() = default;
+
+  // send a request asynchronously, on_done is called once the request is
+  // finished, from any thread.
+  virtual void send(const TraceEntry& entry,
+                    std::string prompt,
+                    RequestRecord* record,
+                    std::function<void()> on_done) = 0;
+};
+
+class InProcBackend final : public Backend {
+ public:
+  InProcBackend() {
+    LLMHandler::Options options;
+    options.model_path(FLAGS_model_path)
+        .devices(FLAGS_device)
+        .max_tokens_per_batch(FLAGS_max_tokens_per_batch)
+        .max_seqs_per_batch(FLAGS_max_seqs_per_batch)
+        .num_decode_steps(FLAGS_num_decode_steps);
+    if (FLAGS_model_path.empty()) {
+      FakeEngine::Options engine_options;
+      engine_options.num_blocks(FLAGS_fake_num_blocks)
+          .step_cost(absl::Microseconds(FLAGS_fake_step_cost_us))
+          .prefill_token_cost(absl::Microseconds(FLAGS_fake_prefill_token_cost_us))
+          .decode_token_cost(absl::Microseconds(FLAGS_fake_decode_token_cost_us));
+      handler_ = std::make_unique<LLMHandler>(
+          std::make_unique<FakeEngine>(engine_options), options);
+    } else {
+      handler_ = std::make_unique<LLMHandler>(options);
+    }
+    handler_->start();
+  }
+
+  void send(const TraceEntry& entry,
+            std::string prompt,
+            RequestRecord* record,
+            std::function<void()> on_done) override {
+    SamplingParams sp;
+    sp.max_tokens = entry.output_len;
+    sp.n = entry.n;
+    sp.ignore_eos = true;
+    record->sent = absl::Now();
+    handler_->schedule_async(
+        std::move(prompt),
+        std::move(sp),
+        Priority::NORMAL,
+        entry.stream,
+        [record, on_done = std::move(on_done)](const RequestOutput& output) {
+          const absl::Time now = absl::Now();
+          if (output.status.has_value() && !output.status->ok()) {
+            record->on_finish(/*succeeded=*/false, 0, now);
+            on_done();
+            return false;
+          }
+          if (output.finished) {
+            const size_t num_tokens = output.usage.has_value()
+                                          ? output.usage->num_generated_tokens
+                                          : 0;
+            record->on_finish(/*succeeded=*/true, num_tokens, now);
+            on_done();
+            return true;
+          }
+          for (const auto& seq_output : output.outputs) {
+            if (!seq_output.text.empty()) {
+              record->on_token(now);
+              break;
+            }
+          }
+          return true;
+        });
+  }
+
+ private:
+  std::unique_ptr<LLMHandler> handler_;
+};
+
+class GrpcBackend final : public Backend {
+ public:
+  GrpcBackend()
+      : stub_(proto::Completion::NewStub(
+            grpc::CreateChannel(FLAGS_address,
+                                grpc::InsecureChannelCredentials()))) {
+    thread_ = std::thread([this]() {
+      void* tag = nullptr;
+      bool ok = false;
+      while (cq_.Next(&tag, &ok)) {
+        auto* call = static_cast<Call*>(tag);
+        if (!call->proceed(ok)) {
+          delete call;
+        }
+      }
+    });
+  }
+
+  ~GrpcBackend() override {
+    cq_.Shutdown();
+    thread_.join();
+  }
+
+  void send(const TraceEntry& entry,
+            std::string prompt,
+            RequestRecord* record,
+            std::function<void()> on_done) override {
+    proto::CompletionRequest request;
+    request.set_model(FLAGS_model);
+    request.set_prompt(std::move(prompt));
+    request.set_max_tokens(entry.output_len);
+    request.set_n(entry.n);
+    request.set_stream(entry.stream);
+    request.set_ignore_eos(true);
+    record->sent = absl::Now();
+    new Call(stub_.get(), &cq_, request, record, std::move(on_done));
+  }
+
+ private:
+  // state machine of an async streaming rpc
+  class Call {
+   public:
+    Call(proto::Completion::Stub* stub,
+         grpc::CompletionQueue* cq,
+         const proto::CompletionRequest& request,
+         RequestRecord* record,
+         std::function<void()> on_done)
+        : record_(record), on_done_(std::move(on_done)) {
+      reader_ = stub->PrepareAsyncComplete(&context_, request, cq);
+      reader_->StartCall(this);
+    }
+
+    // returns false if the call is done and can be deleted
+    bool proceed(bool ok) {
+      const absl::Time now = absl::Now();
+      if (finishing_) {
+        record_->on_finish(status_.ok(), num_output_tokens_, now);
+        on_done_();
+        return false;
+      }
+      if (reading_ && ok) {
+        if (response_.has_usage()) {
+          num_output_tokens_ = response_.usage().completion_tokens();
+        }
+        for (const auto& choice : response_.choices()) {
+          if (!choice.text().empty()) {
+            record_->on_token(now);
+            break;
+          }
+        }
+      }
+      if (ok) {
+        reading_ = true;
+        reader_->Read(&response_, this);
+      } else {
+        finishing_ = true;
+        reader_->Finish(&status_, this);
+      }
+      return true;
+    }
+
+   private:
+    grpc::ClientContext context_;
+    proto::CompletionResponse response_;
+    std::unique_ptr<grpc::ClientAsyncReader<proto::CompletionResponse>>
+        reader_;
+    grpc::Status status_;
+    bool reading_ = false;
+    bool finishing_ = false;
+    size_t num_output_tokens_ = 0;
+
+    RequestRecord* record_;
+    std::function<void()> on_done_;
+  };
+
+  std::unique_ptr<proto::Completion::Stub> stub_;
+  grpc::CompletionQueue cq_;
+  std::thread thread_;
+};
+
+double percentile(std::vector<double> values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  const size_t idx = std::min(values.size() - 1,
+                              static_cast<size_t>(p * values.size()));
+  std::nth_element(values.begin(), values.begin() + idx, values.end());
+  return values[idx];
+}
+
+void print_latency(const std::string& name, const std::vector<double>& values) {
+  std::cout << absl::StrFormat("%-5s ms  p50: %8.2f  p90: %8.2f  p99: %8.2f\n",
+                               name,
+                               percentile(values, 0.5),
+                               percentile(values, 0.9),
+                               percentile(values, 0.99));
+}
+
+bool meet_slo(const RequestRecord& record) {
+  if (!record.ok) {
+    return false;
+  }
+  if (FLAGS_slo_ttft_ms > 0 && record.ttft_ms() > FLAGS_slo_ttft_ms) {
+    return false;
+  }
+  if (FLAGS_slo_itl_ms > 0 && record.mean_itl_ms() > FLAGS_slo_itl_ms) {
+    return false;
+  }
+  if (FLAGS_slo_e2e_ms > 0 && record.e2e_ms() > FLAGS_slo_e2e_ms) {
+    return false;
+  }
+  return true;
+}
+
+void report(const std::vector<RequestRecord>& records, double duration) {
+  std::vector<double> ttft;
+  std::vector<double> itl;
+  std::vector<double> e2e;
+  size_t num_failures = 0;
+  size_t num_output_tokens = 0;
+  size_t num_good = 0;
+  for (const auto& record : records) {
+    if (!record.ok) {
+      ++num_failures;
+      continue;
+    }
+    ttft.push_back(record.ttft_ms());
+    e2e.push_back(record.e2e_ms());
+    itl.insert(itl.end(), record.itl_ms.begin(), record.itl_ms.end());
+    num_output_tokens += record.num_output_tokens;
+    if (meet_slo(record)) {
+      ++num_good;
+    }
+  }
+
+  const double num_requests = static_cast<double>(records.size());
+  std::cout << absl::StrFormat(
+      "requests: %d, failures: %d, duration: %.2fs\n"
+      "throughput: %.2f req/s, %.2f output tokens/s\n"
+      "goodput: %.2f req/s (%.1f%% within SLO)\n",
+      records.size(),
+      num_failures,
+      duration,
+      num_requests / duration,
+      num_output_tokens / duration,
+      num_good / duration,
+      num_requests > 0 ? 100.0 * num_good / num_requests : 0.0);
+  print_latency("ttft", ttft);
+  print_latency("itl", itl);
+  print_latency("e2e", e2e);
+}
+
+}  // namespace
+}  // namespace llm
+
+int main(int argc, char* argv[]) {
+  using namespace llm;
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  const auto entries =
+      FLAGS_trace.empty() ? synthesize_trace() : load_trace(FLAGS_trace);
+  const size_t num_requests = entries.size();
+  CHECK_GT(num_requests, 0) << "no requests to send";
+
+  std::unique_ptr<Backend> backend;
+  if (FLAGS_backend == "inproc") {
+    backend = std::make_unique<InProcBackend>();
+  } else if (FLAGS_backend == "grpc") {
+    backend = std::make_unique<GrpcBackend>();
+  } else {
+    LOG(FATAL) << "Unknown backend: " << FLAGS_backend;
+  }
+
+  // prepare prompts ahead of time to keep the dispatching cheap
+  absl::BitGen gen(std::seed_seq{FLAGS_seed});
+  std::vector<std::string> prompts;
+  prompts.reserve(num_requests);
+  for (const auto& entry : entries) {
+    prompts.push_back(make_prompt(entry.prompt_len, gen));
+  }
+
+  std::vector<RequestRecord> records(num_requests);
+  absl::BlockingCounter pending(static_cast<int>(num_requests));
+  const absl::Time start = absl::Now();
+
+  if (FLAGS_mode == "closed") {
+    // start the next request once one finishes
+    std::atomic<size_t> next{0};
+    std::function<void()> send_next = [&]() {
+      const size_t i = next.fetch_add(1);
+      if (i >= num_requests) {
+        return;
+      }
+      backend->send(entries[i], std::move(prompts[i]), &records[i], [&]() {
+        send_next();
+        pending.DecrementCount();
+      });
+    };
+    const size_t concurrency =
+        std::min<size_t>(FLAGS_concurrency, num_requests);
+    for (size_t i = 0; i < concurrency; ++i) {
+      send_next();
+    }
+    pending.Wait();
+  } else {
+    // open loop: send requests at their arrival time
+    CHECK(FLAGS_mode == "trace" || FLAGS_mode == "poisson")
+        << "Unknown mode: " << FLAGS_mode;
+    std::exponential_distribution<double> interval(FLAGS_request_rate);
+    double arrival = 0;
+    for (size_t i = 0; i < num_requests; ++i) {
+      arrival = FLAGS_mode == "trace" ? entries[i].timestamp
+                                      : arrival + interval(gen);
+      absl::SleepFor(start + absl::Seconds(arrival) - absl::Now());
+      backend->send(entries[i], std::move(prompts[i]), &records[i], [&]() {
+        pending.DecrementCount();
+      });
+    }
+    pending.Wait();
+  }
+
+  const double duration = absl::ToDoubleSeconds(absl::Now() - start);
+  report(records, duration);
+  return 0;
+}
@@ -0,0 +1,146 @@
+#include "histogram.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace llm {
+
+ShardedHistogram::ShardedHistogram(std::vector<double> bucket_boundaries)
+    : bucket_boundaries_(std::move(bucket_boundaries)) {
+  CHECK(std::is_sorted(bucket_boundaries_.begin(), bucket_boundaries_.end()))
+      << "bucket boundaries must be in increasing order";
+
+  // one more bucket for +Inf
+  const size_t num_buckets = bucket_boundaries_.size() + 1;
+  const size_t num_cache_lines =
+      (num_buckets + kWordsPerCacheLine - 1) / kWordsPerCacheLine;
+  shards_ = std::make_unique<Shard[]>(kNumShards);
+  for (size_t i = 0; i < kNumShards; ++i) {
+    shards_[i].counts = std::make_unique<CacheLine[]>(num_cache_lines);
+  }
+}
+
+ShardedHistogram::Shard& ShardedHistogram::shard() const {
+  // threads are assigned to shards in round robin order
+  static std::atomic<size_t> next_shard{0};
+  // NOLINTNEXTLINE
+  thread_local const size_t shard_idx =
+      next_shard.fetch_add(1, std::memory_order_relaxed) % kNumShards;
+  return shards_[shard_idx];
+}
+
+void ShardedHistogram::observe(double value) {
+  // the first bucket whose upper bound is no less than the value
+  const size_t bucket =
+      std::lower_bound(
+          bucket_boundaries_.begin(), bucket_boundaries_.end(), value) -
+      bucket_boundaries_.begin();
+
+  Shard& s = shard();
+  s.count(bucket).fetch_add(1, std::memory_order_relaxed);
+  // the shard is rarely shared, so the loop almost always succeeds at once
+  double sum = s.sum.load(std::memory_order_relaxed);
+  while (!s.sum.compare_exchange_weak(
+      sum, sum + value, std::memory_order_relaxed)) {
+  }
+}
+
+ShardedHistogram::Snapshot ShardedHistogram::snapshot() const {
+  Snapshot snapshot;
+  snapshot.bucket_boundaries = bucket_boundaries_;
+  snapshot.bucket_counts.resize(bucket_boundaries_.size() + 1, 0);
+  for (size_t i = 0; i < kNumShards; ++i) {
+    Shard& s = shards_[i];
+    for (size_t b = 0; b < snapshot.bucket_counts.size(); ++b) {
+      const uint64_t count = s.count(b).load(std::memory_order_relaxed);
+      snapshot.bucket_counts[b] += count;
+      snapshot.count += count;
+    }
+    snapshot.sum += s.sum.load(std::memory_order_relaxed);
+  }
+  return snapshot;
+}
+
+double ShardedHistogram::Snapshot::quantile(double q) const {
+  if (count == 0) {
+    return 0;
+  }
+  const double rank = std::clamp(q, 0.0, 1.0) * static_cast<double>(count);
+  uint64_t cumulative = 0;
+  for (size_t b = 0; b < bucket_counts.size(); ++b) {
+    const uint64_t prev = cumulative;
+    cumulative += bucket_counts[b];
+    if (static_cast<double>(cumulative) < rank || bucket_counts[b] == 0) {
+      continue;
+    }
+    if (b == bucket_boundaries.size()) {
+      // falls into +Inf bucket
+      return bucket_boundaries.empty() ? 0 : bucket_boundaries.back();
+    }
+    const double lower = b == 0 ? 0 : bucket_boundaries[b - 1];
+    const double upper = bucket_boundaries[b];
+    const double fraction = (rank - static_cast<double>(prev)) /
+                            static_cast<double>(bucket_counts[b]);
+    return lower + (upper - lower) * fraction;
+  }
+  return bucket_boundaries.empty() ? 0 : bucket_boundaries.back();
+}
+
+std::vector<double> log_linear_buckets(double min, double max) {
+  CHECK_GT(min, 0);
+  CHECK_GE(max, min);
+  std::vector<double> boundaries;
+  // start from the power of ten no greater than min
+  const int min_exp = static_cast<int>(std::floor(std::log10(min)));
+  const int max_exp = static_cast<int>(std::ceil(std::log10(max)));
+  for (int exp = min_exp; exp <= max_exp; ++exp) {
+    // powers of ten are exact for non-negative exponents, dividing by them
+    // gives the closest doubles to decimal bounds, e.g. 3e-5 instead of
+    // 3.0000000000000004e-05
+    const double scale = std::pow(10.0, std::abs(exp));
+    for (int i = 1; i <= 9; ++i) {
+      const double bound = exp < 0 ? i / scale : i * scale;
+      // allow for rounding errors of pow
+      if (bound < min * (1 - 1e-9) || bound > max * (1 + 1e-9)) {
+        continue;
+      }
+      boundaries.push_back(bound);
+    }
+  }
+  return boundaries;
+}
+
+const std::vector<double>& latency_buckets() {
+  static const std::vector<double> buckets = log_linear_buckets(1e-5, 100);
+  return buckets;
+}
+
+ShardedHistogram& HistogramFamily::Add(
+    const Labels& labels,
+    const std::vector<double>& bucket_boundaries) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& [histogram_labels, histogram] : histograms_) {
+    if (histogram_labels == labels) {
+      return *histogram;
+    }
+  }
+  histograms_.emplace_back(
+      labels, std::make_unique<ShardedHistogram>(bucket_boundaries));
+  return *histograms_.back().second;
+}
+
+std::vector<std::pair<HistogramFamily::Labels, ShardedHistogram::Snapshot>>
+HistogramFamily::Collect() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::pair<Labels, ShardedHistogram::Snapshot>> snapshots;
+  snapshots.reserve(histograms_.size());
+  for (const auto& [labels, histogram] : histograms_) {
+    snapshots.emplace_back(labels, histogram->snapshot());
+  }
+  return snapshots;
+}
+
+}  // namespace llm
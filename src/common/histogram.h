@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llm {
+
+// A histogram that is cheap to record into from many threads. Observations go
+// to one of several cache line aligned shards picked by the recording thread,
+// so the hot path is a few relaxed atomic adds on a cache line that is rarely
+// shared, without any locks. Shards are merged when taking a snapshot, e.g.
+// at scrape time.
+class ShardedHistogram final {
+ public:
+  struct Snapshot {
+    // the upper bounds of buckets, in increasing order. there is one more
+    // bucket for values greater than the last bound, i.e. +Inf.
+    std::vector<double> bucket_boundaries;
+
+    // non-cumulative counts of each bucket, including the +Inf bucket.
+    std::vector<uint64_t> bucket_counts;
+
+    uint64_t count = 0;
+
+    double sum = 0;
+
+    // estimate the q-quantile with linear interpolation within the bucket.
+    // returns the last bound if the quantile falls into the +Inf bucket.
+    double quantile(double q) const;
+  };
+
+  explicit ShardedHistogram(std::vector<double> bucket_boundaries);
+
+  // record a value, thread safe and lock free
+  void observe(double value);
+
+  // merge all shards, thread safe
+  Snapshot snapshot() const;
+
+  const std::vector<double>& bucket_boundaries() const {
+    return bucket_boundaries_;
+  }
+
+ private:
+  static constexpr size_t kNumShards = 32;
+  static constexpr size_t kWordsPerCacheLine = 8;
+
+  struct alignas(64) CacheLine {
+    std::atomic<uint64_t> words[kWordsPerCacheLine] = {};
+  };
+
+  struct alignas(64) Shard {
+    std::atomic<double> sum{0};
+
+    // bucket counts, padded to whole cache lines
+    std::unique_ptr<CacheLine[]> counts;
+
+    std::atomic<uint64_t>& count(size_t bucket) {
+      return counts[bucket / kWordsPerCacheLine]
+          .words[bucket % kWordsPerCacheLine];
+    }
+  };
+
+  // returns the shard of the calling thread
+  Shard& shard() const;
+
+  const std::vector<double> bucket_boundaries_;
+
+  std::unique_ptr<Shard[]> shards_;
+};
+
+// Bucket boundaries with a fixed relative resolution: each power of ten
+// between [min, max] is split into 9 linear buckets, i.e. 1, 2, ..., 9 times
+// the power of ten.
+std::vector<double> log_linear_buckets(double min, double max);
+
+// The default buckets for latencies in seconds, from 10us to 100s.
+const std::vector<double>& latency_buckets();
+
+// A group of histograms of the same metric with different labels.
+class HistogramFamily final {
+ public:
+  using Labels = std::map<std::string, std::string>;
+
+  HistogramFamily(std::string name, std::string help)
+      : name_(std::move(name)), help_(std::move(help)) {}
+
+  // add a histogram with given labels, the returned reference stays valid for
+  // the lifetime of the family.
+  ShardedHistogram& Add(
+      const Labels& labels,
+      const std::vector<double>& bucket_boundaries = latency_buckets());
+
+  // snapshots of all histograms in the family
+  std::vector<std::pair<Labels, ShardedHistogram::Snapshot>> Collect() const;
+
+  const std::string& name() const { return name_; }
+
+  const std::string& help() const { return help_; }
+
+ private:
+  const std::string name_;
+
+  const std::string help_;
+
+  mutable std::mutex mutex_;
+
+  std::vector<std::pair<Labels, std::unique_ptr<ShardedHistogram>>>
+      histograms_;
+};
+
+}  // namespace llm
@@ -0,0 +1,97 @@
+#include "histogram.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace llm {
+
+TEST(HistogramTest, Observe) {
+  ShardedHistogram histogram({1.0, 2.0, 5.0});
+  histogram.observe(0.5);
+  // upper bounds are inclusive
+  histogram.observe(1.0);
+  histogram.observe(3.0);
+  histogram.observe(10.0);
+
+  const auto snapshot = histogram.snapshot();
+  EXPECT_EQ(snapshot.bucket_counts, std::vector<uint64_t>({2, 0, 1, 1}));
+  EXPECT_EQ(snapshot.count, 4);
+  EXPECT_DOUBLE_EQ(snapshot.sum, 14.5);
+}
+
+TEST(HistogramTest, Quantile) {
+  ShardedHistogram histogram({1.0, 2.0, 3.0, 4.0});
+  EXPECT_EQ(histogram.snapshot().quantile(0.5), 0);
+
+  for (int i = 0; i < 100; ++i) {
+    histogram.observe(1.5);
+  }
+  for (int i = 0; i < 100; ++i) {
+    histogram.observe(3.5);
+  }
+  const auto snapshot = histogram.snapshot();
+  EXPECT_DOUBLE_EQ(snapshot.quantile(0.25), 1.5);
+  EXPECT_DOUBLE_EQ(snapshot.quantile(0.5), 2.0);
+  EXPECT_DOUBLE_EQ(snapshot.quantile(0.75), 3.5);
+  EXPECT_DOUBLE_EQ(snapshot.quantile(1.0), 4.0);
+
+  // values beyond the last bound
+  histogram.observe(100.0);
+  EXPECT_DOUBLE_EQ(histogram.snapshot().quantile(1.0), 4.0);
+}
+
+TEST(HistogramTest, LogLinearBuckets) {
+  const auto buckets = log_linear_buckets(0.001, 0.1);
+  ASSERT_EQ(buckets.size(), 19);
+  EXPECT_DOUBLE_EQ(buckets.front(), 0.001);
+  EXPECT_DOUBLE_EQ(buckets[1], 0.002);
+  EXPECT_DOUBLE_EQ(buckets[9], 0.01);
+  EXPECT_DOUBLE_EQ(buckets.back(), 0.1);
+  EXPECT_TRUE(std::is_sorted(buckets.begin(), buckets.end()));
+
+  EXPECT_DOUBLE_EQ(latency_buckets().front(), 1e-5);
+  EXPECT_DOUBLE_EQ(latency_buckets().back(), 100);
+}
+
+TEST(HistogramTest, ConcurrentObserve) {
+  ShardedHistogram histogram(latency_buckets());
+  constexpr int kNumThreads = 8;
+  constexpr int kNumObservations = 10000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&histogram]() {
+      for (int i = 0; i < kNumObservations; ++i) {
+        histogram.observe(0.001);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const auto snapshot = histogram.snapshot();
+  EXPECT_EQ(snapshot.count, kNumThreads * kNumObservations);
+  EXPECT_NEAR(snapshot.sum, kNumThreads * kNumObservations * 0.001, 1e-6);
+}
+
+TEST(HistogramTest, Family) {
+  HistogramFamily family("latency_seconds", "latency");
+  auto& prefill = family.Add({{"stage", "prefill"}});
+  auto& decode = family.Add({{"stage", "decode"}}, {1.0});
+  // the same labels return the same histogram
+  EXPECT_EQ(&family.Add({{"stage", "prefill"}}), &prefill);
+
+  prefill.observe(0.1);
+  decode.observe(0.5);
+  decode.observe(2.0);
+  const auto snapshots = family.Collect();
+  ASSERT_EQ(snapshots.size(), 2);
+  EXPECT_EQ(snapshots[0].first.at("stage"), "prefill");
+  EXPECT_EQ(snapshots[0].second.count, 1);
+  EXPECT_EQ(snapshots[1].second.bucket_counts,
+            std::vector<uint64_t>({1, 1}));
+}
+
+}  // namespace llm
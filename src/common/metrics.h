@@ -3,13 +3,18 @@
 #include <prometheus/counter.h>
 #include <prometheus/family.h>
 #include <prometheus/gauge.h>
-#include <prometheus/histogram.h>
 #include <prometheus/labels.h>
+#include <prometheus/metric_family.h>
 #include <prometheus/registry.h>
 #include <prometheus/text_serializer.h>
 
+#include <deque>
+#include <limits>
+#include <mutex>
 #include <string>
+#include <vector>
 
+#include "histogram.h"
 #include "macros.h"
 #include "timer.h"
 
@@ -17,7 +22,6 @@ namespace llm {
 
 using prometheus::Counter;
 using prometheus::Gauge;
-using prometheus::Histogram;
 using prometheus::Info;
 using prometheus::Summary;
 
@@ -35,10 +39,17 @@ class Metrics final {
     return instance;
   }
 
-  // get the metrics string
+  // get the metrics string, histogram shards are merged here
   std::string GetString() const {
+    auto families = registry_.Collect();
+    {
+      std::lock_guard<std::mutex> lock(histogram_mutex_);
+      for (const auto& family : histogram_families_) {
+        families.push_back(CollectHistogramFamily(family));
+      }
+    }
     prometheus::TextSerializer serializer;
-    return serializer.Serialize(registry_.Collect());
+    return serializer.Serialize(families);
   }
 
   // helper functions to define metrics
@@ -53,18 +64,53 @@ class Metrics final {
     return prometheus::BuildCounter().Name(name).Help(desc).Register(registry_);
   }
 
-  prometheus::Family<prometheus::Histogram>& BuildHistogram(
-      const std::string& name,
-      const std::string& desc) {
-    return prometheus::BuildHistogram().Name(name).Help(desc).Register(
-        registry_);
+  // histograms are recorded into per-thread shards instead of prometheus
+  // histograms, which take a lock for each observation.
+  HistogramFamily& BuildHistogram(const std::string& name,
+                                  const std::string& desc) {
+    std::lock_guard<std::mutex> lock(histogram_mutex_);
+    return histogram_families_.emplace_back(name, desc);
   }
 
  private:
   Metrics() = default;
   ~Metrics() = default;
 
+  static prometheus::MetricFamily CollectHistogramFamily(
+      const HistogramFamily& family) {
+    prometheus::MetricFamily metric_family;
+    metric_family.name = family.name();
+    metric_family.help = family.help();
+    metric_family.type = prometheus::MetricType::Histogram;
+    for (const auto& [labels, snapshot] : family.Collect()) {
+      prometheus::ClientMetric metric;
+      for (const auto& [name, value] : labels) {
+        metric.label.push_back({name, value});
+      }
+      auto& histogram = metric.histogram;
+      histogram.sample_count = snapshot.count;
+      histogram.sample_sum = snapshot.sum;
+      uint64_t cumulative_count = 0;
+      for (size_t i = 0; i < snapshot.bucket_counts.size(); ++i) {
+        cumulative_count += snapshot.bucket_counts[i];
+        prometheus::ClientMetric::Bucket bucket;
+        bucket.cumulative_count = cumulative_count;
+        bucket.upper_bound = i < snapshot.bucket_boundaries.size()
+                                 ? snapshot.bucket_boundaries[i]
+                                 : std::numeric_limits<double>::infinity();
+        histogram.bucket.push_back(bucket);
+      }
+      metric_family.metric.push_back(std::move(metric));
+    }
+    return metric_family;
+  }
+
   prometheus::Registry registry_;
+
+  mutable std::mutex histogram_mutex_;
+
+  // deque keeps references stable
+  std::deque<HistogramFamily> histogram_families_;
 };
 
 class AutoCounter final {
@@ -84,11 +130,27 @@ class AutoCounter final {
   Timer timer_;
 };
 
+class AutoHistogram final {
+ public:
+  AutoHistogram(ShardedHistogram& histogram) : histogram_(histogram) {}
+
+  ~AutoHistogram() {
+    // record the elapsed time
+    histogram_.observe(timer_.elapsed_seconds());
+  }
+
+ private:
+  // NOLINTNEXTLINE
+  ShardedHistogram& histogram_;
+
+  // the timer
+  Timer timer_;
+};
+
 }  // namespace llm
 
 // define helpful macros to hide boilerplate code
 // NOLINTBEGIN(bugprone-macro-parentheses)
-// extern const prometheus::Histogram::BucketBoundaries default_buckets;
 
 // define gauge
 // a gauge is a metric that represents a single numerical value that can
@@ -132,19 +194,32 @@ class AutoCounter final {
 // define histogram
 // a histogram samples observations (usually things like request durations or
 // response sizes) and counts them in configurable buckets. It also provides a
-// sum of all observed values.
+// sum of all observed values. Recording is lock free, prefer it over counters
+// for latencies on hot paths to get the distribution.
 #define DEFINE_HISTOGRAM(name, desc, ...)                   \
   auto& HISTOGRAM_##name = llm::Metrics::Instance()         \
                                .BuildHistogram(#name, desc) \
                                .Add({}, __VA_ARGS__);
 
+// define histogram with the default latency buckets, from 10us to 100s
+#define DEFINE_LATENCY_HISTOGRAM(name, desc)                \
+  auto& HISTOGRAM_##name = llm::Metrics::Instance()         \
+                               .BuildHistogram(#name, desc) \
+                               .Add({});
+
 #define DEFINE_HISTOGRAM_FAMILY(name, desc) \
   auto& name##_family = llm::Metrics::Instance().BuildHistogram(#name, desc);
 
+// bucket boundaries are optional, default to latency buckets
 #define DEFINE_HISTOGRAM_INSTANCE(alias, name, ...) \
   auto& HISTOGRAM_##alias = name##_family.Add(__VA_ARGS__);
 
-#define HISTOGRAM_OBSERVE(name, value) HISTOGRAM_##name.Observe(value);
+#define HISTOGRAM_OBSERVE(name, value) HISTOGRAM_##name.observe(value);
+
+// Declares a latency histogram having a variable name based on line number.
+// example: AUTO_HISTOGRAM(a_histogram_name);
+#define AUTO_HISTOGRAM(name) \
+  llm::AutoHistogram LLM_ANON_VAR(name)(HISTOGRAM_##name);
 
 // declare gauge
 #define DECLARE_GAUGE(name) extern prometheus::Gauge& GAUGE_##name;
@@ -164,11 +239,11 @@ class AutoCounter final {
   extern prometheus::Family<prometheus::Counter>& name##_family;
 
 // declare histogram
-#define DECLARE_HISTOGRAM(name) extern prometheus::Histogram& HISTOGRAM_##name;
+#define DECLARE_HISTOGRAM(name) extern llm::ShardedHistogram& HISTOGRAM_##name;
 
 #define DECLARE_HISTOGRAM_INSTANCE(alias) \
-  extern prometheus::Histogram& HISTOGRAM_##alias;
+  extern llm::ShardedHistogram& HISTOGRAM_##alias;
 
 #define DECLARE_HISTOGRAM_FAMILY(name) \
-  extern prometheus::Family<prometheus::Histogram>& name##_family;
+  extern llm::HistogramFamily& name##_family;
 // NOLINTEND(bugprone-macro-parentheses)
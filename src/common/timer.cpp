@@ -15,4 +15,9 @@ double Timer::elapsed_seconds() const {
   return absl::ToDoubleSeconds(absl::Now() - start_);
 }
 
+// get the elapsed time in microseconds
+int64_t Timer::elapsed_microseconds() const {
+  return absl::ToInt64Microseconds(absl::Now() - start_);
+}
+
 }  // namespace llm
\ No newline at end of file
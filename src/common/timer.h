@@ -2,6 +2,8 @@
 
 #include <absl/time/time.h>
 
+#include <cstdint>
+
 namespace llm {
 
 class Timer final {
@@ -14,6 +16,9 @@ class Timer final {
   // get the elapsed time in seconds
   double elapsed_seconds() const;
 
+  // get the elapsed time in microseconds
+  int64_t elapsed_microseconds() const;
+
  private:
   // the start time of the timer
   absl::Time start_;
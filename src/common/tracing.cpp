@@ -0,0 +1,356 @@
+#include "tracing.h"
+
+#include <absl/random/random.h>
+#include <absl/strings/ascii.h>
+#include <absl/strings/str_format.h>
+#include <absl/time/clock.h>
+#include <glog/logging.h>
+
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+namespace llm {
+namespace {
+using json = nlohmann::json;
+
+// NOLINTNEXTLINE
+std::atomic<bool> tracing_enabled{false};
+// NOLINTNEXTLINE
+std::shared_ptr<Tracer> global_tracer;
+
+uint64_t random_id() {
+  // NOLINTNEXTLINE
+  thread_local absl::InsecureBitGen gen;
+  uint64_t id = 0;
+  while (id == 0) {
+    id = absl::Uniform<uint64_t>(gen);
+  }
+  return id;
+}
+
+bool parse_hex(std::string_view hex, uint64_t* value) {
+  uint64_t result = 0;
+  for (const char c : hex) {
+    if (!absl::ascii_isxdigit(static_cast<unsigned char>(c))) {
+      return false;
+    }
+    const char lower = absl::ascii_tolower(static_cast<unsigned char>(c));
+    const uint64_t digit = lower <= '9' ? lower - '0' : lower - 'a' + 10;
+    result = (result << 4) | digit;
+  }
+  *value = result;
+  return true;
+}
+
+std::string to_hex(uint64_t id) { return absl::StrFormat("%016x", id); }
+
+json attribute_value_json(const SpanAttributeValue& value) {
+  if (const auto* v = std::get_if<int64_t>(&value)) {
+    return *v;
+  }
+  return std::get<std::string>(value);
+}
+
+}  // namespace
+
+std::optional<TraceContext> TraceContext::from_traceparent(
+    std::string_view traceparent) {
+  // 00-<32 hex>-<16 hex>-<2 hex>
+  constexpr size_t kTraceParentSize = 55;
+  if (traceparent.size() != kTraceParentSize || traceparent[2] != '-' ||
+      traceparent[35] != '-' || traceparent[52] != '-' ||
+      traceparent.substr(0, 2) != "00") {
+    return std::nullopt;
+  }
+
+  TraceContext context;
+  uint64_t flags = 0;
+  if (!parse_hex(traceparent.substr(3, 16), &context.trace_id_high) ||
+      !parse_hex(traceparent.substr(19, 16), &context.trace_id_low) ||
+      !parse_hex(traceparent.substr(36, 16), &context.span_id) ||
+      !parse_hex(traceparent.substr(53, 2), &flags)) {
+    return std::nullopt;
+  }
+  // all zero ids are invalid
+  if ((context.trace_id_high == 0 && context.trace_id_low == 0) ||
+      context.span_id == 0) {
+    return std::nullopt;
+  }
+  context.sampled = (flags & 0x01) != 0;
+  return context;
+}
+
+std::string TraceContext::to_traceparent() const {
+  return absl::StrFormat(
+      "00-%s-%s-%02x", trace_id(), to_hex(span_id), sampled ? 1 : 0);
+}
+
+std::string TraceContext::trace_id() const {
+  return to_hex(trace_id_high) + to_hex(trace_id_low);
+}
+
+RequestTrace::RequestTrace(std::shared_ptr<Tracer> tracer,
+                           std::string name,
+                           const TraceContext& parent)
+    : tracer_(std::move(tracer)) {
+  context_ = parent;
+  context_.span_id = random_id();
+  context_.sampled = true;
+
+  root_.name = std::move(name);
+  root_.span_id = context_.span_id;
+  root_.parent_span_id = parent.span_id;
+  root_.start_time = absl::Now();
+}
+
+RequestTrace::~RequestTrace() {
+  std::vector<Span> spans;
+  {
+    absl::MutexLock lock(&mutex_);
+    root_.end_time = absl::Now();
+    spans.reserve(spans_.size() + 1);
+    spans.push_back(std::move(root_));
+    for (auto& span : spans_) {
+      spans.push_back(std::move(span));
+    }
+  }
+  tracer_->submit(context_, std::move(spans));
+}
+
+void RequestTrace::add_span(std::string name,
+                            absl::Time start_time,
+                            absl::Time end_time,
+                            std::vector<SpanAttribute> attributes) {
+  Span span;
+  span.name = std::move(name);
+  span.span_id = random_id();
+  span.parent_span_id = context_.span_id;
+  span.start_time = start_time;
+  span.end_time = end_time;
+  span.attributes = std::move(attributes);
+
+  absl::MutexLock lock(&mutex_);
+  spans_.push_back(std::move(span));
+}
+
+void RequestTrace::add_event(std::string name,
+                             std::vector<SpanAttribute> attributes) {
+  const absl::Time now = absl::Now();
+  add_span(std::move(name), now, now, std::move(attributes));
+}
+
+void RequestTrace::set_attribute(std::string key, SpanAttributeValue value) {
+  absl::MutexLock lock(&mutex_);
+  root_.attributes.emplace_back(std::move(key), std::move(value));
+}
+
+ChromeTraceExporter::ChromeTraceExporter(std::unique_ptr<std::ostream> out)
+    : out_(std::move(out)) {
+  CHECK(out_ != nullptr);
+  // json array format, the closing bracket is optional so that the file is
+  // still loadable if the process crashes.
+  *out_ << "[\n";
+}
+
+ChromeTraceExporter::~ChromeTraceExporter() {
+  *out_ << "\n]\n";
+  out_->flush();
+}
+
+void ChromeTraceExporter::write_event(const std::string& event) {
+  if (!first_event_) {
+    *out_ << ",\n";
+  }
+  first_event_ = false;
+  *out_ << event;
+}
+
+void ChromeTraceExporter::export_trace(const TraceContext& context,
+                                       const std::vector<Span>& spans) {
+  if (spans.empty()) {
+    return;
+  }
+  const int64_t tid = next_tid_++;
+  const std::string trace_id = context.trace_id();
+
+  // name the row after the request
+  write_event(json{{"name", "thread_name"},
+                   {"ph", "M"},
+                   {"pid", 1},
+                   {"tid", tid},
+                   {"args", {{"name", spans[0].name + " " + trace_id}}}}
+                  .dump());
+
+  for (const auto& span : spans) {
+    json args = {{"trace_id", trace_id}, {"span_id", to_hex(span.span_id)}};
+    for (const auto& [key, value] : span.attributes) {
+      args[key] = attribute_value_json(value);
+    }
+    write_event(json{{"name", span.name},
+                     {"cat", "request"},
+                     {"ph", "X"},
+                     {"ts", absl::ToUnixMicros(span.start_time)},
+                     {"dur",
+                      absl::ToInt64Microseconds(span.end_time -
+                                                span.start_time)},
+                     {"pid", 1},
+                     {"tid", tid},
+                     {"args", std::move(args)}}
+                    .dump());
+  }
+}
+
+void ChromeTraceExporter::flush() { out_->flush(); }
+
+OtlpJsonExporter::OtlpJsonExporter(std::unique_ptr<std::ostream> out,
+                                   std::string service_name)
+    : out_(std::move(out)), service_name_(std::move(service_name)) {
+  CHECK(out_ != nullptr);
+}
+
+void OtlpJsonExporter::export_trace(const TraceContext& context,
+                                    const std::vector<Span>& spans) {
+  const std::string trace_id = context.trace_id();
+  auto otlp_spans = json::array();
+  for (const auto& span : spans) {
+    auto attributes = json::array();
+    for (const auto& [key, value] : span.attributes) {
+      // 64-bit integers are encoded as strings in OTLP/JSON
+      json otlp_value;
+      if (const auto* v = std::get_if<int64_t>(&value)) {
+        otlp_value["intValue"] = std::to_string(*v);
+      } else {
+        otlp_value["stringValue"] = std::get<std::string>(value);
+      }
+      attributes.push_back({{"key", key}, {"value", std::move(otlp_value)}});
+    }
+    json otlp_span = {
+        {"traceId", trace_id},
+        {"spanId", to_hex(span.span_id)},
+        {"name", span.name},
+        // SPAN_KIND_SERVER for the root span, SPAN_KIND_INTERNAL for others
+        {"kind", &span == &spans.front() ? 2 : 1},
+        {"startTimeUnixNano",
+         std::to_string(absl::ToUnixNanos(span.start_time))},
+        {"endTimeUnixNano", std::to_string(absl::ToUnixNanos(span.end_time))},
+        {"attributes", std::move(attributes)}};
+    if (span.parent_span_id != 0) {
+      otlp_span["parentSpanId"] = to_hex(span.parent_span_id);
+    }
+    otlp_spans.push_back(std::move(otlp_span));
+  }
+
+  json resource;
+  resource["attributes"] = json::array(
+      {{{"key", "service.name"},
+        {"value", {{"stringValue", service_name_}}}}});
+  json scope_spans;
+  scope_spans["scope"] = {{"name", "scalellm"}};
+  scope_spans["spans"] = std::move(otlp_spans);
+  json resource_spans;
+  resource_spans["resource"] = std::move(resource);
+  resource_spans["scopeSpans"] = json::array({std::move(scope_spans)});
+  json request;
+  request["resourceSpans"] = json::array({std::move(resource_spans)});
+  *out_ << request.dump() << "\n";
+}
+
+void OtlpJsonExporter::flush() { out_->flush(); }
+
+Tracer::Tracer(const Options& options, std::unique_ptr<TraceExporter> exporter)
+    : options_(options), exporter_(std::move(exporter)) {
+  CHECK(exporter_ != nullptr);
+  export_thread_ = std::thread([this]() { export_loop(); });
+}
+
+Tracer::~Tracer() {
+  // exit after exporting all pending traces
+  queue_.push(nullptr);
+  export_thread_.join();
+  exporter_->flush();
+}
+
+std::shared_ptr<RequestTrace> Tracer::start_trace(
+    std::string name,
+    const std::optional<TraceContext>& parent) {
+  if (parent.has_value()) {
+    // follow the sampling decision of the caller
+    if (!parent->sampled) {
+      return nullptr;
+    }
+    return std::make_shared<RequestTrace>(
+        shared_from_this(), std::move(name), parent.value());
+  }
+
+  // NOLINTNEXTLINE
+  thread_local absl::InsecureBitGen gen;
+  if (options_.sample_rate() <= 0.0 ||
+      !absl::Bernoulli(gen, options_.sample_rate())) {
+    return nullptr;
+  }
+  // start a new trace
+  TraceContext context;
+  context.trace_id_high = random_id();
+  context.trace_id_low = random_id();
+  return std::make_shared<RequestTrace>(
+      shared_from_this(), std::move(name), context);
+}
+
+void Tracer::submit(const TraceContext& context, std::vector<Span> spans) {
+  auto trace = std::make_unique<FinishedTrace>();
+  trace->context = context;
+  trace->spans = std::move(spans);
+  queue_.push(std::move(trace));
+}
+
+void Tracer::export_loop() {
+  while (true) {
+    auto trace = queue_.pop();
+    if (trace == nullptr) {
+      break;
+    }
+    exporter_->export_trace(trace->context, trace->spans);
+    // flush when idle to keep the output up to date
+    if (queue_.empty()) {
+      exporter_->flush();
+    }
+  }
+}
+
+std::shared_ptr<Tracer> Tracer::global() {
+  if (!tracing_enabled.load(std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  return std::atomic_load(&global_tracer);
+}
+
+void Tracer::set_global(std::shared_ptr<Tracer> tracer) {
+  tracing_enabled.store(tracer != nullptr, std::memory_order_relaxed);
+  std::atomic_store(&global_tracer, std::move(tracer));
+}
+
+std::shared_ptr<RequestTrace> start_request_trace(
+    std::string name,
+    const std::optional<TraceContext>& parent) {
+  auto tracer = Tracer::global();
+  if (tracer == nullptr) {
+    return nullptr;
+  }
+  return tracer->start_trace(std::move(name), parent);
+}
+
+std::unique_ptr<TraceExporter> create_trace_exporter(const std::string& format,
+                                                     const std::string& path) {
+  auto out = std::make_unique<std::ofstream>(path, std::ios::trunc);
+  CHECK(out->is_open()) << "Failed to open trace output: " << path;
+  if (format == "chrome") {
+    return std::make_unique<ChromeTraceExporter>(std::move(out));
+  }
+  if (format == "otlp") {
+    return std::make_unique<OtlpJsonExporter>(std::move(out), "scalellm");
+  }
+  LOG(FATAL) << "Unknown trace format: " << format;
+  return nullptr;
+}
+
+}  // namespace llm
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <absl/synchronization/mutex.h>
+#include <absl/time/time.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "concurrent_queue.h"
+#include "macros.h"
+
+namespace llm {
+
+// Trace context propagated across processes in w3c traceparent format:
+//   00-<32 hex trace id>-<16 hex parent span id>-<2 hex flags>
+struct TraceContext {
+  // 128-bit trace id
+  uint64_t trace_id_high = 0;
+  uint64_t trace_id_low = 0;
+
+  // the id of the span that the new spans are children of
+  uint64_t span_id = 0;
+
+  // whether the trace has been sampled by the caller
+  bool sampled = false;
+
+  // returns nullopt if the traceparent is malformed
+  static std::optional<TraceContext> from_traceparent(
+      std::string_view traceparent);
+
+  std::string to_traceparent() const;
+
+  // 32 hex characters
+  std::string trace_id() const;
+};
+
+using SpanAttributeValue = std::variant<int64_t, std::string>;
+using SpanAttribute = std::pair<std::string, SpanAttributeValue>;
+
+struct Span {
+  std::string name;
+
+  uint64_t span_id = 0;
+
+  // 0 for the root span
+  uint64_t parent_span_id = 0;
+
+  absl::Time start_time;
+
+  absl::Time end_time;
+
+  std::vector<SpanAttribute> attributes;
+};
+
+class Tracer;
+
+// All spans of a sampled request. It is shared by the threads handling the
+// request, and the spans are handed over to the tracer for exporting once the
+// last reference goes away. thread safe.
+class RequestTrace final {
+ public:
+  RequestTrace(std::shared_ptr<Tracer> tracer,
+               std::string name,
+               const TraceContext& parent);
+
+  // end the root span and export the trace
+  ~RequestTrace();
+
+  // the context to propagate, the root span is the parent of new spans.
+  const TraceContext& context() const { return context_; }
+
+  // add a finished span as a child of the root span
+  void add_span(std::string name,
+                absl::Time start_time,
+                absl::Time end_time,
+                std::vector<SpanAttribute> attributes = {});
+
+  // add a zero duration span, e.g. preemption
+  void add_event(std::string name, std::vector<SpanAttribute> attributes = {});
+
+  // set attribute for the root span
+  void set_attribute(std::string key, SpanAttributeValue value);
+
+ private:
+  std::shared_ptr<Tracer> tracer_;
+
+  TraceContext context_;
+
+  absl::Mutex mutex_;
+
+  // the root span covering the whole request
+  Span root_ GUARDED_BY(mutex_);
+
+  std::vector<Span> spans_ GUARDED_BY(mutex_);
+};
+
+// Record a span from construction to destruction. It does nothing if the
+// trace is null, so it costs only a branch for requests that are not sampled.
+class ScopedSpan final {
+ public:
+  ScopedSpan(RequestTrace* trace, const char* name)
+      : trace_(trace), name_(name) {
+    if (trace_ != nullptr) {
+      start_time_ = absl::Now();
+    }
+  }
+
+  ~ScopedSpan() {
+    if (trace_ != nullptr) {
+      trace_->add_span(
+          name_, start_time_, absl::Now(), std::move(attributes_));
+    }
+  }
+
+  void add_attribute(std::string key, SpanAttributeValue value) {
+    if (trace_ != nullptr) {
+      attributes_.emplace_back(std::move(key), std::move(value));
+    }
+  }
+
+ private:
+  RequestTrace* trace_;
+  const char* name_;
+  absl::Time start_time_;
+  std::vector<SpanAttribute> attributes_;
+};
+
+// Interface of trace sinks. export_trace is only called from the exporting
+// thread of the tracer.
+class TraceExporter {
+ public:
+  virtual ~TraceExporter() = default;
+
+  // export spans of a finished trace, the root span comes first
+  virtual void export_trace(const TraceContext& context,
+                            const std::vector<Span>& spans) = 0;
+
+  virtual void flush() = 0;
+};
+
+// Chrome trace event format, which can be loaded into chrome://tracing or
+// perfetto. Each request is shown in its own row.
+class ChromeTraceExporter final : public TraceExporter {
+ public:
+  explicit ChromeTraceExporter(std::unique_ptr<std::ostream> out);
+
+  // close the json array
+  ~ChromeTraceExporter() override;
+
+  void export_trace(const TraceContext& context,
+                    const std::vector<Span>& spans) override;
+
+  void flush() override;
+
+ private:
+  void write_event(const std::string& event);
+
+  std::unique_ptr<std::ostream> out_;
+
+  // the row id for the next trace
+  int64_t next_tid_ = 1;
+
+  bool first_event_ = true;
+};
+
+// OTLP/JSON ExportTraceServiceRequest, one per line. It is the format read by
+// the otlpjsonfile receiver of the opentelemetry collector.
+class OtlpJsonExporter final : public TraceExporter {
+ public:
+  OtlpJsonExporter(std::unique_ptr<std::ostream> out, std::string service_name);
+
+  void export_trace(const TraceContext& context,
+                    const std::vector<Span>& spans) override;
+
+  void flush() override;
+
+ private:
+  std::unique_ptr<std::ostream> out_;
+
+  std::string service_name_;
+};
+
+// Samples requests and exports finished traces in a background thread.
+class Tracer final : public std::enable_shared_from_this<Tracer> {
+ public:
+  struct Options {
+    // the fraction of requests to trace, between [0, 1]. requests with a
+    // traceparent follow the sampling decision of the caller.
+    DEFINE_ARG(double, sample_rate) = 0.0;
+  };
+
+  Tracer(const Options& options, std::unique_ptr<TraceExporter> exporter);
+
+  // export all pending traces
+  ~Tracer();
+
+  // returns nullptr if the request is not sampled
+  std::shared_ptr<RequestTrace> start_trace(
+      std::string name,
+      const std::optional<TraceContext>& parent = std::nullopt);
+
+  // hand over a finished trace for exporting, called by RequestTrace
+  void submit(const TraceContext& context, std::vector<Span> spans);
+
+  // the process wide tracer, nullptr if tracing is disabled
+  static std::shared_ptr<Tracer> global();
+
+  static void set_global(std::shared_ptr<Tracer> tracer);
+
+ private:
+  struct FinishedTrace {
+    TraceContext context;
+    std::vector<Span> spans;
+  };
+
+  void export_loop();
+
+  const Options options_;
+
+  std::unique_ptr<TraceExporter> exporter_;
+
+  // nullptr is the signal to exit
+  ConcurrentQueue<std::unique_ptr<FinishedTrace>> queue_;
+
+  std::thread export_thread_;
+};
+
+// start a trace with the global tracer. returns nullptr if tracing is disabled
+// or the request is not sampled.
+std::shared_ptr<RequestTrace> start_request_trace(
+    std::string name,
+    const std::optional<TraceContext>& parent = std::nullopt);
+
+// create an exporter writing to the file, format is either "chrome" or "otlp"
+std::unique_ptr<TraceExporter> create_trace_exporter(const std::string& format,
+                                                     const std::string& path);
+
+}  // namespace llm
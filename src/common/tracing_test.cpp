@@ -0,0 +1,154 @@
+#include "tracing.h"
+
+#include <gtest/gtest.h>
+
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <string>
+
+namespace llm {
+
+namespace {
+// an ostream whose content survives the exporter
+class SharedStream : public std::ostream {
+ public:
+  explicit SharedStream(std::stringbuf* buf) : std::ostream(buf) {}
+};
+}  // namespace
+
+TEST(TracingTest, TraceParent) {
+  const std::string traceparent =
+      "00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01";
+  auto context = TraceContext::from_traceparent(traceparent);
+  ASSERT_TRUE(context.has_value());
+  EXPECT_EQ(context->trace_id(), "0af7651916cd43dd8448eb211c80319c");
+  EXPECT_EQ(context->span_id, 0xb7ad6b7169203331);
+  EXPECT_TRUE(context->sampled);
+  EXPECT_EQ(context->to_traceparent(), traceparent);
+
+  // not sampled
+  context = TraceContext::from_traceparent(
+      "00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-00");
+  ASSERT_TRUE(context.has_value());
+  EXPECT_FALSE(context->sampled);
+
+  // malformed
+  EXPECT_FALSE(TraceContext::from_traceparent("").has_value());
+  EXPECT_FALSE(TraceContext::from_traceparent(
+                   "01-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01")
+                   .has_value());
+  EXPECT_FALSE(TraceContext::from_traceparent(
+                   "00-0af7651916cd43dd8448eb211c80319x-b7ad6b7169203331-01")
+                   .has_value());
+  EXPECT_FALSE(TraceContext::from_traceparent(
+                   "00-00000000000000000000000000000000-b7ad6b7169203331-01")
+                   .has_value());
+  EXPECT_FALSE(TraceContext::from_traceparent(
+                   "00-0af7651916cd43dd8448eb211c80319c-0000000000000000-01")
+                   .has_value());
+}
+
+TEST(TracingTest, Sampling) {
+  std::stringbuf buf;
+  Tracer::Options options;
+  options.sample_rate(0.0);
+  auto tracer = std::make_shared<Tracer>(
+      options,
+      std::make_unique<ChromeTraceExporter>(
+          std::make_unique<SharedStream>(&buf)));
+
+  // not sampled
+  EXPECT_EQ(tracer->start_trace("request"), nullptr);
+
+  // follow the sampling decision of the caller
+  auto parent = TraceContext::from_traceparent(
+      "00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01");
+  auto trace = tracer->start_trace("request", parent);
+  ASSERT_NE(trace, nullptr);
+  EXPECT_EQ(trace->context().trace_id(), parent->trace_id());
+  EXPECT_NE(trace->context().span_id, parent->span_id);
+
+  parent->sampled = false;
+  EXPECT_EQ(tracer->start_trace("request", parent), nullptr);
+
+  // always sampled
+  options.sample_rate(1.0);
+  auto tracer2 = std::make_shared<Tracer>(
+      options,
+      std::make_unique<ChromeTraceExporter>(
+          std::make_unique<SharedStream>(&buf)));
+  EXPECT_NE(tracer2->start_trace("request"), nullptr);
+}
+
+TEST(TracingTest, ChromeTraceExporter) {
+  std::stringbuf buf;
+  {
+    Tracer::Options options;
+    options.sample_rate(1.0);
+    auto tracer = std::make_shared<Tracer>(
+        options,
+        std::make_unique<ChromeTraceExporter>(
+            std::make_unique<SharedStream>(&buf)));
+    auto trace = tracer->start_trace("completion");
+    ASSERT_NE(trace, nullptr);
+    trace->set_attribute("num_prompt_tokens", 10);
+    {
+      ScopedSpan span(trace.get(), "tokenize");
+      span.add_attribute("mode", "stream");
+    }
+    trace->add_event("preempt");
+    // the trace is exported once released
+    trace.reset();
+  }
+
+  const auto events = nlohmann::json::parse(buf.str());
+  ASSERT_TRUE(events.is_array());
+  // one metadata event and three spans
+  ASSERT_EQ(events.size(), 4);
+  EXPECT_EQ(events[0]["ph"], "M");
+  EXPECT_EQ(events[1]["name"], "completion");
+  EXPECT_EQ(events[1]["args"]["num_prompt_tokens"], 10);
+  EXPECT_EQ(events[2]["name"], "tokenize");
+  EXPECT_EQ(events[2]["args"]["mode"], "stream");
+  EXPECT_EQ(events[3]["name"], "preempt");
+  EXPECT_EQ(events[3]["dur"], 0);
+  for (size_t i = 1; i < events.size(); ++i) {
+    EXPECT_EQ(events[i]["tid"], events[0]["tid"]);
+    EXPECT_EQ(events[i]["args"]["trace_id"], events[1]["args"]["trace_id"]);
+  }
+}
+
+TEST(TracingTest, OtlpJsonExporter) {
+  std::stringbuf buf;
+  TraceContext context;
+  {
+    Tracer::Options options;
+    auto tracer = std::make_shared<Tracer>(
+        options,
+        std::make_unique<OtlpJsonExporter>(std::make_unique<SharedStream>(&buf),
+                                           "test"));
+    context = TraceContext::from_traceparent(
+                  "00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01")
+                  .value();
+    auto trace = tracer->start_trace("chat", context);
+    ASSERT_NE(trace, nullptr);
+    ScopedSpan span(trace.get(), "chat_template");
+    span.add_attribute("num_messages", 2);
+  }
+
+  const auto request = nlohmann::json::parse(buf.str());
+  const auto& resource_spans = request["resourceSpans"][0];
+  EXPECT_EQ(resource_spans["resource"]["attributes"][0]["value"]["stringValue"],
+            "test");
+  const auto& spans = resource_spans["scopeSpans"][0]["spans"];
+  ASSERT_EQ(spans.size(), 2);
+  // root span is a child of the caller's span
+  EXPECT_EQ(spans[0]["name"], "chat");
+  EXPECT_EQ(spans[0]["traceId"], "0af7651916cd43dd8448eb211c80319c");
+  EXPECT_EQ(spans[0]["parentSpanId"], "b7ad6b7169203331");
+  EXPECT_EQ(spans[1]["name"], "chat_template");
+  EXPECT_EQ(spans[1]["parentSpanId"], spans[0]["spanId"]);
+  EXPECT_EQ(spans[1]["attributes"][0]["value"]["intValue"], "2");
+}
+
+}  // namespace llm
@@ -2,6 +2,8 @@
 
 #include <torch/torch.h>
 
+#include <algorithm>
+#include <limits>
 #include <vector>
 
 #include "common/metrics.h"
@@ -30,6 +32,21 @@ void pad_2d_vector(std::vector<std::vector<T>>& vec, T pad_value) {
   }
 }
 
+// whether the token at the position is pooled into the embedding
+bool should_pool(PoolingType type, uint32_t pos, uint32_t n_prompt_tokens) {
+  switch (type) {
+    case PoolingType::LAST:
+      return pos + 1 == n_prompt_tokens;
+    case PoolingType::MEAN:
+      return pos < n_prompt_tokens;
+    case PoolingType::CLS:
+      return pos == 0;
+    default:
+      LOG(FATAL) << "Unknown pooling type: " << static_cast<int>(type);
+  }
+  return false;
+}
+
 }  // namespace
 
 Batch::Batch(Sequence* sequence) { add(sequence); }
@@ -69,6 +86,9 @@ void Batch::clear() {
   sequences_.clear();
   token_budgets_.clear();
   budget_used_.clear();
+  embedding_seqs_.clear();
+  prompt_logprobs_.clear();
+  num_decode_steps_ = 1;
 }
 
 // prepare inputs for the batch
@@ -86,6 +106,16 @@ ModelInput Batch::prepare_model_input(uint32_t num_decoding_tokens,
   // track the last token of selected tokens for sampling
   std::vector<int32_t> sample_idxes;
 
+  // tokens to pool for embedding sequences
+  std::vector<int32_t> pooled_token_idxes;
+  std::vector<int32_t> embedding_idxes;
+  embedding_seqs_.clear();
+
+  // prompt tokens to compute logprobs of the next prompt token for
+  std::vector<int32_t> prompt_logprob_idxes;
+  std::vector<int64_t> prompt_logprob_token_ids;
+  prompt_logprobs_.clear();
+
   // track the unique token ids and counts in the batch
   std::vector<std::vector<int64_t>> unique_token_ids_vec;
   std::vector<std::vector<int32_t>> unique_token_counts_vec;
@@ -99,6 +129,10 @@ ModelInput Batch::prepare_model_input(uint32_t num_decoding_tokens,
   // slot ids for new token
   std::vector<int32_t> new_token_slot_ids;
   std::vector<std::vector<int32_t>> block_tables_vec;
+  // kv cache blocks to copy before the forward pass, for beams writing into
+  // blocks shared with other beams
+  std::vector<int32_t> src_block_ids;
+  std::vector<int32_t> dst_block_ids;
   const int32_t num_sequences = static_cast<int32_t>(sequences_.size());
   for (int32_t i = 0; i < num_sequences; ++i) {
     auto* sequence = sequences_[i];
@@ -120,8 +154,11 @@ ModelInput Batch::prepare_model_input(uint32_t num_decoding_tokens,
 
     const uint32_t seq_len = q_seq_len + n_kv_cache_tokens;
 
-    // check if the sequence has enough cache slots
-    CHECK_GE(sequence->kv_cache_capacity(), seq_len);
+    // check if the sequence has enough cache slots, including the slots for
+    // tokens sampled in later decode steps
+    CHECK_GE(sequence->kv_cache_capacity(), seq_len + num_decode_steps_ - 1);
+    CHECK(num_decode_steps_ == 1 || q_seq_len == 1)
+        << "only decode sequences can run several decode steps";
 
     // at least one token to process otherwise the sequence should be finished.
     CHECK_GT(q_seq_len, 0) << "at least one token should be processed. "
@@ -157,6 +194,23 @@ ModelInput Batch::prepare_model_input(uint32_t num_decoding_tokens,
       flatten_tokens_vec.push_back(token_ids[j]);
       flatten_positions_vec.push_back(static_cast<int32_t>(j));
 
+      if (sequence->need_prompt_logprobs() && j + 1 < n_prompt_tokens) {
+        prompt_logprob_idxes.push_back(
+            static_cast<int32_t>(flatten_tokens_vec.size() - 1));
+        prompt_logprob_token_ids.push_back(token_ids[j + 1]);
+      }
+
+      if (sequence->is_embedding()) {
+        // pool hidden states instead of sampling for embedding sequences
+        if (should_pool(sequence->pooling_type(), j, n_prompt_tokens)) {
+          pooled_token_idxes.push_back(
+              static_cast<int32_t>(flatten_tokens_vec.size() - 1));
+          embedding_idxes.push_back(
+              static_cast<int32_t>(embedding_seqs_.size()));
+        }
+        continue;
+      }
+
       // skip prompt tokens except the last one
       if (j + 1 < n_prompt_tokens) {
         continue;
@@ -195,6 +249,22 @@ ModelInput Batch::prepare_model_input(uint32_t num_decoding_tokens,
       }
     }
 
+    if (sequence->is_embedding()) {
+      embedding_seqs_.push_back(sequence);
+    }
+
+    if (sequence->need_prompt_logprobs() &&
+        n_kv_cache_tokens + 1 < n_prompt_tokens) {
+      const uint32_t end = std::min(seq_len, n_prompt_tokens - 1);
+      prompt_logprobs_.push_back(
+          {sequence, n_kv_cache_tokens + 1, end - n_kv_cache_tokens});
+    }
+
+    if (const auto copy = sequence->take_block_copy()) {
+      src_block_ids.push_back(copy->first);
+      dst_block_ids.push_back(copy->second);
+    }
+
     // commit kv cache to advance kv_cache pos in sequence
     sequence->commit_kv_cache(/*size=*/q_seq_len);
 
@@ -243,6 +313,7 @@ ModelInput Batch::prepare_model_input(uint32_t num_decoding_tokens,
   }
 
   ModelInput model_inputs;
+  model_inputs.num_decode_steps = num_decode_steps_;
   model_inputs.token_ids = torch::tensor(flatten_tokens_vec, torch::kInt);
   model_inputs.positions = torch::tensor(flatten_positions_vec, torch::kInt);
 
@@ -258,6 +329,11 @@ ModelInput Batch::prepare_model_input(uint32_t num_decoding_tokens,
   pad_2d_vector(block_tables_vec, /*pad_value=*/0);
   input_params.block_tables = create_2d_tensor(block_tables_vec, torch::kInt);
 
+  if (!src_block_ids.empty()) {
+    model_inputs.src_block_ids = torch::tensor(src_block_ids, torch::kInt);
+    model_inputs.dst_block_ids = torch::tensor(dst_block_ids, torch::kInt);
+  }
+
   CHECK_EQ(sampling_params.size(), selected_token_idxes.size());
   if (!selected_token_idxes.empty()) {
     pad_2d_vector<int64_t>(unique_token_ids_vec, /*pad_value=*/0);
@@ -270,28 +346,134 @@ ModelInput Batch::prepare_model_input(uint32_t num_decoding_tokens,
                                       unique_token_lens_vec);
   }
 
+  if (!prompt_logprob_idxes.empty()) {
+    model_inputs.prompt_logprob_idxes =
+        torch::tensor(prompt_logprob_idxes, torch::kInt);
+    model_inputs.prompt_logprob_token_ids =
+        torch::tensor(prompt_logprob_token_ids, torch::kLong);
+  }
+
+  if (!embedding_seqs_.empty()) {
+    auto& pooling_params = model_inputs.pooling_params;
+    pooling_params.token_idxes = torch::tensor(pooled_token_idxes, torch::kInt);
+    pooling_params.embedding_idxes =
+        torch::tensor(embedding_idxes, torch::kInt);
+    pooling_params.num_embeddings =
+        static_cast<int64_t>(embedding_seqs_.size());
+  }
+
   return model_inputs;
 }
 
 void Batch::process_sample_output(const SampleOutput& sample_output) {
   // it is possible that the model output is empty for prefill sequences
-  if (sample_output.next_tokens.defined()) {
-    const auto& next_tokens = sample_output.next_tokens.cpu();
-    const int64_t num_seqs = next_tokens.numel();
-    int64_t output_idx = 0;
-    for (auto* seq : sequences_) {
-      if (seq->is_prefill_stage()) {
-        // no sampling for prefill sequences
-        continue;
-      }
-      CHECK_LT(output_idx, num_seqs);
+  if (!sample_output.next_tokens.defined()) {
+    return;
+  }
 
-      // add the next token to sequence
-      const int32_t next_token_id =
-          static_cast<int32_t>(next_tokens[output_idx++].item<int64_t>());
-      seq->append_token(next_token_id);
+  const bool need_logprobs =
+      std::any_of(sequences_.begin(), sequences_.end(), [](Sequence* seq) {
+        return seq->need_logprobs();
+      });
+  const bool has_top_tokens = sample_output.top_tokens.defined();
+
+  // copy sampled tokens with top tokens, and their logprobs, to host in one
+  // batched copy for each, logprobs are only copied if needed.
+  // [num_seqs, 1 + num_top_tokens]
+  torch::Tensor tokens = sample_output.next_tokens.unsqueeze(/*dim=*/1);
+  torch::Tensor logprobs;
+  if (has_top_tokens || need_logprobs) {
+    CHECK(!need_logprobs || sample_output.logprobs.defined())
+        << "missing logprobs";
+    logprobs = sample_output.logprobs.defined()
+                   ? sample_output.logprobs.to(torch::kFloat)
+                   : torch::zeros_like(sample_output.next_tokens,
+                                       torch::kFloat);
+    logprobs = logprobs.unsqueeze(/*dim=*/1);
+    if (has_top_tokens) {
+      tokens = torch::cat({tokens, sample_output.top_tokens}, /*dim=*/1);
+      logprobs = torch::cat(
+          {logprobs, sample_output.top_logprobs.to(torch::kFloat)},
+          /*dim=*/1);
     }
-    CHECK_EQ(output_idx, num_seqs);
+    logprobs = logprobs.cpu();
+  }
+  tokens = tokens.to(torch::kCPU, torch::kLong).contiguous();
+  const int64_t num_seqs = tokens.size(0);
+  const int64_t num_top_tokens = tokens.size(1) - 1;
+
+  // get the top tokens and their logprobs of the i-th sequence
+  const auto top_tokens_of = [&](int64_t i, int64_t n) {
+    std::vector<TokenLogprob> top_tokens;
+    n = std::min(n, num_top_tokens);
+    top_tokens.reserve(n);
+    const auto* token_data = tokens[i].data_ptr<int64_t>();
+    const auto* logprob_data = logprobs[i].data_ptr<float>();
+    for (int64_t j = 1; j <= n; ++j) {
+      top_tokens.push_back(
+          {static_cast<int32_t>(token_data[j]), logprob_data[j]});
+    }
+    return top_tokens;
+  };
+
+  int64_t output_idx = 0;
+  for (auto* seq : sequences_) {
+    if (seq->is_prefill_stage() || seq->is_embedding()) {
+      // no sampling for prefill and embedding sequences
+      continue;
+    }
+    CHECK_LT(output_idx, num_seqs);
+    const int64_t i = output_idx++;
+
+    if (seq->is_beam()) {
+      // beams are extended by beam search with candidates across beams
+      CHECK(has_top_tokens) << "missing top tokens for beam search";
+      seq->set_beam_candidates(
+          top_tokens_of(i, seq->sampling_param()->num_top_tokens));
+      continue;
+    }
+
+    // add the next token to sequence
+    const int32_t next_token_id =
+        static_cast<int32_t>(tokens[i][0].item<int64_t>());
+    seq->append_token(next_token_id);
+    if (seq->need_logprobs()) {
+      seq->append_logprob(logprobs[i][0].item<float>(),
+                          top_tokens_of(i, seq->num_top_logprobs()));
+    }
+  }
+  CHECK_EQ(output_idx, num_seqs);
+}
+
+void Batch::process_prompt_logprobs_output(
+    const torch::Tensor& prompt_logprobs) {
+  if (prompt_logprobs_.empty()) {
+    return;
+  }
+  CHECK(prompt_logprobs.defined()) << "missing logprobs of prompt tokens";
+  const auto logprobs =
+      prompt_logprobs.to(torch::kCPU, torch::kFloat32).contiguous();
+  const float* data = logprobs.data_ptr<float>();
+  size_t offset = 0;
+  for (const auto& [sequence, start_idx, num_tokens] : prompt_logprobs_) {
+    CHECK_LE(offset + num_tokens, logprobs.numel());
+    sequence->append_prompt_logprobs(start_idx, {data + offset, num_tokens});
+    offset += num_tokens;
+  }
+  CHECK_EQ(offset, logprobs.numel());
+}
+
+void Batch::process_embedding_output(const torch::Tensor& embeddings) {
+  if (embedding_seqs_.empty()) {
+    return;
+  }
+  CHECK(embeddings.defined()) << "missing embeddings for embedding sequences";
+  const auto pooled = embeddings.to(torch::kCPU, torch::kFloat32).contiguous();
+  CHECK_EQ(pooled.size(0), embedding_seqs_.size());
+  const size_t hidden_size = pooled.size(1);
+  const float* data = pooled.data_ptr<float>();
+  for (size_t i = 0; i < embedding_seqs_.size(); ++i) {
+    embedding_seqs_[i]->append_embedding({data + i * hidden_size, hidden_size});
   }
 }
 
@@ -300,8 +482,8 @@ void Batch::process_validate_output(const torch::Tensor& accepted_ids) {
   const int64_t num_seqs = accepted_ids.size(0);
   int64_t output_idx = 0;
   for (auto* seq : sequences_) {
-    if (seq->is_prefill_stage()) {
-      // no sampling for prefill sequences
+    if (seq->is_prefill_stage() || seq->is_embedding()) {
+      // no sampling for prefill and embedding sequences
       continue;
     }
     CHECK_LT(output_idx, num_seqs);
@@ -317,4 +499,68 @@ void Batch::process_validate_output(const torch::Tensor& accepted_ids) {
   CHECK_EQ(output_idx, num_seqs);
 }
 
+bool Batch::support_decode_steps(const Sequence& sequence) {
+  if (sequence.is_prefill_stage() || sequence.num_tokens_to_process() != 1 ||
+      sequence.is_beam() || sequence.is_embedding() ||
+      sequence.need_logprobs()) {
+    return false;
+  }
+  // penalties depend on tokens sampled in earlier steps, which are not
+  // tracked on device
+  const auto* param = sequence.sampling_param();
+  return param->frequency_penalty == 0.0 && param->presence_penalty == 0.0 &&
+         param->repetition_penalty == 1.0 && param->num_top_tokens == 0;
+}
+
+size_t Batch::max_decode_steps(const Sequence& sequence) {
+  const auto* criteria = sequence.stopping_criteria();
+  size_t max_steps = std::numeric_limits<size_t>::max();
+  if (criteria->max_tokens > 0) {
+    const size_t num_generated = sequence.num_generated_tokens();
+    max_steps = criteria->max_tokens > num_generated
+                    ? criteria->max_tokens - num_generated
+                    : 0;
+  }
+  if (criteria->max_context_len > 0) {
+    const size_t num_tokens = sequence.num_tokens();
+    max_steps = std::min(max_steps,
+                         criteria->max_context_len > num_tokens
+                             ? criteria->max_context_len - num_tokens
+                             : 0);
+  }
+  return max_steps;
+}
+
+void Batch::set_num_decode_steps(uint32_t num_decode_steps) {
+  CHECK_GT(num_decode_steps, 0);
+  if (num_decode_steps > 1) {
+    for (const auto* sequence : sequences_) {
+      CHECK(support_decode_steps(*sequence))
+          << "sequence doesn't support several decode steps";
+      CHECK_LE(num_decode_steps, max_decode_steps(*sequence))
+          << "decode steps exceed the token budget of the sequence";
+    }
+  }
+  num_decode_steps_ = num_decode_steps;
+}
+
+void Batch::process_decode_steps_output(const torch::Tensor& next_tokens) {
+  const auto tokens = next_tokens.to(torch::kCPU, torch::kLong).contiguous();
+  CHECK_EQ(tokens.dim(), 2);
+  CHECK_EQ(tokens.size(0), sequences_.size());
+  const int64_t num_steps = tokens.size(1);
+  const int64_t* data = tokens.data_ptr<int64_t>();
+  for (size_t i = 0; i < sequences_.size(); ++i) {
+    auto* seq = sequences_[i];
+    // tokens sampled after the sequence finished are dropped
+    int64_t num_appended = 0;
+    while (num_appended < num_steps && !seq->is_finished()) {
+      seq->append_token(
+          static_cast<int32_t>(data[i * num_steps + num_appended++]));
+    }
+    // all appended tokens but the last one were fed into later steps
+    seq->commit_kv_cache(/*size=*/num_appended - 1);
+  }
+}
+
 }  // namespace llm
@@ -43,6 +43,10 @@ class Batch {
   // index operator
   // TODO: remove this operator once refactoring is done
   Sequence* operator[](size_t i) { return sequences_[i]; }
+  const Sequence* operator[](size_t i) const { return sequences_[i]; }
+
+  // get the token budget of the i-th sequence
+  uint32_t token_budget(size_t i) const { return token_budgets_[i]; }
 
   // prepare inputs for the batch, a stateful operation
   ModelInput prepare_model_input(uint32_t num_decoding_tokens,
@@ -51,9 +55,36 @@ class Batch {
   // process the sample output for each sequence
   void process_sample_output(const SampleOutput& sample_output);
 
+  // accumulate pooled hidden states into embedding sequences
+  // embeddings: [num_embeddings, hidden_size]
+  void process_embedding_output(const torch::Tensor& embeddings);
+
+  // set logprobs of prompt tokens for sequences requesting them
+  // prompt_logprobs: [n_tokens] in the order of prompt_logprob_idxes
+  void process_prompt_logprobs_output(const torch::Tensor& prompt_logprobs);
+
   // process the accepted output for each sequence
   void process_validate_output(const torch::Tensor& accepted_ids);
 
+  // whether the sequence can run several decode steps in one round, with
+  // tokens sampled on device fed into the next step without host processing
+  static bool support_decode_steps(const Sequence& sequence);
+
+  // the max number of decode steps for the sequence in one round, bounded by
+  // the tokens it may still generate and the max context length. tokens of
+  // later steps would be dropped, at positions beyond the model limits.
+  static size_t max_decode_steps(const Sequence& sequence);
+
+  // set the number of decode steps to run back to back for the batch. all
+  // sequences should support decode steps and have kv cache slots for them.
+  void set_num_decode_steps(uint32_t num_decode_steps);
+
+  uint32_t num_decode_steps() const { return num_decode_steps_; }
+
+  // append tokens sampled in decode steps to each sequence until it finishes
+  // next_tokens: [num_seqs, num_decode_steps]
+  void process_decode_steps_output(const torch::Tensor& next_tokens);
+
   // set the engine type for the batch
   void set_engine_type(EngineType engine_type);
 
@@ -67,6 +98,22 @@ class Batch {
 
   // number of used budget for each sequence
   std::vector<uint32_t> budget_used_;
+
+  // the number of decode steps to run back to back
+  uint32_t num_decode_steps_ = 1;
+
+  // embedding sequences in the last prepared model input
+  std::vector<Sequence*> embedding_seqs_;
+
+  // prompt tokens to compute logprobs for in the last prepared model input
+  struct PromptLogprobs {
+    Sequence* sequence = nullptr;
+    // the index of the first prompt token
+    size_t start_idx = 0;
+    // the number of prompt tokens
+    size_t num_tokens = 0;
+  };
+  std::vector<PromptLogprobs> prompt_logprobs_;
 };
 
 }  // namespace llm
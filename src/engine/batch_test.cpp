@@ -5,6 +5,7 @@
 
 #include <cstdint>
 
+#include "fake_engine.h"
 #include "memory/block.h"
 #include "memory/block_allocator.h"
 #include "request/stopping_criteria.h"
@@ -144,4 +145,391 @@ TEST(BatchTest, Basic) {
   // clang-format on
 }
 
+TEST(BatchTest, Embedding) {
+  BlockAllocator allocator(/*n_blocks=*/20, /*block_size=*/4);
+
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 20;
+  Sequence::Options mean_options = options;
+  mean_options.pooling = PoolingType::MEAN;
+  mean_options.normalize_embedding = false;
+  Sequence::Options last_options = options;
+  last_options.pooling = PoolingType::LAST;
+  last_options.normalize_embedding = false;
+
+  // embedding sequence with mean pooling, processed in two chunks
+  Sequence seq1(/*prompt=*/"",
+                /*token_ids=*/{1, 3, 5, 7, 9},
+                absl::Now(),
+                /*capacity=*/6,
+                mean_options);
+  seq1.append_blocks(allocator.allocate(2));
+  EXPECT_FALSE(seq1.can_share_prefix());
+
+  // embedding sequence with last token pooling
+  Sequence seq2(/*prompt=*/"",
+                /*token_ids=*/{2, 4, 6},
+                absl::Now(),
+                /*capacity=*/4,
+                last_options);
+  seq2.append_blocks(allocator.allocate(1));
+  EXPECT_TRUE(seq2.can_share_prefix());
+
+  // generation sequence in prefill phase
+  Sequence seq3(/*prompt=*/"",
+                /*token_ids=*/{1, 2},
+                absl::Now(),
+                /*capacity=*/10,
+                options);
+  seq3.append_blocks(allocator.allocate(1));
+
+  Batch batch;
+  batch.add(&seq1, /*token_budget=*/3);
+  batch.add(&seq2);
+  batch.add(&seq3);
+  ModelInput model_input = batch.prepare_model_input(
+      /*num_decoding_tokens=*/1, /*min_decoding_bach_size=*/0);
+
+  // flatten tokens: seq1 [0, 3), seq2 [3, 6), seq3 [6, 8)
+  const auto& pooling_params = model_input.pooling_params;
+  EXPECT_EQ(pooling_params.num_embeddings, 2);
+  const std::vector<int32_t> token_idxes = {0, 1, 2, 5};
+  EXPECT_TRUE(equal(pooling_params.token_idxes, token_idxes));
+  const std::vector<int32_t> embedding_idxes = {0, 0, 0, 1};
+  EXPECT_TRUE(equal(pooling_params.embedding_idxes, embedding_idxes));
+  // only the generation sequence is sampled
+  const std::vector<int32_t> selected_token_idxes = {7};
+  EXPECT_TRUE(equal(model_input.sampling_params.selected_token_idxes,
+                    selected_token_idxes));
+
+  SampleOutput sample_output;
+  sample_output.next_tokens = torch::tensor({100}, torch::kLong);
+  batch.process_sample_output(sample_output);
+  batch.process_embedding_output(torch::tensor({{1.0f, 2.0f}, {3.0f, 4.0f}}));
+  EXPECT_FALSE(seq1.is_finished());
+  EXPECT_TRUE(seq1.embedding().empty());
+  EXPECT_TRUE(seq2.is_finished());
+  EXPECT_EQ(seq2.finish_reason(), FinishReason::STOP);
+  EXPECT_EQ(seq2.embedding(), std::vector<float>({3.0f, 4.0f}));
+  EXPECT_EQ(seq3.num_generated_tokens(), 1);
+
+  // the rest of the prompt of seq1
+  Batch next_batch(&seq1);
+  model_input = next_batch.prepare_model_input(
+      /*num_decoding_tokens=*/1, /*min_decoding_bach_size=*/0);
+  EXPECT_FALSE(model_input.sampling_params.selected_token_idxes.defined());
+  const std::vector<int32_t> next_token_idxes = {0, 1};
+  EXPECT_TRUE(
+      equal(model_input.pooling_params.token_idxes, next_token_idxes));
+  next_batch.process_embedding_output(torch::tensor({{4.0f, 3.0f}}));
+  EXPECT_TRUE(seq1.is_finished());
+  // mean of hidden states of all 5 tokens
+  const auto embedding = seq1.embedding();
+  ASSERT_EQ(embedding.size(), 2);
+  EXPECT_FLOAT_EQ(embedding[0], 1.0f);
+  EXPECT_FLOAT_EQ(embedding[1], 1.0f);
+}
+
+TEST(BatchTest, BeamSearch) {
+  BlockAllocator allocator(/*n_blocks=*/20, /*block_size=*/4);
+
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 20;
+  options.sampling_param.num_top_tokens = 2;
+  Sequence::Options beam_options = options;
+  beam_options.beam_search = true;
+
+  // two beams sharing the partially filled block
+  Sequence beam1(/*prompt=*/"",
+                 /*token_ids=*/{1, 3, 5, 7, 9},
+                 absl::Now(),
+                 /*capacity=*/10,
+                 beam_options);
+  beam1.append_blocks(allocator.allocate(2));
+  beam1.commit_kv_cache(/*size=*/5);
+  beam1.append_beam_token(/*token_id=*/11, /*logprob=*/-0.5);
+  Sequence beam2 = beam1.fork();
+  beam2.copy_on_write(/*block_idx=*/1, allocator.allocate());
+
+  // generation sequence in decode phase
+  Sequence seq(/*prompt=*/"",
+               /*token_ids=*/{2, 4},
+               absl::Now(),
+               /*capacity=*/10,
+               options);
+  seq.append_blocks(allocator.allocate(1));
+  seq.commit_kv_cache(/*size=*/2);
+  seq.append_token(6);
+
+  Batch batch({&beam1, &beam2, &seq});
+  ModelInput model_input = batch.prepare_model_input(
+      /*num_decoding_tokens=*/1, /*min_decoding_bach_size=*/0);
+
+  // the shared block is copied before the forward
+  const std::vector<int32_t> src_block_ids = {beam1.blocks()[1].id()};
+  const std::vector<int32_t> dst_block_ids = {beam2.blocks()[1].id()};
+  EXPECT_TRUE(equal(model_input.src_block_ids, src_block_ids));
+  EXPECT_TRUE(equal(model_input.dst_block_ids, dst_block_ids));
+  EXPECT_EQ(model_input.sampling_params.num_top_tokens, 2);
+
+  SampleOutput sample_output;
+  sample_output.next_tokens = torch::tensor({100, 101, 102}, torch::kLong);
+  sample_output.top_tokens =
+      torch::tensor({{20, 21}, {22, 23}, {24, 25}}, torch::kLong);
+  sample_output.top_logprobs =
+      torch::tensor({{-0.1f, -0.2f}, {-0.3f, -0.4f}, {-0.5f, -0.6f}});
+  batch.process_sample_output(sample_output);
+
+  // beams are not extended until beam search selects candidates
+  EXPECT_EQ(beam1.num_tokens(), 6);
+  const auto& candidates = beam2.beam_candidates();
+  ASSERT_EQ(candidates.size(), 2);
+  EXPECT_EQ(candidates[0].token_id, 22);
+  EXPECT_FLOAT_EQ(candidates[0].logprob, -0.3f);
+  EXPECT_EQ(candidates[1].token_id, 23);
+  EXPECT_EQ(beam1.beam_candidates()[0].token_id, 20);
+  // other sequences take the sampled tokens
+  EXPECT_EQ(seq.num_generated_tokens(), 2);
+  EXPECT_EQ(seq.token_ids().back(), 102);
+}
+
+TEST(BatchTest, DecodeSteps) {
+  BlockAllocator allocator(/*n_blocks=*/20, /*block_size=*/4);
+
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 20;
+  Sequence::Options eos_options = options;
+  eos_options.stopping_criteria.eos_token_id = 21;
+  Sequence::Options penalty_options = options;
+  penalty_options.sampling_param.frequency_penalty = 0.1;
+
+  // sequences in decode phase with slots reserved for 3 steps
+  Sequence seq1(/*prompt=*/"",
+                /*token_ids=*/{2, 4},
+                absl::Now(),
+                /*capacity=*/10,
+                options);
+  seq1.append_blocks(allocator.allocate(2));
+  seq1.commit_kv_cache(/*size=*/2);
+  seq1.append_token(6);
+  // finishes at the eos token sampled in the second step
+  Sequence seq2(/*prompt=*/"",
+                /*token_ids=*/{2, 4},
+                absl::Now(),
+                /*capacity=*/10,
+                eos_options);
+  seq2.append_blocks(allocator.allocate(2));
+  seq2.commit_kv_cache(/*size=*/2);
+  seq2.append_token(6);
+  EXPECT_TRUE(Batch::support_decode_steps(seq1));
+  EXPECT_TRUE(Batch::support_decode_steps(seq2));
+  EXPECT_EQ(Batch::max_decode_steps(seq1), 19);
+
+  // prefill sequences and sequences with penalties run one step at a time
+  Sequence prefill_seq(/*prompt=*/"",
+                       /*token_ids=*/{1, 3, 5},
+                       absl::Now(),
+                       /*capacity=*/10,
+                       options);
+  EXPECT_FALSE(Batch::support_decode_steps(prefill_seq));
+  Sequence penalty_seq(/*prompt=*/"",
+                       /*token_ids=*/{2, 4},
+                       absl::Now(),
+                       /*capacity=*/10,
+                       penalty_options);
+  penalty_seq.append_blocks(allocator.allocate(1));
+  penalty_seq.commit_kv_cache(/*size=*/2);
+  penalty_seq.append_token(6);
+  EXPECT_FALSE(Batch::support_decode_steps(penalty_seq));
+
+  Batch batch({&seq1, &seq2});
+  batch.set_num_decode_steps(3);
+  ModelInput model_input = batch.prepare_model_input(
+      /*num_decoding_tokens=*/1, /*min_decoding_bach_size=*/0);
+  EXPECT_EQ(model_input.num_decode_steps, 3);
+  const std::vector<int32_t> token_ids = {6, 6};
+  const std::vector<int32_t> positions = {2, 2};
+  EXPECT_TRUE(equal(model_input.token_ids, token_ids));
+  EXPECT_TRUE(equal(model_input.positions, positions));
+
+  batch.process_decode_steps_output(
+      torch::tensor({{10, 11, 12}, {20, 21, 22}}, torch::kLong));
+
+  // sampled tokens fed into later steps are in the kv cache
+  const std::vector<int32_t> seq1_tokens = {2, 4, 6, 10, 11, 12};
+  EXPECT_EQ(seq1.token_ids(), seq1_tokens);
+  EXPECT_EQ(seq1.num_kv_cache_tokens(), 5);
+  EXPECT_FALSE(seq1.is_finished());
+
+  // tokens after the sequence finished are dropped
+  const std::vector<int32_t> seq2_tokens = {2, 4, 6, 20, 21};
+  EXPECT_EQ(seq2.token_ids(), seq2_tokens);
+  EXPECT_EQ(seq2.num_kv_cache_tokens(), 4);
+  EXPECT_TRUE(seq2.is_finished());
+  EXPECT_EQ(seq2.finish_reason(), FinishReason::STOP);
+}
+
+TEST(BatchTest, MaxDecodeSteps) {
+  BlockAllocator allocator(/*n_blocks=*/20, /*block_size=*/4);
+
+  // two more tokens before reaching max tokens
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 3;
+  Sequence seq1(/*prompt=*/"",
+                /*token_ids=*/{2, 4},
+                absl::Now(),
+                /*capacity=*/10,
+                options);
+  seq1.append_blocks(allocator.allocate(2));
+  seq1.commit_kv_cache(/*size=*/2);
+  seq1.append_token(6);
+  EXPECT_EQ(Batch::max_decode_steps(seq1), 2);
+
+  // one more token before reaching the max context length
+  Sequence::Options context_options;
+  context_options.stopping_criteria.max_tokens = 20;
+  context_options.stopping_criteria.max_context_len = 4;
+  Sequence seq2(/*prompt=*/"",
+                /*token_ids=*/{2, 4},
+                absl::Now(),
+                /*capacity=*/10,
+                context_options);
+  seq2.append_blocks(allocator.allocate(2));
+  seq2.commit_kv_cache(/*size=*/2);
+  seq2.append_token(6);
+  EXPECT_EQ(Batch::max_decode_steps(seq2), 1);
+
+  // steps are bounded by the sequence with the least budget
+  Batch batch({&seq1, &seq2});
+  EXPECT_DEATH(batch.set_num_decode_steps(2), "token budget");
+  batch.set_num_decode_steps(1);
+
+  // the sequence reaches max tokens in the last step of the round
+  Batch round({&seq1});
+  round.set_num_decode_steps(2);
+  round.process_decode_steps_output(torch::tensor({{10, 11}}, torch::kLong));
+  const std::vector<int32_t> seq1_tokens = {2, 4, 6, 10, 11};
+  EXPECT_EQ(seq1.token_ids(), seq1_tokens);
+  EXPECT_EQ(seq1.num_kv_cache_tokens(), 4);
+  EXPECT_TRUE(seq1.is_finished());
+  EXPECT_EQ(seq1.finish_reason(), FinishReason::LENGTH);
+  EXPECT_EQ(Batch::max_decode_steps(seq1), 0);
+}
+
+TEST(BatchTest, Logprobs) {
+  BlockAllocator allocator(/*n_blocks=*/20, /*block_size=*/4);
+  FakeTokenizer tokenizer(/*vocab_size=*/1000);
+
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 20;
+  options.sampling_param.num_top_tokens = 2;
+  options.logprobs = true;
+  options.top_logprobs = 1;
+  Sequence::Options prompt_options = options;
+  prompt_options.prompt_logprobs = true;
+
+  // sequence with prompt logprobs, processed in two chunks
+  Sequence seq1(/*prompt=*/"",
+                /*token_ids=*/{1, 3, 5, 7, 9},
+                absl::Now(),
+                /*capacity=*/10,
+                prompt_options);
+  seq1.append_blocks(allocator.allocate(3));
+  EXPECT_FALSE(seq1.can_share_prefix());
+
+  // generation sequence in decode phase
+  Sequence seq2(/*prompt=*/"",
+                /*token_ids=*/{2, 4},
+                absl::Now(),
+                /*capacity=*/10,
+                options);
+  seq2.append_blocks(allocator.allocate(1));
+  seq2.commit_kv_cache(/*size=*/2);
+  seq2.append_token(6);
+  seq2.append_logprob(/*logprob=*/-0.5f, {{/*token_id=*/6, -0.5f}});
+
+  Batch batch;
+  batch.add(&seq1, /*token_budget=*/3);
+  batch.add(&seq2);
+  ModelInput model_input = batch.prepare_model_input(
+      /*num_decoding_tokens=*/1, /*min_decoding_bach_size=*/0);
+
+  // logprobs of the next prompt token for the first chunk of seq1
+  const std::vector<int32_t> prompt_logprob_idxes = {0, 1, 2};
+  EXPECT_TRUE(equal(model_input.prompt_logprob_idxes, prompt_logprob_idxes));
+  const std::vector<int64_t> prompt_logprob_token_ids = {3, 5, 7};
+  EXPECT_TRUE(
+      equal(model_input.prompt_logprob_token_ids, prompt_logprob_token_ids));
+
+  SampleOutput sample_output;
+  sample_output.next_tokens = torch::tensor({100}, torch::kLong);
+  sample_output.logprobs = torch::tensor({-0.1f});
+  sample_output.top_tokens = torch::tensor({{100, 101}}, torch::kLong);
+  sample_output.top_logprobs = torch::tensor({{-0.1f, -2.0f}});
+  batch.process_sample_output(sample_output);
+  batch.process_prompt_logprobs_output(torch::tensor({-1.0f, -2.0f, -3.0f}));
+
+  // only the requested number of alternatives are kept
+  auto logprobs = seq2.decode_delta_logprobs(seq2.token_ids(), tokenizer);
+  ASSERT_EQ(logprobs.size(), 2);
+  EXPECT_EQ(logprobs[1].token_id, 100);
+  EXPECT_EQ(logprobs[1].token, " t0");
+  EXPECT_FLOAT_EQ(logprobs[1].logprob, -0.1f);
+  ASSERT_EQ(logprobs[1].top_logprobs.size(), 1);
+  EXPECT_EQ(logprobs[1].top_logprobs[0].token_id, 100);
+  // decoded logprobs are not returned again
+  EXPECT_TRUE(seq2.decode_delta_logprobs(seq2.token_ids(), tokenizer).empty());
+
+  // not all prompt logprobs are computed yet
+  EXPECT_FALSE(seq1.decode_prompt_logprobs(tokenizer).has_value());
+
+  // the rest of the prompt of seq1
+  Batch next_batch(&seq1);
+  model_input = next_batch.prepare_model_input(
+      /*num_decoding_tokens=*/1, /*min_decoding_bach_size=*/0);
+  const std::vector<int32_t> next_prompt_logprob_idxes = {0};
+  EXPECT_TRUE(
+      equal(model_input.prompt_logprob_idxes, next_prompt_logprob_idxes));
+  sample_output.next_tokens = torch::tensor({200}, torch::kLong);
+  sample_output.top_tokens = torch::tensor({{200, 201}}, torch::kLong);
+  next_batch.process_sample_output(sample_output);
+  next_batch.process_prompt_logprobs_output(torch::tensor({-4.0f}));
+
+  const auto prompt_logprobs = seq1.decode_prompt_logprobs(tokenizer);
+  ASSERT_TRUE(prompt_logprobs.has_value());
+  ASSERT_EQ(prompt_logprobs->size(), 4);
+  for (size_t i = 0; i < prompt_logprobs->size(); ++i) {
+    EXPECT_EQ(prompt_logprobs->at(i).token_id, seq1.token_ids()[i + 1]);
+    EXPECT_FLOAT_EQ(prompt_logprobs->at(i).logprob, -(i + 1.0f));
+  }
+  // prompt logprobs are only returned once
+  EXPECT_FALSE(seq1.decode_prompt_logprobs(tokenizer).has_value());
+  EXPECT_EQ(seq1.decode_delta_logprobs(seq1.token_ids(), tokenizer).size(), 1);
+}
+
+TEST(BatchTest, NormalizeEmbedding) {
+  Sequence::Options options;
+  options.pooling = PoolingType::CLS;
+  Sequence seq(/*prompt=*/"",
+               /*token_ids=*/{1, 2, 3},
+               absl::Now(),
+               /*capacity=*/4,
+               options);
+  seq.append_block({/*id=*/0, /*size=*/4});
+
+  Batch batch(&seq);
+  const auto model_input = batch.prepare_model_input(
+      /*num_decoding_tokens=*/1, /*min_decoding_bach_size=*/0);
+  // only the first token is pooled
+  const std::vector<int32_t> token_idxes = {0};
+  EXPECT_TRUE(equal(model_input.pooling_params.token_idxes, token_idxes));
+
+  batch.process_embedding_output(torch::tensor({{3.0f, 4.0f}}));
+  ASSERT_TRUE(seq.is_finished());
+  const auto embedding = seq.embedding();
+  ASSERT_EQ(embedding.size(), 2);
+  EXPECT_FLOAT_EQ(embedding[0], 0.6f);
+  EXPECT_FLOAT_EQ(embedding[1], 0.8f);
+}
+
 }  // namespace llm
@@ -0,0 +1,298 @@
+#include "disaggregated_engine.h"
+
+#include <folly/futures/Future.h>
+#include <glog/logging.h>
+
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "common/metrics.h"
+#include "common/timer.h"
+
+// metrics
+DEFINE_HISTOGRAM_FAMILY(kv_transfer_latency_seconds,
+                        "Latency of kv cache transfer in seconds");
+DEFINE_HISTOGRAM_INSTANCE(kv_transfer_to_decode_latency_seconds,
+                          kv_transfer_latency_seconds,
+                          {{"direction", "to_decode"}});
+DEFINE_HISTOGRAM_INSTANCE(kv_transfer_to_prefill_latency_seconds,
+                          kv_transfer_latency_seconds,
+                          {{"direction", "to_prefill"}});
+
+DEFINE_COUNTER_FAMILY(kv_transfer_blocks_total,
+                      "Total number of kv cache blocks transferred");
+DEFINE_COUNTER_INSTANCE(kv_transfer_to_decode_blocks_total,
+                        kv_transfer_blocks_total,
+                        {{"direction", "to_decode"}});
+DEFINE_COUNTER_INSTANCE(kv_transfer_to_prefill_blocks_total,
+                        kv_transfer_blocks_total,
+                        {{"direction", "to_prefill"}});
+
+namespace llm {
+namespace {
+
+// a prefill sequence running on the blocks of the prefill side
+struct PrefillSequence {
+  Sequence* sequence = nullptr;
+
+  // the number of tokens in kv cache before the step
+  size_t num_cached_tokens = 0;
+
+  // blocks of the prefill side, holding the blocks of the sequence that are
+  // swapped out during the step
+  std::vector<Block>* blocks = nullptr;
+};
+
+void add_stats(const ExecutionStats& other, ExecutionStats* stats) {
+  stats->prepare_input_seconds += other.prepare_input_seconds;
+  stats->h2d_seconds += other.h2d_seconds;
+  stats->forward_seconds += other.forward_seconds;
+  stats->logits_seconds += other.logits_seconds;
+  stats->sampling_seconds += other.sampling_seconds;
+  stats->process_output_seconds += other.process_output_seconds;
+  stats->num_padding_seqs += other.num_padding_seqs;
+}
+
+}  // namespace
+
+DisaggregatedEngine::DisaggregatedEngine(
+    std::unique_ptr<Engine> prefill_engine,
+    std::unique_ptr<Engine> decode_engine,
+    std::unique_ptr<KVTransferChannel> to_decode_channel,
+    std::unique_ptr<KVTransferChannel> to_prefill_channel)
+    : prefill_engine_(std::move(prefill_engine)),
+      decode_engine_(std::move(decode_engine)),
+      to_decode_channel_(std::move(to_decode_channel)),
+      to_prefill_channel_(std::move(to_prefill_channel)) {
+  CHECK(prefill_engine_ != nullptr && decode_engine_ != nullptr);
+  const auto& prefill_options = prefill_engine_->block_manager()->options();
+  const auto& decode_options = decode_engine_->block_manager()->options();
+  CHECK_EQ(prefill_options.block_size(), decode_options.block_size())
+      << "block size mismatch between prefill and decode engines";
+  CHECK(!prefill_options.enable_prefix_cache())
+      << "prefix cache should be disabled for the prefill engine";
+  if (prefill_options.num_blocks() < decode_options.num_blocks()) {
+    LOG(WARNING) << "The prefill engine has fewer kv cache blocks than the "
+                    "decode engine, prefill sequences may be deferred: "
+                 << prefill_options.num_blocks() << " vs "
+                 << decode_options.num_blocks();
+  }
+
+  if (to_decode_channel_ == nullptr) {
+    to_decode_channel_ = std::make_unique<LocalKVTransferChannel>();
+  }
+  if (to_prefill_channel_ == nullptr) {
+    to_prefill_channel_ = std::make_unique<LocalKVTransferChannel>();
+  }
+}
+
+ModelOutput DisaggregatedEngine::execute_model(Batch& batch) {
+  BlockManager* prefill_block_manager = prefill_engine_->block_manager();
+  const size_t block_size = prefill_block_manager->options().block_size();
+  const size_t max_blocks = prefill_block_manager->options().num_blocks();
+
+  // release blocks of prefills not continued in this step, e.g. preempted or
+  // cancelled ones. their kv cache has been handed over already.
+  std::unordered_set<int64_t> prefill_ids;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    if (batch[i]->is_prefill_stage()) {
+      prefill_ids.insert(batch[i]->id());
+    }
+  }
+  for (auto it = prefill_blocks_.begin(); it != prefill_blocks_.end();) {
+    if (prefill_ids.count(it->first) == 0) {
+      release_prefill_blocks(&it->second);
+      it = prefill_blocks_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  // split the batch and move prefill sequences onto blocks of the prefill side
+  Batch prefill_batch;
+  Batch decode_batch;
+  std::vector<PrefillSequence> prefill_seqs;
+  // cached blocks to copy to the prefill side
+  std::vector<int32_t> src_block_ids;
+  std::vector<int32_t> dst_block_ids;
+  // sequences that didn't get blocks on the prefill side
+  std::vector<std::pair<const Sequence*, Status>> failed_sequences;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    Sequence* sequence = batch[i];
+    if (!sequence->is_prefill_stage()) {
+      decode_batch.add(sequence, batch.token_budget(i));
+      continue;
+    }
+
+    const size_t num_blocks = sequence->num_blocks();
+    const size_t num_cached_tokens = sequence->num_kv_cache_tokens();
+    auto it = prefill_blocks_.find(sequence->id());
+    // the kv cache of the sequence changed since the last chunk
+    if (it != prefill_blocks_.end() &&
+        (it->second.num_tokens != num_cached_tokens ||
+         it->second.blocks.size() > num_blocks)) {
+      release_prefill_blocks(&it->second);
+      prefill_blocks_.erase(it);
+      it = prefill_blocks_.end();
+    }
+    const size_t num_held_blocks =
+        it == prefill_blocks_.end() ? 0 : it->second.blocks.size();
+
+    if (num_blocks > max_blocks) {
+      // never fits into the prefill side
+      std::stringstream ss;
+      ss << "The sequence needs " << num_blocks
+         << " kv cache blocks, more than the " << max_blocks
+         << " blocks of the prefill engine";
+      LOG_EVERY_N(WARNING, 100) << ss.str();
+      failed_sequences.emplace_back(
+          sequence, Status(StatusCode::RESOURCE_EXHAUSTED, ss.str()));
+      continue;
+    }
+    auto blocks =
+        prefill_block_manager->allocate_blocks(num_blocks - num_held_blocks);
+    if (blocks.size() < num_blocks - num_held_blocks) {
+      // taken by other sequences, leave it to the scheduler
+      LOG_EVERY_N(WARNING, 100)
+          << "Not enough kv cache blocks on the prefill engine for sequence "
+          << sequence->id() << ", " << google::COUNTER << " times so far";
+      failed_sequences.emplace_back(
+          sequence,
+          Status(StatusCode::UNAVAILABLE,
+                 "Not enough kv cache blocks on the prefill engine"));
+      if (it != prefill_blocks_.end()) {
+        release_prefill_blocks(&it->second);
+        prefill_blocks_.erase(it);
+      }
+      continue;
+    }
+
+    if (it == prefill_blocks_.end()) {
+      // the first chunk on the prefill side, copy over tokens already in the
+      // kv cache, e.g. from the prefix cache.
+      it = prefill_blocks_.emplace(sequence->id(), PrefillBlocks{}).first;
+      const size_t num_cached_blocks =
+          (num_cached_tokens + block_size - 1) / block_size;
+      const auto seq_blocks = sequence->blocks();
+      for (size_t j = 0; j < num_cached_blocks; ++j) {
+        src_block_ids.push_back(seq_blocks[j].id());
+        dst_block_ids.push_back(blocks[j].id());
+      }
+    }
+    auto& prefill_blocks = it->second.blocks;
+    prefill_blocks.insert(prefill_blocks.end(),
+                          std::make_move_iterator(blocks.begin()),
+                          std::make_move_iterator(blocks.end()));
+
+    sequence->swap_blocks(prefill_blocks);
+    prefill_batch.add(sequence, batch.token_budget(i));
+    prefill_seqs.push_back({sequence, num_cached_tokens, &prefill_blocks});
+  }
+
+  // several decode steps are only scheduled for decode-only batches
+  if (batch.num_decode_steps() > 1) {
+    CHECK(prefill_batch.empty() && failed_sequences.empty())
+        << "decode steps are scheduled for a batch with prefill sequences";
+    decode_batch.set_num_decode_steps(batch.num_decode_steps());
+  }
+
+  // copy cached tokens to the prefill side then run the prefill
+  auto run_prefill = [&]() {
+    if (!src_block_ids.empty()) {
+      AUTO_HISTOGRAM(kv_transfer_to_prefill_latency_seconds);
+      transfer(decode_engine_.get(),
+               src_block_ids,
+               prefill_engine_.get(),
+               dst_block_ids,
+               to_prefill_channel_.get());
+      COUNTER_ADD(kv_transfer_to_prefill_blocks_total, src_block_ids.size());
+    }
+    return prefill_engine_->execute_model(prefill_batch);
+  };
+
+  // run prefill and decode concurrently
+  ModelOutput prefill_output;
+  ModelOutput decode_output;
+  if (!prefill_batch.empty() && !decode_batch.empty()) {
+    folly::Promise<ModelOutput> promise;
+    auto future = promise.getSemiFuture();
+    threadpool_.schedule(
+        [&run_prefill, promise = std::move(promise)]() mutable {
+          promise.setValue(run_prefill());
+        });
+    decode_output = decode_engine_->execute_model(decode_batch);
+    prefill_output = std::move(future).get();
+  } else if (!prefill_batch.empty()) {
+    prefill_output = run_prefill();
+  } else if (!decode_batch.empty()) {
+    decode_output = decode_engine_->execute_model(decode_batch);
+  }
+
+  // hand the kv cache written by the step over to the decode side, which
+  // always holds the whole kv cache of a sequence between steps.
+  src_block_ids.clear();
+  dst_block_ids.clear();
+  for (auto& prefill_seq : prefill_seqs) {
+    Sequence* sequence = prefill_seq.sequence;
+    // swap the blocks of the sequence back, leaving prefill blocks in place
+    sequence->swap_blocks(*prefill_seq.blocks);
+
+    // the first block may have been partially cached before the step
+    const size_t start = prefill_seq.num_cached_tokens / block_size;
+    const size_t end =
+        (sequence->num_kv_cache_tokens() + block_size - 1) / block_size;
+    const auto seq_blocks = sequence->blocks();
+    for (size_t j = start; j < end; ++j) {
+      src_block_ids.push_back((*prefill_seq.blocks)[j].id());
+      dst_block_ids.push_back(seq_blocks[j].id());
+    }
+    prefill_blocks_[sequence->id()].num_tokens =
+        sequence->num_kv_cache_tokens();
+  }
+
+  if (!src_block_ids.empty()) {
+    AUTO_HISTOGRAM(kv_transfer_to_decode_latency_seconds);
+    transfer(prefill_engine_.get(),
+             src_block_ids,
+             decode_engine_.get(),
+             dst_block_ids,
+             to_decode_channel_.get());
+    COUNTER_ADD(kv_transfer_to_decode_blocks_total, src_block_ids.size());
+  }
+
+  // return blocks to the prefill side once the prefill completes, otherwise
+  // keep them for the next chunk.
+  for (auto& prefill_seq : prefill_seqs) {
+    const Sequence* sequence = prefill_seq.sequence;
+    if (!sequence->is_prefill_stage()) {
+      auto it = prefill_blocks_.find(sequence->id());
+      release_prefill_blocks(&it->second);
+      prefill_blocks_.erase(it);
+    }
+  }
+
+  add_stats(prefill_output.stats, &decode_output.stats);
+  decode_output.failed_sequences = std::move(failed_sequences);
+  return decode_output;
+}
+
+void DisaggregatedEngine::release_prefill_blocks(PrefillBlocks* prefill) {
+  prefill_engine_->block_manager()->release_blocks(prefill->blocks);
+  prefill->num_tokens = 0;
+}
+
+void DisaggregatedEngine::transfer(Engine* src,
+                                   const std::vector<int32_t>& src_block_ids,
+                                   Engine* dst,
+                                   const std::vector<int32_t>& dst_block_ids,
+                                   KVTransferChannel* channel) {
+  CHECK_EQ(src_block_ids.size(), dst_block_ids.size());
+  channel->send(src->export_kv_blocks(src_block_ids));
+  dst->import_kv_blocks(dst_block_ids, channel->recv());
+}
+
+}  // namespace llm
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "batch.h"
+#include "common/threadpool.h"
+#include "engine.h"
+#include "kv_transfer.h"
+#include "memory/block_manager.h"
+#include "models/model_args.h"
+#include "tokenizer/tokenizer.h"
+#include "tokenizer/tokenizer_args.h"
+
+namespace llm {
+
+// An experimental engine that runs prefill and decode on two separate
+// engines, each with its own kv cache and block manager, so that long prefills
+// don't stall the decode steps. To the scheduler it is one logical engine
+// whose blocks live on the decode side:
+// * prefill sequences run on the prefill engine with blocks borrowed from the
+// prefill side until the prefill completes. The kv cache written by each
+// chunk is then transferred into the blocks of the sequence on the decode
+// side, so that the decode side always holds the whole kv cache of a sequence
+// between steps, e.g. for preemption or the prefix cache.
+// * decode sequences run on the decode engine, concurrently with the prefill.
+//
+// Tokens already in the kv cache when a sequence first runs on the prefill
+// side, e.g. from the prefix cache, are copied over once, overlapped with the
+// decode step. The prefill blocks of a sequence not continued in a step are
+// returned, and its cached tokens are copied over again if it comes back.
+// Prefill sequences that don't get blocks are not run and returned in the
+// failed sequences of the output, for the scheduler to preempt or fail them.
+class DisaggregatedEngine final : public Engine {
+ public:
+  // both engines should serve the same model with the same block size. the
+  // prefill engine should have prefix cache disabled since its blocks don't
+  // outlive a prefill. the channels are in-process ones if not given.
+  DisaggregatedEngine(
+      std::unique_ptr<Engine> prefill_engine,
+      std::unique_ptr<Engine> decode_engine,
+      std::unique_ptr<KVTransferChannel> to_decode_channel = nullptr,
+      std::unique_ptr<KVTransferChannel> to_prefill_channel = nullptr);
+
+  // N.B. the stats of the model output add up the work of both engines.
+  ModelOutput execute_model(Batch& batch) override;
+
+  const Tokenizer* tokenizer() const override {
+    return decode_engine_->tokenizer();
+  }
+
+  BlockManager* block_manager() const override {
+    return decode_engine_->block_manager();
+  }
+
+  const ModelArgs& model_args() const override {
+    return decode_engine_->model_args();
+  }
+
+  const TokenizerArgs& tokenizer_args() const override {
+    return decode_engine_->tokenizer_args();
+  }
+
+  Engine* prefill_engine() const { return prefill_engine_.get(); }
+
+  Engine* decode_engine() const { return decode_engine_.get(); }
+
+ private:
+  // blocks on the prefill side of a sequence in prefill
+  struct PrefillBlocks {
+    std::vector<Block> blocks;
+
+    // the number of tokens in the kv cache of the blocks
+    size_t num_tokens = 0;
+  };
+
+  // return the blocks to the prefill side
+  void release_prefill_blocks(PrefillBlocks* prefill);
+
+  // copy the kv cache of src_block_ids on src into dst_block_ids on dst
+  static void transfer(Engine* src,
+                       const std::vector<int32_t>& src_block_ids,
+                       Engine* dst,
+                       const std::vector<int32_t>& dst_block_ids,
+                       KVTransferChannel* channel);
+
+  std::unique_ptr<Engine> prefill_engine_;
+
+  std::unique_ptr<Engine> decode_engine_;
+
+  // channel to move kv cache from the prefill side to the decode side
+  std::unique_ptr<KVTransferChannel> to_decode_channel_;
+
+  // channel to move cached tokens from the decode side to the prefill side
+  std::unique_ptr<KVTransferChannel> to_prefill_channel_;
+
+  // thread to run the prefill engine
+  ThreadPool threadpool_;
+
+  // blocks on the prefill side kept across chunks, by sequence id
+  std::unordered_map<int64_t, PrefillBlocks> prefill_blocks_;
+};
+
+}  // namespace llm
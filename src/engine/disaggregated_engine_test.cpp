@@ -0,0 +1,489 @@
+#include "disaggregated_engine.h"
+
+#include <absl/time/clock.h>
+#include <gtest/gtest.h>
+#include <torch/torch.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "fake_engine.h"
+#include "kv_transfer.h"
+#include "llm_engine.h"
+#include "request/sequence.h"
+
+namespace llm {
+
+namespace {
+// A fake engine whose kv cache holds the token id of each slot, to check that
+// the kv cache is in place before each step.
+class TokenCacheEngine final : public Engine {
+ public:
+  explicit TokenCacheEngine(const FakeEngine::Options& options)
+      : engine_(options),
+        cache_(torch::full({static_cast<int64_t>(options.num_blocks()),
+                            static_cast<int64_t>(options.block_size())},
+                           -1,
+                           torch::kInt)) {}
+
+  ModelOutput execute_model(Batch& batch) override {
+    std::vector<size_t> num_cached_tokens;
+    for (size_t i = 0; i < batch.size(); ++i) {
+      const Sequence* sequence = batch[i];
+      const size_t n_cached = sequence->num_kv_cache_tokens();
+      for (size_t pos = 0; pos < n_cached; ++pos) {
+        EXPECT_EQ(slot(*sequence, pos), sequence->token_ids()[pos])
+            << "sequence " << sequence->id() << ", pos " << pos;
+      }
+      num_cached_tokens.push_back(n_cached);
+    }
+
+    auto output = engine_.execute_model(batch);
+
+    // write token ids of processed tokens into the cache
+    for (size_t i = 0; i < batch.size(); ++i) {
+      const Sequence* sequence = batch[i];
+      for (size_t pos = num_cached_tokens[i];
+           pos < sequence->num_kv_cache_tokens();
+           ++pos) {
+        slot(*sequence, pos) = sequence->token_ids()[pos];
+      }
+    }
+    ++num_steps_;
+    return output;
+  }
+
+  std::vector<KVBlocks> export_kv_blocks(
+      const std::vector<int32_t>& block_ids) override {
+    num_exported_blocks_ += block_ids.size();
+    const auto ids = torch::tensor(block_ids, torch::kLong);
+    KVBlocks blocks;
+    blocks.keys.push_back(cache_.index_select(/*dim=*/0, ids));
+    blocks.values.push_back(cache_.index_select(/*dim=*/0, ids));
+    return {blocks};
+  }
+
+  void import_kv_blocks(const std::vector<int32_t>& block_ids,
+                        const std::vector<KVBlocks>& blocks) override {
+    const auto ids = torch::tensor(block_ids, torch::kLong);
+    cache_.index_copy_(/*dim=*/0, ids, blocks[0].keys[0]);
+  }
+
+  const Tokenizer* tokenizer() const override { return engine_.tokenizer(); }
+
+  BlockManager* block_manager() const override {
+    return engine_.block_manager();
+  }
+
+  const ModelArgs& model_args() const override { return engine_.model_args(); }
+
+  const TokenizerArgs& tokenizer_args() const override {
+    return engine_.tokenizer_args();
+  }
+
+  size_t num_steps() const { return num_steps_; }
+
+  size_t num_exported_blocks() const { return num_exported_blocks_; }
+
+ private:
+  int32_t& slot(const Sequence& sequence, size_t pos) {
+    const int64_t block_size = cache_.size(1);
+    const auto blocks = sequence.blocks();
+    return cache_.data_ptr<int32_t>()[blocks[pos / block_size].id() *
+                                          block_size +
+                                      pos % block_size];
+  }
+
+  FakeEngine engine_;
+
+  torch::Tensor cache_;
+
+  size_t num_steps_ = 0;
+
+  size_t num_exported_blocks_ = 0;
+};
+
+std::unique_ptr<Sequence> create_sequence(size_t num_prompt_tokens,
+                                          int32_t first_token_id = 100) {
+  Sequence::Options options;
+  options.stopping_criteria.max_tokens = 3;
+  options.stopping_criteria.ignore_eos = true;
+  std::vector<int32_t> token_ids;
+  for (size_t i = 0; i < num_prompt_tokens; ++i) {
+    token_ids.push_back(static_cast<int32_t>(first_token_id + i) % 32);
+  }
+  return std::make_unique<Sequence>(/*prompt=*/"",
+                                    token_ids,
+                                    absl::Now(),
+                                    /*capacity=*/100,
+                                    options);
+}
+
+// write tensors in float into a safetensors file
+void save_safetensors(
+    const std::string& path,
+    const std::vector<std::pair<std::string, torch::Tensor>>& tensors) {
+  std::stringstream header;
+  header << "{";
+  int64_t offset = 0;
+  for (size_t i = 0; i < tensors.size(); ++i) {
+    const auto& [name, tensor] = tensors[i];
+    const int64_t n_bytes = tensor.numel() * sizeof(float);
+    header << (i == 0 ? "" : ",") << "\"" << name
+           << "\":{\"dtype\":\"F32\",\"shape\":[";
+    for (int64_t d = 0; d < tensor.dim(); ++d) {
+      header << (d == 0 ? "" : ",") << tensor.size(d);
+    }
+    header << "],\"data_offsets\":[" << offset << "," << offset + n_bytes
+           << "]}";
+    offset += n_bytes;
+  }
+  header << "}";
+  std::string header_str = header.str();
+  // the data starts at an aligned offset
+  header_str.resize((header_str.size() + 7) / 8 * 8, ' ');
+
+  std::ofstream file(path, std::ios::binary);
+  const uint64_t header_size = header_str.size();
+  file.write(reinterpret_cast<const char*>(&header_size), sizeof(header_size));
+  file.write(header_str.data(), header_str.size());
+  for (const auto& [name, tensor] : tensors) {
+    const auto data = tensor.to(torch::kFloat).contiguous();
+    file.write(static_cast<const char*>(data.data_ptr()),
+               data.numel() * sizeof(float));
+  }
+}
+
+// write a tiny llama model with random weights into the directory
+void create_tiny_model(const std::string& dir) {
+  const int64_t vocab_size = 32;
+  const int64_t hidden_size = 64;
+  const int64_t intermediate_size = 128;
+  const int64_t n_layers = 2;
+  const int64_t kv_size = 32;  // 2 kv heads with head dim 16
+  std::filesystem::create_directories(dir);
+
+  std::ofstream config(dir + "/config.json");
+  config << R"({"model_type": "llama", "torch_dtype": "float32",
+    "vocab_size": 32, "hidden_size": 64, "intermediate_size": 128,
+    "num_hidden_layers": 2, "num_attention_heads": 4,
+    "num_key_value_heads": 2, "max_position_embeddings": 256,
+    "bos_token_id": 1, "eos_token_id": 2, "rope_theta": 10000.0})";
+  config.close();
+
+  std::ofstream tokenizer(dir + "/tokenizer.json");
+  tokenizer << R"({"version": "1.0", "truncation": null, "padding": null,
+    "added_tokens": [], "normalizer": null,
+    "pre_tokenizer": {"type": "Whitespace"}, "post_processor": null,
+    "decoder": null, "model": {"type": "WordLevel",
+    "vocab": {"[UNK]": 0, "hello": 1, "world": 2}, "unk_token": "[UNK]"}})";
+  tokenizer.close();
+
+  torch::manual_seed(0);
+  const auto randn = [](int64_t rows, int64_t cols) {
+    return torch::randn({rows, cols}) * 0.2;
+  };
+  std::vector<std::pair<std::string, torch::Tensor>> tensors;
+  tensors.emplace_back("model.embed_tokens.weight",
+                       randn(vocab_size, hidden_size));
+  for (int64_t i = 0; i < n_layers; ++i) {
+    const std::string prefix = "model.layers." + std::to_string(i) + ".";
+    tensors.emplace_back(prefix + "self_attn.q_proj.weight",
+                         randn(hidden_size, hidden_size));
+    tensors.emplace_back(prefix + "self_attn.k_proj.weight",
+                         randn(kv_size, hidden_size));
+    tensors.emplace_back(prefix + "self_attn.v_proj.weight",
+                         randn(kv_size, hidden_size));
+    tensors.emplace_back(prefix + "self_attn.o_proj.weight",
+                         randn(hidden_size, hidden_size));
+    tensors.emplace_back(prefix + "mlp.gate_proj.weight",
+                         randn(intermediate_size, hidden_size));
+    tensors.emplace_back(prefix + "mlp.up_proj.weight",
+                         randn(intermediate_size, hidden_size));
+    tensors.emplace_back(prefix + "mlp.down_proj.weight",
+                         randn(hidden_size, intermediate_size));
+    tensors.emplace_back(prefix + "input_layernorm.weight",
+                         torch::ones({hidden_size}));
+    tensors.emplace_back(prefix + "post_attention_layernorm.weight",
+                         torch::ones({hidden_size}));
+  }
+  tensors.emplace_back("model.norm.weight", torch::ones({hidden_size}));
+  tensors.emplace_back("lm_head.weight", randn(vocab_size, hidden_size));
+  save_safetensors(dir + "/model.safetensors", tensors);
+}
+
+std::unique_ptr<LLMEngine> create_cpu_engine(const std::string& model_path,
+                                             int64_t num_blocks,
+                                             bool enable_prefix_cache) {
+  // 2 layers * 2 kv heads * head dim 16 * (key + value) in float
+  const int64_t block_size_in_bytes = 16 * 2 * 2 * 16 * 2 * sizeof(float);
+  LLMEngine::Options options;
+  options.devices({torch::Device(torch::kCPU)})
+      .block_size(16)
+      .max_cache_size(num_blocks * block_size_in_bytes)
+      .max_memory_utilization(1.0)
+      .enable_prefix_cache(enable_prefix_cache)
+      .enable_cuda_graph(false)
+      .max_cpu_activation_cache_size(0)
+      .max_tokens_per_batch(64);
+  auto engine = std::make_unique<LLMEngine>(options);
+  CHECK(engine->init(model_path));
+  CHECK_EQ(engine->block_manager()->options().num_blocks(), num_blocks);
+  return engine;
+}
+
+// run sequences to the end with chunked prefill, returns the failures reported
+// by the engine in each step.
+std::vector<std::pair<const Sequence*, StatusCode>> run_to_completion(
+    Engine* engine,
+    std::vector<std::unique_ptr<Sequence>>& sequences) {
+  std::vector<std::pair<const Sequence*, StatusCode>> failures;
+  std::vector<const Sequence*> failed;
+  BlockManager* block_manager = engine->block_manager();
+  for (int step = 0; step < 50; ++step) {
+    Batch batch;
+    for (auto& sequence : sequences) {
+      if (!sequence->is_finished() &&
+          std::find(failed.begin(), failed.end(), sequence.get()) ==
+              failed.end()) {
+        CHECK(block_manager->allocate_blocks_for(sequence.get()));
+        batch.add(sequence.get(), /*token_budget=*/8);
+      }
+    }
+    if (batch.empty()) {
+      break;
+    }
+    const auto output = engine->execute_model(batch);
+    for (const auto& [sequence, status] : output.failed_sequences) {
+      failures.emplace_back(sequence, status.code());
+      // deferred ones are retried in the next step
+      if (status.code() != StatusCode::UNAVAILABLE) {
+        failed.push_back(sequence);
+      }
+    }
+  }
+  return failures;
+}
+}  // namespace
+
+TEST(DisaggregatedEngineTest, LocalChannel) {
+  LocalKVTransferChannel channel({torch::Device(torch::kCPU)});
+  for (int i = 0; i < 3; ++i) {
+    KVBlocks blocks;
+    blocks.keys.push_back(torch::full({1, 4}, i));
+    blocks.values.push_back(torch::full({1, 4}, i));
+    channel.send({blocks});
+  }
+  // received in the order they were sent
+  for (int i = 0; i < 3; ++i) {
+    const auto blocks = channel.recv();
+    ASSERT_EQ(blocks.size(), 1);
+    EXPECT_TRUE(torch::equal(blocks[0].keys[0], torch::full({1, 4}, i)));
+  }
+}
+
+TEST(DisaggregatedEngineTest, ExecuteModel) {
+  FakeEngine::Options options;
+  options.block_size(4)
+      .num_blocks(64)
+      .step_cost(absl::ZeroDuration())
+      .prefill_token_cost(absl::ZeroDuration())
+      .decode_token_cost(absl::ZeroDuration());
+  FakeEngine::Options prefill_options = options;
+  prefill_options.enable_prefix_cache(false);
+
+  auto prefill = std::make_unique<TokenCacheEngine>(prefill_options);
+  auto decode = std::make_unique<TokenCacheEngine>(options);
+  const auto* prefill_engine = prefill.get();
+  const auto* decode_engine = decode.get();
+  DisaggregatedEngine engine(std::move(prefill), std::move(decode));
+  BlockManager* prefill_block_manager = prefill_engine->block_manager();
+  BlockManager* block_manager = engine.block_manager();
+  EXPECT_EQ(block_manager, decode_engine->block_manager());
+
+  // prompts longer than the token budget are prefilled in chunks
+  std::vector<std::unique_ptr<Sequence>> sequences;
+  sequences.push_back(create_sequence(10));
+  sequences.push_back(create_sequence(6));
+  sequences.push_back(create_sequence(3));
+
+  for (int step = 0; step < 20; ++step) {
+    Batch batch;
+    for (auto& sequence : sequences) {
+      if (!sequence->is_finished()) {
+        ASSERT_TRUE(block_manager->allocate_blocks_for(sequence.get()));
+        batch.add(sequence.get(), /*token_budget=*/4);
+      }
+    }
+    if (batch.empty()) {
+      break;
+    }
+    engine.execute_model(batch);
+  }
+  // prefill blocks are returned once the prefills complete
+  EXPECT_EQ(prefill_block_manager->num_blocks_in_use(), 0);
+
+  for (const auto& sequence : sequences) {
+    EXPECT_TRUE(sequence->is_finished());
+    EXPECT_EQ(sequence->num_generated_tokens(), 3);
+  }
+  // both engines are used
+  EXPECT_GT(prefill_engine->num_steps(), 0);
+  EXPECT_GT(decode_engine->num_steps(), 0);
+}
+
+TEST(DisaggregatedEngineTest, ChunkedPrefillTransfer) {
+  FakeEngine::Options options;
+  options.block_size(4)
+      .num_blocks(64)
+      .step_cost(absl::ZeroDuration())
+      .prefill_token_cost(absl::ZeroDuration())
+      .decode_token_cost(absl::ZeroDuration());
+  FakeEngine::Options prefill_options = options;
+  prefill_options.enable_prefix_cache(false);
+
+  auto prefill = std::make_unique<TokenCacheEngine>(prefill_options);
+  auto decode = std::make_unique<TokenCacheEngine>(options);
+  const auto* prefill_engine = prefill.get();
+  const auto* decode_engine = decode.get();
+  DisaggregatedEngine engine(std::move(prefill), std::move(decode));
+  BlockManager* prefill_block_manager = prefill_engine->block_manager();
+  BlockManager* block_manager = engine.block_manager();
+
+  const auto run = [&](Sequence* sequence) {
+    while (!sequence->is_finished()) {
+      ASSERT_TRUE(block_manager->allocate_blocks_for(sequence));
+      Batch batch;
+      batch.add(sequence, /*token_budget=*/4);
+      engine.execute_model(batch);
+      // blocks of the prefill side are kept until the prefill completes
+      EXPECT_EQ(prefill_block_manager->num_blocks_in_use(),
+                sequence->is_prefill_stage() ? sequence->num_blocks() : 0);
+    }
+  };
+
+  // a prompt of 40 tokens is prefilled in 10 chunks, each handing over the
+  // block it wrote, with nothing copied back to the prefill side.
+  auto sequence = create_sequence(40);
+  run(sequence.get());
+  EXPECT_EQ(prefill_engine->num_exported_blocks(), 10);
+  EXPECT_EQ(decode_engine->num_exported_blocks(), 0);
+
+  // the 10 blocks shared from the prefix cache are copied to the prefill side
+  // only once for the 5 chunks of the rest of a 60 tokens prompt.
+  block_manager->release_blocks_for(sequence.get());
+  auto shared = create_sequence(60);
+  block_manager->allocate_shared_blocks_for(shared.get());
+  ASSERT_EQ(shared->num_kv_cache_tokens(), 40);
+  run(shared.get());
+  EXPECT_EQ(decode_engine->num_exported_blocks(), 10);
+  EXPECT_EQ(prefill_engine->num_exported_blocks(), 10 + 5);
+}
+
+TEST(DisaggregatedEngineTest, DecodeSteps) {
+  FakeEngine::Options options;
+  options.block_size(4)
+      .num_blocks(64)
+      .step_cost(absl::ZeroDuration())
+      .prefill_token_cost(absl::ZeroDuration())
+      .decode_token_cost(absl::ZeroDuration());
+  FakeEngine::Options prefill_options = options;
+  prefill_options.enable_prefix_cache(false);
+
+  auto decode = std::make_unique<TokenCacheEngine>(options);
+  const auto* decode_engine = decode.get();
+  DisaggregatedEngine engine(
+      std::make_unique<TokenCacheEngine>(prefill_options), std::move(decode));
+  BlockManager* block_manager = engine.block_manager();
+
+  auto sequence = create_sequence(3);
+  ASSERT_TRUE(block_manager->allocate_blocks_for(sequence.get()));
+  Batch prefill;
+  prefill.add(sequence.get());
+  engine.execute_model(prefill);
+  EXPECT_EQ(sequence->num_generated_tokens(), 1);
+
+  // the remaining tokens are generated in one round on the decode side
+  const size_t num_steps = decode_engine->num_steps();
+  ASSERT_TRUE(block_manager->allocate_blocks_for(
+      sequence.get(), sequence->num_tokens() + 1));
+  Batch batch;
+  batch.add(sequence.get());
+  batch.set_num_decode_steps(2);
+  engine.execute_model(batch);
+  EXPECT_EQ(decode_engine->num_steps(), num_steps + 1);
+  EXPECT_EQ(sequence->num_generated_tokens(), 3);
+  EXPECT_TRUE(sequence->is_finished());
+}
+
+TEST(DisaggregatedEngineTest, LLMEngines) {
+  const std::string model_path =
+      (std::filesystem::temp_directory_path() / "disaggregated_engine_test")
+          .string();
+  create_tiny_model(model_path);
+
+  // prompts of 20, 12, 5 and 30 tokens take 2, 1, 1 and 2 blocks
+  const auto create_sequences = [] {
+    std::vector<std::unique_ptr<Sequence>> sequences;
+    sequences.push_back(create_sequence(20, /*first_token_id=*/3));
+    sequences.push_back(create_sequence(12, /*first_token_id=*/7));
+    sequences.push_back(create_sequence(5, /*first_token_id=*/11));
+    sequences.push_back(create_sequence(30, /*first_token_id=*/13));
+    return sequences;
+  };
+
+  // greedy outputs of a single engine
+  auto reference = create_cpu_engine(model_path,
+                                     /*num_blocks=*/64,
+                                     /*enable_prefix_cache=*/false);
+  auto expected = create_sequences();
+  EXPECT_TRUE(run_to_completion(reference.get(), expected).empty());
+
+  // the prefill engine only holds 4 blocks per step
+  DisaggregatedEngine engine(
+      create_cpu_engine(model_path,
+                        /*num_blocks=*/4,
+                        /*enable_prefix_cache=*/false),
+      create_cpu_engine(model_path,
+                        /*num_blocks=*/64,
+                        /*enable_prefix_cache=*/true));
+  auto sequences = create_sequences();
+  // a prompt of 70 tokens takes 5 blocks, which never fit
+  sequences.push_back(create_sequence(70));
+  const auto failures = run_to_completion(&engine, sequences);
+
+  // the last prompt is deferred until the others are prefilled
+  size_t num_deferred = 0;
+  size_t num_failed = 0;
+  for (const auto& [sequence, code] : failures) {
+    if (code == StatusCode::UNAVAILABLE) {
+      EXPECT_EQ(sequence, sequences[3].get());
+      ++num_deferred;
+    } else {
+      EXPECT_EQ(code, StatusCode::RESOURCE_EXHAUSTED);
+      EXPECT_EQ(sequence, sequences[4].get());
+      ++num_failed;
+    }
+  }
+  EXPECT_GT(num_deferred, 0);
+  EXPECT_EQ(num_failed, 1);
+  EXPECT_FALSE(sequences[4]->is_finished());
+  EXPECT_EQ(engine.prefill_engine()->block_manager()->num_blocks_in_use(), 0);
+
+  // the kv cache moved across engines gives the same tokens
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_TRUE(sequences[i]->is_finished());
+    EXPECT_EQ(sequences[i]->token_ids(), expected[i]->token_ids())
+        << "sequence " << i;
+  }
+  std::filesystem::remove_all(model_path);
+}
+
+}  // namespace llm
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "batch.h"
+#include "kv_transfer.h"
 #include "memory/block_manager.h"
 #include "models/model_args.h"
 #include "tokenizer/tokenizer.h"
@@ -25,6 +26,17 @@ class Engine {
 
   // return the tokenizer args
   virtual const TokenizerArgs& tokenizer_args() const = 0;
+
+  // copy the kv cache of the given blocks out of the engine, one entry per
+  // worker. engines without kv cache tensors have nothing to export.
+  virtual std::vector<KVBlocks> export_kv_blocks(
+      const std::vector<int32_t>& /*block_ids*/) {
+    return {};
+  }
+
+  // copy the kv cache exported by another engine into the given blocks.
+  virtual void import_kv_blocks(const std::vector<int32_t>& /*block_ids*/,
+                                const std::vector<KVBlocks>& /*blocks*/) {}
 };
 
 }  // namespace llm
@@ -0,0 +1,139 @@
+#include "fake_engine.h"
+
+#include <absl/strings/str_split.h>
+#include <absl/time/clock.h>
+#include <glog/logging.h>
+#include <torch/torch.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llm {
+namespace {
+// token id 0 is reserved for eos
+constexpr int32_t kEosTokenId = 0;
+// the token generated for every step
+constexpr int32_t kGeneratedTokenId = 1;
+// the size of embeddings returned for embedding sequences
+constexpr int64_t kEmbeddingSize = 8;
+}  // namespace
+
+bool FakeTokenizer::encode(const std::string_view& text,
+                           std::vector<int32_t>* ids) const {
+  for (const auto word : absl::StrSplit(text, ' ', absl::SkipWhitespace())) {
+    // map word to token id in [2, vocab_size)
+    const size_t hash = std::hash<std::string_view>{}(word);
+    ids->push_back(static_cast<int32_t>(2 + hash % (vocab_size_ - 2)));
+  }
+  return true;
+}
+
+std::string FakeTokenizer::decode(const Slice<int32_t>& tokens,
+                                  bool /*skip_special_tokens*/) const {
+  std::string text;
+  text.reserve(tokens.size() * 4);
+  for (const int32_t token : tokens) {
+    text += " t";
+    text += std::to_string(token % 100);
+  }
+  return text;
+}
+
+FakeEngine::FakeEngine(const Options& options) : options_(options) {
+  CHECK_GT(options.vocab_size(), 2) << "vocab size is too small";
+  args_.model_type("fake")
+      .vocab_size(options.vocab_size())
+      .max_position_embeddings(options.max_context_len())
+      .eos_token_id(kEosTokenId);
+  tokenizer_args_.tokenizer_type("fake");
+  tokenizer_ = std::make_unique<FakeTokenizer>(options.vocab_size());
+
+  BlockManager::Options block_options;
+  block_options.num_blocks(options.num_blocks())
+      .block_size(options.block_size())
+      .enable_prefix_cache(options.enable_prefix_cache());
+  block_manager_ = std::make_unique<BlockManager>(block_options);
+}
+
+ModelOutput FakeEngine::execute_model(Batch& batch) {
+  const absl::Time start = absl::Now();
+  auto model_inputs = batch.prepare_model_input(/*num_decoding_tokens=*/1,
+                                                /*min_decoding_bach_size=*/0);
+  if (!model_inputs.token_ids.defined()) {
+    // empty input, just return
+    return {};
+  }
+
+  // split the tokens into prefill and decode tokens
+  const auto q_cu_seq_lens = model_inputs.input_params.q_cu_seq_lens;
+  const auto* q_cu = q_cu_seq_lens.data_ptr<int32_t>();
+  int64_t num_prefill_tokens = 0;
+  int64_t num_decode_tokens = 0;
+  for (int64_t i = 1; i < q_cu_seq_lens.numel(); ++i) {
+    const int32_t q_len = q_cu[i] - q_cu[i - 1];
+    if (q_len == 1) {
+      ++num_decode_tokens;
+    } else {
+      num_prefill_tokens += q_len;
+    }
+  }
+
+  // generate one token for each sequence that finished prefill
+  int64_t num_seqs = 0;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    if (!batch[i]->is_prefill_stage() && !batch[i]->is_embedding()) {
+      ++num_seqs;
+    }
+  }
+  ModelOutput output;
+  const int64_t num_decode_steps = model_inputs.num_decode_steps;
+  if (num_decode_steps > 1) {
+    output.decode_tokens = torch::full(
+        {num_seqs, num_decode_steps}, kGeneratedTokenId, torch::kLong);
+  } else if (num_seqs > 0) {
+    output.sample_output.next_tokens =
+        torch::full({num_seqs}, kGeneratedTokenId, torch::kLong);
+    // the generated token is the top 1 token
+    output.sample_output.logprobs = torch::full({num_seqs}, -1.0f);
+    const int64_t k = model_inputs.sampling_params.num_top_tokens;
+    if (k > 0) {
+      // top tokens are kGeneratedTokenId, kGeneratedTokenId + 1, ... with
+      // decreasing logprobs
+      const auto ranks = torch::arange(k, torch::kLong);
+      auto& sample_output = output.sample_output;
+      sample_output.top_tokens =
+          (ranks + kGeneratedTokenId).unsqueeze(0).repeat({num_seqs, 1});
+      sample_output.top_logprobs =
+          (-(ranks + 1)).to(torch::kFloat).unsqueeze(0).repeat({num_seqs, 1});
+    }
+  }
+  if (model_inputs.prompt_logprob_idxes.defined()) {
+    output.prompt_logprobs =
+        torch::full({model_inputs.prompt_logprob_idxes.numel()}, -1.0f);
+  }
+  const int64_t num_embeddings = model_inputs.pooling_params.num_embeddings;
+  if (num_embeddings > 0) {
+    output.embeddings = torch::ones({num_embeddings, kEmbeddingSize});
+  }
+
+  // simulate the cost of model execution
+  // the fixed cost is paid once for all decode steps
+  const absl::Duration cost =
+      options_.step_cost() +
+      options_.prefill_token_cost() * num_prefill_tokens +
+      options_.decode_token_cost() * num_decode_tokens * num_decode_steps;
+  absl::SleepFor(cost - (absl::Now() - start));
+
+  if (output.decode_tokens.defined()) {
+    batch.process_decode_steps_output(output.decode_tokens);
+  } else {
+    batch.process_sample_output(output.sample_output);
+  }
+  batch.process_prompt_logprobs_output(output.prompt_logprobs);
+  batch.process_embedding_output(output.embeddings);
+  return output;
+}
+
+}  // namespace llm
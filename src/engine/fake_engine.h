@@ -0,0 +1,117 @@
+#pragma once
+
+#include <absl/time/time.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "common/macros.h"
+#include "engine.h"
+#include "memory/block_manager.h"
+#include "models/model_args.h"
+#include "tokenizer/tokenizer.h"
+#include "tokenizer/tokenizer_args.h"
+
+namespace llm {
+
+// A tokenizer that maps each whitespace separated word to one token.
+class FakeTokenizer final : public Tokenizer {
+ public:
+  explicit FakeTokenizer(size_t vocab_size)
+      : FakeTokenizer(vocab_size, std::make_shared<std::atomic<int64_t>>(0)) {}
+
+  bool encode(const std::string_view& text,
+              std::vector<int32_t>* ids) const override;
+
+  bool batch_encode(const std::vector<std::string_view>& texts,
+                    std::vector<std::vector<int32_t>>* ids) const override {
+    num_batch_encodes_->fetch_add(1, std::memory_order_relaxed);
+    return Tokenizer::batch_encode(texts, ids);
+  }
+
+  std::string decode(const Slice<int32_t>& tokens,
+                     bool skip_special_tokens) const override;
+
+  size_t vocab_size() const override { return vocab_size_; }
+
+  std::unique_ptr<Tokenizer> clone() const override {
+    return std::unique_ptr<Tokenizer>(
+        new FakeTokenizer(vocab_size_, num_batch_encodes_));
+  }
+
+  // the number of batch_encode calls, shared with clones
+  int64_t num_batch_encodes() const {
+    return num_batch_encodes_->load(std::memory_order_relaxed);
+  }
+
+ private:
+  FakeTokenizer(size_t vocab_size,
+                std::shared_ptr<std::atomic<int64_t>> num_batch_encodes)
+      : vocab_size_(vocab_size),
+        num_batch_encodes_(std::move(num_batch_encodes)) {}
+
+  size_t vocab_size_;
+
+  std::shared_ptr<std::atomic<int64_t>> num_batch_encodes_;
+};
+
+// An engine without a model for benchmarking the scheduler and the serving
+// stack. Batches go through the real input preparation and kv cache
+// bookkeeping, while the model execution is replaced by a sleep with a
+// configurable cost. It always generates the same non-eos token.
+class FakeEngine final : public Engine {
+ public:
+  struct Options {
+    // the number of slots per block
+    DEFINE_ARG(int32_t, block_size) = 16;
+
+    // the number of kv cache blocks
+    DEFINE_ARG(uint32_t, num_blocks) = 8192;
+
+    // enable prefix cache
+    DEFINE_ARG(bool, enable_prefix_cache) = true;
+
+    // the vocabulary size of the fake tokenizer
+    DEFINE_ARG(int64_t, vocab_size) = 32000;
+
+    // the max context length
+    DEFINE_ARG(int64_t, max_context_len) = 8192;
+
+    // fixed cost for each step
+    DEFINE_ARG(absl::Duration, step_cost) = absl::Microseconds(2000);
+
+    // cost for each prefill token in the batch
+    DEFINE_ARG(absl::Duration, prefill_token_cost) = absl::Microseconds(50);
+
+    // cost for each decode sequence in the batch
+    DEFINE_ARG(absl::Duration, decode_token_cost) = absl::Microseconds(100);
+  };
+
+  explicit FakeEngine(const Options& options);
+
+  ModelOutput execute_model(Batch& batch) override;
+
+  const Tokenizer* tokenizer() const override { return tokenizer_.get(); }
+
+  BlockManager* block_manager() const override { return block_manager_.get(); }
+
+  const ModelArgs& model_args() const override { return args_; }
+
+  const TokenizerArgs& tokenizer_args() const override {
+    return tokenizer_args_;
+  }
+
+ private:
+  const Options options_;
+
+  ModelArgs args_;
+
+  TokenizerArgs tokenizer_args_;
+
+  std::unique_ptr<Tokenizer> tokenizer_;
+
+  std::unique_ptr<BlockManager> block_manager_;
+};
+
+}  // namespace llm
@@ -0,0 +1,27 @@
+#include "kv_transfer.h"
+
+#include <glog/logging.h>
+#include <torch/torch.h>
+
+#include <vector>
+
+namespace llm {
+
+void LocalKVTransferChannel::send(std::vector<KVBlocks> blocks) {
+  if (!devices_.empty()) {
+    CHECK_EQ(blocks.size(), devices_.size())
+        << "the number of workers mismatch between two sides";
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      const auto& device = devices_[i];
+      for (auto& key : blocks[i].keys) {
+        key = key.to(device);
+      }
+      for (auto& value : blocks[i].values) {
+        value = value.to(device);
+      }
+    }
+  }
+  queue_.push(std::move(blocks));
+}
+
+}  // namespace llm
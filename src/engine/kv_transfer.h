@@ -0,0 +1,55 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <optional>
+#include <vector>
+
+#include "common/concurrent_queue.h"
+
+namespace llm {
+
+// A copy of the kv cache of a list of blocks held by one worker.
+struct KVBlocks {
+  // one tensor per layer, [num_blocks, block_size, num_kv_heads, head_dim]
+  std::vector<torch::Tensor> keys;
+  std::vector<torch::Tensor> values;
+};
+
+// A one-way channel to move kv cache blocks from one engine to another, e.g.
+// from the prefill engine to the decode engine in disaggregated serving. Each
+// message carries the blocks of all workers of the sending engine, ordered by
+// rank. Transports across processes or hosts can be plugged in by
+// implementing this interface.
+class KVTransferChannel {
+ public:
+  virtual ~KVTransferChannel() = default;
+
+  // send kv blocks to the receiving side
+  virtual void send(std::vector<KVBlocks> blocks) = 0;
+
+  // receive kv blocks in the order they were sent, blocking call
+  virtual std::vector<KVBlocks> recv() = 0;
+};
+
+// A channel between two engines in the same process. Blocks are handed over
+// as tensors, and moved to the devices of the receiving workers if given.
+class LocalKVTransferChannel final : public KVTransferChannel {
+ public:
+  LocalKVTransferChannel() = default;
+
+  // devices: the device of each receiving worker, ordered by rank
+  explicit LocalKVTransferChannel(std::vector<torch::Device> devices)
+      : devices_(std::move(devices)) {}
+
+  void send(std::vector<KVBlocks> blocks) override;
+
+  std::vector<KVBlocks> recv() override { return queue_.pop(); }
+
+ private:
+  std::vector<torch::Device> devices_;
+
+  ConcurrentQueue<std::vector<KVBlocks>> queue_;
+};
+
+}  // namespace llm
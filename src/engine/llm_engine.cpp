@@ -9,13 +9,15 @@
 
 #include "common/metrics.h"
 #include "common/pretty_print.h"
+#include "memory/activation_arena.h"
+#include "memory/host_memory.h"
 #include "model_loader/model_loader.h"
 #include "model_parallel/parallel_args.h"
 #include "models/model_args.h"
 #include "worker.h"
 
-DEFINE_COUNTER(prepare_input_latency_seconds,
-               "Latency of preparing input in seconds");
+DEFINE_LATENCY_HISTOGRAM(prepare_input_latency_seconds,
+                         "Latency of preparing input in seconds");
 
 namespace llm {
 namespace {
@@ -83,8 +85,13 @@ LLMEngine::LLMEngine(const Options& options) : options_(options) {
     options_.enable_cuda_graph(false);
   }
 
-  // sort cuda graph batch sizes
-  if (options_.enable_cuda_graph()) {
+  // cache activations of forward passes on cpu, the arena is installed once
+  // the weights and kv cache are allocated, see warmup_model().
+  enable_activation_arena_ = device_type == torch::kCPU &&
+                             options_.max_cpu_activation_cache_size() > 0;
+
+  // sort batch sizes of cuda graphs, or of shape buckets on cpu
+  if (options_.enable_cuda_graph() || enable_activation_arena_) {
     batch_sizes_ = options_.cuda_graph_batch_sizes().value_or(
         kDefaultBatchSizesForCudaGraph);
     std::sort(batch_sizes_.begin(), batch_sizes_.end());
@@ -95,11 +102,14 @@ LLMEngine::LLMEngine(const Options& options) : options_(options) {
   runner_options.block_size(options_.block_size())
       .num_decoding_tokens(options_.num_decoding_tokens())
       .cuda_graph_max_seq_len(options_.cuda_graph_max_seq_len())
-      .cuda_graph_batch_sizes(batch_sizes_);
+      .cuda_graph_batch_sizes(batch_sizes_)
+      .warmup_cpu_buckets(enable_activation_arena_);
   for (size_t i = 0; i < devices.size(); ++i) {
     const int32_t rank = static_cast<int32_t>(i);
     ProcessGroup* pg = world_size > 1 ? process_groups_[i].get() : nullptr;
     ParallelArgs parallel_args(rank, world_size, pg);
+    parallel_args.gather_logits(world_size == 1 ||
+                                !options_.enable_vocab_parallel_sampling());
     workers_.emplace_back(
         std::make_unique<Worker>(parallel_args, devices[i], runner_options));
   }
@@ -121,7 +131,7 @@ bool LLMEngine::init(const std::string& model_weights_path) {
     LOG(ERROR) << "Failed to initialize kv cache";
     return false;
   }
-  if (!capture_cuda_graphs()) {
+  if (!warmup_model()) {
     LOG(ERROR) << "Failed to warmup model.";
     return false;
   }
@@ -223,8 +233,17 @@ bool LLMEngine::init_model(const std::string& model_weights_path) {
   return true;
 }
 
-bool LLMEngine::capture_cuda_graphs() {
-  if (!options_.enable_cuda_graph()) {
+bool LLMEngine::warmup_model() {
+  if (enable_activation_arena_) {
+    // installed after loading, so that neither the weights nor temporaries
+    // of loading them are allocated from the arena.
+    ActivationArena::Options arena_options;
+    arena_options.max_cached_bytes(options_.max_cpu_activation_cache_size());
+    ActivationArena::install(arena_options);
+  }
+
+  // capture cuda graphs, or warm up the buffers of shape buckets on cpu
+  if (!options_.enable_cuda_graph() && !enable_activation_arena_) {
     return true;
   }
 
@@ -233,7 +252,7 @@ bool LLMEngine::capture_cuda_graphs() {
     return workers_[0]->capture_cuda_graphs();
   }
 
-  LOG(WARNING)
+  LOG_IF(WARNING, options_.enable_cuda_graph())
       << "It is a known issue "
          "(https://github.com/vectorch-ai/ScaleLLM/issues/131) that CUDA "
          "graph capture may occasionally become stuck when multiple workers "
@@ -262,11 +281,7 @@ int64_t LLMEngine::profile_memory_for_kv_cache() {
 
   const auto& device = workers_[0]->device();
   if (device.is_cpu()) {
-    // use max memory cache size for CPU
-    LOG(INFO) << "Initializing CPU cache with max cache size: "
-              << readable_size(max_cache_size);
-    // TODO: add CPU memory profiling
-    return max_cache_size;
+    return profile_host_memory_for_kv_cache();
   }
   CHECK(device.is_cuda()) << "Only support CPU and CUDA device for now.";
 
@@ -309,6 +324,74 @@ int64_t LLMEngine::profile_memory_for_kv_cache() {
   return std::max(smallest_available_memory, int64_t(0));
 }
 
+int64_t LLMEngine::profile_host_memory_for_kv_cache() {
+  const int64_t max_cache_size = options_.max_cache_size();
+  const double max_memory_utilization = options_.max_memory_utilization();
+
+  // memory before running the model, activations are subtracted from it
+  const auto info = memory::host_memory_info();
+  LOG(INFO) << "Host available memory: " << readable_size(info.available)
+            << ", total memory: " << readable_size(info.total)
+            << ", cgroup limit: " << readable_size(info.cgroup_limit)
+            << ", numa nodes: " << info.numa_nodes;
+
+  // profile the activations of a prompt as long as the largest batch
+  int64_t n_tokens = options_.max_tokens_per_batch();
+  if (args_.max_position_embeddings() > 0) {
+    n_tokens = std::min(n_tokens, args_.max_position_embeddings());
+  }
+  const int32_t block_size = options_.block_size();
+  const int64_t n_blocks = (n_tokens + block_size - 1) / block_size;
+  const std::vector<int64_t> kv_cache_shape = {
+      n_blocks, block_size, n_local_kv_heads_, head_dim_};
+
+  // workers share this process, so the peak rss of the process is measured
+  // once around all of them.
+  if (!memory::reset_peak_rss()) {
+    LOG(WARNING) << "Failed to reset the peak rss, the activation memory is "
+                    "measured from the start of the process";
+  }
+  const int64_t baseline = memory::current_rss();
+  std::vector<folly::SemiFuture<bool>> futures;
+  futures.reserve(workers_.size());
+  for (auto& worker : workers_) {
+    futures.push_back(worker->run_profiling_prompt_async(kv_cache_shape));
+  }
+  auto results = folly::collectAll(futures).get();
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (!results[i].hasValue() || !results[i].value()) {
+      LOG(ERROR) << "Failed to run the profiling prompt for worker: " << i;
+    }
+  }
+  // exclude the temporary kv caches of the workers
+  const int64_t kv_cache_bytes = static_cast<int64_t>(workers_.size()) *
+                                 n_blocks * block_size *
+                                 kv_cache_slot_size_in_bytes();
+  int64_t activation_memory =
+      std::max(memory::peak_rss() - baseline - kv_cache_bytes, int64_t(0));
+  // buffers cached by the activation arena are reused across steps
+  if (options_.max_cpu_activation_cache_size() > 0) {
+    activation_memory = std::max(activation_memory,
+                                 options_.max_cpu_activation_cache_size());
+  }
+
+  int64_t available_memory = info.available - activation_memory;
+  if (max_memory_utilization < 1.0) {
+    available_memory -= info.total * (1.0 - max_memory_utilization);
+  }
+  // each worker allocates its own cache
+  available_memory /= static_cast<int64_t>(workers_.size());
+  if (max_cache_size > 0) {
+    available_memory = std::min(available_memory, max_cache_size);
+  }
+  LOG(INFO) << "Activation memory for " << n_tokens
+            << " tokens: " << readable_size(activation_memory)
+            << ", using max_memory_utilization: " << max_memory_utilization
+            << ", max_cache_size: " << readable_size(max_cache_size)
+            << ", cpu cache size: " << readable_size(available_memory);
+  return std::max(available_memory, int64_t(0));
+}
+
 bool LLMEngine::init_kv_cache(int64_t n_blocks) {
   CHECK_GT(n_blocks, 0) << "no memory for kv cache";
   const int32_t block_size = options_.block_size();
@@ -349,7 +432,7 @@ bool LLMEngine::init_kv_cache(int64_t n_blocks) {
 ModelOutput LLMEngine::execute_model(Batch& batch) {
   // prepare inputs for workers
   uint32_t adjusted_batch_size = 0;
-  if (options_.enable_cuda_graph()) {
+  if (!batch_sizes_.empty()) {
     // find the closest batch size in the captured graph
     const auto it = std::lower_bound(
         batch_sizes_.begin(), batch_sizes_.end(), batch.size());
@@ -361,32 +444,68 @@ ModelOutput LLMEngine::execute_model(Batch& batch) {
   Timer timer;
   auto model_inputs = batch.prepare_model_input(options_.num_decoding_tokens(),
                                                 adjusted_batch_size);
-  COUNTER_ADD(prepare_input_latency_seconds, timer.elapsed_seconds());
+  const double prepare_input_seconds = timer.elapsed_seconds();
+  HISTOGRAM_OBSERVE(prepare_input_latency_seconds, prepare_input_seconds);
 
   if (!model_inputs.token_ids.defined()) {
     // empty input, just return
     return {};
   }
 
+  ModelOutput model_output;
   if (workers_.size() == 1) {
     // only one worker, call blocking forward
-    auto model_output = workers_[0]->execute_model(model_inputs);
+    model_output = workers_[0]->execute_model(model_inputs);
+  } else {
+    // multiple workers, call async forward
+    std::vector<folly::SemiFuture<ModelOutput>> futures;
+    futures.reserve(workers_.size());
+    for (auto& worker : workers_) {
+      futures.push_back(worker->execute_model_async(model_inputs));
+    }
+    // wait for the all future to complete
+    auto results = folly::collectAll(futures).get();
+    // return the result from the first worker
+    model_output = results.front().value();
+  }
+
+  timer.reset();
+  if (model_output.decode_tokens.defined()) {
+    batch.process_decode_steps_output(model_output.decode_tokens);
+  } else {
     batch.process_sample_output(model_output.sample_output);
-    return model_output;
   }
+  batch.process_prompt_logprobs_output(model_output.prompt_logprobs);
+  batch.process_embedding_output(model_output.embeddings);
+
+  auto& stats = model_output.stats;
+  stats.prepare_input_seconds = prepare_input_seconds;
+  stats.process_output_seconds = timer.elapsed_seconds();
+  const auto& input_params = model_inputs.input_params;
+  stats.num_padding_seqs = static_cast<uint32_t>(
+      std::max<int64_t>(input_params.q_cu_seq_lens.numel() - 1 -
+                            input_params.num_sequences,
+                        0));
+  return model_output;
+}
 
-  // multiple workers, call async forward
-  std::vector<folly::SemiFuture<ModelOutput>> futures;
-  futures.reserve(workers_.size());
+std::vector<KVBlocks> LLMEngine::export_kv_blocks(
+    const std::vector<int32_t>& block_ids) {
+  std::vector<KVBlocks> blocks;
+  blocks.reserve(workers_.size());
   for (auto& worker : workers_) {
-    futures.push_back(worker->execute_model_async(model_inputs));
+    blocks.push_back(worker->export_kv_blocks(block_ids));
+  }
+  return blocks;
+}
+
+void LLMEngine::import_kv_blocks(const std::vector<int32_t>& block_ids,
+                                 const std::vector<KVBlocks>& blocks) {
+  CHECK_EQ(blocks.size(), workers_.size())
+      << "the number of workers mismatch between two engines";
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    workers_[i]->import_kv_blocks(block_ids, blocks[i]);
   }
-  // wait for the all future to complete
-  auto results = folly::collectAll(futures).get();
-  // return the result from the first worker
-  auto model_output = results.front().value();
-  batch.process_sample_output(model_output.sample_output);
-  return model_output;
 }
 
 int64_t LLMEngine::kv_cache_slot_size_in_bytes() const {
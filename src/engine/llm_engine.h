@@ -56,6 +56,19 @@ class LLMEngine : public Engine {
 
     // batch sizes to capture cuda graphs
     DEFINE_ARG(std::optional<std::vector<uint32_t>>, cuda_graph_batch_sizes);
+
+    // sample from logits sharded along the vocab across devices instead of
+    // gathering the full logits on each device.
+    DEFINE_ARG(bool, enable_vocab_parallel_sampling) = false;
+
+    // the max bytes of activation buffers cached on cpu, decode batches are
+    // padded into the cuda graph batch sizes to reuse the buffers of their
+    // bucket. 0 to disable.
+    DEFINE_ARG(int64_t, max_cpu_activation_cache_size) = int64_t(2) << 30;
+
+    // the max number of tokens per batch, used to profile the memory of
+    // activations on cpu.
+    DEFINE_ARG(int32_t, max_tokens_per_batch) = 512;
   };
 
   // create an engine with the given devices
@@ -76,6 +89,12 @@ class LLMEngine : public Engine {
     return tokenizer_args_;
   }
 
+  std::vector<KVBlocks> export_kv_blocks(
+      const std::vector<int32_t>& block_ids) override;
+
+  void import_kv_blocks(const std::vector<int32_t>& block_ids,
+                        const std::vector<KVBlocks>& blocks) override;
+
   const QuantArgs& quant_args() const { return quant_args_; }
 
   const Options& options() const { return options_; }
@@ -87,11 +106,17 @@ class LLMEngine : public Engine {
 
   bool init_kv_cache(int64_t n_blocks);
 
-  bool capture_cuda_graphs();
+  // capture cuda graphs, or install the activation arena and warm up its
+  // buffers on cpu. called after the kv cache is initialized.
+  bool warmup_model();
 
   // returns the memory size for the kv cache
   int64_t profile_memory_for_kv_cache();
 
+  // returns the memory size for the kv cache on cpu, the memory of the host
+  // left after the activations of the largest batch.
+  int64_t profile_host_memory_for_kv_cache();
+
   // returns the memory size in bytes for each kv cache slot
   int64_t kv_cache_slot_size_in_bytes() const;
 
@@ -123,6 +148,9 @@ class LLMEngine : public Engine {
   // batch sizes to capture cuda graphs
   std::vector<uint32_t> batch_sizes_;
 
+  // whether activations of forward passes are cached on cpu
+  bool enable_activation_arena_ = false;
+
   // tokenizer
   std::unique_ptr<Tokenizer> tokenizer_;
 
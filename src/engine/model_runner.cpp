@@ -26,6 +26,9 @@ namespace llm {
 void ModelRunner::capture_cuda_graphs(std::vector<KVCache>& kv_cache) {
   if (!device_.is_cuda()) {
     // only capture CUDA graphs
+    if (options_.warmup_cpu_buckets()) {
+      warmup_cpu_buckets(kv_cache);
+    }
     return;
   }
   if (options_.cuda_graph_batch_sizes().empty()) {
@@ -109,6 +112,48 @@ void ModelRunner::capture_cuda_graphs(std::vector<KVCache>& kv_cache) {
   LOG(INFO) << "Finished capturing CUDA graphs";
 }
 
+void ModelRunner::warmup_cpu_buckets(std::vector<KVCache>& kv_cache) {
+  if (options_.cuda_graph_batch_sizes().empty()) {
+    return;
+  }
+  // the largest bucket first, smaller ones mostly reuse its buffers
+  std::vector<uint32_t> sorted_batch_sizes = options_.cuda_graph_batch_sizes();
+  std::sort(
+      sorted_batch_sizes.begin(), sorted_batch_sizes.end(), std::greater<>());
+
+  const int64_t num_decoding_tokens = options_.num_decoding_tokens();
+  const int64_t max_seq_len = options_.cuda_graph_max_seq_len();
+  const int64_t block_size = options_.block_size();
+  const int64_t block_table_len = (max_seq_len + block_size - 1) / block_size;
+  auto options = torch::dtype(torch::kInt32).device(device_);
+
+  LOG(INFO) << "Warming up cpu activation buffers, batch sizes: "
+            << sorted_batch_sizes;
+  for (const auto batch_size : sorted_batch_sizes) {
+    const int64_t n_tokens = num_decoding_tokens * batch_size;
+    // all sequences read block 0 and write into its first slot, which is
+    // overwritten by real sequences later
+    InputParameters params;
+    params.empty_kv_cache = false;
+    params.num_sequences = static_cast<int32_t>(batch_size);
+    params.q_max_seq_len = static_cast<int32_t>(num_decoding_tokens);
+    params.kv_max_seq_len = static_cast<int32_t>(max_seq_len);
+    params.q_cu_seq_lens = torch::arange(
+        /*start=*/0, /*end=*/n_tokens + 1, num_decoding_tokens, options);
+    params.kv_cu_seq_lens = torch::arange(/*start=*/0,
+                                          /*end=*/batch_size * max_seq_len + 1,
+                                          max_seq_len,
+                                          options);
+    params.new_cache_slots = torch::zeros({n_tokens}, options);
+    params.block_tables = torch::zeros({batch_size, block_table_len}, options);
+
+    const auto token_ids = torch::zeros({n_tokens}, options);
+    const auto positions = torch::zeros({n_tokens}, options);
+    model_->forward(token_ids, positions, kv_cache, params);
+  }
+  LOG(INFO) << "Finished warming up cpu activation buffers";
+}
+
 // tokens: [num_tokens]
 // positions: [num_tokens] token pos in the sequence
 // returns: [num_tokens, hidden_size]
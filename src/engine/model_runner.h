@@ -29,6 +29,10 @@ class ModelRunner final {
 
     // batch sizes to capture cuda graphs
     DEFINE_ARG(std::vector<uint32_t>, cuda_graph_batch_sizes);
+
+    // run a decode step of each batch size on cpu instead, to warm up the
+    // activation buffers cached for the shape buckets
+    DEFINE_ARG(bool, warmup_cpu_buckets) = false;
   };
 
   ModelRunner(CausalLM* model,
@@ -48,6 +52,9 @@ class ModelRunner final {
                         const InputParameters& params);
 
  private:
+  // run a decode step of each batch size at the max sequence length
+  void warmup_cpu_buckets(std::vector<KVCache>& kv_cache);
+
   // model, do not own
   CausalLM* model_;
 
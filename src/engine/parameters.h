@@ -2,11 +2,39 @@
 
 #include <torch/torch.h>
 
+#include <utility>
+#include <vector>
+
+#include "common/tensor_helper.h"
 #include "models/parameters.h"
+#include "request/status.h"
 #include "sampling/parameters.h"
 
 namespace llm {
 
+class Sequence;
+
+// parameters to pool hidden states of embedding sequences. each pooled token
+// is added into the embedding of its sequence.
+struct PoolingParameters {
+  PoolingParameters to(const torch::Device& device) const {
+    PoolingParameters params;
+    params.token_idxes = safe_to(token_idxes, device);
+    params.embedding_idxes = safe_to(embedding_idxes, device);
+    params.num_embeddings = num_embeddings;
+    return params;
+  }
+
+  // IntTensor: [n_pooled_tokens] indices of pooled tokens in flatten tokens
+  torch::Tensor token_idxes;
+
+  // IntTensor: [n_pooled_tokens] index of the embedding for each pooled token
+  torch::Tensor embedding_idxes;
+
+  // the number of embedding sequences in the batch
+  int64_t num_embeddings = 0;
+};
+
 // input for the model that encapsulates all the necessary
 // input information.
 struct ModelInput {
@@ -18,6 +46,46 @@ struct ModelInput {
   InputParameters input_params;
   // sampling parameters, mainly for sampling
   SamplingParameters sampling_params;
+  // pooling parameters for embedding sequences
+  PoolingParameters pooling_params;
+
+  // kv cache blocks to copy before the forward, e.g. blocks shared by beams
+  // that are about to diverge. [num_copies] IntTensor
+  torch::Tensor src_block_ids;
+  torch::Tensor dst_block_ids;
+
+  // prompt tokens to compute logprobs of the next prompt token for.
+  // [n_tokens] IntTensor indices in flatten tokens
+  torch::Tensor prompt_logprob_idxes;
+  // [n_tokens] LongTensor ids of the next prompt tokens
+  torch::Tensor prompt_logprob_token_ids;
+
+  // the number of decode steps to run back to back, tokens sampled in each
+  // step are fed into the next one on device
+  uint32_t num_decode_steps = 1;
+};
+
+// time spent in each stage of executing a batch, in seconds
+struct ExecutionStats {
+  // build the model input from the batch
+  double prepare_input_seconds = 0;
+
+  // copy the model input to device
+  double h2d_seconds = 0;
+
+  // model forward, including waiting for kernels to complete
+  double forward_seconds = 0;
+
+  // compute and process logits
+  double logits_seconds = 0;
+
+  double sampling_seconds = 0;
+
+  // append sampled tokens to sequences
+  double process_output_seconds = 0;
+
+  // the number of sequences padded to match a captured cuda graph
+  uint32_t num_padding_seqs = 0;
 };
 
 // output for the model that encapsulates all the necessary
@@ -29,10 +97,28 @@ struct ModelOutput {
   // output of sampling
   SampleOutput sample_output;
 
+  // [num_seqs, num_decode_steps] LongTensor tokens sampled in each step when
+  // running several decode steps, instead of the sample output
+  torch::Tensor decode_tokens;
+
   // logits for selected indices
   torch::Tensor logits;
 
-  // torch::Tensor logprob;
+  // [num_embeddings, hidden_size] pooled hidden states in float for
+  // embedding sequences
+  torch::Tensor embeddings;
+
+  // [n_tokens] logprobs of prompt tokens in float, in the same order as
+  // prompt_logprob_idxes of the input
+  torch::Tensor prompt_logprobs;
+
+  // execution stats for profiling
+  ExecutionStats stats;
+
+  // sequences of the batch that were not run, with the reason. UNAVAILABLE
+  // if they may run in a later step, e.g. no free blocks left for this step,
+  // otherwise they can never run on the engine.
+  std::vector<std::pair<const Sequence*, Status>> failed_sequences;
 };
 
 }  // namespace llm
\ No newline at end of file
@@ -17,22 +17,24 @@
 #include "memory/kv_cache.h"
 #include "memory/memory.h"
 #include "model_loader/state_dict.h"
+#include "model_parallel/model_parallel.h"
 #include "models/parameters.h"
 #include "sampling/logits_processor.h"
 #include "sampling/sampler.h"
+#include "sampling/vocab_parallel_sampler.h"
 
 // latency metrics
-DEFINE_COUNTER_FAMILY(execution_latency_seconds,
-                      "Execution latency in seconds");
-DEFINE_COUNTER_INSTANCE(model_execution_latency_seconds,
-                        execution_latency_seconds,
-                        {{"stage", "model"}});
-DEFINE_COUNTER_INSTANCE(logits_processing_latency_seconds,
-                        execution_latency_seconds,
-                        {{"stage", "logits_processing"}});
-DEFINE_COUNTER_INSTANCE(sampling_latency_seconds,
-                        execution_latency_seconds,
-                        {{"stage", "sampling"}});
+DEFINE_HISTOGRAM_FAMILY(execution_latency_seconds,
+                        "Execution latency in seconds");
+DEFINE_HISTOGRAM_INSTANCE(model_execution_latency_seconds,
+                          execution_latency_seconds,
+                          {{"stage", "model"}});
+DEFINE_HISTOGRAM_INSTANCE(logits_processing_latency_seconds,
+                          execution_latency_seconds,
+                          {{"stage", "logits_processing"}});
+DEFINE_HISTOGRAM_INSTANCE(sampling_latency_seconds,
+                          execution_latency_seconds,
+                          {{"stage", "sampling"}});
 
 namespace llm {
 
@@ -66,11 +68,15 @@ bool Worker::init_kv_cache(const std::vector<int64_t>& kv_cache_shape) {
   // create a KVCache for each layer
   const int64_t num_layers = args_.n_layers();
   kv_caches_.reserve(num_layers);
+  // zero the cpu cache to commit its pages now, on the numa node of the
+  // thread running the model, instead of faulting them in while serving.
+  const auto options = torch::dtype(dtype_).device(device_);
   for (int64_t i = 0; i < num_layers; ++i) {
-    auto key_cache =
-        torch::empty(kv_cache_shape, torch::dtype(dtype_).device(device_));
-    auto value_cache =
-        torch::empty(kv_cache_shape, torch::dtype(dtype_).device(device_));
+    auto key_cache = device_.is_cpu() ? torch::zeros(kv_cache_shape, options)
+                                      : torch::empty(kv_cache_shape, options);
+    auto value_cache = device_.is_cpu()
+                           ? torch::zeros(kv_cache_shape, options)
+                           : torch::empty(kv_cache_shape, options);
     kv_caches_.emplace_back(key_cache, value_cache);
   }
   return true;
@@ -104,32 +110,130 @@ std::tuple<int64_t, int64_t> Worker::profile_device_memory() {
   return {available_memory, total_memory};
 }
 
+bool Worker::run_profiling_prompt(
+    const std::vector<int64_t>& kv_cache_shape) {
+  CHECK(model_ != nullptr) << "Model is not initialized.";
+  CHECK(kv_caches_.empty()) << "KV caches are already initialized.";
+  CHECK(device_.is_cpu()) << "Host memory profiling is only supported on CPU.";
+
+  // temporary kv caches for the prompt
+  const auto options = torch::dtype(dtype_).device(device_);
+  std::vector<KVCache> kv_caches;
+  kv_caches.reserve(args_.n_layers());
+  for (int64_t i = 0; i < args_.n_layers(); ++i) {
+    kv_caches.emplace_back(torch::zeros(kv_cache_shape, options),
+                           torch::zeros(kv_cache_shape, options));
+  }
+
+  const int64_t n_blocks = kv_cache_shape[0];
+  const int64_t n_tokens = n_blocks * kv_cache_shape[1];
+  const auto int_options = torch::dtype(torch::kInt32).device(device_);
+  const auto token_ids = torch::zeros({n_tokens}, int_options);
+  const auto positions = torch::arange(n_tokens, int_options);
+  InputParameters params;
+  params.empty_kv_cache = true;
+  params.num_sequences = 1;
+  params.q_max_seq_len = static_cast<int32_t>(n_tokens);
+  params.kv_max_seq_len = static_cast<int32_t>(n_tokens);
+  params.q_cu_seq_lens = torch::tensor({int64_t(0), n_tokens}, int_options);
+  params.kv_cu_seq_lens = params.q_cu_seq_lens;
+  params.new_cache_slots = torch::arange(n_tokens, int_options);
+  params.block_tables = torch::arange(n_blocks, int_options).unsqueeze(0);
+
+  const auto hidden_states =
+      model_->forward(token_ids, positions, kv_caches, params);
+  // logits of the last token as in sampling
+  const auto selected_idxes = torch::tensor({n_tokens - 1}, int_options);
+  model_->logits(hidden_states, selected_idxes);
+  return true;
+}
+
 ModelOutput Worker::execute_model(const ModelInput& inputs) {
+  if (inputs.num_decode_steps > 1) {
+    return execute_decode_steps(inputs);
+  }
   torch::DeviceGuard device_guard(device_);
 
+  ModelOutput output;
   Timer timer;
+  Timer stage_timer;
 
   // all tensors should be on the same device as model
   auto flatten_tokens = inputs.token_ids.to(device_);
   auto flatten_positions = inputs.positions.to(device_);
   InputParameters params = inputs.input_params.to(device_);
+  output.stats.h2d_seconds = stage_timer.elapsed_seconds();
+
+  // copy shared blocks before new tokens are written into their copies
+  if (inputs.src_block_ids.defined()) {
+    const auto src_block_ids = inputs.src_block_ids.to(device_);
+    const auto dst_block_ids = inputs.dst_block_ids.to(device_);
+    for (auto& kv_cache : kv_caches_) {
+      kv_cache.copy_blocks(src_block_ids, dst_block_ids);
+    }
+  }
 
   // call model runner forward to get hidden states
+  stage_timer.reset();
   auto hidden_states = model_runner_->forward(
       flatten_tokens, flatten_positions, kv_caches_, params);
   // waits for all kernels in current streams to complete.
   at::cuda::getCurrentCUDAStream().synchronize();
-  COUNTER_ADD(model_execution_latency_seconds, timer.elapsed_seconds());
+  output.stats.forward_seconds = stage_timer.elapsed_seconds();
+  HISTOGRAM_OBSERVE(model_execution_latency_seconds, timer.elapsed_seconds());
+
+  // pool hidden states for embedding sequences
+  if (inputs.pooling_params.num_embeddings > 0) {
+    const PoolingParameters pooling_params = inputs.pooling_params.to(device_);
+    const auto pooled =
+        hidden_states.index_select(/*dim=*/0, pooling_params.token_idxes)
+            .to(torch::kFloat32);
+    auto embeddings = torch::zeros(
+        {pooling_params.num_embeddings, pooled.size(1)}, pooled.options());
+    output.embeddings = embeddings.index_add_(
+        /*dim=*/0, pooling_params.embedding_idxes, pooled);
+  }
+
+  // logprobs of prompt tokens from the raw logits of their previous tokens
+  if (inputs.prompt_logprob_idxes.defined()) {
+    const auto idxes = inputs.prompt_logprob_idxes.to(device_);
+    const auto token_ids = inputs.prompt_logprob_token_ids.to(device_);
+    torch::Tensor logits = model_->logits(hidden_states, idxes);
+    if (!parallel_args_.gather_logits()) {
+      logits = gather_from_model_parallel_region(logits, parallel_args_);
+    }
+    const auto logprobs =
+        torch::log_softmax(logits, /*dim=*/-1, /*dtype=*/torch::kFloat32);
+    output.prompt_logprobs =
+        logprobs.gather(/*dim=*/-1, token_ids.unsqueeze(/*dim=*/-1))
+            .squeeze(/*dim=*/-1);
+  }
 
   // prepare model output
-  ModelOutput output;
   if (inputs.sampling_params.selected_token_idxes.defined()) {
+    stage_timer.reset();
     SamplingParameters sampling_params =
         inputs.sampling_params.to(device_, dtype_);
     // call model to get logits
     torch::Tensor logits =
         model_->logits(hidden_states, sampling_params.selected_token_idxes);
 
+    if (!parallel_args_.gather_logits()) {
+      // logits are sharded along the vocab
+      if (VocabParallelSampler::is_supported(sampling_params)) {
+        output.stats.logits_seconds = stage_timer.elapsed_seconds();
+        timer.reset();
+        VocabParallelSampler sampler(sampling_params, parallel_args_);
+        output.sample_output = sampler.forward(logits);
+        HISTOGRAM_OBSERVE(sampling_latency_seconds, timer.elapsed_seconds());
+        output.stats.sampling_seconds = timer.elapsed_seconds();
+        output.do_sample = sampling_params.do_sample;
+        return output;
+      }
+      // fall back to sampling from the full logits
+      logits = gather_from_model_parallel_region(logits, parallel_args_);
+    }
+
     // create and call logits processors
     timer.reset();
     auto logits_processor = LogitsProcessor::create(sampling_params);
@@ -138,18 +242,22 @@ ModelOutput Worker::execute_model(const ModelInput& inputs) {
                                        sampling_params.unique_token_ids,
                                        sampling_params.unique_token_counts,
                                        sampling_params.unique_token_ids_lens);
-    COUNTER_ADD(logits_processing_latency_seconds, timer.elapsed_seconds());
+    HISTOGRAM_OBSERVE(logits_processing_latency_seconds,
+                      timer.elapsed_seconds());
+    output.stats.logits_seconds = stage_timer.elapsed_seconds();
 
     // set logits to output
     output.logits = logits;
 
     timer.reset();
-    auto sampler = std::make_unique<Sampler>(sampling_params.do_sample);
+    auto sampler = std::make_unique<Sampler>(sampling_params.do_sample,
+                                             sampling_params.num_top_tokens);
     // select sample logits
     auto sample_logits =
         logits.index_select(/*dim=*/0, sampling_params.sample_idxes);
     auto sample_output = sampler->forward(sample_logits);
-    COUNTER_ADD(sampling_latency_seconds, timer.elapsed_seconds());
+    HISTOGRAM_OBSERVE(sampling_latency_seconds, timer.elapsed_seconds());
+    output.stats.sampling_seconds = timer.elapsed_seconds();
 
     // set sample output to output
     output.sample_output = sample_output;
@@ -160,6 +268,133 @@ ModelOutput Worker::execute_model(const ModelInput& inputs) {
   return output;
 }
 
+ModelOutput Worker::execute_decode_steps(const ModelInput& inputs) {
+  // the scheduler bounds the steps by the context length of each sequence
+  const int64_t max_position = args_.max_position_embeddings();
+  const int64_t last_kv_len =
+      inputs.input_params.kv_max_seq_len + inputs.num_decode_steps - 1;
+  CHECK(max_position <= 0 || last_kv_len <= max_position)
+      << "decode steps run past the max position embeddings";
+  torch::DeviceGuard device_guard(device_);
+
+  ModelOutput output;
+  Timer timer;
+
+  auto flatten_tokens = inputs.token_ids.to(device_);
+  auto flatten_positions = inputs.positions.to(device_);
+  InputParameters params = inputs.input_params.to(device_);
+  const SamplingParameters sampling_params =
+      inputs.sampling_params.to(device_, dtype_);
+  output.stats.h2d_seconds = timer.elapsed_seconds();
+  CHECK(sampling_params.selected_token_idxes.defined())
+      << "no tokens to sample for decode steps";
+
+  // each sequence has one token per step, followed by padding sequences for
+  // cuda graphs, which stay unchanged across steps.
+  const int64_t num_seqs = params.num_sequences;
+  const int64_t num_tokens = flatten_tokens.numel();
+  const auto int_options = flatten_positions.options();
+  const auto seq_idxes = torch::arange(num_tokens + 1, int_options);
+  const auto is_seq = seq_idxes.slice(/*dim=*/0, 0, num_tokens) < num_seqs;
+  const auto kv_len_deltas = seq_idxes.clamp_max(num_seqs);
+  const int64_t block_size = runner_options_.block_size();
+
+  auto logits_processor = LogitsProcessor::create(sampling_params);
+  Sampler sampler(sampling_params.do_sample, /*num_top_tokens=*/0);
+  const auto sample = [&](const torch::Tensor& hidden_states) {
+    // N.B. no top tokens and logprobs are needed for decode steps
+    torch::Tensor logits =
+        model_->logits(hidden_states, sampling_params.selected_token_idxes);
+    if (!parallel_args_.gather_logits()) {
+      if (VocabParallelSampler::is_supported(sampling_params)) {
+        VocabParallelSampler vocab_sampler(sampling_params, parallel_args_);
+        torch::Tensor next_tokens = vocab_sampler.forward(logits).next_tokens;
+        return next_tokens;
+      }
+      logits = gather_from_model_parallel_region(logits, parallel_args_);
+    }
+    logits = logits_processor->forward(logits,
+                                       sampling_params.unique_token_ids,
+                                       sampling_params.unique_token_counts,
+                                       sampling_params.unique_token_ids_lens);
+    logits = logits.index_select(/*dim=*/0, sampling_params.sample_idxes);
+    torch::Tensor next_tokens = sampler.forward(logits).next_tokens;
+    return next_tokens;
+  };
+
+  std::vector<torch::Tensor> step_tokens;
+  step_tokens.reserve(inputs.num_decode_steps);
+  timer.reset();
+  for (uint32_t step = 0; step < inputs.num_decode_steps; ++step) {
+    if (step > 0) {
+      // advance all sequences by the token sampled in the last step, the kv
+      // cache slots are reserved by the scheduler
+      const auto& last_tokens = step_tokens.back();
+      flatten_tokens = torch::zeros_like(flatten_tokens);
+      flatten_tokens.slice(/*dim=*/0, 0, num_seqs).copy_(last_tokens);
+      flatten_positions = flatten_positions + is_seq.to(torch::kInt);
+      params.kv_cu_seq_lens = params.kv_cu_seq_lens + kv_len_deltas;
+      params.kv_max_seq_len += 1;
+      const auto block_idxes =
+          torch::div(flatten_positions, block_size, "floor").to(torch::kLong);
+      const auto block_ids =
+          params.block_tables.gather(/*dim=*/1, block_idxes.unsqueeze(1))
+              .squeeze(1);
+      const auto slots = block_ids * block_size +
+                         torch::remainder(flatten_positions, block_size);
+      params.new_cache_slots =
+          torch::where(is_seq, slots, torch::zeros_like(slots))
+              .to(torch::kInt);
+    }
+
+    auto hidden_states = model_runner_->forward(
+        flatten_tokens, flatten_positions, kv_caches_, params);
+    auto next_tokens = sample(hidden_states);
+    if (parallel_args_.world_size() > 1) {
+      // keep all ranks on the tokens sampled by the first rank, which are
+      // returned to the engine
+      if (parallel_args_.rank() != 0) {
+        next_tokens.zero_();
+      }
+      parallel_args_.process_group()->allreduce(next_tokens);
+    }
+    step_tokens.push_back(next_tokens);
+  }
+  // waits for all steps to complete, the host only blocks once per round
+  at::cuda::getCurrentCUDAStream().synchronize();
+  output.stats.forward_seconds = timer.elapsed_seconds();
+  HISTOGRAM_OBSERVE(model_execution_latency_seconds, timer.elapsed_seconds());
+
+  output.decode_tokens = torch::stack(step_tokens, /*dim=*/1);
+  output.do_sample = sampling_params.do_sample;
+  return output;
+}
+
+KVBlocks Worker::export_kv_blocks(const std::vector<int32_t>& block_ids) const {
+  CHECK(!kv_caches_.empty()) << "KV caches are not initialized.";
+  const auto ids = torch::tensor(block_ids, torch::kInt);
+  KVBlocks blocks;
+  blocks.keys.reserve(kv_caches_.size());
+  blocks.values.reserve(kv_caches_.size());
+  for (const auto& kv_cache : kv_caches_) {
+    auto [keys, values] = kv_cache.get_kv_blocks(ids);
+    blocks.keys.push_back(std::move(keys));
+    blocks.values.push_back(std::move(values));
+  }
+  return blocks;
+}
+
+void Worker::import_kv_blocks(const std::vector<int32_t>& block_ids,
+                              const KVBlocks& blocks) {
+  CHECK(!kv_caches_.empty()) << "KV caches are not initialized.";
+  CHECK_EQ(blocks.keys.size(), kv_caches_.size());
+  CHECK_EQ(blocks.values.size(), kv_caches_.size());
+  const auto ids = torch::tensor(block_ids, torch::kInt);
+  for (size_t i = 0; i < kv_caches_.size(); ++i) {
+    kv_caches_[i].set_kv_blocks(ids, blocks.keys[i], blocks.values[i]);
+  }
+}
+
 folly::SemiFuture<std::tuple<int64_t, int64_t>>
 Worker::profile_device_memory_async() {
   folly::Promise<std::tuple<int64_t, int64_t>> promise;
@@ -171,6 +406,18 @@ Worker::profile_device_memory_async() {
   return future;
 }
 
+folly::SemiFuture<bool> Worker::run_profiling_prompt_async(
+    const std::vector<int64_t>& kv_cache_shape) {
+  folly::Promise<bool> promise;
+  auto future = promise.getSemiFuture();
+  threadpool_.schedule(
+      [this, &kv_cache_shape, promise = std::move(promise)]() mutable {
+        const bool success = this->run_profiling_prompt(kv_cache_shape);
+        promise.setValue(success);
+      });
+  return future;
+}
+
 folly::SemiFuture<ModelOutput> Worker::execute_model_async(
     const ModelInput& inputs) {
   folly::Promise<ModelOutput> promise;
@@ -4,6 +4,7 @@
 #include <torch/torch.h>
 
 #include "common/threadpool.h"
+#include "kv_transfer.h"
 #include "model_loader/state_dict.h"
 #include "model_parallel/parallel_args.h"
 #include "model_runner.h"
@@ -38,12 +39,24 @@ class Worker final {
   // returns available memory and total memory
   std::tuple<int64_t, int64_t> profile_device_memory();
 
+  // run a prompt filling a temporary kv cache of the given shape, for the
+  // caller to measure the host memory of activations, only for cpu. blocking
+  // call
+  bool run_profiling_prompt(const std::vector<int64_t>& kv_cache_shape);
+
   // initialize kv cache. blocking call
   bool init_kv_cache(const std::vector<int64_t>& kv_cache_shape);
 
   // Run the model on the given input. blocking call
   ModelOutput execute_model(const ModelInput& inputs);
 
+  // copy the kv cache of the given blocks out of all layers. blocking call
+  KVBlocks export_kv_blocks(const std::vector<int32_t>& block_ids) const;
+
+  // copy the kv cache of all layers into the given blocks. blocking call
+  void import_kv_blocks(const std::vector<int32_t>& block_ids,
+                        const KVBlocks& blocks);
+
   // capture cuda graph for the model. blocking call
   bool capture_cuda_graphs();
 
@@ -59,6 +72,9 @@ class Worker final {
 
   folly::SemiFuture<std::tuple<int64_t, int64_t>> profile_device_memory_async();
 
+  folly::SemiFuture<bool> run_profiling_prompt_async(
+      const std::vector<int64_t>& kv_cache_shape);
+
   // initialize kv cache. async call
   folly::SemiFuture<bool> init_kv_cache_async(
       const std::vector<int64_t>& kv_cache_shape);
@@ -73,6 +89,10 @@ class Worker final {
   const torch::Device& device() const { return device_; }
 
  private:
+  // run several decode steps back to back, feeding the tokens sampled in each
+  // step into the next one without leaving the device
+  ModelOutput execute_decode_steps(const ModelInput& inputs);
+
   // working thread
   ThreadPool threadpool_;
 
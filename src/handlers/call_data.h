@@ -1,13 +1,23 @@
 #pragma once
 
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
 #include <glog/logging.h>
 #include <grpcpp/alarm.h>
 #include <grpcpp/grpcpp.h>
 
+#include <algorithm>
 #include <atomic>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <utility>
+
+#include "common/macros.h"
+#include "common/tracing.h"
 
 namespace llm {
 
@@ -23,11 +33,31 @@ class CallData {
 
 // Class encompasing the state and logic needed to serve a server streaming
 // request.
+// Responses are pushed into a per-call queue bounded by both the number and
+// the bytes of pending responses, and drained by the grpc handler thread, so
+// a slow client never blocks the producer. When the client lags behind, new
+// responses are coalesced into the last pending one if a coalescer is
+// provided, up to a max size per response. Once the queue is full and the
+// response can't be coalesced, the call is finished with RESOURCE_EXHAUSTED
+// and write() returns false, which signals the producer to cancel the
+// request.
 template <typename Request, typename Response>
 class StreamCallData : public CallData {
  public:
   enum class Status { CREATE, WRITE, PENDING, FINISH };
 
+  struct Options {
+    // max number of responses waiting to be sent to client
+    DEFINE_ARG(size_t, max_pending_responses) = 64;
+
+    // max bytes of responses waiting to be sent to client
+    DEFINE_ARG(size_t, max_pending_bytes) = size_t(16) << 20;
+
+    // responses are coalesced into a pending one only up to this size, which
+    // stays below the default max message size of grpc clients.
+    DEFINE_ARG(size_t, max_coalesced_bytes) = size_t(1) << 20;
+  };
+
   // pack the response with state
   struct ResponseWithState {
     ResponseWithState(Response _response) : response(std::move(_response)) {}
@@ -43,6 +73,8 @@ class StreamCallData : public CallData {
     std::optional<Response> response;
     // grpc status to be sent to client
     std::optional<grpc::Status> grpc_status;
+    // serialized size of the response
+    size_t bytes = 0;
   };
 
   // callback for registering itself to the service
@@ -56,39 +88,77 @@ class StreamCallData : public CallData {
   // callback for new request
   using OnRequest = std::function<void(StreamCallData<Request, Response>*)>;
 
+  // callback for merging a response into a pending one that has not been sent
+  // yet. returns false if the response can't be merged, in which case
+  // 'pending' must be left untouched.
+  using Coalescer = std::function<bool(Response* pending, const Response&)>;
+
   StreamCallData(grpc::ServerCompletionQueue* cq,
                  OnRegister on_register,
                  OnRequest on_request)
+      : StreamCallData(cq,
+                       std::move(on_register),
+                       std::move(on_request),
+                       Options{}) {}
+
+  StreamCallData(grpc::ServerCompletionQueue* cq,
+                 OnRegister on_register,
+                 OnRequest on_request,
+                 const Options& options)
       : cq_(cq),
         responder_(&ctx_),
         on_register_(on_register),
-        on_new_request_(on_request) {
+        on_new_request_(on_request),
+        options_(options) {
+    options_.max_pending_responses(
+        std::max<size_t>(options_.max_pending_responses(), 1));
     // register itself to the service for handling request
     on_register_(&ctx_, &request_, &responder_, cq_, cq_, this);
   }
 
   const Request& request() const { return request_; }
 
+  // context of the rpc, e.g. for client metadata
+  grpc::ServerContext* context() { return &ctx_; }
+
+  // record network writes into the trace, the trace is kept alive until the
+  // call is finished. should be called before any response is sent.
+  void set_trace(std::shared_ptr<RequestTrace> trace) {
+    trace_ = std::move(trace);
+  }
+
   // returns true if the rpc is ok
   bool is_rpc_ok() const { return rpc_ok_.load(std::memory_order_relaxed); }
 
+  // set the coalescer used to merge responses when the client lags behind.
+  // should be called before any response is sent.
+  void set_coalescer(Coalescer coalescer) { coalescer_ = std::move(coalescer); }
+
+  // returns the number of responses waiting to be sent to client
+  size_t num_pending_responses() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_responses_.size();
+  }
+
+  // returns the bytes of responses waiting to be sent to client
+  size_t num_pending_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_bytes_;
+  }
+
   // call following methods to reply to client
   // returns true if the response has been accepted and will be delivered
   // asynchronously.
-  // returns false if the rpc channel has been closed/cancelled.
+  // returns false if the rpc channel has been closed/cancelled or the client
+  // is too slow to keep up.
   bool write(Response response) {
-    // pack the response with state
-    auto new_response =
-        std::make_shared<ResponseWithState>(std::move(response));
-    return send_response(new_response);
+    return send_response(ResponseWithState(std::move(response)));
   }
 
   bool write_and_finish(Response response,
                         grpc::Status grpc_status = grpc::Status::OK) {
-    // pack the response with state
-    auto new_response = std::make_shared<ResponseWithState>(
-        std::move(response), std::move(grpc_status));
-    return send_response(new_response);
+    return send_response(
+        ResponseWithState(std::move(response), std::move(grpc_status)));
   }
 
   // returns false if the rpc channel has been closed/cancelled.
@@ -99,24 +169,76 @@ class StreamCallData : public CallData {
 
   // returns false if the rpc channel has been closed/cancelled.
   bool finish(grpc::Status grpc_status = grpc::Status::OK) {
-    // pack status with grpc status
-    auto new_response =
-        std::make_shared<ResponseWithState>(std::move(grpc_status));
-    return send_response(new_response);
+    return send_response(ResponseWithState(std::move(grpc_status)));
   }
 
-  bool send_response(std::shared_ptr<ResponseWithState> response) {
-    // wait previous response to be processed
-    std::shared_ptr<ResponseWithState> expected = nullptr;
-    while (
-        !std::atomic_compare_exchange_weak(&response_, &expected, response)) {
-      expected = nullptr;
+  bool send_response(ResponseWithState response) {
+    bool accepted = true;
+    bool need_notify = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // no more responses are allowed after finish
+      if (closed_) {
+        return false;
+      }
+
+      const bool rpc_ok = rpc_ok_.load(std::memory_order_relaxed);
+      const bool is_final = response.grpc_status.has_value();
+      if (!is_final) {
+        if (!rpc_ok) {
+          // drop the response, the rpc channel has been closed/cancelled
+          return false;
+        }
+
+        response.bytes = response.response->ByteSizeLong();
+        if (!pending_responses_.empty()) {
+          bool is_full =
+              pending_bytes_ + response.bytes > options_.max_pending_bytes();
+          // client is lagging behind, try to merge into the last response
+          auto& last = pending_responses_.back();
+          if (!is_full && coalescer_ && !last.grpc_status.has_value() &&
+              last.bytes + response.bytes <= options_.max_coalesced_bytes() &&
+              coalescer_(&last.response.value(), response.response.value())) {
+            const size_t bytes = last.response->ByteSizeLong();
+            pending_bytes_ = pending_bytes_ - last.bytes + bytes;
+            last.bytes = bytes;
+            return true;
+          }
+
+          is_full = is_full || pending_responses_.size() >=
+                                   options_.max_pending_responses();
+          if (is_full) {
+            // the client can't keep up, finish the call with error
+            LOG(WARNING) << "Client is too slow, finishing the stream with "
+                         << pending_responses_.size() << " pending responses"
+                         << " of " << pending_bytes_ << " bytes";
+            response = ResponseWithState(
+                grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
+                             "Client is too slow to consume responses"));
+            accepted = false;
+          }
+        }
+      }
+
+      if (response.grpc_status.has_value()) {
+        closed_ = true;
+      }
+      pending_bytes_ += response.bytes;
+      pending_responses_.push_back(std::move(response));
+      // wake up the grpc handler thread if it is idle
+      if (!op_in_flight_) {
+        op_in_flight_ = true;
+        need_notify = true;
+      }
+      accepted = accepted && rpc_ok;
     }
 
     // notify the grpc handler thread
-    notify_alarm_.Set(
-        cq_, gpr_time_0(gpr_clock_type::GPR_CLOCK_MONOTONIC), this);
-    return rpc_ok_.load(std::memory_order_relaxed);
+    if (need_notify) {
+      notify_alarm_.Set(
+          cq_, gpr_time_0(gpr_clock_type::GPR_CLOCK_MONOTONIC), this);
+    }
+    return accepted;
   }
 
   // proceed to the next state.
@@ -131,7 +253,7 @@ class StreamCallData : public CallData {
     // it is notification from cq for new request
     if (status_ == Status::CREATE) {
       // Spawn a new CallData instance to serve new clients
-      new StreamCallData(cq_, on_register_, on_new_request_);
+      new StreamCallData(cq_, on_register_, on_new_request_, options_);
 
       // rpc error before acctually processing the request, release the calldata
       if (!rpc_ok) {
@@ -142,46 +264,17 @@ class StreamCallData : public CallData {
       status_ = Status::WRITE;
       // The actual processing.
       on_new_request_(this);
-    } else if (status_ == Status::WRITE) {
-      if (auto rs = std::atomic_load(&response_)) {
-        // send the response to client
-        // WriteAndFinish
-        if (rs->response.has_value() && rs->grpc_status.has_value()) {
-          if (rpc_ok) {
-            // change the status to pending to wait for write op to finish
-            status_ = Status::FINISH;
-            responder_.WriteAndFinish(
-                rs->response.value(), {}, rs->grpc_status.value(), this);
-          } else {
-            // the request has been finished, release the calldata
-            return false;
-          }
-        } else if (rs->response.has_value()) {
-          // if rpc is ok, send the response to client, otherwise, wait for
-          // finish alarm
-          if (rpc_ok) {
-            // change the status to pending to wait for write op to finish
-            status_ = Status::PENDING;
-            responder_.Write(rs->response.value(), this);
-          } else {
-            std::atomic_store(&response_, {});
-          }
-        } else {
-          if (rpc_ok) {
-            // the rpc is ok, send the finish status to client
-            status_ = Status::FINISH;
-            responder_.Finish(rs->grpc_status.value(), this);
-          } else {
-            // the request has been finished, release the calldata
-            return false;
-          }
-        }
+    } else if (status_ == Status::WRITE || status_ == Status::PENDING) {
+      if (status_ == Status::PENDING && trace_) {
+        trace_->add_span("grpc_write", write_start_time_, absl::Now());
       }
-    } else if (status_ == Status::PENDING) {
-      // the write op has been finished, proceed to the next write op
-      status_ = Status::WRITE;
-      std::atomic_store(&response_, {});
+      // either notified by the alarm or the previous write op has finished,
+      // proceed to the next pending response
+      return write_next(rpc_ok);
     } else if (status_ == Status::FINISH) {
+      if (trace_) {
+        trace_->add_span("grpc_finish", write_start_time_, absl::Now());
+      }
       // Once in the FINISH state, deallocate CallData.
       return false;
     }
@@ -189,6 +282,54 @@ class StreamCallData : public CallData {
   }
 
  private:
+  // send the next pending response to client.
+  // returns false if the call data is finished and can be deleted
+  bool write_next(bool rpc_ok) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      status_ = Status::WRITE;
+      while (true) {
+        if (pending_responses_.empty()) {
+          // nothing to send, wait for the next notification
+          op_in_flight_ = false;
+          return true;
+        }
+        inflight_response_.emplace(std::move(pending_responses_.front()));
+        pending_responses_.pop_front();
+        pending_bytes_ -= inflight_response_->bytes;
+        if (rpc_ok) {
+          break;
+        }
+        // rpc is broken, drop responses until the finish status arrives
+        if (inflight_response_->grpc_status.has_value()) {
+          // the request has been finished, release the calldata
+          return false;
+        }
+      }
+    }
+
+    // the in-flight response is only accessed by the grpc handler thread
+    auto& rs = inflight_response_.value();
+    if (trace_) {
+      write_start_time_ = absl::Now();
+    }
+    if (rs.response.has_value() && rs.grpc_status.has_value()) {
+      // WriteAndFinish
+      status_ = Status::FINISH;
+      responder_.WriteAndFinish(
+          rs.response.value(), {}, rs.grpc_status.value(), this);
+    } else if (rs.response.has_value()) {
+      // change the status to pending to wait for write op to finish
+      status_ = Status::PENDING;
+      responder_.Write(rs.response.value(), this);
+    } else {
+      // send the finish status to client
+      status_ = Status::FINISH;
+      responder_.Finish(rs.grpc_status.value(), this);
+    }
+    return true;
+  }
+
   Status status_ = Status::CREATE;
 
   // completion queue: the producer-consumer queue where for asynchronous server
@@ -216,8 +357,35 @@ class StreamCallData : public CallData {
   // callback for new request
   OnRequest on_new_request_;
 
-  // next response to be sent to client
-  std::shared_ptr<ResponseWithState> response_;
+  // callback for merging responses when the client lags behind
+  Coalescer coalescer_;
+
+  // limits of responses waiting to be sent to client
+  Options options_;
+
+  // mutex protecting the following members
+  mutable std::mutex mutex_;
+
+  // responses waiting to be sent to client
+  std::deque<ResponseWithState> pending_responses_;
+
+  // total bytes of the pending responses
+  size_t pending_bytes_ = 0;
+
+  // whether there is an alarm or write op in flight
+  bool op_in_flight_ = false;
+
+  // whether the finish status has been queued
+  bool closed_ = false;
+
+  // the response being sent to client, owned by the grpc handler thread
+  std::optional<ResponseWithState> inflight_response_;
+
+  // trace of the request, nullptr if the request is not sampled
+  std::shared_ptr<RequestTrace> trace_;
+
+  // the time when the in-flight op was issued, only tracked for traced calls
+  absl::Time write_start_time_;
 };
 
 }  // namespace llm
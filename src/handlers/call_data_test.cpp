@@ -0,0 +1,256 @@
+#include "call_data.h"
+
+#include <absl/strings/str_format.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <grpcpp/grpcpp.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "completion.grpc.pb.h"
+
+namespace llm {
+
+using TestCallData =
+    StreamCallData<proto::CompletionRequest, proto::CompletionResponse>;
+
+namespace {
+
+bool append_text(proto::CompletionResponse* pending,
+                 const proto::CompletionResponse& response) {
+  pending->mutable_choices(0)->mutable_text()->append(
+      response.choices(0).text());
+  return true;
+}
+
+proto::CompletionResponse make_response(const std::string& text) {
+  proto::CompletionResponse response;
+  response.add_choices()->set_text(text);
+  return response;
+}
+
+// a minimal async grpc server that hands over incoming calls to the test
+class TestServer {
+ public:
+  TestServer(const TestCallData::Options& options,
+             TestCallData::Coalescer coalescer)
+      : coalescer_(std::move(coalescer)) {
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(
+        "localhost:0", grpc::InsecureServerCredentials(), &port_);
+    builder.RegisterService(&service_);
+    cq_ = builder.AddCompletionQueue();
+    server_ = builder.BuildAndStart();
+
+    auto on_register =
+        [this](grpc::ServerContext* context,
+               proto::CompletionRequest* request,
+               grpc::ServerAsyncWriter<proto::CompletionResponse>* responder,
+               grpc::ServerCompletionQueue* new_call_cq,
+               grpc::ServerCompletionQueue* notification_cq,
+               void* tag) {
+          service_.RequestComplete(
+              context, request, responder, new_call_cq, notification_cq, tag);
+        };
+    auto on_request = [this](TestCallData* call_data) {
+      if (coalescer_) {
+        call_data->set_coalescer(coalescer_);
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      calls_.push_back(call_data);
+    };
+    new TestCallData(cq_.get(), on_register, on_request, options);
+
+    thread_ = std::thread([this]() {
+      void* tag = nullptr;
+      bool rpc_ok = false;
+      while (cq_->Next(&tag, &rpc_ok)) {
+        auto* call_data = static_cast<CallData*>(tag);
+        if (!call_data->proceed(rpc_ok)) {
+          delete call_data;
+        }
+      }
+    });
+  }
+
+  ~TestServer() {
+    server_->Shutdown();
+    cq_->Shutdown();
+    thread_.join();
+  }
+
+  std::string address() const { return absl::StrFormat("localhost:%d", port_); }
+
+  // wait until n calls have arrived
+  std::vector<TestCallData*> wait_for_calls(size_t n) {
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (calls_.size() >= n) {
+          return calls_;
+        }
+      }
+      absl::SleepFor(absl::Milliseconds(1));
+    }
+  }
+
+ private:
+  int port_ = 0;
+  TestCallData::Coalescer coalescer_;
+  proto::Completion::AsyncService service_;
+  std::unique_ptr<grpc::ServerCompletionQueue> cq_;
+  std::unique_ptr<grpc::Server> server_;
+  std::thread thread_;
+
+  std::mutex mutex_;
+  std::vector<TestCallData*> calls_;
+};
+
+// a streaming client that can be paused before reading responses
+class TestClient {
+ public:
+  TestClient(const std::string& address) {
+    // coalesced responses can be large
+    grpc::ChannelArguments args;
+    args.SetMaxReceiveMessageSize(-1);
+    stub_ = proto::Completion::NewStub(grpc::CreateCustomChannel(
+        address, grpc::InsecureChannelCredentials(), args));
+    reader_ = stub_->Complete(&context_, proto::CompletionRequest());
+  }
+
+  // read all responses until the stream is finished
+  grpc::Status read_all() {
+    proto::CompletionResponse response;
+    while (reader_->Read(&response)) {
+      ++num_responses_;
+      text_ += response.choices(0).text();
+    }
+    return reader_->Finish();
+  }
+
+  size_t num_responses() const { return num_responses_; }
+  const std::string& text() const { return text_; }
+
+ private:
+  std::unique_ptr<proto::Completion::Stub> stub_;
+  grpc::ClientContext context_;
+  std::unique_ptr<grpc::ClientReader<proto::CompletionResponse>> reader_;
+  size_t num_responses_ = 0;
+  std::string text_;
+};
+
+}  // namespace
+
+TEST(StreamCallDataTest, SlowClientDoesNotBlockOthers) {
+  TestCallData::Options options;
+  options.max_pending_responses(8)
+      .max_pending_bytes(32 << 20)
+      .max_coalesced_bytes(4 << 20);
+  TestServer server(options, append_text);
+  TestClient slow_client(server.address());
+  TestClient fast_client(server.address());
+  const auto calls = server.wait_for_calls(2);
+
+  // big enough responses to exhaust the transport buffers of the slow client
+  const std::string chunk(64 * 1024, 'x');
+  const size_t kNumResponses = 256;
+
+  std::thread fast_reader([&]() { EXPECT_TRUE(fast_client.read_all().ok()); });
+
+  // slow client doesn't read anything until all responses are produced
+  const absl::Time start = absl::Now();
+  for (size_t i = 0; i < kNumResponses; ++i) {
+    for (auto* call_data : calls) {
+      EXPECT_TRUE(call_data->write(make_response(chunk)));
+    }
+  }
+  for (auto* call_data : calls) {
+    EXPECT_LE(call_data->num_pending_responses(), 8);
+    EXPECT_LE(call_data->num_pending_bytes(), 32 << 20);
+    EXPECT_TRUE(call_data->finish());
+  }
+  // writes never wait for the client
+  EXPECT_LT(absl::Now() - start, absl::Seconds(5));
+
+  fast_reader.join();
+  EXPECT_EQ(fast_client.text().size(), chunk.size() * kNumResponses);
+
+  // the slow client gets all the text, with lagging deltas coalesced
+  EXPECT_TRUE(slow_client.read_all().ok());
+  EXPECT_EQ(slow_client.text().size(), chunk.size() * kNumResponses);
+  EXPECT_LT(slow_client.num_responses(), kNumResponses);
+}
+
+TEST(StreamCallDataTest, CoalescedResponsesAreCapped) {
+  TestCallData::Options options;
+  options.max_pending_responses(1024)
+      .max_pending_bytes(64 << 20)
+      .max_coalesced_bytes(256 * 1024);
+  TestServer server(options, append_text);
+  TestClient slow_client(server.address());
+  auto* call_data = server.wait_for_calls(1)[0];
+
+  const std::string chunk(64 * 1024, 'x');
+  const size_t kNumResponses = 256;
+  for (size_t i = 0; i < kNumResponses; ++i) {
+    EXPECT_TRUE(call_data->write(make_response(chunk)));
+  }
+  EXPECT_TRUE(call_data->finish());
+
+  // lagging deltas are merged into responses of at most 256KB
+  EXPECT_TRUE(slow_client.read_all().ok());
+  EXPECT_EQ(slow_client.text().size(), chunk.size() * kNumResponses);
+  EXPECT_GE(slow_client.num_responses(), chunk.size() * kNumResponses /
+                                             options.max_coalesced_bytes());
+}
+
+TEST(StreamCallDataTest, CancelStreamWhenBytesExceeded) {
+  TestCallData::Options options;
+  options.max_pending_responses(1024)
+      .max_pending_bytes(1 << 20)
+      .max_coalesced_bytes(64 << 20);
+  TestServer server(options, append_text);
+  TestClient slow_client(server.address());
+  auto* call_data = server.wait_for_calls(1)[0];
+
+  const std::string chunk(64 * 1024, 'x');
+  bool accepted = true;
+  for (size_t i = 0; i < 1024 && accepted; ++i) {
+    // the call may be released once a write is refused, so only check it
+    // while all writes have been accepted.
+    EXPECT_LE(call_data->num_pending_bytes(), 1 << 20);
+    accepted = call_data->write(make_response(chunk));
+  }
+  // neither more responses nor coalescing beyond the bytes limit
+  EXPECT_FALSE(accepted);
+
+  const auto status = slow_client.read_all();
+  EXPECT_EQ(status.error_code(), grpc::StatusCode::RESOURCE_EXHAUSTED);
+  EXPECT_LT(slow_client.text().size(), chunk.size() * 1024);
+}
+
+TEST(StreamCallDataTest, CancelStreamWhenQueueIsFull) {
+  TestCallData::Options options;
+  options.max_pending_responses(4);
+  TestServer server(options, /*coalescer=*/nullptr);
+  TestClient slow_client(server.address());
+  auto* call_data = server.wait_for_calls(1)[0];
+
+  const std::string chunk(64 * 1024, 'x');
+  bool accepted = true;
+  for (size_t i = 0; i < 1024 && accepted; ++i) {
+    accepted = call_data->write(make_response(chunk));
+  }
+  // backpressure signal to cancel the request
+  EXPECT_FALSE(accepted);
+
+  const auto status = slow_client.read_all();
+  EXPECT_EQ(status.error_code(), grpc::StatusCode::RESOURCE_EXHAUSTED);
+}
+
+}  // namespace llm
@@ -10,6 +10,7 @@
 #include <boost/algorithm/string.hpp>
 #include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 
 #include "chat_template/chat_template.h"
@@ -25,6 +26,53 @@ thread_local ShortUUID short_uuid;
 
 std::string generate_request_id() { return "chatcmpl-" + short_uuid.random(); }
 
+// merge streaming deltas into a pending response when the client lags behind
+bool coalesce_deltas(proto::ChatResponse* pending,
+                     const proto::ChatResponse& response) {
+  if (response.has_usage() || pending->has_usage()) {
+    return false;
+  }
+  // check all choices can be merged before touching the pending response
+  for (const auto& choice : response.choices()) {
+    // role is only sent with the first message of each choice
+    if (choice.has_message() || choice.delta().has_role()) {
+      return false;
+    }
+    for (const auto& pending_choice : pending->choices()) {
+      if (pending_choice.index() == choice.index() &&
+          (pending_choice.has_finish_reason() ||
+           pending_choice.has_message())) {
+        return false;
+      }
+    }
+  }
+
+  for (const auto& choice : response.choices()) {
+    proto::ChatChoice* target = nullptr;
+    for (auto& pending_choice : *pending->mutable_choices()) {
+      if (pending_choice.index() == choice.index()) {
+        target = &pending_choice;
+        break;
+      }
+    }
+    if (target == nullptr) {
+      *pending->add_choices() = choice;
+      continue;
+    }
+    if (choice.delta().has_content()) {
+      target->mutable_delta()->mutable_content()->append(
+          choice.delta().content());
+    }
+    if (choice.has_logprobs()) {
+      target->mutable_logprobs()->MergeFrom(choice.logprobs());
+    }
+    if (choice.has_finish_reason()) {
+      target->set_finish_reason(choice.finish_reason());
+    }
+  }
+  return true;
+}
+
 bool send_delta_to_client(ChatCallData* call_data,
                           std::unordered_set<size_t>* first_message_sent,
                           const std::string& request_id,
@@ -54,7 +102,9 @@ bool send_delta_to_client(ChatCallData* call_data,
       }
     }
 
-    if (!seq_output.text.empty()) {
+    const bool has_logprobs =
+        seq_output.logprobs.has_value() && !seq_output.logprobs->empty();
+    if (!seq_output.text.empty() || has_logprobs) {
       proto::ChatResponse response;
       response.set_object("chat.completion.chunk");
       response.set_id(request_id);
@@ -64,6 +114,9 @@ bool send_delta_to_client(ChatCallData* call_data,
       choice->set_index(index);
       auto* message = choice->mutable_delta();
       message->set_content(seq_output.text);
+      if (has_logprobs) {
+        add_logprobs(seq_output.logprobs.value(), choice->mutable_logprobs());
+      }
       if (!call_data->write(std::move(response))) {
         return false;
       }
@@ -105,6 +158,9 @@ bool send_result_to_client(ChatCallData* call_data,
     auto* message = choice->mutable_message();
     message->set_role("assistant");
     message->set_content(output.text);
+    if (output.logprobs.has_value()) {
+      add_logprobs(output.logprobs.value(), choice->mutable_logprobs());
+    }
     if (output.finish_reason.has_value()) {
       choice->set_finish_reason(output.finish_reason.value());
     }
@@ -165,6 +221,32 @@ SamplingParams grpc_request_to_sampling_params(
     sampling_params.stop_token_ids = std::vector<int32_t>(
         request.stop_token_ids().begin(), request.stop_token_ids().end());
   }
+  if (request.has_num_beams()) {
+    sampling_params.num_beams = request.num_beams();
+  }
+  if (request.has_length_penalty()) {
+    sampling_params.length_penalty = request.length_penalty();
+  }
+  if (request.has_early_stopping()) {
+    sampling_params.early_stopping = request.early_stopping();
+  }
+  if (request.has_logprobs()) {
+    sampling_params.logprobs = request.logprobs();
+  }
+  if (request.has_top_logprobs()) {
+    sampling_params.top_logprobs = request.top_logprobs();
+  }
+  if (!request.logit_bias().empty()) {
+    sampling_params.logit_bias = std::unordered_map<int32_t, float>(
+        request.logit_bias().begin(), request.logit_bias().end());
+  }
+  if (request.banned_token_ids_size() > 0) {
+    sampling_params.banned_token_ids = std::vector<int32_t>(
+        request.banned_token_ids().begin(), request.banned_token_ids().end());
+  }
+  if (request.has_session_id()) {
+    sampling_params.session_id = request.session_id();
+  }
   return sampling_params;
 }
 
@@ -190,6 +272,13 @@ void ChatHandler::chat_async(ChatCallData* call_data) {
   auto sp = grpc_request_to_sampling_params(grpc_request);
   auto priority = to_priority(grpc_request.priority());
   auto stream = grpc_request.stream();
+  if (stream) {
+    call_data->set_coalescer(coalesce_deltas);
+  }
+
+  // trace the request if sampled
+  auto trace = start_rpc_trace("chat", call_data->context());
+  call_data->set_trace(trace);
 
   std::vector<Message> messages;
   messages.reserve(grpc_request.messages_size());
@@ -228,7 +317,8 @@ void ChatHandler::chat_async(ChatCallData* call_data) {
                                     created_time,
                                     model,
                                     req_output);
-      });
+      },
+      std::move(trace));
 }
 
 }  // namespace llm
@@ -8,6 +8,8 @@
 
 #include <cstdint>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "request/output.h"
 #include "utils.h"
@@ -20,13 +22,71 @@ namespace {
 thread_local ShortUUID short_uuid;
 std::string generate_request_id() { return "cmpl-" + short_uuid.random(); }
 
+// merge streaming deltas into a pending response when the client lags behind
+bool coalesce_deltas(proto::CompletionResponse* pending,
+                     const proto::CompletionResponse& response) {
+  if (response.has_usage() || pending->has_usage()) {
+    return false;
+  }
+  // check all choices can be merged before touching the pending response
+  for (const auto& choice : response.choices()) {
+    for (const auto& pending_choice : pending->choices()) {
+      if (pending_choice.index() == choice.index() &&
+          pending_choice.has_finish_reason()) {
+        return false;
+      }
+    }
+  }
+
+  for (const auto& choice : response.choices()) {
+    proto::Choice* target = nullptr;
+    for (auto& pending_choice : *pending->mutable_choices()) {
+      if (pending_choice.index() == choice.index()) {
+        target = &pending_choice;
+        break;
+      }
+    }
+    if (target == nullptr) {
+      *pending->add_choices() = choice;
+      continue;
+    }
+    target->mutable_text()->append(choice.text());
+    if (choice.has_logprobs()) {
+      target->mutable_logprobs()->MergeFrom(choice.logprobs());
+    }
+    if (choice.has_finish_reason()) {
+      target->set_finish_reason(choice.finish_reason());
+    }
+  }
+  if (response.has_prompt_logprobs()) {
+    pending->mutable_prompt_logprobs()->MergeFrom(response.prompt_logprobs());
+  }
+  return true;
+}
+
 bool send_delta_to_client(CompletionCallData* call_data,
                           const std::string& request_id,
                           int64_t created_time,
                           const std::string& model,
                           const RequestOutput& output) {
+  // send prompt logprobs as a separate message
+  if (output.prompt_logprobs.has_value()) {
+    proto::CompletionResponse response;
+    response.set_object("text_completion");
+    response.set_id(request_id);
+    response.set_created(created_time);
+    response.set_model(model);
+    add_logprobs(output.prompt_logprobs.value(),
+                 response.mutable_prompt_logprobs());
+    if (!call_data->write(std::move(response))) {
+      return false;
+    }
+  }
+
   for (const auto& seq_output : output.outputs) {
-    if (!seq_output.text.empty()) {
+    const bool has_logprobs =
+        seq_output.logprobs.has_value() && !seq_output.logprobs->empty();
+    if (!seq_output.text.empty() || has_logprobs) {
       proto::CompletionResponse response;
       response.set_object("text_completion");
       response.set_id(request_id);
@@ -35,6 +95,9 @@ bool send_delta_to_client(CompletionCallData* call_data,
       auto* choice = response.add_choices();
       choice->set_index(seq_output.index);
       choice->set_text(seq_output.text);
+      if (has_logprobs) {
+        add_logprobs(seq_output.logprobs.value(), choice->mutable_logprobs());
+      }
       if (!call_data->write(std::move(response))) {
         return false;
       }
@@ -75,12 +138,19 @@ bool send_result_to_client(CompletionCallData* call_data,
     auto* choice = response.add_choices();
     choice->set_index(output.index);
     choice->set_text(output.text);
-    // choice->set_logprobs(0);
+    if (output.logprobs.has_value()) {
+      add_logprobs(output.logprobs.value(), choice->mutable_logprobs());
+    }
     if (output.finish_reason.has_value()) {
       choice->set_finish_reason(output.finish_reason.value());
     }
   }
 
+  if (req_output.prompt_logprobs.has_value()) {
+    add_logprobs(req_output.prompt_logprobs.value(),
+                 response.mutable_prompt_logprobs());
+  }
+
   // add usage statistics
   if (req_output.usage.has_value()) {
     const auto& usage = req_output.usage.value();
@@ -139,6 +209,31 @@ SamplingParams grpc_request_to_sampling_params(
     sampling_params.stop_token_ids = std::vector<int32_t>(
         request.stop_token_ids().begin(), request.stop_token_ids().end());
   }
+  if (request.has_num_beams()) {
+    sampling_params.num_beams = request.num_beams();
+  }
+  if (request.has_length_penalty()) {
+    sampling_params.length_penalty = request.length_penalty();
+  }
+  if (request.has_early_stopping()) {
+    sampling_params.early_stopping = request.early_stopping();
+  }
+  if (request.has_logprobs()) {
+    // logprobs of chosen tokens with the given number of alternatives
+    sampling_params.logprobs = true;
+    sampling_params.top_logprobs = request.logprobs();
+  }
+  if (request.has_prompt_logprobs()) {
+    sampling_params.prompt_logprobs = request.prompt_logprobs();
+  }
+  if (!request.logit_bias().empty()) {
+    sampling_params.logit_bias = std::unordered_map<int32_t, float>(
+        request.logit_bias().begin(), request.logit_bias().end());
+  }
+  if (request.banned_token_ids_size() > 0) {
+    sampling_params.banned_token_ids = std::vector<int32_t>(
+        request.banned_token_ids().begin(), request.banned_token_ids().end());
+  }
   return sampling_params;
 }
 
@@ -164,6 +259,13 @@ void CompletionHandler::complete_async(CompletionCallData* call_data) {
   auto sp = grpc_request_to_sampling_params(grpc_request);
   auto priority = to_priority(grpc_request.priority());
   auto stream = grpc_request.stream();
+  if (stream) {
+    call_data->set_coalescer(coalesce_deltas);
+  }
+
+  // trace the request if sampled
+  auto trace = start_rpc_trace("completion", call_data->context());
+  call_data->set_trace(trace);
 
   // schedule the request
   llm_handler_->schedule_async(
@@ -191,7 +293,8 @@ void CompletionHandler::complete_async(CompletionCallData* call_data) {
         // send delta to client
         return send_delta_to_client(
             call_data, request_id, created_time, model, req_output);
-      });
+      },
+      std::move(trace));
 }
 
 }  // namespace llm
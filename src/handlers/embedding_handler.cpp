@@ -0,0 +1,105 @@
+#include "embedding_handler.h"
+
+#include <glog/logging.h>
+#include <grpcpp/grpcpp.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "request/output.h"
+#include "utils.h"
+
+namespace llm {
+
+namespace {
+
+bool send_result_to_client(EmbeddingCallData* call_data,
+                           const std::string& model,
+                           const RequestOutput& req_output) {
+  proto::EmbeddingResponse response;
+  response.set_object("list");
+  response.set_model(model);
+
+  // add embeddings into response
+  for (const auto& output : req_output.outputs) {
+    auto* data = response.add_data();
+    data->set_index(output.index);
+    data->set_object("embedding");
+    data->mutable_embedding()->Add(output.embedding.begin(),
+                                   output.embedding.end());
+  }
+
+  // add usage statistics
+  if (req_output.usage.has_value()) {
+    const auto& usage = req_output.usage.value();
+    auto* proto_usage = response.mutable_usage();
+    proto_usage->set_prompt_tokens(
+        static_cast<int32_t>(usage.num_prompt_tokens));
+    proto_usage->set_total_tokens(static_cast<int32_t>(usage.num_total_tokens));
+  }
+
+  return call_data->write_and_finish(response);
+}
+
+EmbeddingParams grpc_request_to_embedding_params(
+    const proto::EmbeddingRequest& request) {
+  EmbeddingParams embedding_params;
+  if (request.has_pooling()) {
+    embedding_params.pooling = request.pooling();
+  }
+  if (request.has_normalize()) {
+    embedding_params.normalize = request.normalize();
+  }
+  return embedding_params;
+}
+
+}  // namespace
+
+EmbeddingHandler::EmbeddingHandler(LLMHandler* llm_handler,
+                                   const std::vector<std::string>& models)
+    : llm_handler_(llm_handler), models_(models.begin(), models.end()) {
+  CHECK(llm_handler_ != nullptr);
+  CHECK(!models_.empty());
+}
+
+void EmbeddingHandler::embed_async(EmbeddingCallData* call_data) {
+  const auto& grpc_request = call_data->request();
+  // check if model is supported
+  const auto& model = grpc_request.model();
+  if (!models_.contains(model)) {
+    call_data->finish_with_error(grpc::StatusCode::NOT_FOUND,
+                                 "Model not supported");
+    return;
+  }
+
+  auto ep = grpc_request_to_embedding_params(grpc_request);
+  auto priority = to_priority(grpc_request.priority());
+
+  // trace the request if sampled
+  auto trace = start_rpc_trace("embedding", call_data->context());
+  call_data->set_trace(trace);
+
+  // schedule the request
+  llm_handler_->embed_async(
+      grpc_request.input(),
+      std::move(ep),
+      priority,
+      [call_data, model](const RequestOutput& req_output) -> bool {
+        if (req_output.status.has_value()) {
+          const auto& status = req_output.status.value();
+          if (!status.ok()) {
+            return call_data->finish_with_error(
+                to_grpc_status_code(status.code()), status.message());
+          }
+        }
+        // embeddings are only sent once finished
+        if (!req_output.finished) {
+          return true;
+        }
+        return send_result_to_client(call_data, model, req_output);
+      },
+      std::move(trace));
+}
+
+}  // namespace llm
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <absl/container/flat_hash_set.h>
+
+#include "call_data.h"
+#include "embedding.grpc.pb.h"  // IWYU pragma: keep
+#include "handlers/llm_handler.h"
+
+namespace llm {
+
+using EmbeddingCallData =
+    StreamCallData<proto::EmbeddingRequest, proto::EmbeddingResponse>;
+
+// a class to handle embedding requests
+class EmbeddingHandler final {
+ public:
+  EmbeddingHandler(LLMHandler* llm_handler,
+                   const std::vector<std::string>& models);
+
+  // caller needs to guarantee the lifetime of call_data.
+  void embed_async(EmbeddingCallData* call_data);
+
+ private:
+  // llm handler
+  LLMHandler* llm_handler_;
+
+  absl::flat_hash_set<std::string> models_;
+};
+
+}  // namespace llm
@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include <utility>
+
+namespace llm {
+
+// EmbeddingParams is used to specify how to compute the embedding for a
+// request. the prompt is run through prefill only, and hidden states of its
+// tokens are pooled into the embedding.
+struct EmbeddingParams {
+  EmbeddingParams() = default;
+  EmbeddingParams(std::string pooling, bool normalize)
+      : pooling(std::move(pooling)), normalize(normalize) {}
+
+  // how to pool hidden states of prompt tokens, one of "last", "mean" and
+  // "cls". default = "last".
+  // only "last" can reuse kv cache of shared prefixes, the others process
+  // the whole prompt.
+  std::string pooling = "last";
+
+  // whether to normalize the embedding to unit length. default = true.
+  bool normalize = true;
+};
+
+}  // namespace llm
@@ -1,15 +1,26 @@
 #include "llm_handler.h"
 
+#include <absl/synchronization/blocking_counter.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <atomic>
+#include <limits>
+#include <map>
 #include <memory>
+#include <numeric>
+#include <optional>
+#include <string_view>
 #include <thread>
 #include <utility>
 
 #include "common/metrics.h"
 #include "common/scope_guard.h"
 #include "common/timer.h"
+#include "common/tracing.h"
+#include "engine/disaggregated_engine.h"
 #include "engine/utils.h"
 #include "models/model_args.h"
 #include "models/model_registry.h"
@@ -44,25 +55,45 @@ DEFINE_COUNTER_INSTANCE(request_unimplemented,
                         request_status_total,
                         {{"code", "UNIMPLEMENTED"}});
 
-DEFINE_COUNTER_FAMILY(request_handling_latency_seconds,
-                      "Request handling latency in seconds");
-DEFINE_COUNTER_INSTANCE(chat_handling_latency_seconds,
-                        request_handling_latency_seconds,
-                        {{"type", "chat"}});
-DEFINE_COUNTER_INSTANCE(completion_handling_latency_seconds,
-                        request_handling_latency_seconds,
-                        {{"type", "completion"}});
+DEFINE_HISTOGRAM_FAMILY(request_handling_latency_seconds,
+                        "Request handling latency in seconds");
+DEFINE_HISTOGRAM_INSTANCE(chat_handling_latency_seconds,
+                          request_handling_latency_seconds,
+                          {{"type", "chat"}});
+DEFINE_HISTOGRAM_INSTANCE(completion_handling_latency_seconds,
+                          request_handling_latency_seconds,
+                          {{"type", "completion"}});
+DEFINE_HISTOGRAM_INSTANCE(embedding_handling_latency_seconds,
+                          request_handling_latency_seconds,
+                          {{"type", "embedding"}});
 
-DEFINE_COUNTER(tokenization_latency_seconds,
-               "Prompt tokenization latency in seconds");
-DEFINE_COUNTER(chat_template_latency_seconds,
-               "Chat template latency in seconds");
+DEFINE_LATENCY_HISTOGRAM(tokenization_latency_seconds,
+                         "Prompt tokenization latency in seconds");
+DEFINE_LATENCY_HISTOGRAM(chat_template_latency_seconds,
+                         "Chat template latency in seconds");
+
+DEFINE_COUNTER_FAMILY(chat_session_lookups_total,
+                      "Total number of chat session lookups");
+DEFINE_COUNTER_INSTANCE(chat_session_hit,
+                        chat_session_lookups_total,
+                        {{"result", "hit"}});
+DEFINE_COUNTER_INSTANCE(chat_session_miss,
+                        chat_session_lookups_total,
+                        {{"result", "miss"}});
+DEFINE_COUNTER(chat_session_prompt_tokens_total,
+               "Total number of prompt tokens of chat requests in sessions");
+DEFINE_COUNTER(chat_session_reused_tokens_total,
+               "Total number of prompt tokens reused from the last turn of "
+               "chat sessions instead of tokenizing again");
 
 namespace llm {
 namespace {
 
 #define CALLBACK_WITH_ERROR(CODE, MSG) callback(Status{CODE, MSG});
 
+// the number of prompts tokenized together by one handling thread
+constexpr size_t kEncodeChunkSize = 64;
+
 void log_request_status(StatusCode code) {
   switch (code) {
     case StatusCode::OK:
@@ -119,11 +150,23 @@ bool verify_params(const SamplingParams& sp, OutputCallback callback) {
     return false;
   }
 
-  // logprobs <= 5
-  // if (sp.logprobs > 5) {
-  //   CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
-  //                                 "logprobs must be between 0 and 5");
-  // }
+  // logit_bias between [-100, 100]
+  if (sp.logit_bias.has_value()) {
+    for (const auto& [token_id, bias] : sp.logit_bias.value()) {
+      if (bias < -100.0 || bias > 100.0) {
+        CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
+                            "logit_bias must be between -100 and 100");
+        return false;
+      }
+    }
+  }
+
+  // top_logprobs <= 20
+  if (sp.top_logprobs > 20) {
+    CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
+                        "top_logprobs must be between 0 and 20");
+    return false;
+  }
 
   // presence_penalty between [-2.0, 2.0]
   if (sp.presence_penalty < -2.0 || sp.presence_penalty > 2.0) {
@@ -141,11 +184,51 @@ bool verify_params(const SamplingParams& sp, OutputCallback callback) {
   return true;
 }
 
-}  // namespace
+// merge logit biases and banned tokens into sparse biases sorted by token id,
+// banned tokens have -inf biases. returns false if any token is out of vocab.
+bool to_logit_bias(const SamplingParams& sp,
+                   int64_t vocab_size,
+                   std::vector<std::pair<int32_t, float>>* logit_bias) {
+  std::map<int32_t, float> biases;
+  if (sp.logit_bias.has_value()) {
+    for (const auto& [token_id, bias] : sp.logit_bias.value()) {
+      biases[token_id] = bias;
+    }
+  }
+  if (sp.banned_token_ids.has_value()) {
+    for (const int32_t token_id : sp.banned_token_ids.value()) {
+      biases[token_id] = -std::numeric_limits<float>::infinity();
+    }
+  }
+  for (const auto& [token_id, bias] : biases) {
+    if (token_id < 0 || token_id >= vocab_size) {
+      return false;
+    }
+    // zero biases are no-ops
+    if (bias != 0.0) {
+      logit_bias->emplace_back(token_id, bias);
+    }
+  }
+  return true;
+}
 
-LLMHandler::LLMHandler(const Options& options) : options_(options) {
+std::optional<PoolingType> to_pooling_type(const std::string& pooling) {
+  if (pooling == "last") {
+    return PoolingType::LAST;
+  }
+  if (pooling == "mean") {
+    return PoolingType::MEAN;
+  }
+  if (pooling == "cls") {
+    return PoolingType::CLS;
+  }
+  return std::nullopt;
+}
+
+std::unique_ptr<Engine> create_engine(
+    const LLMHandler::Options& options,
+    const std::vector<torch::Device>& devices) {
   // construct engine
-  const auto devices = parse_devices(options.devices().value_or("auto"));
   LOG(INFO) << "Creating engine with devices: " << to_string(devices);
 
   // create a speculative engine if draft model path is provided
@@ -169,31 +252,168 @@ LLMHandler::LLMHandler(const Options& options) : options_(options) {
 
     auto spec_engine = std::make_unique<SpeculativeEngine>(spec_options);
     CHECK(spec_engine->init(options.model_path(), draft_model_path));
-    engine_ = std::move(spec_engine);
-  } else {
-    LLMEngine::Options eng_options;
-    eng_options.devices(devices)
-        .block_size(options.block_size())
-        .max_cache_size(options.max_cache_size())
-        .max_memory_utilization(options.max_memory_utilization())
-        .enable_prefix_cache(options.enable_prefix_cache())
-        .enable_cuda_graph(options.enable_cuda_graph())
-        .cuda_graph_max_seq_len(options.cuda_graph_max_seq_len())
-        .cuda_graph_batch_sizes(options.cuda_graph_batch_sizes());
+    return spec_engine;
+  }
 
-    auto engine = std::make_unique<LLMEngine>(eng_options);
-    CHECK(engine->init(options.model_path()));
-    engine_ = std::move(engine);
+  LLMEngine::Options eng_options;
+  eng_options.devices(devices)
+      .block_size(options.block_size())
+      .max_cache_size(options.max_cache_size())
+      .max_memory_utilization(options.max_memory_utilization())
+      .enable_prefix_cache(options.enable_prefix_cache())
+      .enable_cuda_graph(options.enable_cuda_graph())
+      .cuda_graph_max_seq_len(options.cuda_graph_max_seq_len())
+      .cuda_graph_batch_sizes(options.cuda_graph_batch_sizes())
+      .enable_vocab_parallel_sampling(
+          options.enable_vocab_parallel_sampling())
+      .max_cpu_activation_cache_size(options.max_cpu_activation_cache_size())
+      .max_tokens_per_batch(options.max_tokens_per_batch());
+
+  auto engine = std::make_unique<LLMEngine>(eng_options);
+  CHECK(engine->init(options.model_path()));
+
+  // create a disaggregated engine if prefill devices are provided
+  const auto prefill_devices_str = options.prefill_devices().value_or("");
+  if (prefill_devices_str.empty()) {
+    return engine;
+  }
+  const auto prefill_devices = parse_devices(prefill_devices_str);
+  LOG(INFO) << "Using prefill devices: " << to_string(prefill_devices);
+  // prefill blocks are scratch blocks that don't outlive a step, and cuda
+  // graphs are only captured for decoding.
+  eng_options.devices(prefill_devices)
+      .enable_prefix_cache(false)
+      .enable_cuda_graph(false);
+  auto prefill_engine = std::make_unique<LLMEngine>(eng_options);
+  CHECK(prefill_engine->init(options.model_path()));
+
+  auto to_decode_channel = std::make_unique<LocalKVTransferChannel>(devices);
+  auto to_prefill_channel =
+      std::make_unique<LocalKVTransferChannel>(prefill_devices);
+  return std::make_unique<DisaggregatedEngine>(std::move(prefill_engine),
+                                               std::move(engine),
+                                               std::move(to_decode_channel),
+                                               std::move(to_prefill_channel));
+}
+
+std::vector<std::unique_ptr<Engine>> create_engines(
+    const LLMHandler::Options& options) {
+  const auto devices = parse_devices(options.devices().value_or("auto"));
+  const size_t num_replicas = options.num_replicas();
+  CHECK_GT(num_replicas, 0) << "At least one replica is required";
+
+  std::vector<std::unique_ptr<Engine>> engines;
+  if (num_replicas == 1) {
+    engines.push_back(create_engine(options, devices));
+    return engines;
+  }
+
+  CHECK(options.draft_model_path().value_or("").empty() &&
+        options.prefill_devices().value_or("").empty())
+      << "Speculative decoding and disaggregation are not supported with "
+         "multiple replicas";
+  // all replicas share the device if only one is given, e.g. cpu
+  const bool share_device = devices.size() == 1;
+  CHECK(share_device || devices.size() % num_replicas == 0)
+      << "Devices can't be split evenly among " << num_replicas
+      << " replicas: " << to_string(devices);
+  const size_t num_devices = share_device ? 1 : devices.size() / num_replicas;
+  for (size_t i = 0; i < num_replicas; ++i) {
+    const auto begin = devices.begin() + (share_device ? 0 : i * num_devices);
+    const std::vector<torch::Device> replica_devices(begin,
+                                                     begin + num_devices);
+    engines.push_back(create_engine(options, replica_devices));
+  }
+  return engines;
+}
+
+std::vector<std::unique_ptr<Engine>> to_engines(
+    std::unique_ptr<Engine> engine) {
+  std::vector<std::unique_ptr<Engine>> engines;
+  engines.push_back(std::move(engine));
+  return engines;
+}
+
+// get the turn of a finished chat request to keep for its session, nullptr if
+// the request didn't complete.
+std::shared_ptr<SessionCache::Turn> to_session_turn(const Request& request) {
+  if (request.is_cancelled() || request.sequences.empty()) {
+    return nullptr;
+  }
+  const Sequence& seq = request.sequences.front();
+  if (!seq.is_finished()) {
+    return nullptr;
+  }
+  const auto token_ids = seq.token_ids();
+  size_t end = token_ids.size();
+  // the stop token is rendered by the chat template in the next turn
+  if (seq.finish_reason() == FinishReason::STOP &&
+      end > seq.num_prompt_tokens()) {
+    const int32_t last_token_id = token_ids[end - 1];
+    const auto& criteria = request.stopping_criteria;
+    if (last_token_id == criteria.eos_token_id ||
+        criteria.stop_token_ids.count(last_token_id) > 0) {
+      --end;
+    }
   }
+  auto turn = std::make_shared<SessionCache::Turn>();
+  turn->prompt = request.prompt;
+  turn->prompt_token_ids = request.prompt_tokens;
+  turn->reply_token_ids = token_ids.slice(seq.num_prompt_tokens(), end);
+  return turn;
+}
 
-  model_args_ = engine_->model_args();
+}  // namespace
+
+LLMHandler::LLMHandler(const Options& options)
+    : LLMHandler(create_engines(options), options) {}
+
+LLMHandler::LLMHandler(std::unique_ptr<Engine> engine, const Options& options)
+    : LLMHandler(to_engines(std::move(engine)), options) {}
+
+LLMHandler::LLMHandler(std::vector<std::unique_ptr<Engine>> engines,
+                       const Options& options)
+    : options_(options), engines_(std::move(engines)) {
+  CHECK(!engines_.empty());
+  for (const auto& engine : engines_) {
+    CHECK(engine != nullptr);
+  }
+  const auto& engine = engines_[0];
+  model_args_ = engine->model_args();
 
   ContinuousScheduler::Options scheduler_options;
   scheduler_options.max_tokens_per_batch(options.max_tokens_per_batch())
       .max_seqs_per_batch(options.max_seqs_per_batch())
-      .num_speculative_tokens(options.num_speculative_tokens());
-  scheduler_ =
-      std::make_unique<ContinuousScheduler>(engine_.get(), scheduler_options);
+      .num_speculative_tokens(options.num_speculative_tokens())
+      .num_decode_steps(options.num_decode_steps())
+      .max_queue_wait_high(options.max_queue_wait_high())
+      .max_queue_wait_normal(options.max_queue_wait_normal())
+      .max_queue_wait_low(options.max_queue_wait_low())
+      .max_kv_demand_high(options.max_kv_demand_high())
+      .max_kv_demand_normal(options.max_kv_demand_normal())
+      .max_kv_demand_low(options.max_kv_demand_low());
+  std::vector<ReplicaRouter::Replica> replicas;
+  for (const auto& replica_engine : engines_) {
+    auto scheduler = std::make_unique<ContinuousScheduler>(
+        replica_engine.get(), scheduler_options);
+    Scheduler* scheduler_ptr = scheduler.get();
+    replicas.push_back(
+        {&replica_engine->block_manager()->prefix_cache_summary(),
+         [scheduler_ptr] { return scheduler_ptr->num_requests(); }});
+    schedulers_.push_back(std::move(scheduler));
+  }
+  if (engines_.size() > 1) {
+    LOG(INFO) << "Routing requests among " << engines_.size() << " replicas";
+    const uint32_t block_size =
+        engine->block_manager()->options().block_size();
+    router_ = std::make_unique<ReplicaRouter>(
+        std::move(replicas), block_size, ReplicaRouter::Options());
+  }
+
+  if (options.max_chat_sessions() > 0) {
+    session_cache_ =
+        std::make_shared<SessionCache>(options.max_chat_sessions());
+  }
 
   // construct chat template
   auto factory = ModelRegistry::get_default_chat_template_factory(
@@ -203,7 +423,7 @@ LLMHandler::LLMHandler(const Options& options) : options_(options) {
               << model_args_.model_type();
     chat_template_ = factory();
   } else {
-    const auto& tokenizer_args = engine_->tokenizer_args();
+    const auto& tokenizer_args = engine->tokenizer_args();
     if (!tokenizer_args.chat_template().empty()) {
       LOG(WARNING) << "No default chat template found for model type: "
                    << model_args_.model_type();
@@ -211,7 +431,7 @@ LLMHandler::LLMHandler(const Options& options) : options_(options) {
   }
 
   // construct tokenizers and handling threads
-  const auto* tokenizer = engine_->tokenizer();
+  const auto* tokenizer = engine->tokenizer();
   for (size_t i = 0; i < options.num_handling_threads(); ++i) {
     // create a tokenizer for each thread for now
     tokenizers_.emplace_back(tokenizer->clone());
@@ -237,9 +457,10 @@ void LLMHandler::schedule_async(std::string prompt,
                                 SamplingParams sp,
                                 Priority priority,
                                 bool stream,
-                                OutputCallback callback) {
+                                OutputCallback callback,
+                                std::shared_ptr<RequestTrace> trace) {
   // add one pending request
-  scheduler_->inc_pending_requests(1);
+  inc_pending_requests(1);
   schedule(std::move(prompt),
            std::move(sp),
            priority,
@@ -249,16 +470,18 @@ void LLMHandler::schedule_async(std::string prompt,
                log_request_status(output.status.value().code());
              }
              return callback(output);
-           });
+           },
+           std::move(trace));
 }
 
 void LLMHandler::schedule_chat_async(std::vector<Message> messages,
                                      SamplingParams sp,
                                      Priority priority,
                                      bool stream,
-                                     OutputCallback callback) {
+                                     OutputCallback callback,
+                                     std::shared_ptr<RequestTrace> trace) {
   // add one pending request
-  scheduler_->inc_pending_requests(1);
+  inc_pending_requests(1);
   schedule(std::move(messages),
            std::move(sp),
            priority,
@@ -268,7 +491,8 @@ void LLMHandler::schedule_chat_async(std::vector<Message> messages,
                log_request_status(output.status.value().code());
              }
              return callback(output);
-           });
+           },
+           std::move(trace));
 }
 
 void LLMHandler::schedule_batch_async(std::vector<std::string> prompts,
@@ -280,20 +504,20 @@ void LLMHandler::schedule_batch_async(std::vector<std::string> prompts,
       << "Number of prompts and sampling parameters should be the same";
 
   const size_t num_requests = prompts.size();
-  scheduler_->inc_pending_requests(num_requests);
-  for (size_t i = 0; i < num_requests; ++i) {
-    schedule(std::move(prompts[i]),
-             // the sampling parameter may be shared
-             sps.size() == 1 ? sps[0] : std::move(sps[i]),
-             priority,
-             stream,
-             [i, callback](const RequestOutput& output) {
-               if (output.status.has_value()) {
-                 log_request_status(output.status.value().code());
-               }
-               return callback(i, output);
-             });
-  }
+  inc_pending_requests(num_requests);
+  std::vector<size_t> indices(num_requests);
+  std::iota(indices.begin(), indices.end(), 0);
+  auto shared_prompts =
+      std::make_shared<std::vector<std::string>>(std::move(prompts));
+  schedule_batch(std::move(indices),
+                 std::move(sps),
+                 priority,
+                 stream,
+                 std::move(callback),
+                 [prompts = std::move(shared_prompts)](
+                     size_t index) -> std::optional<std::string> {
+                   return std::move((*prompts)[index]);
+                 });
 }
 
 void LLMHandler::schedule_chat_batch_async(
@@ -306,11 +530,18 @@ void LLMHandler::schedule_chat_batch_async(
       << "Number of conversations and sampling parameters should be the same";
 
   const size_t num_requests = conversations.size();
-  scheduler_->inc_pending_requests(num_requests);
-  for (size_t i = 0; i < conversations.size(); ++i) {
+  inc_pending_requests(num_requests);
+  std::vector<size_t> indices;
+  indices.reserve(num_requests);
+  for (size_t i = 0; i < num_requests; ++i) {
+    const SamplingParams& sp = sps.size() == 1 ? sps[0] : sps[i];
+    if (!sp.session_id.has_value() || session_cache_ == nullptr) {
+      indices.push_back(i);
+      continue;
+    }
+    // turns of a session reuse token ids of the last turn instead
     schedule(std::move(conversations[i]),
-             // the sampling parameter may be shared
-             sps.size() == 1 ? sps[0] : std::move(sps[i]),
+             sp,
              priority,
              stream,
              [i, callback](const RequestOutput& output) {
@@ -318,25 +549,253 @@ void LLMHandler::schedule_chat_batch_async(
                  log_request_status(output.status.value().code());
                }
                return callback(i, output);
-             });
+             },
+             /*trace=*/nullptr);
+  }
+  auto shared_conversations =
+      std::make_shared<std::vector<std::vector<Message>>>(
+          std::move(conversations));
+  schedule_batch(std::move(indices),
+                 std::move(sps),
+                 priority,
+                 stream,
+                 std::move(callback),
+                 [this, conversations = std::move(shared_conversations)](
+                     size_t index) -> std::optional<std::string> {
+                   AUTO_HISTOGRAM(chat_template_latency_seconds);
+                   return chat_template_ == nullptr
+                              ? std::nullopt
+                              : chat_template_->apply((*conversations)[index]);
+                 });
+}
+
+void LLMHandler::schedule_batch(
+    std::vector<size_t> indices,
+    std::vector<SamplingParams> sps,
+    Priority priority,
+    bool stream,
+    BatchOutputCallback callback,
+    std::function<std::optional<std::string>(size_t index)> get_prompt) {
+  auto shared_indices =
+      std::make_shared<const std::vector<size_t>>(std::move(indices));
+  auto shared_sps =
+      std::make_shared<const std::vector<SamplingParams>>(std::move(sps));
+  const size_t num_requests = shared_indices->size();
+  // each chunk is encoded with one call, which tokenizers may parallelize
+  // internally, the same way as offline inference.
+  for (size_t start = 0; start < num_requests; start += kEncodeChunkSize) {
+    const size_t end = std::min(start + kEncodeChunkSize, num_requests);
+    auto task = [this,
+                 indices = shared_indices,
+                 sps = shared_sps,
+                 start,
+                 end,
+                 priority,
+                 stream,
+                 batch_callback = callback,
+                 get_prompt](size_t tid) {
+      // remove the pending requests of the chunk after scheduling
+      SCOPE_GUARD([this, start, end] {
+        for (size_t k = start; k < end; ++k) {
+          dec_pending_requests();
+        }
+      });
+      auto output_callback = [&batch_callback](size_t index) {
+        return [index, batch_callback](const RequestOutput& output) {
+          if (output.status.has_value()) {
+            log_request_status(output.status.value().code());
+          }
+          return batch_callback(index, output);
+        };
+      };
+      auto sampling_params = [&](size_t index) -> const SamplingParams& {
+        return sps->size() == 1 ? (*sps)[0] : (*sps)[index];
+      };
+
+      // texts point into prompts, which must not reallocate
+      std::vector<size_t> idxes;
+      std::vector<std::string> prompts;
+      std::vector<std::string_view> texts;
+      prompts.reserve(end - start);
+      for (size_t k = start; k < end; ++k) {
+        const size_t i = (*indices)[k];
+        OutputCallback callback = output_callback(i);
+        if (!verify_params(sampling_params(i), callback)) {
+          continue;
+        }
+        auto prompt = get_prompt(i);
+        if (!prompt.has_value() || prompt->empty()) {
+          CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
+                              "Failed to construct prompt");
+          continue;
+        }
+        idxes.push_back(i);
+        prompts.push_back(std::move(prompt.value()));
+        texts.emplace_back(prompts.back());
+      }
+
+      Timer timer;
+      std::vector<std::vector<int32_t>> ids;
+      std::vector<uint8_t> is_valid(idxes.size(), 1);
+      if (!texts.empty() && tokenizers_[tid]->batch_encode(texts, &ids)) {
+        const double latency = timer.elapsed_seconds() / texts.size();
+        for (size_t k = 0; k < idxes.size(); ++k) {
+          HISTOGRAM_OBSERVE(tokenization_latency_seconds, latency);
+        }
+      } else {
+        // encode one by one to report errors of each prompt
+        ids.assign(idxes.size(), {});
+        for (size_t k = 0; k < idxes.size(); ++k) {
+          is_valid[k] = encode_prompt(
+              tid, prompts[k], nullptr, &ids[k], output_callback(idxes[k]));
+        }
+      }
+
+      for (size_t k = 0; k < idxes.size(); ++k) {
+        if (!is_valid[k]) {
+          continue;
+        }
+        const size_t i = idxes[k];
+        OutputCallback callback = output_callback(i);
+        auto request = build_request(*tokenizers_[tid],
+                                     std::move(prompts[k]),
+                                     std::move(ids[k]),
+                                     sampling_params(i),
+                                     priority,
+                                     stream,
+                                     callback,
+                                     /*trace=*/nullptr);
+        if (!request) {
+          continue;
+        }
+
+        Scheduler* scheduler = route(*request);
+        // shed the request early if the replica is overloaded
+        if (Status status = scheduler->admit(*request); !status.ok()) {
+          callback(std::move(status));
+          continue;
+        }
+        if (!scheduler->schedule(request)) {
+          CALLBACK_WITH_ERROR(StatusCode::RESOURCE_EXHAUSTED,
+                              "No available resources to schedule request");
+        }
+      }
+    };
+    // add into the queue
+    queue_.push(std::move(task));
   }
 }
 
+void LLMHandler::embed_async(std::string prompt,
+                             EmbeddingParams ep,
+                             Priority priority,
+                             OutputCallback callback,
+                             std::shared_ptr<RequestTrace> trace) {
+  // add one pending request
+  inc_pending_requests(1);
+  schedule_embedding(
+      std::move(prompt),
+      std::move(ep),
+      priority,
+      [callback = std::move(callback)](const RequestOutput& output) {
+        if (output.status.has_value()) {
+          log_request_status(output.status.value().code());
+        }
+        return callback(output);
+      },
+      std::move(trace));
+}
+
+void LLMHandler::embed_batch_async(std::vector<std::string> prompts,
+                                   EmbeddingParams ep,
+                                   Priority priority,
+                                   BatchOutputCallback callback) {
+  const size_t num_requests = prompts.size();
+  inc_pending_requests(num_requests);
+  for (size_t i = 0; i < num_requests; ++i) {
+    schedule_embedding(std::move(prompts[i]),
+                       ep,
+                       priority,
+                       [i, callback](const RequestOutput& output) {
+                         if (output.status.has_value()) {
+                           log_request_status(output.status.value().code());
+                         }
+                         return callback(i, output);
+                       },
+                       /*trace=*/nullptr);
+  }
+}
+
+void LLMHandler::schedule_embedding(std::string prompt,
+                                    EmbeddingParams ep,
+                                    Priority priority,
+                                    OutputCallback callback,
+                                    std::shared_ptr<RequestTrace> trace) {
+  const absl::Time enqueue_time = trace ? absl::Now() : absl::InfinitePast();
+  auto task = [this,
+               prompt = std::move(prompt),
+               ep = std::move(ep),
+               priority,
+               callback = std::move(callback),
+               trace = std::move(trace),
+               enqueue_time](size_t tid) mutable {
+    AUTO_HISTOGRAM(embedding_handling_latency_seconds);
+    if (trace) {
+      trace->add_span("handler_queue", enqueue_time, absl::Now());
+    }
+    // remove the pending request after scheduling
+    SCOPE_GUARD([this] { dec_pending_requests(); });
+
+    if (prompt.empty()) {
+      CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
+                          "Prompt should not be empty");
+      return;
+    }
+
+    auto request = create_embedding_request(
+        tid, std::move(prompt), ep, priority, callback, std::move(trace));
+    if (!request) {
+      return;
+    }
+
+    Scheduler* scheduler = route(*request);
+    // shed the request early if the replica is overloaded
+    if (Status status = scheduler->admit(*request); !status.ok()) {
+      callback(std::move(status));
+      return;
+    }
+    if (!scheduler->schedule(request)) {
+      CALLBACK_WITH_ERROR(StatusCode::RESOURCE_EXHAUSTED,
+                          "No available resources to schedule request");
+      return;
+    }
+  };
+  // add into the queue
+  queue_.push(std::move(task));
+}
+
 void LLMHandler::schedule(std::string prompt,
                           SamplingParams sp,
                           Priority priority,
                           bool stream,
-                          OutputCallback callback) {
+                          OutputCallback callback,
+                          std::shared_ptr<RequestTrace> trace) {
+  const absl::Time enqueue_time = trace ? absl::Now() : absl::InfinitePast();
   auto task = [this,
                prompt = std::move(prompt),
                sp = std::move(sp),
                priority,
                stream,
-               callback = std::move(callback)](size_t tid) mutable {
-    AUTO_COUNTER(completion_handling_latency_seconds);
+               callback = std::move(callback),
+               trace = std::move(trace),
+               enqueue_time](size_t tid) mutable {
+    AUTO_HISTOGRAM(completion_handling_latency_seconds);
+    if (trace) {
+      trace->add_span("handler_queue", enqueue_time, absl::Now());
+    }
 
     // remove the pending request after scheduling
-    SCOPE_GUARD([this] { scheduler_->dec_pending_requests(); });
+    SCOPE_GUARD([this] { dec_pending_requests(); });
 
     Timer timer;
     // verify the prompt
@@ -344,13 +803,24 @@ void LLMHandler::schedule(std::string prompt,
       return;
     }
 
-    auto request =
-        create_request(tid, std::move(prompt), sp, priority, stream, callback);
+    auto request = create_request(tid,
+                                  std::move(prompt),
+                                  sp,
+                                  priority,
+                                  stream,
+                                  callback,
+                                  std::move(trace));
     if (!request) {
       return;
     }
 
-    if (!scheduler_->schedule(request)) {
+    Scheduler* scheduler = route(*request);
+    // shed the request early if the replica is overloaded
+    if (Status status = scheduler->admit(*request); !status.ok()) {
+      callback(std::move(status));
+      return;
+    }
+    if (!scheduler->schedule(request)) {
       CALLBACK_WITH_ERROR(StatusCode::RESOURCE_EXHAUSTED,
                           "No available resources to schedule request");
       return;
@@ -364,29 +834,42 @@ void LLMHandler::schedule(std::vector<Message> messages,
                           SamplingParams sp,
                           Priority priority,
                           bool stream,
-                          OutputCallback callback) {
+                          OutputCallback callback,
+                          std::shared_ptr<RequestTrace> trace) {
+  const absl::Time enqueue_time = trace ? absl::Now() : absl::InfinitePast();
   auto task = [this,
                messages = std::move(messages),
                sp = std::move(sp),
                priority,
                stream,
-               callback = std::move(callback)](size_t tid) mutable {
-    AUTO_COUNTER(chat_handling_latency_seconds);
+               callback = std::move(callback),
+               trace = std::move(trace),
+               enqueue_time](size_t tid) mutable {
+    AUTO_HISTOGRAM(chat_handling_latency_seconds);
+    if (trace) {
+      trace->add_span("handler_queue", enqueue_time, absl::Now());
+    }
     // remove the pending request after scheduling
-    SCOPE_GUARD([this] { scheduler_->dec_pending_requests(); });
+    SCOPE_GUARD([this] { dec_pending_requests(); });
 
     // verify the prompt
     if (!verify_params(sp, callback)) {
       return;
     }
 
-    auto request =
-        create_chat_request(tid, messages, sp, priority, stream, callback);
+    auto request = create_chat_request(
+        tid, messages, sp, priority, stream, callback, std::move(trace));
     if (!request) {
       return;
     }
 
-    if (!scheduler_->schedule(request)) {
+    Scheduler* scheduler = route(*request);
+    // shed the request early if the replica is overloaded
+    if (Status status = scheduler->admit(*request); !status.ok()) {
+      callback(std::move(status));
+      return;
+    }
+    if (!scheduler->schedule(request)) {
       CALLBACK_WITH_ERROR(StatusCode::RESOURCE_EXHAUSTED,
                           "No available resources to schedule request");
       return;
@@ -407,59 +890,331 @@ void LLMHandler::handling_loop(size_t tid) {
   }
 }
 
+Scheduler* LLMHandler::route(const Request& request) const {
+  if (router_ == nullptr) {
+    return schedulers_[0].get();
+  }
+  return schedulers_[router_->route(request.prompt_tokens)].get();
+}
+
+void LLMHandler::inc_pending_requests(size_t count) {
+  for (auto& scheduler : schedulers_) {
+    scheduler->inc_pending_requests(count);
+  }
+}
+
+void LLMHandler::dec_pending_requests() {
+  for (auto& scheduler : schedulers_) {
+    scheduler->dec_pending_requests();
+  }
+}
+
 void LLMHandler::start() {
-  loop_thread_ = std::thread([this]() {
-    const bool running = running_.load(std::memory_order_relaxed);
-    CHECK(!running) << "Handler is already running";
-
-    running_.store(true, std::memory_order_relaxed);
-    const auto timeout = absl::Milliseconds(500);
-    while (!stoped_.load(std::memory_order_relaxed)) {
-      // move scheduler forward
-      scheduler_->step(timeout);
-    }
-    running_.store(false, std::memory_order_relaxed);
-  });
+  const bool running = running_.exchange(true);
+  CHECK(!running) << "Handler is already running";
+
+  for (auto& scheduler : schedulers_) {
+    loop_threads_.emplace_back([this, scheduler = scheduler.get()]() {
+      const auto timeout = absl::Milliseconds(500);
+      while (!stoped_.load(std::memory_order_relaxed)) {
+        // move scheduler forward
+        scheduler->step(timeout);
+      }
+    });
+  }
 }
 
 // stop the engine
 void LLMHandler::stop() {
   // set stop flag
   stoped_.store(true, std::memory_order_relaxed);
-  // wait for the loop thread to finish
-  if (loop_thread_.joinable()) {
-    loop_thread_.join();
+  // wait for the loop threads to finish
+  for (auto& thread : loop_threads_) {
+    thread.join();
+  }
+  if (!loop_threads_.empty()) {
+    loop_threads_.clear();
+    running_.store(false, std::memory_order_relaxed);
   }
 }
 
 void LLMHandler::run_until_complete() {
-  const bool running = running_.load(std::memory_order_relaxed);
+  const bool running = running_.exchange(true);
   CHECK(!running) << "Handler is already running";
 
-  running_.store(true, std::memory_order_relaxed);
-  scheduler_->run_until_complete();
+  run_replicas_until_complete();
   running_.store(false, std::memory_order_relaxed);
 }
 
-std::unique_ptr<Request> LLMHandler::create_request(size_t tid,
-                                                    std::string prompt,
-                                                    const SamplingParams& sp,
-                                                    Priority priority,
-                                                    bool stream,
-                                                    OutputCallback callback) {
+void LLMHandler::run_replicas_until_complete() {
+  if (schedulers_.size() == 1) {
+    schedulers_[0]->run_until_complete();
+    return;
+  }
+  std::vector<std::thread> threads;
+  threads.reserve(schedulers_.size());
+  for (auto& scheduler : schedulers_) {
+    threads.emplace_back(
+        [scheduler = scheduler.get()] { scheduler->run_until_complete(); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+std::vector<RequestOutput> LLMHandler::generate(
+    std::vector<std::string> prompts,
+    std::vector<SamplingParams> sps,
+    Priority priority) {
+  return generate_offline(
+      prompts.size(),
+      std::move(sps),
+      priority,
+      [&prompts](size_t index) -> std::optional<std::string> {
+        return std::move(prompts[index]);
+      });
+}
+
+std::vector<RequestOutput> LLMHandler::generate_chat(
+    std::vector<std::vector<Message>> conversations,
+    std::vector<SamplingParams> sps,
+    Priority priority) {
+  return generate_offline(
+      conversations.size(),
+      std::move(sps),
+      priority,
+      [this, &conversations](size_t index) -> std::optional<std::string> {
+        AUTO_HISTOGRAM(chat_template_latency_seconds);
+        return chat_template_ == nullptr
+                   ? std::nullopt
+                   : chat_template_->apply(conversations[index]);
+      });
+}
+
+std::vector<RequestOutput> LLMHandler::embed(std::vector<std::string> prompts,
+                                              EmbeddingParams ep) {
+  // outputs are written into their slots directly
+  std::vector<RequestOutput> outputs(prompts.size());
+  embed_batch_async(std::move(prompts),
+                    std::move(ep),
+                    Priority::NORMAL,
+                    [&outputs](size_t index, RequestOutput output) {
+                      outputs[index] = std::move(output);
+                      return true;
+                    });
+  // pending requests keep schedulers running until all are scheduled
+  run_until_complete();
+  return outputs;
+}
+
+std::vector<RequestOutput> LLMHandler::generate_offline(
+    size_t num_prompts,
+    std::vector<SamplingParams> sps,
+    Priority priority,
+    const std::function<std::optional<std::string>(size_t index)>&
+        get_prompt) {
+  CHECK(num_prompts == sps.size() || sps.size() == 1)
+      << "Number of prompts and sampling parameters should be the same";
+  const bool running = running_.exchange(true);
+  CHECK(!running) << "Handler is already running";
+
+  // outputs are written into their slots directly, no streaming
+  std::vector<RequestOutput> outputs(num_prompts);
+  auto output_callback = [&outputs](size_t index) -> OutputCallback {
+    return [&outputs, index](RequestOutput output) {
+      if (output.status.has_value()) {
+        log_request_status(output.status.value().code());
+      }
+      outputs[index] = std::move(output);
+      return true;
+    };
+  };
+  auto sampling_params = [&sps](size_t index) -> const SamplingParams& {
+    return sps.size() == 1 ? sps[0] : sps[index];
+  };
+
+  // tokenize all prompts with handling threads, in chunks to amortize the
+  // queueing overhead. each chunk is encoded with one call, which tokenizers
+  // may parallelize internally.
+  std::vector<std::string> prompts(num_prompts);
+  std::vector<std::vector<int>> prompt_tokens(num_prompts);
+  std::vector<uint8_t> is_valid(num_prompts, 0);
+  const size_t num_chunks =
+      (num_prompts + kEncodeChunkSize - 1) / kEncodeChunkSize;
+  absl::BlockingCounter counter(static_cast<int>(num_chunks));
+  for (size_t start = 0; start < num_prompts; start += kEncodeChunkSize) {
+    const size_t end = std::min(start + kEncodeChunkSize, num_prompts);
+    queue_.push([&, start, end](size_t tid) {
+      std::vector<size_t> idxes;
+      std::vector<std::string_view> texts;
+      for (size_t i = start; i < end; ++i) {
+        auto callback = output_callback(i);
+        if (!verify_params(sampling_params(i), callback)) {
+          continue;
+        }
+        auto prompt = get_prompt(i);
+        if (!prompt.has_value() || prompt->empty()) {
+          CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
+                              "Failed to construct prompt");
+          continue;
+        }
+        prompts[i] = std::move(prompt.value());
+        idxes.push_back(i);
+        texts.emplace_back(prompts[i]);
+      }
+
+      Timer timer;
+      std::vector<std::vector<int32_t>> ids;
+      if (!texts.empty() && tokenizers_[tid]->batch_encode(texts, &ids)) {
+        const double latency = timer.elapsed_seconds() / texts.size();
+        for (size_t k = 0; k < idxes.size(); ++k) {
+          HISTOGRAM_OBSERVE(tokenization_latency_seconds, latency);
+          prompt_tokens[idxes[k]] = std::move(ids[k]);
+          is_valid[idxes[k]] = 1;
+        }
+      } else {
+        // encode one by one to report errors of each prompt
+        for (const size_t i : idxes) {
+          if (encode_prompt(tid,
+                            prompts[i],
+                            nullptr,
+                            &prompt_tokens[i],
+                            output_callback(i))) {
+            is_valid[i] = 1;
+          }
+        }
+      }
+      counter.DecrementCount();
+    });
+  }
+  counter.Wait();
+
+  // the lexicographical order of tokens puts prompts with shared prefixes
+  // next to each other, so the shared blocks are still in the prefix cache
+  // when the next prompt is scheduled.
+  std::vector<size_t> order;
+  order.reserve(num_prompts);
+  for (size_t i = 0; i < num_prompts; ++i) {
+    if (is_valid[i]) {
+      order.push_back(i);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return prompt_tokens[a] < prompt_tokens[b];
+  });
+
+  // requests are created in order since the scheduler serves requests with
+  // the same priority in the order of creation. with multiple replicas, each
+  // replica takes a contiguous range of the order to keep prefixes together.
+  auto tokenizer = engines_[0]->tokenizer()->clone();
+  for (size_t k = 0; k < order.size(); ++k) {
+    const size_t i = order[k];
+    auto request = build_request(*tokenizer,
+                                 std::move(prompts[i]),
+                                 std::move(prompt_tokens[i]),
+                                 sampling_params(i),
+                                 priority,
+                                 /*stream=*/false,
+                                 output_callback(i),
+                                 /*trace=*/nullptr);
+    if (!request) {
+      continue;
+    }
+    Scheduler* scheduler =
+        schedulers_[k * schedulers_.size() / order.size()].get();
+    // the request queue is bounded, run steps to drain it when it is full
+    while (!scheduler->schedule(request)) {
+      scheduler->step(absl::ZeroDuration());
+    }
+  }
+  run_replicas_until_complete();
+
+  running_.store(false, std::memory_order_relaxed);
+  return outputs;
+}
+
+std::unique_ptr<Request> LLMHandler::create_request(
+    size_t tid,
+    std::string prompt,
+    const SamplingParams& sp,
+    Priority priority,
+    bool stream,
+    OutputCallback callback,
+    std::shared_ptr<RequestTrace> trace) {
   CHECK(!prompt.empty()) << "Prompt should not be empty";
 
-  // encode the prompt
-  Timer timer;
   std::vector<int> prompt_tokens;
-  if (!tokenizers_[tid]->encode(prompt, &prompt_tokens)) {
+  if (!encode_prompt(tid, prompt, trace.get(), &prompt_tokens, callback)) {
+    return nullptr;
+  }
+  return build_request(*tokenizers_[tid],
+                       std::move(prompt),
+                       std::move(prompt_tokens),
+                       sp,
+                       priority,
+                       stream,
+                       std::move(callback),
+                       std::move(trace));
+}
+
+bool LLMHandler::encode_prompt(size_t tid,
+                               const std::string& prompt,
+                               RequestTrace* trace,
+                               std::vector<int>* prompt_tokens,
+                               const OutputCallback& callback) {
+  Timer timer;
+  ScopedSpan span(trace, "tokenize");
+  if (!tokenizers_[tid]->encode(prompt, prompt_tokens)) {
     LOG(ERROR) << "Failed to encode prompt: " << prompt;
     CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
                         "Failed to encode prompt");
-    return nullptr;
+    return false;
+  }
+  span.add_attribute("num_tokens",
+                     static_cast<int64_t>(prompt_tokens->size()));
+  HISTOGRAM_OBSERVE(tokenization_latency_seconds, timer.elapsed_seconds());
+  return true;
+}
+
+bool LLMHandler::verify_beam_search_params(
+    const SamplingParams& sp,
+    bool stream,
+    const OutputCallback& callback) const {
+  // partial outputs of beams may be dropped later
+  if (stream) {
+    CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
+                        "beam search does not support streaming");
+    return false;
+  }
+  if (options_.num_speculative_tokens() > 0) {
+    CALLBACK_WITH_ERROR(StatusCode::UNIMPLEMENTED,
+                        "beam search is not supported with speculative "
+                        "decoding");
+    return false;
+  }
+  if (sp.n > sp.num_beams) {
+    CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
+                        "n must be no greater than num_beams");
+    return false;
   }
-  COUNTER_ADD(tokenization_latency_seconds, timer.elapsed_seconds());
+  // all beams of a request are scheduled in one batch
+  if (static_cast<int64_t>(sp.num_beams) > options_.max_seqs_per_batch()) {
+    CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
+                        "num_beams must be no greater than max_seqs_per_batch");
+    return false;
+  }
+  return true;
+}
 
+std::unique_ptr<Request> LLMHandler::build_request(
+    const Tokenizer& tokenizer,
+    std::string prompt,
+    std::vector<int> prompt_tokens,
+    const SamplingParams& sp,
+    Priority priority,
+    bool stream,
+    OutputCallback callback,
+    std::shared_ptr<RequestTrace> trace) {
   const int64_t max_context_len = model_args_.max_position_embeddings();
   if (prompt_tokens.size() >= max_context_len) {
     LOG(ERROR) << "Prompt is too long: " << prompt_tokens.size();
@@ -474,6 +1229,19 @@ std::unique_ptr<Request> LLMHandler::create_request(size_t tid,
   }
 
   const uint32_t num_seqs = std::max<uint32_t>(1, sp.n);
+  const bool beam_search = sp.num_beams > 1;
+  if (beam_search && !verify_beam_search_params(sp, stream, callback)) {
+    return nullptr;
+  }
+  const bool logprobs = sp.logprobs || sp.top_logprobs > 0;
+  // accepted draft tokens are not sampled from the target model
+  if ((logprobs || sp.prompt_logprobs) &&
+      options_.num_speculative_tokens() > 0) {
+    CALLBACK_WITH_ERROR(StatusCode::UNIMPLEMENTED,
+                        "logprobs are not supported with speculative "
+                        "decoding");
+    return nullptr;
+  }
   // allocate enough capacity for prompt tokens, max tokens, and speculative
   // tokens
   const size_t capacity = prompt_tokens.size() + max_tokens +
@@ -492,6 +1260,36 @@ std::unique_ptr<Request> LLMHandler::create_request(size_t tid,
   // sampling_param.do_sample = sp.do_sample;
   // sampling_param.seed = sp.seed;
 
+  if (beam_search) {
+    BeamSearchOptions beam_options;
+    beam_options.num_beams = sp.num_beams;
+    beam_options.length_penalty = sp.length_penalty;
+    beam_options.early_stopping = sp.early_stopping;
+    request->beam_search =
+        std::make_unique<BeamSearch>(beam_options, num_seqs);
+    // beams are extended with the best of top tokens from processed logits,
+    // twice as many as beams to keep enough unfinished candidates.
+    sampling_param.num_top_tokens = 2 * static_cast<int64_t>(sp.num_beams);
+    sampling_param.temperature = 0.0;
+    sampling_param.top_p = 1.0;
+    sampling_param.top_k = -1;
+  }
+
+  if (!to_logit_bias(
+          sp, model_args_.vocab_size(), &sampling_param.logit_bias)) {
+    CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
+                        "token ids of logit_bias and banned_token_ids must "
+                        "be in the vocab");
+    return nullptr;
+  }
+
+  request->logprobs = logprobs;
+  request->top_logprobs = sp.top_logprobs;
+  request->prompt_logprobs = sp.prompt_logprobs;
+  // alternatives are the top tokens from processed logits
+  sampling_param.num_top_tokens = std::max<int64_t>(
+      sampling_param.num_top_tokens, static_cast<int64_t>(sp.top_logprobs));
+
   // stopping criteria
   auto& stopping_criteria = request->stopping_criteria;
   stopping_criteria.max_tokens = max_tokens;
@@ -512,7 +1310,7 @@ std::unique_ptr<Request> LLMHandler::create_request(size_t tid,
   if (sp.stop.has_value()) {
     for (const auto& s : sp.stop.value()) {
       std::vector<int> stop_tokens;
-      if (!tokenizers_[tid]->encode(s, &stop_tokens)) {
+      if (!tokenizer.encode(s, &stop_tokens)) {
         CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
                             "Failed to encode stop sequence");
         LOG(ERROR) << "Failed to encode stop sequence: " << s;
@@ -528,18 +1326,82 @@ std::unique_ptr<Request> LLMHandler::create_request(size_t tid,
   // set callback for outputs
   request->on_output = callback;
 
+  if (trace) {
+    trace->set_attribute("num_prompt_tokens",
+                         static_cast<int64_t>(request->num_prompt_tokens()));
+    trace->set_attribute("max_tokens", static_cast<int64_t>(max_tokens));
+    trace->set_attribute("n", static_cast<int64_t>(num_seqs));
+    trace->set_attribute("stream", static_cast<int64_t>(stream));
+    request->trace = std::move(trace);
+  }
+
   // add one sequence, rest will be added by scheduler
   request->add_sequence();
   return request;
 }
 
+std::unique_ptr<Request> LLMHandler::create_embedding_request(
+    size_t tid,
+    std::string prompt,
+    const EmbeddingParams& ep,
+    Priority priority,
+    OutputCallback callback,
+    std::shared_ptr<RequestTrace> trace) {
+  const auto pooling = to_pooling_type(ep.pooling);
+  if (!pooling.has_value()) {
+    CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
+                        "pooling must be one of last, mean and cls");
+    return nullptr;
+  }
+  // the draft model would pool its own hidden states
+  if (options_.num_speculative_tokens() > 0) {
+    CALLBACK_WITH_ERROR(StatusCode::UNIMPLEMENTED,
+                        "Embeddings are not supported with speculative "
+                        "decoding");
+    return nullptr;
+  }
+
+  std::vector<int> prompt_tokens;
+  if (!encode_prompt(tid, prompt, trace.get(), &prompt_tokens, callback)) {
+    return nullptr;
+  }
+  const int64_t max_context_len = model_args_.max_position_embeddings();
+  if (prompt_tokens.size() > max_context_len) {
+    LOG(ERROR) << "Prompt is too long: " << prompt_tokens.size();
+    CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT, "Prompt is too long");
+    return nullptr;
+  }
+
+  // no tokens are generated, one more slot to satisfy the capacity check
+  const size_t capacity = prompt_tokens.size() + 1;
+  auto request = std::make_unique<Request>(std::move(prompt),
+                                           std::move(prompt_tokens),
+                                           capacity,
+                                           /*num_seqs=*/1);
+  request->pooling = pooling;
+  request->normalize_embedding = ep.normalize;
+  request->priority = priority;
+  request->on_output = std::move(callback);
+
+  if (trace) {
+    trace->set_attribute("num_prompt_tokens",
+                         static_cast<int64_t>(request->num_prompt_tokens()));
+    trace->set_attribute("pooling", ep.pooling);
+    request->trace = std::move(trace);
+  }
+
+  request->add_sequence();
+  return request;
+}
+
 std::unique_ptr<Request> LLMHandler::create_chat_request(
     size_t tid,
     const std::vector<Message>& messages,
     const SamplingParams& sp,
     Priority priority,
     bool stream,
-    OutputCallback callback) {
+    OutputCallback callback,
+    std::shared_ptr<RequestTrace> trace) {
   // construct prompt from dialog messages
   if (chat_template_ == nullptr) {
     CALLBACK_WITH_ERROR(
@@ -551,17 +1413,78 @@ std::unique_ptr<Request> LLMHandler::create_chat_request(
   }
 
   Timer timer;
-  auto prompt = chat_template_->apply(messages);
+  std::optional<std::string> prompt;
+  {
+    ScopedSpan span(trace.get(), "chat_template");
+    span.add_attribute("num_messages", static_cast<int64_t>(messages.size()));
+    prompt = chat_template_->apply(messages);
+  }
   if (!prompt.has_value()) {
     CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
                         "Failed to construct prompt from messages");
     LOG(ERROR) << "Failed to construct prompt from messages";
     return nullptr;
   }
-  COUNTER_ADD(chat_template_latency_seconds, timer.elapsed_seconds());
+  HISTOGRAM_OBSERVE(chat_template_latency_seconds, timer.elapsed_seconds());
+
+  if (!sp.session_id.has_value() || session_cache_ == nullptr) {
+    return create_request(tid,
+                          std::move(prompt.value()),
+                          sp,
+                          priority,
+                          stream,
+                          callback,
+                          std::move(trace));
+  }
+
+  // reuse token ids of the last turn of the session
+  const std::string& session_id = sp.session_id.value();
+  std::vector<int> prompt_tokens;
+  {
+    Timer tokenize_timer;
+    ScopedSpan span(trace.get(), "tokenize");
+    const auto turn = session_cache_->get(session_id);
+    const int64_t num_reused = SessionCache::encode(
+        turn.get(), prompt.value(), *tokenizers_[tid], &prompt_tokens);
+    if (num_reused < 0) {
+      LOG(ERROR) << "Failed to encode prompt: " << prompt.value();
+      CALLBACK_WITH_ERROR(StatusCode::INVALID_ARGUMENT,
+                          "Failed to encode prompt");
+      return nullptr;
+    }
+    span.add_attribute("num_tokens",
+                       static_cast<int64_t>(prompt_tokens.size()));
+    span.add_attribute("num_reused_tokens", num_reused);
+    HISTOGRAM_OBSERVE(tokenization_latency_seconds,
+                      tokenize_timer.elapsed_seconds());
+
+    if (num_reused > 0) {
+      COUNTER_INC(chat_session_hit);
+    } else {
+      COUNTER_INC(chat_session_miss);
+    }
+    COUNTER_ADD(chat_session_prompt_tokens_total, prompt_tokens.size());
+    COUNTER_ADD(chat_session_reused_tokens_total, num_reused);
+  }
 
-  return create_request(
-      tid, std::move(prompt.value()), sp, priority, stream, callback);
+  auto request = build_request(*tokenizers_[tid],
+                               std::move(prompt.value()),
+                               std::move(prompt_tokens),
+                               sp,
+                               priority,
+                               stream,
+                               callback,
+                               std::move(trace));
+  // the client continues with one of the replies, only kept if there is one
+  if (request != nullptr && request->num_seqs == 1) {
+    request->on_finish = [session_cache = session_cache_,
+                          session_id](const Request& request) {
+      if (auto turn = to_session_turn(request)) {
+        session_cache->put(session_id, std::move(turn));
+      }
+    };
+  }
+  return request;
 }
 
 }  // namespace llm
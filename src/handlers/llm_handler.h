@@ -2,14 +2,20 @@
 
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "chat_template/chat_template.h"
 #include "common/concurrent_queue.h"
+#include "common/tracing.h"
+#include "embedding_params.h"
 #include "engine/engine.h"
+#include "replica_router.h"
 #include "request/output.h"
 #include "sampling_params.h"
+#include "session_cache.h"
 #include "scheduler/continuous_scheduler.h"
 
 namespace llm {
@@ -32,6 +38,10 @@ class LLMHandler {
 
     DEFINE_ARG(std::optional<std::string>, draft_devices);
 
+    // experimental: run prefill on a separate engine on these devices, with
+    // kv cache transferred to the engine on `devices` for decoding.
+    DEFINE_ARG(std::optional<std::string>, prefill_devices);
+
     // the number of slots per block, default 16, value must be multiple of 16
     DEFINE_ARG(int32_t, block_size) = 16;
 
@@ -48,6 +58,9 @@ class LLMHandler {
     // enable cuda graph
     DEFINE_ARG(bool, enable_cuda_graph) = true;
 
+    // the max bytes of activation buffers cached on cpu, 0 to disable
+    DEFINE_ARG(int64_t, max_cpu_activation_cache_size) = int64_t(2) << 30;
+
     // max sequence length used to capture cuda graphs
     DEFINE_ARG(int64_t, cuda_graph_max_seq_len) = 2048;
 
@@ -58,6 +71,11 @@ class LLMHandler {
     DEFINE_ARG(std::optional<std::vector<uint32_t>>,
                draft_cuda_graph_batch_sizes);
 
+    // sample from logits sharded along the vocab across devices without
+    // gathering the full logits. ignored for speculative decoding, which needs
+    // the full probabilities.
+    DEFINE_ARG(bool, enable_vocab_parallel_sampling) = false;
+
     // the maximum number of tokens per batch
     DEFINE_ARG(int32_t, max_tokens_per_batch) = 256;
 
@@ -67,29 +85,65 @@ class LLMHandler {
     // the number of speculative tokens per step
     DEFINE_ARG(int32_t, num_speculative_tokens) = 0;
 
+    // the number of decode steps to run back to back for decode-only batches
+    DEFINE_ARG(int32_t, num_decode_steps) = 1;
+
+    // the max estimated seconds a prompt waits to be scheduled before new
+    // requests are rejected, for each priority. 0 for no limit.
+    DEFINE_ARG(double, max_queue_wait_high) = 0.0;
+    DEFINE_ARG(double, max_queue_wait_normal) = 0.0;
+    DEFINE_ARG(double, max_queue_wait_low) = 0.0;
+
+    // the max ratio of kv cache demand of unfinished requests to the kv cache
+    // capacity before new requests are rejected, for each priority. 0 for no
+    // limit.
+    DEFINE_ARG(double, max_kv_demand_high) = 0.0;
+    DEFINE_ARG(double, max_kv_demand_normal) = 0.0;
+    DEFINE_ARG(double, max_kv_demand_low) = 0.0;
+
     // the number of threads to use for handling requests
     DEFINE_ARG(size_t, num_handling_threads) = 4;
+
+    // the number of data parallel replicas, each with its own engine and
+    // scheduler. devices are split evenly among replicas.
+    DEFINE_ARG(size_t, num_replicas) = 1;
+
+    // the maximum number of chat sessions to keep token ids of the last turn
+    // for, 0 to disable.
+    DEFINE_ARG(size_t, max_chat_sessions) = 1024;
   };
 
   LLMHandler(const Options& options);
 
-  ~LLMHandler();
+  // create a handler with the given engine, e.g. a fake engine for
+  // benchmarking. engine related options are ignored.
+  LLMHandler(std::unique_ptr<Engine> engine, const Options& options);
+
+  // create a handler with one data parallel replica for each engine.
+  LLMHandler(std::vector<std::unique_ptr<Engine>> engines,
+             const Options& options);
+
+  virtual ~LLMHandler();
 
   // schedule a request, the engine will execute the request asynchronously
   // and call the callback with output when the request is done
   // the callback will be called multiple times if the request is a streaming
   // request
-  void schedule_async(std::string prompt,
-                      SamplingParams sp,
-                      Priority priority,
-                      bool stream,
-                      OutputCallback callback);
-
-  void schedule_chat_async(std::vector<Message> messages,
-                           SamplingParams sp,
-                           Priority priority,
-                           bool stream,
-                           OutputCallback callback);
+  // spans are recorded into the trace if it is not null.
+  virtual void schedule_async(std::string prompt,
+                              SamplingParams sp,
+                              Priority priority,
+                              bool stream,
+                              OutputCallback callback,
+                              std::shared_ptr<RequestTrace> trace = nullptr);
+
+  virtual void schedule_chat_async(
+      std::vector<Message> messages,
+      SamplingParams sp,
+      Priority priority,
+      bool stream,
+      OutputCallback callback,
+      std::shared_ptr<RequestTrace> trace = nullptr);
 
   // batch version
   void schedule_batch_async(std::vector<std::string> prompts,
@@ -105,6 +159,21 @@ class LLMHandler {
       bool stream,
       BatchOutputCallback callback);
 
+  // compute the embedding of the prompt, the engine runs the prompt through
+  // prefill only, sharing batches and the prefix cache with generation
+  // requests, then calls the callback once with the pooled embedding.
+  virtual void embed_async(std::string prompt,
+                           EmbeddingParams ep,
+                           Priority priority,
+                           OutputCallback callback,
+                           std::shared_ptr<RequestTrace> trace = nullptr);
+
+  // batch version
+  void embed_batch_async(std::vector<std::string> prompts,
+                         EmbeddingParams ep,
+                         Priority priority,
+                         BatchOutputCallback callback);
+
   // start the handling loop
   void start();
 
@@ -114,14 +183,86 @@ class LLMHandler {
   // run until complete, blocking call
   void run_until_complete();
 
+  // offline batch inference, blocking call. all prompts are tokenized up
+  // front, then scheduled without streaming in an order that puts prompts
+  // with shared prefixes next to each other to maximize prefix cache hits.
+  // returns outputs in the same order as prompts. the handler must not be
+  // running.
+  std::vector<RequestOutput> generate(
+      std::vector<std::string> prompts,
+      std::vector<SamplingParams> sps,
+      Priority priority = Priority::NORMAL);
+
+  std::vector<RequestOutput> generate_chat(
+      std::vector<std::vector<Message>> conversations,
+      std::vector<SamplingParams> sps,
+      Priority priority = Priority::NORMAL);
+
+  // offline embeddings, blocking call. returns outputs in the same order as
+  // prompts. the handler must not be running.
+  std::vector<RequestOutput> embed(std::vector<std::string> prompts,
+                                   EmbeddingParams ep);
+
+  // profiles of the latest engine steps of the first replica, nullptr if not
+  // available
+  const StepProfiler* step_profiler() const {
+    return schedulers_.empty() ? nullptr : schedulers_[0]->step_profiler();
+  }
+
+ protected:
+  // used by fake handlers in tests and benchmarks, no engine is created.
+  LLMHandler() = default;
+
  private:
   using Task = std::function<void(size_t tid)>;
+
+  // offline batch inference over num_prompts inputs, get_prompt returns the
+  // prompt of the i-th input, or nullopt if it is invalid. thread safe.
+  std::vector<RequestOutput> generate_offline(
+      size_t num_prompts,
+      std::vector<SamplingParams> sps,
+      Priority priority,
+      const std::function<std::optional<std::string>(size_t index)>&
+          get_prompt);
+
+  // encode the prompt with the tokenizer of the handling thread
+  bool encode_prompt(size_t tid,
+                     const std::string& prompt,
+                     RequestTrace* trace,
+                     std::vector<int>* prompt_tokens,
+                     const OutputCallback& callback);
+
+  // verify beam search is supported for the request
+  bool verify_beam_search_params(const SamplingParams& sp,
+                                 bool stream,
+                                 const OutputCallback& callback) const;
+
+  // create a request from the tokenized prompt
+  std::unique_ptr<Request> build_request(const Tokenizer& tokenizer,
+                                         std::string prompt,
+                                         std::vector<int> prompt_tokens,
+                                         const SamplingParams& sp,
+                                         Priority priority,
+                                         bool stream,
+                                         OutputCallback callback,
+                                         std::shared_ptr<RequestTrace> trace);
+
   std::unique_ptr<Request> create_request(size_t tid,
                                           std::string prompt,
                                           const SamplingParams& sp,
                                           Priority priority,
                                           bool stream,
-                                          OutputCallback callback);
+                                          OutputCallback callback,
+                                          std::shared_ptr<RequestTrace> trace);
+
+  // create an embedding request that finishes after prefill
+  std::unique_ptr<Request> create_embedding_request(
+      size_t tid,
+      std::string prompt,
+      const EmbeddingParams& ep,
+      Priority priority,
+      OutputCallback callback,
+      std::shared_ptr<RequestTrace> trace);
 
   std::unique_ptr<Request> create_chat_request(
       size_t tid,
@@ -129,27 +270,62 @@ class LLMHandler {
       const SamplingParams& sp,
       Priority priority,
       bool stream,
-      OutputCallback callback);
+      OutputCallback callback,
+      std::shared_ptr<RequestTrace> trace);
 
   void schedule(std::string prompt,
                 SamplingParams sp,
                 Priority priority,
                 bool stream,
-                OutputCallback callback);
+                OutputCallback callback,
+                std::shared_ptr<RequestTrace> trace);
 
   void schedule(std::vector<Message> messages,
                 SamplingParams sp,
                 Priority priority,
                 bool stream,
-                OutputCallback callback);
+                OutputCallback callback,
+                std::shared_ptr<RequestTrace> trace);
+
+  // schedule the inputs at the given indices in chunks, each chunk is
+  // tokenized with one batch_encode call. get_prompt returns the prompt of
+  // the i-th input, or nullopt if it is invalid.
+  void schedule_batch(
+      std::vector<size_t> indices,
+      std::vector<SamplingParams> sps,
+      Priority priority,
+      bool stream,
+      BatchOutputCallback callback,
+      std::function<std::optional<std::string>(size_t index)> get_prompt);
+
+  void schedule_embedding(std::string prompt,
+                          EmbeddingParams ep,
+                          Priority priority,
+                          OutputCallback callback,
+                          std::shared_ptr<RequestTrace> trace);
 
   void handling_loop(size_t tid);
 
+  // pick the replica to serve the request
+  Scheduler* route(const Request& request) const;
+
+  // track requests that have not been routed yet in all replicas, so that
+  // none of them completes before the requests are routed.
+  void inc_pending_requests(size_t count);
+  void dec_pending_requests();
+
+  // run all replicas until all their requests are completed, blocking call
+  void run_replicas_until_complete();
+
   const Options options_;
 
-  std::unique_ptr<Engine> engine_;
+  // engines and schedulers of data parallel replicas
+  std::vector<std::unique_ptr<Engine>> engines_;
 
-  std::unique_ptr<Scheduler> scheduler_;
+  std::vector<std::unique_ptr<Scheduler>> schedulers_;
+
+  // routes requests to replicas, only created for multiple replicas
+  std::unique_ptr<ReplicaRouter> router_;
 
   // model args
   ModelArgs model_args_;
@@ -167,8 +343,12 @@ class LLMHandler {
   // chat template instance
   std::unique_ptr<ChatTemplate> chat_template_;
 
-  // thread for moving forward the scheduler
-  std::thread loop_thread_;
+  // token ids of the last turn of chat sessions, shared with finish callbacks
+  // of requests. nullptr if disabled.
+  std::shared_ptr<SessionCache> session_cache_;
+
+  // threads for moving forward the schedulers, one for each replica
+  std::vector<std::thread> loop_threads_;
 
   // flag to stop the loop
   std::atomic_bool stoped_{false};
@@ -0,0 +1,283 @@
+#include "llm_handler.h"
+
+#include <absl/strings/str_split.h>
+#include <absl/time/time.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "engine/fake_engine.h"
+
+namespace llm {
+
+namespace {
+// tokenizer, if not null, is set to the tokenizer of the first engine, which
+// handling threads clone
+std::unique_ptr<LLMHandler> create_handler(
+    size_t num_replicas = 1,
+    const FakeTokenizer** tokenizer = nullptr) {
+  FakeEngine::Options engine_options;
+  engine_options.step_cost(absl::ZeroDuration())
+      .prefill_token_cost(absl::ZeroDuration())
+      .decode_token_cost(absl::ZeroDuration());
+
+  LLMHandler::Options options;
+  options.max_tokens_per_batch(1024)
+      .max_seqs_per_batch(8)
+      .num_handling_threads(2);
+  std::vector<std::unique_ptr<Engine>> engines;
+  for (size_t i = 0; i < num_replicas; ++i) {
+    engines.push_back(std::make_unique<FakeEngine>(engine_options));
+  }
+  if (tokenizer != nullptr) {
+    *tokenizer = static_cast<const FakeTokenizer*>(engines[0]->tokenizer());
+  }
+  return std::make_unique<LLMHandler>(std::move(engines), options);
+}
+
+size_t num_words(const std::string& text) {
+  return std::vector<std::string>(
+             absl::StrSplit(text, ' ', absl::SkipWhitespace()))
+      .size();
+}
+}  // namespace
+
+class LLMHandlerTest : public ::testing::TestWithParam<size_t> {};
+
+TEST_P(LLMHandlerTest, Generate) {
+  auto handler = create_handler(/*num_replicas=*/GetParam());
+
+  // more prompts than a batch, with shared prefixes in random order
+  std::vector<std::string> prompts;
+  for (int i = 0; i < 100; ++i) {
+    prompts.push_back("system prompt " + std::to_string(i % 7) + " question " +
+                      std::string(i % 5 + 1, 'x'));
+  }
+  SamplingParams sp;
+  sp.max_tokens = 4;
+  const auto outputs = handler->generate(prompts, {sp});
+
+  // outputs are in the same order as prompts
+  ASSERT_EQ(outputs.size(), prompts.size());
+  for (size_t i = 0; i < prompts.size(); ++i) {
+    const auto& output = outputs[i];
+    ASSERT_TRUE(output.status.has_value());
+    EXPECT_TRUE(output.status->ok());
+    EXPECT_TRUE(output.finished);
+    ASSERT_TRUE(output.usage.has_value());
+    EXPECT_EQ(output.usage->num_prompt_tokens, num_words(prompts[i]));
+    EXPECT_EQ(output.usage->num_generated_tokens, 4);
+    ASSERT_EQ(output.outputs.size(), 1);
+    EXPECT_EQ(output.outputs[0].finish_reason, "length");
+  }
+}
+
+TEST_P(LLMHandlerTest, GenerateWithInvalidRequests) {
+  auto handler = create_handler(/*num_replicas=*/GetParam());
+
+  SamplingParams sp;
+  sp.max_tokens = 2;
+  SamplingParams invalid_sp;
+  invalid_sp.temperature = 3.0;
+  const auto outputs =
+      handler->generate({"a b c", "", "a b", "a"}, {sp, sp, invalid_sp, sp});
+
+  // errors are reported in place without failing other prompts
+  ASSERT_EQ(outputs.size(), 4);
+  EXPECT_TRUE(outputs[0].status->ok());
+  EXPECT_EQ(outputs[1].status->code(), StatusCode::INVALID_ARGUMENT);
+  EXPECT_EQ(outputs[2].status->code(), StatusCode::INVALID_ARGUMENT);
+  EXPECT_TRUE(outputs[3].status->ok());
+  EXPECT_EQ(outputs[3].usage->num_generated_tokens, 2);
+
+  // the handler can be reused
+  EXPECT_EQ(handler->generate({"a b"}, {sp}).size(), 1);
+}
+
+TEST_P(LLMHandlerTest, Embed) {
+  auto handler = create_handler(/*num_replicas=*/GetParam());
+
+  // repeated prompts hit the prefix cache
+  std::vector<std::string> prompts;
+  for (int i = 0; i < 20; ++i) {
+    prompts.push_back("query " + std::to_string(i % 3) + " a b c d");
+  }
+  const auto outputs = handler->embed(prompts, EmbeddingParams());
+
+  ASSERT_EQ(outputs.size(), prompts.size());
+  for (size_t i = 0; i < prompts.size(); ++i) {
+    const auto& output = outputs[i];
+    ASSERT_TRUE(output.status.has_value());
+    EXPECT_TRUE(output.status->ok());
+    EXPECT_TRUE(output.finished);
+    EXPECT_EQ(output.usage->num_prompt_tokens, num_words(prompts[i]));
+    EXPECT_EQ(output.usage->num_generated_tokens, 0);
+    ASSERT_EQ(output.outputs.size(), 1);
+    EXPECT_EQ(output.outputs[0].finish_reason, "stop");
+    EXPECT_TRUE(output.outputs[0].text.empty());
+    // the fake engine pools ones, which are normalized to unit length
+    const auto& embedding = output.outputs[0].embedding;
+    ASSERT_FALSE(embedding.empty());
+    for (const float value : embedding) {
+      EXPECT_FLOAT_EQ(value, 1.0f / std::sqrt(embedding.size()));
+    }
+  }
+
+  // unknown pooling type is rejected
+  const auto invalid = handler->embed({"a b"}, EmbeddingParams("max", true));
+  ASSERT_EQ(invalid.size(), 1);
+  EXPECT_EQ(invalid[0].status->code(), StatusCode::INVALID_ARGUMENT);
+
+  // generation still works after embeddings
+  SamplingParams sp;
+  sp.max_tokens = 2;
+  const auto generated = handler->generate({"query 0 a b c d"}, {sp});
+  EXPECT_EQ(generated[0].usage->num_generated_tokens, 2);
+}
+
+TEST_P(LLMHandlerTest, BeamSearch) {
+  auto handler = create_handler(/*num_replicas=*/GetParam());
+
+  SamplingParams sp;
+  sp.max_tokens = 4;
+  sp.n = 2;
+  sp.num_beams = 3;
+  SamplingParams too_many_seqs = sp;
+  too_many_seqs.n = 4;
+  SamplingParams too_many_beams = sp;
+  too_many_beams.num_beams = 16;
+  const auto outputs = handler->generate(
+      {"a b c", "a b", "a"}, {sp, too_many_seqs, too_many_beams});
+
+  ASSERT_EQ(outputs.size(), 3);
+  const auto& output = outputs[0];
+  ASSERT_TRUE(output.status.has_value());
+  EXPECT_TRUE(output.status->ok());
+  EXPECT_TRUE(output.finished);
+  // the best n hypotheses are returned
+  ASSERT_EQ(output.outputs.size(), 2);
+  for (const auto& seq_output : output.outputs) {
+    EXPECT_EQ(seq_output.finish_reason, "length");
+    EXPECT_EQ(num_words(seq_output.text), 4);
+  }
+  EXPECT_NE(output.outputs[0].text, output.outputs[1].text);
+  EXPECT_EQ(output.usage->num_generated_tokens, 8);
+
+  // n > num_beams and num_beams > max_seqs_per_batch are rejected
+  EXPECT_EQ(outputs[1].status->code(), StatusCode::INVALID_ARGUMENT);
+  EXPECT_EQ(outputs[2].status->code(), StatusCode::INVALID_ARGUMENT);
+}
+
+TEST_P(LLMHandlerTest, Logprobs) {
+  auto handler = create_handler(/*num_replicas=*/GetParam());
+
+  SamplingParams sp;
+  sp.max_tokens = 3;
+  sp.logprobs = true;
+  sp.top_logprobs = 2;
+  sp.prompt_logprobs = true;
+  SamplingParams too_many_top_logprobs = sp;
+  too_many_top_logprobs.top_logprobs = 21;
+  const auto outputs =
+      handler->generate({"a b c", "a b"}, {sp, too_many_top_logprobs});
+
+  ASSERT_EQ(outputs.size(), 2);
+  const auto& output = outputs[0];
+  ASSERT_TRUE(output.status.has_value());
+  EXPECT_TRUE(output.status->ok());
+  ASSERT_EQ(output.outputs.size(), 1);
+  // fake engine generates the top 1 token with logprob -1 at each step
+  const auto& logprobs = output.outputs[0].logprobs;
+  ASSERT_TRUE(logprobs.has_value());
+  ASSERT_EQ(logprobs->size(), 3);
+  for (const auto& logprob : logprobs.value()) {
+    EXPECT_EQ(logprob.token_id, 1);
+    EXPECT_FLOAT_EQ(logprob.logprob, -1.0f);
+    ASSERT_EQ(logprob.top_logprobs.size(), 2);
+    EXPECT_EQ(logprob.top_logprobs[0].token_id, 1);
+    EXPECT_EQ(logprob.top_logprobs[1].token_id, 2);
+    EXPECT_FLOAT_EQ(logprob.top_logprobs[1].logprob, -2.0f);
+  }
+  // no logprob for the first prompt token
+  ASSERT_TRUE(output.prompt_logprobs.has_value());
+  EXPECT_EQ(output.prompt_logprobs->size(), 2);
+
+  EXPECT_EQ(outputs[1].status->code(), StatusCode::INVALID_ARGUMENT);
+}
+
+TEST_P(LLMHandlerTest, LogitBias) {
+  auto handler = create_handler(/*num_replicas=*/GetParam());
+
+  SamplingParams sp;
+  sp.max_tokens = 2;
+  sp.logit_bias = std::unordered_map<int32_t, float>{{2, 5.0}, {3, -100.0}};
+  sp.banned_token_ids = std::vector<int32_t>{4, 5};
+  SamplingParams too_large_bias = sp;
+  too_large_bias.logit_bias = std::unordered_map<int32_t, float>{{2, 101.0}};
+  SamplingParams out_of_vocab = sp;
+  out_of_vocab.banned_token_ids = std::vector<int32_t>{32000};
+  const auto outputs = handler->generate(
+      {"a b c", "a b", "a"}, {sp, too_large_bias, out_of_vocab});
+
+  ASSERT_EQ(outputs.size(), 3);
+  EXPECT_TRUE(outputs[0].status->ok());
+  EXPECT_EQ(outputs[0].usage->num_generated_tokens, 2);
+  EXPECT_EQ(outputs[1].status->code(), StatusCode::INVALID_ARGUMENT);
+  EXPECT_EQ(outputs[2].status->code(), StatusCode::INVALID_ARGUMENT);
+}
+
+TEST_P(LLMHandlerTest, ScheduleBatch) {
+  const FakeTokenizer* tokenizer = nullptr;
+  auto handler = create_handler(/*num_replicas=*/GetParam(), &tokenizer);
+
+  std::vector<std::string> prompts;
+  std::vector<SamplingParams> sps;
+  for (int i = 0; i < 100; ++i) {
+    prompts.push_back("prompt " + std::to_string(i) + " a b");
+    SamplingParams sp;
+    sp.max_tokens = 2;
+    // one invalid request doesn't fail the rest of its chunk
+    if (i == 42) {
+      sp.temperature = 3.0;
+    }
+    sps.push_back(sp);
+  }
+  prompts[7].clear();
+
+  const int64_t num_batch_encodes = tokenizer->num_batch_encodes();
+  std::vector<RequestOutput> outputs(prompts.size());
+  handler->schedule_batch_async(prompts,
+                                sps,
+                                Priority::NORMAL,
+                                /*stream=*/false,
+                                [&outputs](size_t index, RequestOutput output) {
+                                  outputs[index] = std::move(output);
+                                  return true;
+                                });
+  handler->run_until_complete();
+
+  // prompts are tokenized in chunks of 64 instead of one by one
+  EXPECT_EQ(tokenizer->num_batch_encodes() - num_batch_encodes, 2);
+  for (size_t i = 0; i < prompts.size(); ++i) {
+    const auto& output = outputs[i];
+    ASSERT_TRUE(output.status.has_value());
+    if (i == 7 || i == 42) {
+      EXPECT_EQ(output.status->code(), StatusCode::INVALID_ARGUMENT);
+      continue;
+    }
+    EXPECT_TRUE(output.status->ok());
+    EXPECT_TRUE(output.finished);
+    EXPECT_EQ(output.usage->num_prompt_tokens, num_words(prompts[i]));
+    EXPECT_EQ(output.usage->num_generated_tokens, 2);
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(Replicas,
+                         LLMHandlerTest,
+                         ::testing::Values(1, 2));
+
+}  // namespace llm
@@ -0,0 +1,98 @@
+#include "output_bridge.h"
+
+#include <glog/logging.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace llm {
+
+OutputBridge::State::State(size_t capacity) : queue(capacity) {
+  fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  CHECK(fd >= 0) << "Failed to create eventfd, errno: " << errno;
+}
+
+OutputBridge::State::~State() { close(fd); }
+
+void OutputBridge::State::push(uint64_t stream_id, RequestOutput output) {
+  queue.blockingWrite(stream_id, std::move(output));
+  // signal the loop once until it drains the queue
+  if (!notified.exchange(true, std::memory_order_acq_rel)) {
+    const uint64_t value = 1;
+    if (write(fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+      LOG(ERROR) << "Failed to signal eventfd, errno: " << errno;
+    }
+  }
+}
+
+void OutputBridge::State::remove_stream(uint64_t stream_id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  streams.erase(stream_id);
+}
+
+OutputBridge::OutputBridge(size_t capacity)
+    : state_(std::make_shared<State>(capacity)) {}
+
+OutputBridge::~OutputBridge() = default;
+
+int OutputBridge::fd() const { return state_->fd; }
+
+OutputCallback OutputBridge::callback(uint64_t stream_id) {
+  auto cancelled = std::make_shared<std::atomic_bool>(false);
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->streams[stream_id] = cancelled;
+  }
+  return [state = state_, stream_id, cancelled](RequestOutput output) {
+    if (cancelled->load(std::memory_order_relaxed)) {
+      return false;
+    }
+    // no more outputs after the last one or an error
+    const bool done = output.finished ||
+                      (output.status.has_value() && !output.status->ok());
+    state->push(stream_id, std::move(output));
+    if (done) {
+      state->remove_stream(stream_id);
+    }
+    return true;
+  };
+}
+
+std::vector<OutputBridge::Item> OutputBridge::drain() {
+  // reset the signal before draining, outputs pushed from now on signal again
+  uint64_t value = 0;
+  if (read(state_->fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+    LOG(ERROR) << "Failed to read eventfd, errno: " << errno;
+  }
+  state_->notified.store(false, std::memory_order_release);
+
+  std::vector<Item> items;
+  Item item;
+  while (state_->queue.read(item)) {
+    items.push_back(std::move(item));
+  }
+  return items;
+}
+
+void OutputBridge::cancel(uint64_t stream_id) {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  auto it = state_->streams.find(stream_id);
+  if (it != state_->streams.end()) {
+    it->second->store(true, std::memory_order_relaxed);
+    state_->streams.erase(it);
+  }
+}
+
+size_t OutputBridge::num_streams() const {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  return state_->streams.size();
+}
+
+}  // namespace llm
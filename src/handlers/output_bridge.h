@@ -0,0 +1,74 @@
+#pragma once
+
+#include <folly/MPMCQueue.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "llm_handler.h"
+#include "request/output.h"
+
+namespace llm {
+
+// Delivers outputs of requests from response threads to an event loop, e.g.
+// python asyncio. Callbacks of requests push outputs tagged with the id of
+// their stream into a lock-free queue and signal an eventfd, only once until
+// the loop drains the queue. The outputs of a whole step are then handled
+// with one wakeup of the loop, and in python with one GIL acquisition instead
+// of one for each output. Thread safe.
+class OutputBridge final {
+ public:
+  using Item = std::pair<uint64_t, RequestOutput>;
+
+  // capacity: the max number of pending outputs, callbacks block when the
+  // queue is full until the loop drains it.
+  explicit OutputBridge(size_t capacity = 65536);
+
+  ~OutputBridge();
+
+  // the eventfd to wait on, readable when there are outputs to drain
+  int fd() const;
+
+  // create the callback of a request that delivers outputs to the stream
+  OutputCallback callback(uint64_t stream_id);
+
+  // move out all pending outputs in the order they were pushed, non-blocking
+  std::vector<Item> drain();
+
+  // cancel the stream, the request is cancelled on its next output
+  void cancel(uint64_t stream_id);
+
+  // the number of streams that have not finished or been cancelled
+  size_t num_streams() const;
+
+ private:
+  // shared with callbacks of requests that may outlive the bridge
+  struct State {
+    explicit State(size_t capacity);
+    ~State();
+
+    void push(uint64_t stream_id, RequestOutput output);
+
+    void remove_stream(uint64_t stream_id);
+
+    int fd = -1;
+
+    folly::MPMCQueue<Item> queue;
+
+    // whether the loop has been signaled since its last drain
+    std::atomic_bool notified{false};
+
+    // cancellation flags of open streams
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, std::shared_ptr<std::atomic_bool>> streams;
+  };
+
+  std::shared_ptr<State> state_;
+};
+
+}  // namespace llm
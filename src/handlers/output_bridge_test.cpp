@@ -0,0 +1,92 @@
+#include "output_bridge.h"
+
+#include <gtest/gtest.h>
+#include <poll.h>
+
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace llm {
+
+namespace {
+bool is_readable(int fd) {
+  pollfd pfd{fd, POLLIN, 0};
+  return poll(&pfd, 1, /*timeout=*/0) == 1 && (pfd.revents & POLLIN) != 0;
+}
+
+RequestOutput text_output(const std::string& text, bool finished) {
+  RequestOutput output;
+  output.outputs.push_back({/*index=*/0, text, std::nullopt});
+  output.finished = finished;
+  return output;
+}
+}  // namespace
+
+TEST(OutputBridgeTest, Drain) {
+  OutputBridge bridge;
+  EXPECT_FALSE(is_readable(bridge.fd()));
+  EXPECT_TRUE(bridge.drain().empty());
+
+  // streams push outputs from response threads concurrently
+  const int kNumStreams = 4;
+  const int kNumOutputs = 100;
+  std::vector<std::thread> threads;
+  for (int s = 0; s < kNumStreams; ++s) {
+    threads.emplace_back([callback = bridge.callback(s)] {
+      for (int i = 0; i < kNumOutputs; ++i) {
+        EXPECT_TRUE(callback(text_output(std::to_string(i),
+                                         /*finished=*/i + 1 == kNumOutputs)));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // finished streams are closed
+  EXPECT_EQ(bridge.num_streams(), 0);
+
+  // all outputs are drained at once, in order for each stream
+  EXPECT_TRUE(is_readable(bridge.fd()));
+  const auto items = bridge.drain();
+  EXPECT_FALSE(is_readable(bridge.fd()));
+  ASSERT_EQ(items.size(), kNumStreams * kNumOutputs);
+  std::map<uint64_t, int> next;
+  for (const auto& [stream_id, output] : items) {
+    ASSERT_LT(stream_id, kNumStreams);
+    const int i = next[stream_id]++;
+    EXPECT_EQ(output.outputs[0].text, std::to_string(i));
+    EXPECT_EQ(output.finished, i + 1 == kNumOutputs);
+  }
+
+  // signaled again for outputs after the drain
+  auto callback = bridge.callback(kNumStreams);
+  EXPECT_TRUE(callback(text_output("a", /*finished=*/false)));
+  EXPECT_TRUE(is_readable(bridge.fd()));
+  EXPECT_EQ(bridge.drain().size(), 1);
+}
+
+TEST(OutputBridgeTest, Cancel) {
+  OutputBridge bridge;
+  auto callback = bridge.callback(/*stream_id=*/7);
+  EXPECT_EQ(bridge.num_streams(), 1);
+  EXPECT_TRUE(callback(text_output("a", /*finished=*/false)));
+
+  // the request is cancelled on its next output, which is dropped
+  bridge.cancel(7);
+  EXPECT_EQ(bridge.num_streams(), 0);
+  EXPECT_FALSE(callback(text_output("b", /*finished=*/false)));
+  const auto items = bridge.drain();
+  ASSERT_EQ(items.size(), 1);
+  EXPECT_EQ(items[0].first, 7);
+  EXPECT_EQ(items[0].second.outputs[0].text, "a");
+
+  // outputs with errors close the stream
+  auto failed = bridge.callback(/*stream_id=*/8);
+  EXPECT_TRUE(failed(Status(StatusCode::INVALID_ARGUMENT, "bad request")));
+  EXPECT_EQ(bridge.num_streams(), 0);
+  EXPECT_EQ(bridge.drain().size(), 1);
+}
+
+}  // namespace llm
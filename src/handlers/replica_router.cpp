@@ -0,0 +1,80 @@
+#include "replica_router.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "common/metrics.h"
+
+DEFINE_COUNTER_FAMILY(replica_routing_total,
+                      "Total number of requests routed to replicas");
+DEFINE_COUNTER_INSTANCE(replica_routing_by_prefix_total,
+                        replica_routing_total,
+                        {{"by", "prefix"}});
+DEFINE_COUNTER_INSTANCE(replica_routing_by_load_total,
+                        replica_routing_total,
+                        {{"by", "load"}});
+
+DEFINE_COUNTER(replica_routing_prefix_match_blocks_total,
+               "Total number of prefix cache blocks matched by routing");
+
+namespace llm {
+
+ReplicaRouter::ReplicaRouter(std::vector<Replica> replicas,
+                             uint32_t block_size,
+                             const Options& options)
+    : replicas_(std::move(replicas)),
+      block_size_(block_size),
+      options_(options) {
+  CHECK(!replicas_.empty()) << "at least one replica is required";
+  CHECK_GT(block_size_, 0);
+  for (const auto& replica : replicas_) {
+    CHECK(replica.summary != nullptr && replica.load != nullptr);
+  }
+}
+
+size_t ReplicaRouter::route(const Slice<int32_t>& prompt_token_ids) const {
+  const size_t n_replicas = replicas_.size();
+  if (n_replicas == 1) {
+    return 0;
+  }
+
+  std::vector<size_t> loads(n_replicas);
+  size_t min_load = std::numeric_limits<size_t>::max();
+  for (size_t i = 0; i < n_replicas; ++i) {
+    loads[i] = replicas_[i].load();
+    min_load = std::min(min_load, loads[i]);
+  }
+
+  const auto hashes =
+      PrefixCacheSummary::block_hashes(prompt_token_ids, block_size_);
+  // pick the longest match among replicas that are not overloaded, then the
+  // least loaded one. start from a rotating replica so that ties are spread.
+  const size_t start = next_.fetch_add(1, std::memory_order_relaxed);
+  size_t best = n_replicas;
+  size_t best_match = 0;
+  for (size_t k = 0; k < n_replicas; ++k) {
+    const size_t i = (start + k) % n_replicas;
+    if (loads[i] > min_load + options_.max_load_imbalance()) {
+      continue;
+    }
+    const size_t match = replicas_[i].summary->match(hashes);
+    if (best == n_replicas || match > best_match ||
+        (match == best_match && loads[i] < loads[best])) {
+      best = i;
+      best_match = match;
+    }
+  }
+
+  if (best_match > 0) {
+    COUNTER_INC(replica_routing_by_prefix_total);
+    COUNTER_ADD(replica_routing_prefix_match_blocks_total, best_match);
+  } else {
+    COUNTER_INC(replica_routing_by_load_total);
+  }
+  return best;
+}
+
+}  // namespace llm
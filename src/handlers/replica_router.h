@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "common/macros.h"
+#include "common/slice.h"
+#include "memory/prefix_cache_summary.h"
+
+namespace llm {
+
+// Routes requests across data parallel replicas. A request goes to the
+// replica with the longest prefix cache match of its prompt, estimated from
+// the summary of each replica's prefix cache, as long as the replica is not
+// much busier than the least loaded one. Requests without any match go to
+// the least loaded replica. Thread safe.
+class ReplicaRouter final {
+ public:
+  struct Options {
+    // the number of extra requests a replica may have over the least loaded
+    // replica and still be picked for a longer prefix cache match
+    DEFINE_ARG(size_t, max_load_imbalance) = 8;
+  };
+
+  struct Replica {
+    // the summary of the replica's prefix cache
+    const PrefixCacheSummary* summary = nullptr;
+
+    // returns the current load, e.g. the number of requests in flight
+    std::function<size_t()> load;
+  };
+
+  ReplicaRouter(std::vector<Replica> replicas,
+                uint32_t block_size,
+                const Options& options);
+
+  // returns the index of the replica to serve the prompt
+  size_t route(const Slice<int32_t>& prompt_token_ids) const;
+
+  size_t num_replicas() const { return replicas_.size(); }
+
+ private:
+  const std::vector<Replica> replicas_;
+
+  const uint32_t block_size_;
+
+  const Options options_;
+
+  // rotates the start replica to break ties
+  mutable std::atomic<size_t> next_{0};
+};
+
+}  // namespace llm
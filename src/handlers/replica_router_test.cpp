@@ -0,0 +1,75 @@
+#include "replica_router.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "memory/prefix_cache_summary.h"
+
+namespace llm {
+
+TEST(ReplicaRouterTest, RouteByPrefix) {
+  const uint32_t block_size = 4;
+  PrefixCacheSummary summary0;
+  PrefixCacheSummary summary1;
+  std::vector<size_t> loads = {0, 0};
+
+  // replica 1 caches the first two blocks of the prompt
+  const std::vector<int32_t> prompt = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  for (const uint64_t hash :
+       PrefixCacheSummary::block_hashes(prompt, block_size)) {
+    summary1.add(hash);
+  }
+  // replica 0 caches only the first block
+  summary0.add(PrefixCacheSummary::block_hashes(prompt, block_size)[0]);
+
+  ReplicaRouter::Options options;
+  options.max_load_imbalance(2);
+  ReplicaRouter router({{&summary0, [&] { return loads[0]; }},
+                        {&summary1, [&] { return loads[1]; }}},
+                       block_size,
+                       options);
+  EXPECT_EQ(router.num_replicas(), 2);
+  EXPECT_EQ(router.route(prompt), 1);
+
+  // a slightly busier replica is still picked for a longer match
+  loads = {0, 2};
+  EXPECT_EQ(router.route(prompt), 1);
+
+  // but not when it is much busier than others
+  loads = {0, 3};
+  EXPECT_EQ(router.route(prompt), 0);
+
+  // equal matches go to the less loaded replica
+  summary1.remove(PrefixCacheSummary::block_hashes(prompt, block_size)[1]);
+  loads = {1, 0};
+  EXPECT_EQ(router.route(prompt), 1);
+}
+
+TEST(ReplicaRouterTest, RouteByLoad) {
+  PrefixCacheSummary summary0;
+  PrefixCacheSummary summary1;
+  PrefixCacheSummary summary2;
+  std::vector<size_t> loads = {3, 1, 2};
+  ReplicaRouter router({{&summary0, [&] { return loads[0]; }},
+                        {&summary1, [&] { return loads[1]; }},
+                        {&summary2, [&] { return loads[2]; }}},
+                       /*block_size=*/4,
+                       ReplicaRouter::Options());
+
+  // without any match, the least loaded replica is picked
+  const std::vector<int32_t> prompt = {1, 2, 3, 4, 5};
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(router.route(prompt), 1);
+  }
+
+  // ties are spread among replicas
+  loads = {0, 0, 0};
+  std::vector<size_t> counts(3, 0);
+  for (int i = 0; i < 3; ++i) {
+    ++counts[router.route(prompt)];
+  }
+  EXPECT_EQ(counts, std::vector<size_t>({1, 1, 1}));
+}
+
+}  // namespace llm
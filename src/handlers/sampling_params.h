@@ -2,6 +2,8 @@
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace llm {
@@ -23,7 +25,18 @@ struct SamplingParams {
                  bool skip_special_tokens,
                  bool ignore_eos,
                  std::optional<std::vector<std::string>> stop,
-                 std::optional<std::vector<int32_t>> stop_token_ids)
+                 std::optional<std::vector<int32_t>> stop_token_ids,
+                 uint32_t num_beams = 1,
+                 float length_penalty = 1.0,
+                 bool early_stopping = false,
+                 bool logprobs = false,
+                 uint32_t top_logprobs = 0,
+                 bool prompt_logprobs = false,
+                 std::optional<std::unordered_map<int32_t, float>> logit_bias =
+                     std::nullopt,
+                 std::optional<std::vector<int32_t>> banned_token_ids =
+                     std::nullopt,
+                 std::optional<std::string> session_id = std::nullopt)
       : max_tokens(max_tokens),
         n(n),
         echo(echo),
@@ -36,7 +49,16 @@ struct SamplingParams {
         skip_special_tokens(skip_special_tokens),
         ignore_eos(ignore_eos),
         stop(stop),
-        stop_token_ids(stop_token_ids) {}
+        stop_token_ids(stop_token_ids),
+        num_beams(num_beams),
+        length_penalty(length_penalty),
+        early_stopping(early_stopping),
+        logprobs(logprobs),
+        top_logprobs(top_logprobs),
+        prompt_logprobs(prompt_logprobs),
+        logit_bias(std::move(logit_bias)),
+        banned_token_ids(std::move(banned_token_ids)),
+        session_id(std::move(session_id)) {}
 
   // number of tokens to generate. truncted to model's max context length.
   uint32_t max_tokens = 16;
@@ -85,6 +107,41 @@ struct SamplingParams {
 
   // the list of token ids to stop generating further tokens.
   std::optional<std::vector<int32_t>> stop_token_ids;
+
+  // number of beams for beam search. default = 1 to disable beam search.
+  // the best n of the beams are returned, sampling parameters like
+  // temperature, top_p and top_k are ignored.
+  uint32_t num_beams = 1;
+
+  // exponential penalty to the length for beam search. default = 1.0
+  // values > 0.0 promote longer sequences, while values < 0.0 encourage
+  // shorter ones.
+  float length_penalty = 1.0;
+
+  // whether to stop beam search as soon as there are num_beams finished
+  // candidates. default = false.
+  bool early_stopping = false;
+
+  // whether to return logprobs of generated tokens. default = false
+  bool logprobs = false;
+
+  // number of most likely alternatives to return with the logprob of each
+  // generated token, between [0, 20]. default = 0
+  uint32_t top_logprobs = 0;
+
+  // whether to return logprobs of prompt tokens. default = false
+  bool prompt_logprobs = false;
+
+  // biases added to logits of tokens before sampling, between [-100, 100].
+  std::optional<std::unordered_map<int32_t, float>> logit_bias;
+
+  // token ids that are never generated.
+  std::optional<std::vector<int32_t>> banned_token_ids;
+
+  // the id of the chat session, chat only. the prompt reuses token ids of
+  // the last turn of the session instead of tokenizing the whole conversation
+  // again.
+  std::optional<std::string> session_id;
 };
 
 }  // namespace llm
\ No newline at end of file
@@ -0,0 +1,118 @@
+#include "session_cache.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace llm {
+namespace {
+bool starts_with(std::string_view text, std::string_view prefix) {
+  return text.substr(0, prefix.size()) == prefix;
+}
+}  // namespace
+
+SessionCache::SessionCache(size_t capacity) : capacity_(capacity) {
+  CHECK_GT(capacity_, 0) << "capacity should be greater than 0";
+}
+
+std::shared_ptr<const SessionCache::Turn> SessionCache::get(
+    const std::string& session_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(session_id);
+  if (it == index_.end()) {
+    return nullptr;
+  }
+  // move the session to the front
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->second;
+}
+
+void SessionCache::put(const std::string& session_id,
+                       std::shared_ptr<const Turn> turn) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(session_id);
+  if (it != index_.end()) {
+    it->second->second = std::move(turn);
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return;
+  }
+  entries_.emplace_front(session_id, std::move(turn));
+  index_[session_id] = entries_.begin();
+  // evict the least recently used sessions
+  while (entries_.size() > capacity_) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+size_t SessionCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+int64_t SessionCache::encode(const Turn* turn,
+                             const std::string& prompt,
+                             const Tokenizer& tokenizer,
+                             std::vector<int32_t>* token_ids) {
+  token_ids->clear();
+  if (turn == nullptr || !starts_with(prompt, turn->prompt)) {
+    return tokenizer.encode(prompt, token_ids) ? 0 : -1;
+  }
+
+  // special tokens added to any encoded text, e.g. bos, which are already
+  // among the reused token ids
+  std::vector<int32_t> special_token_ids;
+  if (!tokenizer.encode("", &special_token_ids)) {
+    return -1;
+  }
+
+  std::string_view rest(prompt);
+  rest.remove_prefix(turn->prompt.size());
+  *token_ids = turn->prompt_token_ids;
+
+  // the client sends the reply back as the content of an assistant message
+  const std::string reply =
+      tokenizer.decode(turn->reply_token_ids, /*skip_special_tokens=*/true);
+  if (!reply.empty()) {
+    // decoding may drop the leading space of the reply, which the template
+    // may render after the prompt
+    std::string_view content = rest;
+    if (!std::isspace(static_cast<unsigned char>(reply.front()))) {
+      const size_t pos = content.find_first_not_of(" \t\r\n");
+      content.remove_prefix(std::min(pos, content.size()));
+    }
+    if (starts_with(content, reply)) {
+      rest = content.substr(reply.size());
+      token_ids->insert(token_ids->end(),
+                        turn->reply_token_ids.begin(),
+                        turn->reply_token_ids.end());
+    }
+  }
+
+  std::vector<int32_t> rest_token_ids;
+  if (!tokenizer.encode(rest, &rest_token_ids)) {
+    return -1;
+  }
+  if (rest_token_ids.size() < special_token_ids.size() ||
+      !std::equal(special_token_ids.begin(),
+                  special_token_ids.end(),
+                  rest_token_ids.begin())) {
+    // special tokens can't be told apart from the rest of the prompt
+    token_ids->clear();
+    return tokenizer.encode(prompt, token_ids) ? 0 : -1;
+  }
+  const int64_t num_reused = static_cast<int64_t>(token_ids->size());
+  token_ids->insert(token_ids->end(),
+                    rest_token_ids.begin() + special_token_ids.size(),
+                    rest_token_ids.end());
+  return num_reused;
+}
+
+}  // namespace llm
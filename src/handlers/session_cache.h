@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "tokenizer/tokenizer.h"
+
+namespace llm {
+
+// Keeps the exact token ids of the last turn of chat sessions, keyed by a
+// session id from the client. The next turn re-renders the whole conversation
+// through the chat template, and tokenizing it again may split the text
+// differently from the ids the model has processed, especially around the
+// generated reply, so the prefix cache match stops early. Instead, the prompt
+// of the next turn reuses the ids of the last turn for the rendered text they
+// cover, and only the rest of the prompt is tokenized. Least recently used
+// sessions are evicted beyond the capacity. Thread safe.
+class SessionCache final {
+ public:
+  // the last turn of a session
+  struct Turn {
+    // the rendered prompt and its token ids
+    std::string prompt;
+    std::vector<int32_t> prompt_token_ids;
+
+    // the token ids of the generated reply, without the stop token
+    std::vector<int32_t> reply_token_ids;
+  };
+
+  explicit SessionCache(size_t capacity);
+
+  // returns the last turn of the session, or nullptr if not found
+  std::shared_ptr<const Turn> get(const std::string& session_id);
+
+  // replaces the last turn of the session
+  void put(const std::string& session_id, std::shared_ptr<const Turn> turn);
+
+  size_t size() const;
+
+  // encode the prompt of the next turn, reusing the token ids of the last turn
+  // for the prefix of the prompt they cover. the prompt is encoded as a whole
+  // if the last turn is not its prefix. returns the number of reused token
+  // ids, or -1 if failed to encode.
+  static int64_t encode(const Turn* turn,
+                        const std::string& prompt,
+                        const Tokenizer& tokenizer,
+                        std::vector<int32_t>* token_ids);
+
+ private:
+  using Entry = std::pair<std::string, std::shared_ptr<const Turn>>;
+
+  const size_t capacity_;
+
+  mutable std::mutex mutex_;
+
+  // sessions in the order of last use, most recent first
+  std::list<Entry> entries_;
+
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+}  // namespace llm
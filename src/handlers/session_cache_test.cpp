@@ -0,0 +1,130 @@
+#include "session_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llm {
+
+namespace {
+constexpr int32_t kBosTokenId = 1;
+// a merged token for "ab", never produced by encoding
+constexpr int32_t kMergedTokenId = 2;
+constexpr int32_t kCharOffset = 10;
+
+// maps each char to one token and adds bos in front of the text
+class CharTokenizer final : public Tokenizer {
+ public:
+  bool encode(const std::string_view& text,
+              std::vector<int32_t>* ids) const override {
+    ids->push_back(kBosTokenId);
+    for (const char c : text) {
+      ids->push_back(static_cast<unsigned char>(c) + kCharOffset);
+    }
+    return true;
+  }
+
+  std::string decode(const Slice<int32_t>& tokens,
+                     bool skip_special_tokens) const override {
+    std::string text;
+    for (const int32_t token : tokens) {
+      if (token == kMergedTokenId) {
+        text += "ab";
+      } else if (token >= kCharOffset) {
+        text += static_cast<char>(token - kCharOffset);
+      } else if (!skip_special_tokens) {
+        text += "<s>";
+      }
+    }
+    return text;
+  }
+
+  size_t vocab_size() const override { return 256 + kCharOffset; }
+
+  std::unique_ptr<Tokenizer> clone() const override {
+    return std::make_unique<CharTokenizer>();
+  }
+};
+
+std::vector<int32_t> encode(const std::string& text, bool add_bos = true) {
+  std::vector<int32_t> ids;
+  CharTokenizer().encode(text, &ids);
+  if (!add_bos) {
+    ids.erase(ids.begin());
+  }
+  return ids;
+}
+
+std::vector<int32_t> concat(std::vector<int32_t> a,
+                            const std::vector<int32_t>& b) {
+  a.insert(a.end(), b.begin(), b.end());
+  return a;
+}
+}  // namespace
+
+TEST(SessionCacheTest, Evict) {
+  SessionCache cache(/*capacity=*/2);
+  EXPECT_EQ(cache.get("a"), nullptr);
+
+  auto turn = std::make_shared<SessionCache::Turn>();
+  turn->prompt = "hi";
+  cache.put("a", turn);
+  cache.put("b", turn);
+  EXPECT_EQ(cache.size(), 2);
+
+  // session b is the least recently used one after getting a
+  ASSERT_NE(cache.get("a"), nullptr);
+  cache.put("c", turn);
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_NE(cache.get("a"), nullptr);
+  EXPECT_EQ(cache.get("b"), nullptr);
+  EXPECT_NE(cache.get("c"), nullptr);
+
+  // the last turn is replaced
+  auto next = std::make_shared<SessionCache::Turn>();
+  next->prompt = "hello";
+  cache.put("a", next);
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.get("a")->prompt, "hello");
+}
+
+TEST(SessionCacheTest, Encode) {
+  const CharTokenizer tokenizer;
+  SessionCache::Turn turn;
+  turn.prompt = "U: hi\nA:";
+  turn.prompt_token_ids = encode(turn.prompt);
+  // the generated reply "abc" starts with a merged token
+  turn.reply_token_ids = {kMergedTokenId, 'c' + kCharOffset};
+
+  std::vector<int32_t> token_ids;
+  // the whole prompt is encoded without the last turn
+  const std::string prompt = "U: hi\nA: abc\nU: more\nA:";
+  EXPECT_EQ(SessionCache::encode(nullptr, prompt, tokenizer, &token_ids), 0);
+  EXPECT_EQ(token_ids, encode(prompt));
+
+  // token ids of the prompt and the reply are reused, including the merged
+  // token, and the rest is encoded without bos
+  const int64_t num_prompt_tokens = turn.prompt_token_ids.size();
+  EXPECT_EQ(SessionCache::encode(&turn, prompt, tokenizer, &token_ids),
+            num_prompt_tokens + 2);
+  EXPECT_EQ(token_ids,
+            concat(concat(turn.prompt_token_ids, turn.reply_token_ids),
+                   encode("\nU: more\nA:", /*add_bos=*/false)));
+
+  // only the prompt is reused if the client changes the reply
+  const std::string edited = "U: hi\nA: abd\nU: more\nA:";
+  EXPECT_EQ(SessionCache::encode(&turn, edited, tokenizer, &token_ids),
+            num_prompt_tokens);
+  EXPECT_EQ(token_ids,
+            concat(turn.prompt_token_ids,
+                   encode(" abd\nU: more\nA:", /*add_bos=*/false)));
+
+  // nothing is reused if the prompt of the last turn changes
+  const std::string changed = "U: hello\nA: abc\nU: more\nA:";
+  EXPECT_EQ(SessionCache::encode(&turn, changed, tokenizer, &token_ids), 0);
+  EXPECT_EQ(token_ids, encode(changed));
+}
+
+}  // namespace llm
@@ -3,6 +3,10 @@
 #include <glog/logging.h>
 #include <grpcpp/grpcpp.h>
 
+#include <optional>
+#include <string>
+#include <string_view>
+
 #include "common.pb.h"
 
 namespace llm {
@@ -49,4 +53,37 @@ grpc::StatusCode to_grpc_status_code(StatusCode code) {
   return grpc::StatusCode::UNKNOWN;
 }
 
-}  // namespace llm
\ No newline at end of file
+void add_logprobs(const std::vector<LogProb>& logprobs,
+                  proto::LogProbs* proto_logprobs) {
+  for (const auto& logprob : logprobs) {
+    auto* proto_logprob = proto_logprobs->add_content();
+    proto_logprob->set_token(logprob.token);
+    proto_logprob->set_token_id(logprob.token_id);
+    proto_logprob->set_logprob(logprob.logprob);
+    for (const auto& top : logprob.top_logprobs) {
+      auto* proto_top = proto_logprob->add_top_logprobs();
+      proto_top->set_token(top.token);
+      proto_top->set_token_id(top.token_id);
+      proto_top->set_logprob(top.logprob);
+    }
+  }
+}
+
+std::shared_ptr<RequestTrace> start_rpc_trace(std::string name,
+                                              grpc::ServerContext* context) {
+  std::optional<TraceContext> parent;
+  const auto& metadata = context->client_metadata();
+  if (auto it = metadata.find("traceparent"); it != metadata.end()) {
+    parent = TraceContext::from_traceparent(
+        std::string_view(it->second.data(), it->second.size()));
+  }
+
+  auto trace = start_request_trace(std::move(name), parent);
+  if (trace) {
+    context->AddInitialMetadata("traceparent",
+                                trace->context().to_traceparent());
+  }
+  return trace;
+}
+
+}  // namespace llm
@@ -2,7 +2,12 @@
 
 #include <grpcpp/grpcpp.h>
 
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "common.pb.h"
+#include "common/tracing.h"
 #include "request/output.h"
 #include "request/status.h"
 namespace llm {
@@ -11,4 +16,14 @@ Priority to_priority(proto::Priority priority);
 
 grpc::StatusCode to_grpc_status_code(StatusCode code);
 
+// append logprobs to the proto message
+void add_logprobs(const std::vector<LogProb>& logprobs,
+                  proto::LogProbs* proto_logprobs);
+
+// start a trace for the rpc, continuing the trace from the w3c traceparent in
+// client metadata if present. the traceparent of the new trace is sent back in
+// initial metadata. returns nullptr if the request is not sampled.
+std::shared_ptr<RequestTrace> start_rpc_trace(std::string name,
+                                              grpc::ServerContext* context);
+
 }  // namespace llm
\ No newline at end of file
@@ -416,37 +416,49 @@ unsafe fn _get_tensor(
 }
 
 
-// A simple C wrapper of hf-tokenzier library
+// A thread-safe C wrapper of hf-tokenzier library, results are returned in
+// buffers owned by the caller, which are freed with tokenizer_free_*().
 // ported from https://github.com/mlc-ai/tokenizers-cpp
 
 pub struct TokenizerWrapper {
-    // The tokenizer
+    // The tokenizer, only accessed through shared references
     tokenizer: Tokenizer,
-    // Holds the encoded ids to avoid dropping them
-    encode_ids: Vec<u32>,
-    // Holds the decoded string to avoid dropping it
-    decode_str: String,
-}
-
-impl TokenizerWrapper {
-    pub fn encode(&mut self, text: &str, add_special_tokens: bool) {
-        // Encode the text and store the ids
-        self.encode_ids = Vec::from(
-            self.tokenizer
-                .encode(text, add_special_tokens)
-                .unwrap()
-                .get_ids(),
-        );
+}
+
+// Hand over the ownership of a vector to the caller
+unsafe fn into_raw_parts<T>(vec: Vec<T>, out_data: *mut *mut T, out_len: *mut usize) {
+    let mut boxed = vec.into_boxed_slice();
+    *out_data = boxed.as_mut_ptr();
+    *out_len = boxed.len();
+    forget(boxed);
+}
+
+// Take back the ownership of a buffer returned by into_raw_parts
+unsafe fn free_raw_parts<T>(data: *mut T, len: usize) {
+    if !data.is_null() {
+        drop(Box::from_raw(std::ptr::slice_from_raw_parts_mut(data, len)));
     }
+}
 
-    pub fn decode(&mut self, ids: Vec<u32>, skip_special_tokens: bool) {
-        // Decode the ids and store the string
-        self.decode_str = self.tokenizer.decode(&ids, skip_special_tokens).unwrap();
+// Borrow a buffer from the caller, which may be null if empty
+unsafe fn as_slice<'a, T>(data: *const T, len: usize) -> &'a [T] {
+    if len == 0 {
+        &[]
+    } else {
+        std::slice::from_raw_parts(data, len)
     }
+}
 
-    pub fn get_vocab_size(&self, with_added_tokens: bool) -> usize {
-        self.tokenizer.get_vocab_size(with_added_tokens)
+// Concatenate items and return offsets, the i-th item is in
+// [offsets[i], offsets[i + 1]) of the concatenated buffer.
+fn concat<T: Copy, I: AsRef<[T]>>(items: impl Iterator<Item = I>) -> (Vec<T>, Vec<usize>) {
+    let mut data = Vec::new();
+    let mut offsets = vec![0];
+    for item in items {
+        data.extend_from_slice(item.as_ref());
+        offsets.push(data.len());
     }
+    (data, offsets)
 }
 
 #[no_mangle]
@@ -454,68 +466,142 @@ extern "C" fn tokenizer_from_file(path: *const c_char) -> *mut TokenizerWrapper
     let c_str = unsafe { CStr::from_ptr(path) };
     let path_str = match c_str.to_str() {
         Ok(s) => s,
-        Err(_) => panic!("Failed to convert C string to Rust string"),
+        Err(_) => return std::ptr::null_mut(),
     };
-
-    let boxed = Box::new(TokenizerWrapper {
-        tokenizer: Tokenizer::from_file(path_str).unwrap().into(),
-        encode_ids: Vec::new(),
-        decode_str: String::new(),
-    });
-
-    Box::into_raw(boxed)
+    match Tokenizer::from_file(path_str) {
+        Ok(tokenizer) => Box::into_raw(Box::new(TokenizerWrapper { tokenizer })),
+        Err(_) => std::ptr::null_mut(),
+    }
 }
 
 #[no_mangle]
 extern "C" fn tokenizer_encode(
-    handle: *mut TokenizerWrapper,
+    handle: *const TokenizerWrapper,
     input_cstr: *const u8,
     len: usize,
     add_special_tokens: bool,
-) {
+    out_ids: *mut *mut u32,
+    out_len: *mut usize,
+) -> bool {
     unsafe {
-        let input_data = std::str::from_utf8(std::slice::from_raw_parts(input_cstr, len)).unwrap();
-        (*handle).encode(input_data, add_special_tokens);
+        let input_data = match std::str::from_utf8(as_slice(input_cstr, len)) {
+            Ok(s) => s,
+            Err(_) => return false,
+        };
+        match (*handle).tokenizer.encode(input_data, add_special_tokens) {
+            Ok(encoding) => {
+                into_raw_parts(encoding.get_ids().to_vec(), out_ids, out_len);
+                true
+            }
+            Err(_) => false,
+        }
     }
 }
 
 #[no_mangle]
-extern "C" fn tokenizer_get_encode_ids(
-    handle: *mut TokenizerWrapper,
-    out_data: *mut *mut u32,
+extern "C" fn tokenizer_encode_batch(
+    handle: *const TokenizerWrapper,
+    input_cstrs: *const *const u8,
+    input_lens: *const usize,
+    num_inputs: usize,
+    add_special_tokens: bool,
+    out_ids: *mut *mut u32,
     out_len: *mut usize,
-) {
+    out_offsets: *mut *mut usize,
+) -> bool {
     unsafe {
-        *out_data = (*handle).encode_ids.as_mut_ptr();
-        *out_len = (*handle).encode_ids.len()
+        let cstrs = as_slice(input_cstrs, num_inputs);
+        let lens = as_slice(input_lens, num_inputs);
+        let mut inputs = Vec::with_capacity(num_inputs);
+        for (&cstr, &len) in cstrs.iter().zip(lens) {
+            match std::str::from_utf8(as_slice(cstr, len)) {
+                Ok(s) => inputs.push(s),
+                Err(_) => return false,
+            }
+        }
+        // texts are encoded in parallel by the tokenizer
+        match (*handle).tokenizer.encode_batch(inputs, add_special_tokens) {
+            Ok(encodings) => {
+                let (ids, offsets) = concat(encodings.iter().map(|e| e.get_ids()));
+                into_raw_parts(ids, out_ids, out_len);
+                let mut offsets_len = 0;
+                into_raw_parts(offsets, out_offsets, &mut offsets_len);
+                true
+            }
+            Err(_) => false,
+        }
     }
 }
 
 #[no_mangle]
 extern "C" fn tokenizer_decode(
-    handle: *mut TokenizerWrapper,
+    handle: *const TokenizerWrapper,
     input_ids: *const u32,
     len: usize,
     skip_special_tokens: bool,
-) {
+    out_cstr: *mut *mut u8,
+    out_len: *mut usize,
+) -> bool {
     unsafe {
-        let input_data = Vec::from(std::slice::from_raw_parts(input_ids, len));
-        (*handle).decode(input_data, skip_special_tokens);
+        let ids = as_slice(input_ids, len);
+        match (*handle).tokenizer.decode(ids, skip_special_tokens) {
+            Ok(text) => {
+                into_raw_parts(text.into_bytes(), out_cstr, out_len);
+                true
+            }
+            Err(_) => false,
+        }
     }
 }
 
 #[no_mangle]
-extern "C" fn tokenizer_get_decode_str(
-    handle: *mut TokenizerWrapper,
+extern "C" fn tokenizer_decode_batch(
+    handle: *const TokenizerWrapper,
+    input_ids: *const *const u32,
+    input_lens: *const usize,
+    num_inputs: usize,
+    skip_special_tokens: bool,
     out_cstr: *mut *mut u8,
     out_len: *mut usize,
-) {
+    out_offsets: *mut *mut usize,
+) -> bool {
     unsafe {
-        *out_cstr = (*handle).decode_str.as_mut_ptr();
-        *out_len = (*handle).decode_str.len();
+        let ids = as_slice(input_ids, num_inputs);
+        let lens = as_slice(input_lens, num_inputs);
+        let inputs: Vec<&[u32]> = ids
+            .iter()
+            .zip(lens)
+            .map(|(&ids, &len)| as_slice(ids, len))
+            .collect();
+        // ids are decoded in parallel by the tokenizer
+        match (*handle).tokenizer.decode_batch(&inputs, skip_special_tokens) {
+            Ok(texts) => {
+                let (bytes, offsets) = concat(texts.iter().map(|t| t.as_bytes()));
+                into_raw_parts(bytes, out_cstr, out_len);
+                let mut offsets_len = 0;
+                into_raw_parts(offsets, out_offsets, &mut offsets_len);
+                true
+            }
+            Err(_) => false,
+        }
     }
 }
 
+#[no_mangle]
+extern "C" fn tokenizer_free_ids(ids: *mut u32, len: usize) {
+    unsafe { free_raw_parts(ids, len) }
+}
+
+#[no_mangle]
+extern "C" fn tokenizer_free_str(cstr: *mut u8, len: usize) {
+    unsafe { free_raw_parts(cstr, len) }
+}
+
+#[no_mangle]
+extern "C" fn tokenizer_free_offsets(offsets: *mut usize, len: usize) {
+    unsafe { free_raw_parts(offsets, len) }
+}
+
 #[no_mangle]
 extern "C" fn tokenizer_free(wrapper: *mut TokenizerWrapper) {
     unsafe {
@@ -525,9 +611,9 @@ extern "C" fn tokenizer_free(wrapper: *mut TokenizerWrapper) {
 
 #[no_mangle]
 extern "C" fn tokenizer_vocab_size(
-    handle: *mut TokenizerWrapper, 
+    handle: *const TokenizerWrapper,
     with_added_tokens: bool) -> usize {
     unsafe {
-        (*handle).get_vocab_size(with_added_tokens)
+        (*handle).tokenizer.get_vocab_size(with_added_tokens)
     }
 }
@@ -7,31 +7,60 @@ extern "C" {
 
 // The C interface to the hf-tokenizers library
 // ported from https://github.com/mlc-ai/tokenizers-cpp
+// a handle can be shared by multiple threads, results are returned in buffers
+// owned by the caller, which should be freed with tokenizer_free_*().
 #include <stddef.h>
 #include <stdint.h>
 
 using TokenizerHandle = void*;
 
+// returns nullptr if failed to load the tokenizer
 TokenizerHandle tokenizer_from_file(const char* path);
 // TokenizerHandle tokenizer_from_pretrained(const char* identifier);
 
-void tokenizer_encode(TokenizerHandle handle,
+// returns false if failed to encode, ids are freed with tokenizer_free_ids()
+bool tokenizer_encode(TokenizerHandle handle,
                       const char* data,
                       size_t len,
-                      bool add_special_tokens);
+                      bool add_special_tokens,
+                      uint32_t** out_ids,
+                      size_t* out_len);
 
-void tokenizer_decode(TokenizerHandle handle,
-                      const uint32_t* data,
+// encode a batch of texts in parallel. ids of all texts are concatenated,
+// ids of the i-th text are in [offsets[i], offsets[i + 1]). offsets has
+// num_inputs + 1 elements and is freed with tokenizer_free_offsets().
+bool tokenizer_encode_batch(TokenizerHandle handle,
+                            const char* const* data,
+                            const size_t* lens,
+                            size_t num_inputs,
+                            bool add_special_tokens,
+                            uint32_t** out_ids,
+                            size_t* out_len,
+                            size_t** out_offsets);
+
+// returns false if failed to decode, str is freed with tokenizer_free_str()
+bool tokenizer_decode(TokenizerHandle handle,
+                      const uint32_t* ids,
                       size_t len,
-                      bool skip_special_tokens);
+                      bool skip_special_tokens,
+                      char** out_str,
+                      size_t* out_len);
+
+// decode a batch of ids in parallel, with the same layout as encode_batch.
+bool tokenizer_decode_batch(TokenizerHandle handle,
+                            const uint32_t* const* ids,
+                            const size_t* lens,
+                            size_t num_inputs,
+                            bool skip_special_tokens,
+                            char** out_str,
+                            size_t* out_len,
+                            size_t** out_offsets);
+
+void tokenizer_free_ids(uint32_t* ids, size_t len);
 
-void tokenizer_get_decode_str(TokenizerHandle handle,
-                              const char** data,
-                              size_t* len);
+void tokenizer_free_str(char* str, size_t len);
 
-void tokenizer_get_encode_ids(TokenizerHandle handle,
-                              const uint32_t** id_data,
-                              size_t* len);
+void tokenizer_free_offsets(size_t* offsets, size_t len);
 
 void tokenizer_free(TokenizerHandle handle);
 
@@ -0,0 +1,200 @@
+#include "cpu_attention.h"
+
+#include <ATen/Dispatch.h>
+#include <ATen/Parallel.h>
+#include <glog/logging.h>
+#include <torch/torch.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace llm {
+
+namespace {
+template <typename scalar_t>
+void varlen_attention_kernel(
+    const scalar_t* __restrict__ query,     // [n_tokens, n_heads, head_dim]
+    const std::vector<KVBlockView>& kv_blocks,  // [n_seqs]
+    const int32_t* q_cu_lens,                   // [n_seqs + 1]
+    const std::vector<int32_t>& seq_idxes,      // [n_tokens]
+    const float* alibi_slopes,                  // [n_heads] or nullptr
+    int64_t n_heads,
+    int64_t head_dim,
+    float scale,
+    scalar_t* __restrict__ output) {  // [n_tokens, n_heads, head_dim]
+  const int64_t n_tokens = static_cast<int64_t>(seq_idxes.size());
+
+  // one task for each query row of each head
+  at::parallel_for(
+      0, n_tokens * n_heads, /*grain_size=*/1, [&](int64_t begin, int64_t end) {
+        std::vector<float> q_row(head_dim);
+        std::vector<float> acc(head_dim);
+        std::vector<float> scores;
+        for (int64_t idx = begin; idx < end; ++idx) {
+          const int64_t token = idx / n_heads;
+          const int64_t head = idx % n_heads;
+          const int32_t seq = seq_idxes[token];
+          const KVBlockView& kv = kv_blocks[seq];
+          const int64_t q_len = q_cu_lens[seq + 1] - q_cu_lens[seq];
+          // causal mask: the i-th query attends to keys [0, kv_len - q_len + i]
+          const int64_t n_keys =
+              kv.num_tokens - q_len + (token - q_cu_lens[seq]) + 1;
+          const int64_t kv_head_offset =
+              (head / (n_heads / kv.num_heads)) * kv.head_stride;
+          const float slope =
+              alibi_slopes == nullptr ? 0.0f : alibi_slopes[head];
+
+          const scalar_t* q = query + idx * head_dim;
+          for (int64_t d = 0; d < head_dim; ++d) {
+            q_row[d] = static_cast<float>(q[d]) * scale;
+          }
+
+          // keys are read block by block in place
+          scores.resize(n_keys);
+          float max_score = -std::numeric_limits<float>::infinity();
+          for (int64_t b = 0, j = 0; j < n_keys; ++b) {
+            const scalar_t* k_block =
+                static_cast<const scalar_t*>(kv.key_blocks[b]) +
+                kv_head_offset;
+            const int64_t block_end = std::min(j + kv.block_size, n_keys);
+            for (const scalar_t* k_row = k_block; j < block_end;
+                 ++j, k_row += kv.token_stride) {
+              float score = slope * static_cast<float>(j);
+              for (int64_t d = 0; d < head_dim; ++d) {
+                score += q_row[d] * static_cast<float>(k_row[d]);
+              }
+              scores[j] = score;
+              max_score = std::max(max_score, score);
+            }
+          }
+
+          float sum = 0.0f;
+          std::fill(acc.begin(), acc.end(), 0.0f);
+          for (int64_t b = 0, j = 0; j < n_keys; ++b) {
+            const scalar_t* v_block =
+                static_cast<const scalar_t*>(kv.value_blocks[b]) +
+                kv_head_offset;
+            const int64_t block_end = std::min(j + kv.block_size, n_keys);
+            for (const scalar_t* v_row = v_block; j < block_end;
+                 ++j, v_row += kv.token_stride) {
+              const float p = std::exp(scores[j] - max_score);
+              sum += p;
+              for (int64_t d = 0; d < head_dim; ++d) {
+                acc[d] += p * static_cast<float>(v_row[d]);
+              }
+            }
+          }
+
+          scalar_t* out = output + idx * head_dim;
+          const float inv_sum = 1.0f / sum;
+          for (int64_t d = 0; d < head_dim; ++d) {
+            out[d] = static_cast<scalar_t>(acc[d] * inv_sum);
+          }
+        }
+      });
+}
+
+}  // namespace
+
+void cpu_varlen_attention(
+    const torch::Tensor& query,           // [n_tokens, n_heads, head_dim]
+    const torch::Tensor& key,             // [n_kv_tokens, n_kv_heads, head_dim]
+    const torch::Tensor& value,           // [n_kv_tokens, n_kv_heads, head_dim]
+    const torch::Tensor& q_cu_seq_lens,   // [n_seqs + 1]
+    const torch::Tensor& kv_cu_seq_lens,  // [n_seqs + 1]
+    const torch::optional<torch::Tensor>& alibi_slopes,  // [n_heads]
+    float scale,
+    torch::Tensor& output) {
+  CHECK(key.sizes() == value.sizes());
+  CHECK_EQ(key.scalar_type(), value.scalar_type());
+  CHECK(key.device().is_cpu()) << "key should be on cpu";
+  const auto k = key.contiguous();
+  const auto v = value.contiguous();
+  const auto kv_cu_lens_cpu =
+      kv_cu_seq_lens.cpu().to(torch::kInt).contiguous();
+  const int32_t* kv_cu_lens = kv_cu_lens_cpu.data_ptr<int32_t>();
+  const int64_t n_seqs = kv_cu_lens_cpu.numel() - 1;
+
+  // one block for each sequence
+  const int64_t token_bytes = k.stride(0) * k.element_size();
+  const auto* key_data = static_cast<const char*>(k.data_ptr());
+  const auto* value_data = static_cast<const char*>(v.data_ptr());
+  std::vector<KVBlockView> kv_blocks(n_seqs);
+  for (int64_t i = 0; i < n_seqs; ++i) {
+    auto& view = kv_blocks[i];
+    view.num_tokens = kv_cu_lens[i + 1] - kv_cu_lens[i];
+    view.block_size = std::max<int64_t>(view.num_tokens, 1);
+    view.num_heads = k.size(-2);
+    view.token_stride = k.stride(0);
+    view.head_stride = k.stride(1);
+    view.dtype = k.scalar_type();
+    view.key_blocks = {key_data + kv_cu_lens[i] * token_bytes};
+    view.value_blocks = {value_data + kv_cu_lens[i] * token_bytes};
+  }
+  cpu_varlen_attention(
+      query, kv_blocks, q_cu_seq_lens, alibi_slopes, scale, output);
+}
+
+void cpu_varlen_attention(
+    const torch::Tensor& query,                 // [n_tokens, n_heads, head_dim]
+    const std::vector<KVBlockView>& kv_blocks,  // [n_seqs]
+    const torch::Tensor& q_cu_seq_lens,         // [n_seqs + 1]
+    const torch::optional<torch::Tensor>& alibi_slopes,  // [n_heads]
+    float scale,
+    torch::Tensor& output) {
+  CHECK(query.device().is_cpu()) << "query should be on cpu";
+  CHECK_EQ(output.scalar_type(), query.scalar_type());
+
+  const int64_t n_tokens = query.size(0);
+  const int64_t n_heads = query.size(-2);
+  const int64_t head_dim = query.size(-1);
+
+  const auto q_cu_lens_cpu = q_cu_seq_lens.cpu().to(torch::kInt).contiguous();
+  const int32_t* q_cu_lens = q_cu_lens_cpu.data_ptr<int32_t>();
+  const int64_t n_seqs = q_cu_lens_cpu.numel() - 1;
+  CHECK_EQ(q_cu_lens[n_seqs], n_tokens);
+  CHECK_EQ(static_cast<int64_t>(kv_blocks.size()), n_seqs);
+
+  // the sequence of each query token
+  std::vector<int32_t> seq_idxes(n_tokens);
+  for (int64_t i = 0; i < n_seqs; ++i) {
+    const auto& kv = kv_blocks[i];
+    const int32_t q_len = q_cu_lens[i + 1] - q_cu_lens[i];
+    CHECK(kv.num_tokens >= q_len);
+    CHECK_EQ(kv.dtype, query.scalar_type());
+    CHECK(n_heads % kv.num_heads == 0);
+    std::fill(seq_idxes.begin() + q_cu_lens[i],
+              seq_idxes.begin() + q_cu_lens[i + 1],
+              static_cast<int32_t>(i));
+  }
+
+  torch::Tensor slopes;
+  if (alibi_slopes.has_value()) {
+    slopes = alibi_slopes.value().to(torch::kFloat).contiguous();
+    CHECK_EQ(slopes.numel(), n_heads);
+  }
+
+  const auto q = query.contiguous();
+  torch::Tensor out =
+      output.is_contiguous() ? output : torch::empty_like(q);
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      torch::kHalf, torch::kBFloat16, q.scalar_type(), "cpu_attention", [&] {
+        varlen_attention_kernel<scalar_t>(
+            q.data_ptr<scalar_t>(),
+            kv_blocks,
+            q_cu_lens,
+            seq_idxes,
+            slopes.defined() ? slopes.data_ptr<float>() : nullptr,
+            n_heads,
+            head_dim,
+            scale,
+            out.data_ptr<scalar_t>());
+      });
+  if (!out.is_same(output)) {
+    output.copy_(out);
+  }
+}
+
+}  // namespace llm
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <vector>
+
+#include "memory/kv_cache.h"
+
+namespace llm {
+
+// fused causal attention for variable length sequences on cpu. scores of each
+// query row are computed, normalized and applied to values in one task, so no
+// [n_heads, q_len, kv_len] scores, masks or biases are materialized. alibi
+// biases are computed inline as slope * key position, which only differs from
+// slope * (key position - query position) by a per-row constant that softmax
+// cancels out.
+void cpu_varlen_attention(
+    const torch::Tensor& query,           // [n_tokens, n_heads, head_dim]
+    const torch::Tensor& key,             // [n_kv_tokens, n_kv_heads, head_dim]
+    const torch::Tensor& value,           // [n_kv_tokens, n_kv_heads, head_dim]
+    const torch::Tensor& q_cu_seq_lens,   // [n_seqs + 1]
+    const torch::Tensor& kv_cu_seq_lens,  // [n_seqs + 1]
+    const torch::optional<torch::Tensor>& alibi_slopes,  // [n_heads]
+    float scale,
+    torch::Tensor& output);  // [n_tokens, n_heads, head_dim]
+
+// same as above, but keys and values are read in place from kv cache blocks
+// of each sequence instead of being gathered into contiguous tensors.
+void cpu_varlen_attention(
+    const torch::Tensor& query,                 // [n_tokens, n_heads, head_dim]
+    const std::vector<KVBlockView>& kv_blocks,  // [n_seqs]
+    const torch::Tensor& q_cu_seq_lens,         // [n_seqs + 1]
+    const torch::optional<torch::Tensor>& alibi_slopes,  // [n_heads]
+    float scale,
+    torch::Tensor& output);  // [n_tokens, n_heads, head_dim]
+
+}  // namespace llm
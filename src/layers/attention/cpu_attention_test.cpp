@@ -0,0 +1,180 @@
+#include "cpu_attention.h"
+
+#include <gtest/gtest.h>
+#include <torch/torch.h>
+
+#include <tuple>
+#include <vector>
+
+#include "memory/kv_cache.h"
+
+namespace llm {
+using ISlice = torch::indexing::Slice;
+
+namespace {
+// naive attention with relative alibi biases slope * (k_pos - q_pos)
+torch::Tensor naive_varlen_attention(
+    const torch::Tensor& query,  // [n_tokens, n_heads, head_dim]
+    const torch::Tensor& key,    // [n_kv_tokens, n_kv_heads, head_dim]
+    const torch::Tensor& value,  // [n_kv_tokens, n_kv_heads, head_dim]
+    const std::vector<int32_t>& q_cu_lens,
+    const std::vector<int32_t>& kv_cu_lens,
+    const torch::optional<torch::Tensor>& alibi_slopes,
+    float scale) {
+  const int64_t n_heads = query.size(1);
+  const int64_t group_size = n_heads / key.size(1);
+  std::vector<torch::Tensor> outputs;
+  for (size_t i = 0; i + 1 < q_cu_lens.size(); ++i) {
+    const int64_t q_len = q_cu_lens[i + 1] - q_cu_lens[i];
+    const int64_t kv_len = kv_cu_lens[i + 1] - kv_cu_lens[i];
+    const auto q =
+        query.slice(0, q_cu_lens[i], q_cu_lens[i + 1]).to(torch::kFloat);
+    const auto k = key.slice(0, kv_cu_lens[i], kv_cu_lens[i + 1])
+                       .repeat_interleave(group_size, /*dim=*/1)
+                       .to(torch::kFloat);
+    const auto v = value.slice(0, kv_cu_lens[i], kv_cu_lens[i + 1])
+                       .repeat_interleave(group_size, /*dim=*/1)
+                       .to(torch::kFloat);
+    // [n_heads, q_len, kv_len]
+    auto scores = torch::einsum("qhd,khd->hqk", {q, k}) * scale;
+    const auto q_pos = torch::arange(kv_len - q_len, kv_len).view({-1, 1});
+    const auto k_pos = torch::arange(kv_len).view({1, -1});
+    if (alibi_slopes.has_value()) {
+      scores += alibi_slopes.value().view({-1, 1, 1}) * (k_pos - q_pos);
+    }
+    scores = scores.masked_fill(k_pos > q_pos, -INFINITY);
+    outputs.push_back(
+        torch::einsum("hqk,khd->qhd", {scores.softmax(/*dim=*/-1), v}));
+  }
+  return torch::cat(outputs, /*dim=*/0);
+}
+}  // namespace
+
+class CpuAttentionTest
+    : public ::testing::TestWithParam<std::tuple<torch::ScalarType /*dtype*/,
+                                                 int64_t /*n_heads*/,
+                                                 int64_t /*n_kv_heads*/,
+                                                 bool /*alibi*/>> {};
+
+TEST_P(CpuAttentionTest, Varlen) {
+  const auto& [dtype, n_heads, n_kv_heads, alibi] = GetParam();
+  const int64_t head_dim = 64;
+  const float scale = 0.125;
+  // prefill, chunked prefill and decode
+  const std::vector<int32_t> q_cu_lens = {0, 17, 21, 22};
+  const std::vector<int32_t> kv_cu_lens = {0, 17, 50, 150};
+  const int64_t n_tokens = q_cu_lens.back();
+  const int64_t n_kv_tokens = kv_cu_lens.back();
+
+  const auto options = torch::dtype(dtype);
+  const auto query = torch::randn({n_tokens, n_heads, head_dim}, options);
+  const auto key = torch::randn({n_kv_tokens, n_kv_heads, head_dim}, options);
+  const auto value =
+      torch::randn({n_kv_tokens, n_kv_heads, head_dim}, options);
+  torch::optional<torch::Tensor> alibi_slopes;
+  if (alibi) {
+    alibi_slopes = torch::rand({n_heads}, torch::kFloat);
+  }
+
+  torch::Tensor output = torch::empty_like(query);
+  cpu_varlen_attention(query,
+                       key,
+                       value,
+                       torch::tensor(q_cu_lens, torch::kInt),
+                       torch::tensor(kv_cu_lens, torch::kInt),
+                       alibi_slopes,
+                       scale,
+                       output);
+
+  const auto ref_output = naive_varlen_attention(
+      query, key, value, q_cu_lens, kv_cu_lens, alibi_slopes, scale);
+  const double tol = dtype == torch::kFloat ? 1e-5 : 1e-2;
+  EXPECT_TRUE(torch::allclose(
+      output.to(torch::kFloat), ref_output, /*rtol=*/tol, /*atol=*/tol));
+}
+
+TEST_P(CpuAttentionTest, KVBlocks) {
+  const auto& [dtype, n_heads, n_kv_heads, alibi] = GetParam();
+  const int64_t head_dim = 64;
+  const int64_t block_size = 8;
+  const int64_t n_blocks = 32;
+  const float scale = 0.125;
+  const std::vector<int32_t> q_cu_lens = {0, 17, 21, 22};
+  const std::vector<int32_t> kv_cu_lens = {0, 17, 50, 150};
+  const int64_t n_tokens = q_cu_lens.back();
+  const int64_t n_kv_tokens = kv_cu_lens.back();
+
+  const auto options = torch::dtype(dtype);
+  const auto query = torch::randn({n_tokens, n_heads, head_dim}, options);
+  const auto key = torch::randn({n_kv_tokens, n_kv_heads, head_dim}, options);
+  const auto value =
+      torch::randn({n_kv_tokens, n_kv_heads, head_dim}, options);
+  torch::optional<torch::Tensor> alibi_slopes;
+  if (alibi) {
+    alibi_slopes = torch::rand({n_heads}, torch::kFloat);
+  }
+
+  // scatter keys and values into shuffled blocks, block 0 is for padding
+  const std::vector<int64_t> kv_shape = {
+      n_blocks, block_size, n_kv_heads, head_dim};
+  KVCache kv_cache(torch::zeros(kv_shape, options),
+                   torch::zeros(kv_shape, options));
+  const auto block_ids = torch::randperm(n_blocks - 1, torch::kInt) + 1;
+  const int32_t* ids = block_ids.data_ptr<int32_t>();
+  std::vector<std::vector<int32_t>> block_tables_vec;
+  std::vector<int32_t> slot_ids;
+  int64_t next_block = 0;
+  for (size_t i = 0; i + 1 < kv_cu_lens.size(); ++i) {
+    const int64_t kv_len = kv_cu_lens[i + 1] - kv_cu_lens[i];
+    std::vector<int32_t> block_table;
+    for (int64_t j = 0; j < kv_len; ++j) {
+      if (j % block_size == 0) {
+        block_table.push_back(ids[next_block++]);
+      }
+      slot_ids.push_back(block_table.back() * block_size + j % block_size);
+    }
+    block_tables_vec.push_back(block_table);
+  }
+  auto block_tables = torch::zeros(
+      {static_cast<int64_t>(block_tables_vec.size()), 13}, torch::kInt);
+  for (size_t i = 0; i < block_tables_vec.size(); ++i) {
+    const auto& table = block_tables_vec[i];
+    block_tables.index_put_(
+        {static_cast<int64_t>(i), ISlice(0, table.size())},
+        torch::tensor(table, torch::kInt));
+  }
+  kv_cache.set_kv_cache(torch::tensor(slot_ids, torch::kInt), key, value);
+
+  const auto kv_cu_seq_lens = torch::tensor(kv_cu_lens, torch::kInt);
+  torch::Tensor output = torch::empty_like(query);
+  cpu_varlen_attention(
+      query,
+      kv_cache.get_kv_block_views(block_tables, kv_cu_seq_lens),
+      torch::tensor(q_cu_lens, torch::kInt),
+      alibi_slopes,
+      scale,
+      output);
+
+  // the same as attention with contiguous keys and values
+  torch::Tensor ref_output = torch::empty_like(query);
+  cpu_varlen_attention(query,
+                       key,
+                       value,
+                       torch::tensor(q_cu_lens, torch::kInt),
+                       kv_cu_seq_lens,
+                       alibi_slopes,
+                       scale,
+                       ref_output);
+  EXPECT_TRUE(torch::equal(output, ref_output));
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Varlen,
+    CpuAttentionTest,
+    ::testing::Combine(::testing::Values(torch::kFloat, torch::kBFloat16),
+                       ::testing::Values(8),     // n_heads
+                       ::testing::Values(8, 2),  // n_kv_heads
+                       ::testing::Values(false, true)  // alibi
+                       ));
+
+}  // namespace llm
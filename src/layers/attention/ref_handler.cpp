@@ -2,6 +2,7 @@
 
 #include <torch/torch.h>
 
+#include "cpu_attention.h"
 #include "memory/kv_cache.h"
 #include "models/parameters.h"
 
@@ -13,7 +14,7 @@ torch::Tensor masked_self_attention(
     const torch::Tensor& query,         // [q_seq_len, n_heads, head_dim]
     const torch::Tensor& key,           // [k_seq_len, n_heads, head_dim]
     const torch::Tensor& value,         // [k_seq_len, n_heads, head_dim]
-    const torch::Tensor& alibi_biases,  // [n_heads, q_seq_len, k_seq_len]
+    const torch::Tensor& alibi_biases,  // [n_heads, 1, k_seq_len]
     const torch::Tensor& mask,          // [n_heads, q_seq_len, k_seq_len]
     float scale) {
   // => [n_heads, q_seq_len, k_seq_len]
@@ -44,7 +45,7 @@ void varlen_masked_self_attention(
     const torch::Tensor& value,           // [n_tokens, n_kv_heads, head_dim]
     const torch::Tensor& q_cu_seq_lens,   // [n_seqs + 1]
     const torch::Tensor& kv_cu_seq_lens,  // [n_seqs + 1]
-    const torch::optional<torch::Tensor> alibi_slopes,  // [n_heads]
+    const torch::Tensor& alibi_biases,    // [n_heads, 1, max_kv_len]
     float scale,
     torch::Tensor& output) {
   // same length for key and value
@@ -94,15 +95,11 @@ void varlen_masked_self_attention(
     mask = torch::tril(mask, /*diagonal=*/kv_len - q_len).to(query);
 
     torch::Tensor bias;
-    if (alibi_slopes) {
-      const torch::Tensor& slopes = alibi_slopes.value();
-      CHECK(slopes.size(0) == n_heads);
-
-      // calculate alibi attention bias
+    if (alibi_biases.defined()) {
+      CHECK(alibi_biases.size(0) == n_heads);
+      CHECK(alibi_biases.size(-1) >= kv_len);
       // since it's causal mask, we can just use [0, 1, ...,, kv_len)
-      auto distance = torch::arange(0, kv_len, query.options());
-      // [n_heads, 1, kv_len]
-      bias = distance.view({1, 1, kv_len}) * slopes.view({n_heads, 1, 1});
+      bias = alibi_biases.slice(/*dim=*/-1, /*start=*/0, /*end=*/kv_len);
     }
 
     const auto attn =
@@ -140,6 +137,54 @@ std::tuple<torch::Tensor, torch::Tensor> RefHandler::apply_pos_emb(
   return {query, key};
 }
 
+torch::Tensor RefHandler::alibi_biases(int64_t kv_len) {
+  if (!alibi_slopes_.has_value()) {
+    return {};
+  }
+  if (!alibi_bias_tile_.defined() || alibi_bias_tile_.size(-1) < kv_len) {
+    // grow to the next power of 2 to amortize the cost of longer sequences
+    int64_t len = 1024;
+    while (len < kv_len) {
+      len *= 2;
+    }
+    const auto slopes = alibi_slopes_.value().to(torch::kFloat);
+    const int64_t n_heads = slopes.size(0);
+    const auto distance = torch::arange(0, len, slopes.options());
+    alibi_bias_tile_ =
+        distance.view({1, 1, len}) * slopes.view({n_heads, 1, 1});
+  }
+  return alibi_bias_tile_;
+}
+
+void RefHandler::varlen_attention(const torch::Tensor& query,
+                                  const torch::Tensor& key,
+                                  const torch::Tensor& value,
+                                  const InputParameters& input_params,
+                                  torch::Tensor& output) {
+  // the fused kernel saves materializing [n_heads, q_len, kv_len] alibi
+  // biases, while the batched matmuls of einsum are faster without them
+  if (query.device().is_cpu() && alibi_slopes_.has_value()) {
+    // alibi biases are computed inline by the fused kernel
+    cpu_varlen_attention(query,
+                         key,
+                         value,
+                         input_params.q_cu_seq_lens,
+                         input_params.kv_cu_seq_lens,
+                         alibi_slopes_,
+                         scale_,
+                         output);
+    return;
+  }
+  varlen_masked_self_attention(query,
+                               key,
+                               value,
+                               input_params.q_cu_seq_lens,
+                               input_params.kv_cu_seq_lens,
+                               alibi_biases(input_params.kv_max_seq_len),
+                               scale_,
+                               output);
+}
+
 // batch prefill for attention, optimized for prefill stage
 void RefHandler::batch_prefill(
     const torch::Tensor& query,           // [n_tokens, n_heads, head_dim]
@@ -148,14 +193,7 @@ void RefHandler::batch_prefill(
     const InputParameters& input_params,  // input paras used for attention
     torch::Tensor& output) {
   // don't use kv cache in prefill stage
-  varlen_masked_self_attention(query,
-                               key,
-                               value,
-                               input_params.q_cu_seq_lens,
-                               input_params.kv_cu_seq_lens,
-                               alibi_slopes_,
-                               scale_,
-                               output);
+  varlen_attention(query, key, value, input_params, output);
 }
 
 // batch decode for attention, optimized for decode stage
@@ -165,18 +203,26 @@ void RefHandler::batch_decode(
     const KVCache& kv_cache,              // where to retrieval key and value
     const InputParameters& input_params,  // input paras used for attention
     torch::Tensor& output) {
+  // the fused kernel reads cache blocks in place, which saves gathering the
+  // whole context for single query decode. chunked prefill without alibi
+  // gathers key and value for the batched matmuls of einsum instead.
+  const bool decode_only = input_params.q_max_seq_len <= 1;
+  if (query.device().is_cpu() && (decode_only || alibi_slopes_.has_value())) {
+    // read key and value from cache blocks in place
+    const auto kv_blocks = kv_cache.get_kv_block_views(
+        input_params.block_tables, input_params.kv_cu_seq_lens);
+    cpu_varlen_attention(query,
+                         kv_blocks,
+                         input_params.q_cu_seq_lens,
+                         alibi_slopes_,
+                         scale_,
+                         output);
+    return;
+  }
   // retrieval key and value from kv_cache
   auto [key, value] = kv_cache.get_kv_cache(input_params.block_tables,
                                             input_params.kv_cu_seq_lens);
-
-  varlen_masked_self_attention(query,
-                               key,
-                               value,
-                               input_params.q_cu_seq_lens,
-                               input_params.kv_cu_seq_lens,
-                               alibi_slopes_,
-                               scale_,
-                               output);
+  varlen_attention(query, key, value, input_params, output);
 }
 
 // append key and value to kv_cache
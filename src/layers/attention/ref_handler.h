@@ -10,6 +10,8 @@
 namespace llm {
 
 // an pytorch implementation handler for attention operations, used for testing
+// and non-cuda devices. a fused kernel is used on cpu, while other devices
+// fall back to einsum with alibi biases sliced from a cached tile.
 class RefHandler : public AttentionHandler {
  public:
   // create a flash attn handler with rope positional embedding
@@ -59,6 +61,17 @@ class RefHandler : public AttentionHandler {
       const InputParameters& input_params) override;
 
  private:
+  // get alibi biases for key positions [0, kv_len) of all heads, which are
+  // sliced from a cached tile grown on demand. [n_heads, 1, kv_len]
+  torch::Tensor alibi_biases(int64_t kv_len);
+
+  // attention for variable length sequences
+  void varlen_attention(const torch::Tensor& query,
+                        const torch::Tensor& key,
+                        const torch::Tensor& value,
+                        const InputParameters& input_params,
+                        torch::Tensor& output);
+
   // scale factor
   float scale_ = 0.0;
 
@@ -67,6 +80,9 @@ class RefHandler : public AttentionHandler {
 
   // alibi slops
   torch::optional<torch::Tensor> alibi_slopes_;
+
+  // cached alibi biases for the einsum fallback. [n_heads, 1, max_kv_len]
+  torch::Tensor alibi_bias_tile_;
 };
 
 }  // namespace llm
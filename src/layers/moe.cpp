@@ -0,0 +1,271 @@
+#include "moe.h"
+
+#include <glog/logging.h>
+#include <torch/torch.h>
+
+#include <algorithm>
+#include <string>
+#include <tuple>
+
+#include "model_parallel/model_parallel.h"
+
+namespace llm {
+namespace moe {
+
+std::tuple<torch::Tensor, torch::Tensor> topk_gating(
+    const torch::Tensor& router_logits,
+    int64_t topk,
+    bool renormalize) {
+  CHECK_LE(topk, router_logits.size(-1));
+  // compute the probabilities in float for numerical stability
+  const auto probs = torch::softmax(router_logits, /*dim=*/-1, torch::kFloat);
+  auto [weights, expert_ids] = probs.topk(topk, /*dim=*/-1);
+  if (renormalize) {
+    weights = weights / weights.sum(/*dim=*/-1, /*keepdim=*/true);
+  }
+  return {weights.to(router_logits.dtype()), expert_ids};
+}
+
+PermutedTokens permute(const torch::Tensor& tokens,
+                       const torch::Tensor& expert_ids,
+                       int64_t expert_start,
+                       int64_t n_experts) {
+  CHECK_EQ(tokens.size(0), expert_ids.size(0));
+  const int64_t topk = expert_ids.size(1);
+
+  auto ids = expert_ids.flatten().to(torch::kLong) - expert_start;
+  // move assignments to other experts into an extra group at the end
+  ids = ids.masked_fill(ids.lt(0).logical_or(ids.ge(n_experts)), n_experts);
+  // stable sort to keep the order of tokens within each expert
+  const auto order =
+      std::get<1>(ids.sort(/*stable=*/true, /*dim=*/0, /*descending=*/false));
+
+  // count with scatter_add instead of bincount, which syncs with the host on
+  // cuda to find the number of bins.
+  const auto counts = torch::zeros({n_experts + 1}, ids.options())
+                          .scatter_add_(/*dim=*/0, ids, torch::ones_like(ids))
+                          .slice(/*dim=*/0, /*start=*/0, /*end=*/n_experts);
+  auto offsets = torch::zeros({n_experts + 1}, ids.options());
+  offsets.slice(/*dim=*/0, /*start=*/1) = counts.cumsum(/*dim=*/0);
+
+  PermutedTokens permuted;
+  permuted.row_ids = order;
+  permuted.tokens = tokens.index_select(
+      /*dim=*/0, torch::div(order, topk, /*rounding_mode=*/"floor"));
+  permuted.expert_offsets = offsets;
+  return permuted;
+}
+
+torch::Tensor grouped_gemm(const torch::Tensor& input,
+                           const torch::Tensor& weights,
+                           const torch::Tensor& expert_offsets,
+                           int64_t max_rows) {
+  if (std::min(max_rows, input.size(0)) <= kMaxPaddedRowsPerExpert) {
+    return grouped_gemm_padded(input, weights, expert_offsets, max_rows);
+  }
+  return grouped_gemm_per_expert(input, weights, expert_offsets);
+}
+
+int64_t grouped_gemm_rows(int64_t n_rows,
+                          int64_t n_experts,
+                          int64_t max_rows) {
+  max_rows = std::min(max_rows, n_rows);
+  return max_rows <= kMaxPaddedRowsPerExpert ? n_experts * max_rows : n_rows;
+}
+
+torch::Tensor grouped_gemm_padded(const torch::Tensor& input,
+                                  const torch::Tensor& weights,
+                                  const torch::Tensor& expert_offsets,
+                                  int64_t max_rows) {
+  const int64_t n_experts = weights.size(0);
+  const int64_t n_rows = input.size(0);
+  CHECK_EQ(expert_offsets.numel(), n_experts + 1);
+  CHECK_EQ(input.size(1), weights.size(2));
+  max_rows = std::min(max_rows, n_rows);
+
+  // the slot of each row in the padded buffer, [expert, row in the expert].
+  // rows of dropped assignments go to an extra slot at the end.
+  const int64_t n_slots = n_experts * max_rows;
+  const auto offsets = expert_offsets.to(input.device(), torch::kLong);
+  const auto rows = torch::arange(n_rows, offsets.options());
+  const auto groups = torch::searchsorted(offsets.slice(/*dim=*/0, 1),
+                                          rows,
+                                          /*out_int32=*/false,
+                                          /*right=*/true);
+  const auto slots =
+      torch::where(groups.lt(n_experts),
+                   groups * max_rows + rows - offsets.index_select(0, groups),
+                   n_slots);
+
+  auto padded = torch::zeros({n_slots + 1, input.size(1)}, input.options());
+  padded.index_copy_(/*dim=*/0, slots, input);
+  auto padded_out =
+      torch::empty({n_slots + 1, weights.size(1)}, input.options());
+  // outputs of dropped rows are zeros
+  padded_out[n_slots].zero_();
+  auto out = padded_out.slice(/*dim=*/0, 0, n_slots)
+                 .view({n_experts, max_rows, weights.size(1)});
+  torch::bmm_out(out,
+                 padded.slice(/*dim=*/0, 0, n_slots)
+                     .view({n_experts, max_rows, input.size(1)}),
+                 weights.transpose(1, 2));
+  return padded_out.index_select(/*dim=*/0, slots);
+}
+
+torch::Tensor grouped_gemm_per_expert(const torch::Tensor& input,
+                                      const torch::Tensor& weights,
+                                      const torch::Tensor& expert_offsets) {
+  const int64_t n_experts = weights.size(0);
+  CHECK_EQ(expert_offsets.numel(), n_experts + 1);
+  CHECK_EQ(input.size(1), weights.size(2));
+
+  // syncs with the host to read the offsets
+  const auto offsets_cpu = expert_offsets.to(torch::kCPU, torch::kLong);
+  const auto* offsets = offsets_cpu.data_ptr<int64_t>();
+  CHECK_LE(offsets[n_experts], input.size(0));
+  auto output =
+      torch::zeros({input.size(0), weights.size(1)}, input.options());
+  // each group writes into its own rows of the output, empty groups are free
+  for (int64_t e = 0; e < n_experts; ++e) {
+    const int64_t start = offsets[e];
+    const int64_t end = offsets[e + 1];
+    if (start == end) {
+      continue;
+    }
+    auto out = output.slice(/*dim=*/0, start, end);
+    torch::mm_out(out, input.slice(/*dim=*/0, start, end), weights[e].t());
+  }
+  return output;
+}
+
+torch::Tensor unpermute(const torch::Tensor& input,
+                        const torch::Tensor& row_ids,
+                        const torch::Tensor& topk_weights) {
+  const int64_t n_tokens = topk_weights.size(0);
+  const int64_t topk = topk_weights.size(1);
+  const auto weights =
+      topk_weights.flatten().index_select(/*dim=*/0, row_ids).unsqueeze(1);
+  auto output = torch::zeros({n_tokens, input.size(1)}, input.options());
+  return output.index_add_(
+      /*dim=*/0,
+      torch::div(row_ids, topk, /*rounding_mode=*/"floor"),
+      input * weights.to(input.dtype()));
+}
+
+}  // namespace moe
+
+FusedMoEImpl::FusedMoEImpl(int64_t n_experts,
+                           int64_t topk,
+                           int64_t hidden_size,
+                           int64_t intermediate_size,
+                           bool renormalize,
+                           const std::string& act,
+                           const ParallelArgs& parallel_args,
+                           const torch::TensorOptions& options)
+    : topk_(topk),
+      intermediate_size_(intermediate_size),
+      renormalize_(renormalize),
+      parallel_args_(parallel_args) {
+  const int32_t world_size = parallel_args.world_size();
+  CHECK_EQ(n_experts % world_size, 0)
+      << "n_experts " << n_experts << " not divisible by world_size "
+      << world_size;
+  CHECK_LE(topk, n_experts);
+  n_local_experts_ = n_experts / world_size;
+  expert_start_ = parallel_args.rank() * n_local_experts_;
+
+  act_with_mul_ = Activation::get_act_with_mul_func(act, options.device());
+  CHECK(act_with_mul_ != nullptr);
+
+  gate_ = register_parameter("gate",
+                             torch::empty({n_experts, hidden_size}, options),
+                             /*requires_grad=*/false);
+  w13_ = register_parameter(
+      "w13",
+      torch::empty({n_local_experts_, intermediate_size * 2, hidden_size},
+                   options),
+      /*requires_grad=*/false);
+  w2_ = register_parameter(
+      "w2",
+      torch::empty({n_local_experts_, hidden_size, intermediate_size},
+                   options),
+      /*requires_grad=*/false);
+
+  w1_is_loaded_.resize(n_local_experts_, false);
+  w3_is_loaded_.resize(n_local_experts_, false);
+  w2_is_loaded_.resize(n_local_experts_, false);
+}
+
+torch::Tensor FusedMoEImpl::forward(const torch::Tensor& x) {
+  namespace F = torch::nn::functional;
+  const auto router_logits = F::linear(x, gate_);
+  const auto [topk_weights, expert_ids] =
+      moe::topk_gating(router_logits, topk_, renormalize_);
+
+  const auto permuted =
+      moe::permute(x, expert_ids, expert_start_, n_local_experts_);
+  // each token selects distinct experts, at most n_tokens rows per expert.
+  // only small batches are padded to it, larger ones run a gemm per expert.
+  const int64_t max_rows = x.size(0);
+  auto h = moe::grouped_gemm(
+      permuted.tokens, w13_, permuted.expert_offsets, max_rows);
+  h = moe::grouped_gemm(
+      act_with_mul_(h), w2_, permuted.expert_offsets, max_rows);
+  auto output = moe::unpermute(h, permuted.row_ids, topk_weights);
+
+  if (parallel_args_.world_size() > 1) {
+    // sum up outputs of experts on all ranks
+    output = reduce_from_model_parallel_region(output, parallel_args_);
+  }
+  return output;
+}
+
+void FusedMoEImpl::load_state_dict(const StateDict& state_dict) {
+  // copy the tensor into the given slice of weights if found
+  auto load = [&](const std::string& tensor_name, torch::Tensor weight) {
+    const auto tensor = state_dict.get_tensor(tensor_name);
+    if (!tensor.defined()) {
+      return false;
+    }
+    CHECK_EQ(weight.sizes(), tensor.sizes())
+        << "weight size mismatch for " << name() << " " << tensor_name;
+    weight.copy_(tensor);
+    return true;
+  };
+
+  if (load("gate.weight", gate_)) {
+    gate_is_loaded_ = true;
+  }
+  const int64_t n = intermediate_size_;
+  for (int64_t i = 0; i < n_local_experts_; ++i) {
+    const std::string prefix =
+        "experts." + std::to_string(expert_start_ + i) + ".";
+    auto w13 = w13_[i];
+    if (load(prefix + "w1.weight", w13.slice(/*dim=*/0, 0, n))) {
+      w1_is_loaded_[i] = true;
+    }
+    if (load(prefix + "w3.weight", w13.slice(/*dim=*/0, n, 2 * n))) {
+      w3_is_loaded_[i] = true;
+    }
+    if (load(prefix + "w2.weight", w2_[i])) {
+      w2_is_loaded_[i] = true;
+    }
+  }
+}
+
+void FusedMoEImpl::verify_loaded_weights(const std::string& prefix) const {
+  CHECK(gate_is_loaded_) << "weight is not loaded for " << prefix
+                         << "gate.weight";
+  for (int64_t i = 0; i < n_local_experts_; ++i) {
+    const std::string expert_prefix =
+        prefix + "experts." + std::to_string(expert_start_ + i) + ".";
+    CHECK(w1_is_loaded_[i])
+        << "weight is not loaded for " << expert_prefix << "w1.weight";
+    CHECK(w3_is_loaded_[i])
+        << "weight is not loaded for " << expert_prefix << "w3.weight";
+    CHECK(w2_is_loaded_[i])
+        << "weight is not loaded for " << expert_prefix << "w2.weight";
+  }
+}
+
+}  // namespace llm
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <glog/logging.h>
+#include <torch/torch.h>
+
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "activation.h"
+#include "model_loader/state_dict.h"
+#include "model_parallel/parallel_args.h"
+
+namespace llm {
+
+namespace moe {
+// select top k experts for each token from the router logits.
+// router_logits: [n_tokens, n_experts]
+// returns: weights [n_tokens, topk] and expert ids [n_tokens, topk]
+std::tuple<torch::Tensor, torch::Tensor> topk_gating(
+    const torch::Tensor& router_logits,
+    int64_t topk,
+    bool renormalize);
+
+// tokens grouped by the expert they are routed to
+struct PermutedTokens {
+  // [n_tokens * topk, dim], rows of the same expert are contiguous
+  torch::Tensor tokens;
+
+  // [n_tokens * topk], the flattened (token, k) index of each row, i.e.
+  // token * topk + k
+  torch::Tensor row_ids;
+
+  // [n_experts + 1] on the device of tokens, rows of expert e are
+  // [offsets[e], offsets[e+1]). rows from offsets[n_experts] on are dropped.
+  torch::Tensor expert_offsets;
+};
+
+// group tokens by experts in [expert_start, expert_start + n_experts), a token
+// is repeated once for each of its selected experts. assignments to other
+// experts are dropped, e.g. experts on other ranks, and moved to the end so
+// that shapes don't depend on the routing and the host never waits for it.
+// tokens: [n_tokens, dim]
+// expert_ids: [n_tokens, topk]
+PermutedTokens permute(const torch::Tensor& tokens,
+                       const torch::Tensor& expert_ids,
+                       int64_t expert_start,
+                       int64_t n_experts);
+
+// the max rows per expert of the padded batched gemm. small batches, e.g.
+// decode, are bound by reading the weights, so padding every expert to the
+// same number of rows is cheap and saves syncing with the host. larger
+// batches are compute bound and run a gemm for each expert instead.
+constexpr int64_t kMaxPaddedRowsPerExpert = 64;
+
+// multiply each group of rows with the weight of its expert. up to
+// kMaxPaddedRowsPerExpert rows per expert, it runs grouped_gemm_padded,
+// otherwise grouped_gemm_per_expert.
+// input: [n_rows, in_features]
+// weights: [n_experts, out_features, in_features]
+// expert_offsets: [n_experts + 1]
+// max_rows: no less than the number of rows of any expert
+// returns: [n_rows, out_features]
+torch::Tensor grouped_gemm(const torch::Tensor& input,
+                           const torch::Tensor& weights,
+                           const torch::Tensor& expert_offsets,
+                           int64_t max_rows);
+
+// the number of rows grouped_gemm multiplies, including padding, which
+// bounds both its flops and the size of its buffers.
+int64_t grouped_gemm_rows(int64_t n_rows, int64_t n_experts, int64_t max_rows);
+
+// multiply in one batched gemm. rows are scattered into a buffer of
+// [n_experts, max_rows] padded with zeros, without syncing with the host.
+// outputs of dropped rows are zeros.
+torch::Tensor grouped_gemm_padded(const torch::Tensor& input,
+                                  const torch::Tensor& weights,
+                                  const torch::Tensor& expert_offsets,
+                                  int64_t max_rows);
+
+// multiply with a gemm for each expert on its own rows, which reads the
+// offsets on the host. outputs of dropped rows are zeros.
+torch::Tensor grouped_gemm_per_expert(const torch::Tensor& input,
+                                      const torch::Tensor& weights,
+                                      const torch::Tensor& expert_offsets);
+
+// scatter rows back to their tokens and sum them up with the gating weights.
+// input: [n_rows, dim]
+// row_ids: [n_rows]
+// topk_weights: [n_tokens, topk]
+// returns: [n_tokens, dim]
+torch::Tensor unpermute(const torch::Tensor& input,
+                        const torch::Tensor& row_ids,
+                        const torch::Tensor& topk_weights);
+
+}  // namespace moe
+
+// Mixture of experts with top k gating. Experts are sharded across ranks, each
+// rank holds n_experts / world_size experts and the outputs are reduced across
+// ranks. The gate is replicated on all ranks.
+class FusedMoEImpl : public torch::nn::Module {
+ public:
+  FusedMoEImpl(int64_t n_experts,
+               int64_t topk,
+               int64_t hidden_size,
+               int64_t intermediate_size,
+               bool renormalize,
+               const std::string& act,
+               const ParallelArgs& parallel_args,
+               const torch::TensorOptions& options);
+
+  // x: [n_tokens, hidden_size]
+  torch::Tensor forward(const torch::Tensor& x);
+
+  // load the weights from the checkpoint with mixtral's naming:
+  // gate.weight and experts.{i}.w1/w3/w2.weight for gate/up/down projections.
+  void load_state_dict(const StateDict& state_dict);
+
+  void verify_loaded_weights(const std::string& prefix) const;
+
+  void pretty_print(std::ostream& stream) const override {
+    stream << name() << " " << w13_.sizes() << " " << w2_.sizes() << " "
+           << w13_.device();
+  }
+
+ private:
+  // parameter members, must be registered
+  // [n_experts, hidden_size]
+  torch::Tensor gate_{nullptr};
+
+  // fused gate and up projections of local experts
+  // [n_local_experts, intermediate_size * 2, hidden_size]
+  torch::Tensor w13_{nullptr};
+
+  // down projections of local experts
+  // [n_local_experts, hidden_size, intermediate_size]
+  torch::Tensor w2_{nullptr};
+
+  // whether the weights are loaded
+  bool gate_is_loaded_ = false;
+  std::vector<bool> w1_is_loaded_;
+  std::vector<bool> w3_is_loaded_;
+  std::vector<bool> w2_is_loaded_;
+
+  ActFunc act_with_mul_{nullptr};
+
+  int64_t topk_ = 0;
+  int64_t intermediate_size_ = 0;
+  bool renormalize_ = false;
+
+  // the first expert on this rank
+  int64_t expert_start_ = 0;
+  int64_t n_local_experts_ = 0;
+
+  ParallelArgs parallel_args_;
+};
+TORCH_MODULE(FusedMoE);
+
+}  // namespace llm
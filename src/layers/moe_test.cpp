@@ -0,0 +1,233 @@
+#include "moe.h"
+
+#include <gtest/gtest.h>
+#include <torch/torch.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "model_loader/state_dict.h"
+#include "model_parallel/parallel_args.h"
+
+namespace llm {
+
+namespace {
+// computes moe token by token with each selected expert
+torch::Tensor moe_ref(const torch::Tensor& x,
+                      const torch::Tensor& gate,
+                      const torch::Tensor& w1,  // [n_experts, inter, hidden]
+                      const torch::Tensor& w3,  // [n_experts, inter, hidden]
+                      const torch::Tensor& w2,  // [n_experts, hidden, inter]
+                      int64_t topk) {
+  const auto probs = torch::softmax(torch::matmul(x, gate.t()), /*dim=*/-1);
+  auto [weights, ids] = probs.topk(topk, /*dim=*/-1);
+  weights = weights / weights.sum(/*dim=*/-1, /*keepdim=*/true);
+
+  auto output = torch::zeros_like(x);
+  for (int64_t t = 0; t < x.size(0); ++t) {
+    const auto token = x[t];
+    for (int64_t k = 0; k < topk; ++k) {
+      const int64_t e = ids[t][k].item<int64_t>();
+      const auto h = torch::silu(torch::matmul(w1[e], token)) *
+                     torch::matmul(w3[e], token);
+      output[t] += weights[t][k] * torch::matmul(w2[e], h);
+    }
+  }
+  return output;
+}
+}  // namespace
+
+TEST(MoETest, TopkGating) {
+  const auto logits = torch::tensor({{1.0f, 3.0f, 2.0f, 0.0f},
+                                     {0.0f, 1.0f, 0.5f, 5.0f}});
+  const auto [weights, ids] =
+      moe::topk_gating(logits, /*topk=*/2, /*renormalize=*/true);
+  EXPECT_TRUE(torch::equal(ids, torch::tensor({{1, 2}, {3, 1}})));
+  // weights of each token sum up to 1
+  EXPECT_TRUE(torch::allclose(weights.sum(/*dim=*/-1), torch::ones({2})));
+  EXPECT_GT(weights[0][0].item<float>(), weights[0][1].item<float>());
+}
+
+TEST(MoETest, PermuteUnpermute) {
+  const int64_t n_tokens = 5;
+  const auto tokens = torch::randn({n_tokens, 8});
+  const auto ids = torch::tensor({{2, 0}, {1, 2}, {0, 3}, {2, 1}, {3, 0}});
+  const auto permuted =
+      moe::permute(tokens, ids, /*expert_start=*/0, /*n_experts=*/4);
+
+  EXPECT_TRUE(torch::equal(permuted.expert_offsets,
+                           torch::tensor({0, 3, 5, 8, 10}, torch::kLong)));
+  // tokens of each expert keep their order
+  EXPECT_TRUE(torch::equal(
+      permuted.row_ids,
+      torch::tensor({1, 4, 9, 2, 7, 0, 3, 6, 5, 8}, torch::kLong)));
+  EXPECT_TRUE(torch::equal(permuted.tokens[0], tokens[0]));
+  EXPECT_TRUE(torch::equal(permuted.tokens[3], tokens[1]));
+
+  // unpermute with weights of 0.5 gets the tokens back
+  const auto weights = torch::full({n_tokens, 2}, 0.5f);
+  const auto output =
+      moe::unpermute(permuted.tokens, permuted.row_ids, weights);
+  EXPECT_TRUE(torch::allclose(output, tokens));
+
+  // experts out of range are dropped
+  const auto local =
+      moe::permute(tokens, ids, /*expert_start=*/2, /*n_experts=*/2);
+  EXPECT_TRUE(torch::equal(local.expert_offsets,
+                           torch::tensor({0, 3, 5}, torch::kLong)));
+  // but kept at the end to keep the shapes
+  EXPECT_EQ(local.tokens.size(0), 10);
+  EXPECT_TRUE(torch::equal(local.row_ids.slice(0, 0, 5),
+                           torch::tensor({0, 3, 6, 5, 8}, torch::kLong)));
+}
+
+TEST(MoETest, GroupedGemm) {
+  const auto input = torch::randn({6, 8});
+  const auto weights = torch::randn({3, 4, 8});
+  // the second expert has no rows
+  const auto offsets = torch::tensor({0, 2, 2, 6}, torch::kLong);
+  const auto output =
+      moe::grouped_gemm(input, weights, offsets, /*max_rows=*/4);
+  ASSERT_EQ(output.sizes(), torch::IntArrayRef({6, 4}));
+  const auto expected0 = torch::matmul(input.slice(0, 0, 2), weights[0].t());
+  const auto expected2 = torch::matmul(input.slice(0, 2, 6), weights[2].t());
+  EXPECT_TRUE(torch::allclose(
+      output.slice(0, 0, 2), expected0, /*rtol=*/1e-5, /*atol=*/1e-5));
+  EXPECT_TRUE(torch::allclose(
+      output.slice(0, 2, 6), expected2, /*rtol=*/1e-5, /*atol=*/1e-5));
+  EXPECT_TRUE(torch::allclose(
+      output, moe::grouped_gemm_per_expert(input, weights, offsets)));
+
+  // the last two rows are dropped
+  const auto dropped = torch::tensor({0, 2, 2, 4}, torch::kLong);
+  const auto dropped_output =
+      moe::grouped_gemm(input, weights, dropped, /*max_rows=*/2);
+  EXPECT_TRUE(
+      torch::equal(dropped_output.slice(0, 4, 6), torch::zeros({2, 4})));
+  EXPECT_TRUE(torch::allclose(
+      dropped_output, moe::grouped_gemm_per_expert(input, weights, dropped)));
+}
+
+TEST(MoETest, GroupedGemmMatchesReference) {
+  const int64_t n_tokens = 33;
+  const int64_t n_experts = 8;
+  const int64_t topk = 2;
+  const auto tokens = torch::randn({n_tokens, 16});
+  const auto weights = torch::randn({4, 24, 16});
+  const auto logits = torch::randn({n_tokens, n_experts});
+  const auto [topk_weights, ids] =
+      moe::topk_gating(logits, topk, /*renormalize=*/true);
+  // the local experts are [4, 8), the others are dropped
+  const auto permuted =
+      moe::permute(tokens, ids, /*expert_start=*/4, /*n_experts=*/4);
+
+  const auto output = moe::grouped_gemm(
+      permuted.tokens, weights, permuted.expert_offsets, n_tokens);
+  const auto expected = moe::grouped_gemm_per_expert(
+      permuted.tokens, weights, permuted.expert_offsets);
+  EXPECT_TRUE(torch::allclose(output, expected, /*rtol=*/1e-5, /*atol=*/1e-4));
+}
+
+TEST(MoETest, GroupedGemmLargeBatch) {
+  // more rows per expert than the padded gemm takes
+  const int64_t n_tokens = 2 * moe::kMaxPaddedRowsPerExpert + 3;
+  const auto tokens = torch::randn({n_tokens, 16});
+  const auto weights = torch::randn({4, 24, 16});
+  const auto logits = torch::randn({n_tokens, 8});
+  const auto [topk_weights, ids] =
+      moe::topk_gating(logits, /*topk=*/2, /*renormalize=*/true);
+  const auto permuted =
+      moe::permute(tokens, ids, /*expert_start=*/4, /*n_experts=*/4);
+
+  const auto output = moe::grouped_gemm(
+      permuted.tokens, weights, permuted.expert_offsets, n_tokens);
+  const auto expected = moe::grouped_gemm_padded(
+      permuted.tokens, weights, permuted.expert_offsets, n_tokens);
+  EXPECT_TRUE(torch::allclose(output, expected, /*rtol=*/1e-5, /*atol=*/1e-4));
+}
+
+TEST(MoETest, GroupedGemmRows) {
+  // mixtral: 8 experts, top 2
+  const int64_t n_experts = 8;
+  const int64_t topk = 2;
+
+  // prefill multiplies the routed rows only, without any padding
+  const int64_t n_prefill_tokens = 4096;
+  const int64_t n_prefill_rows = n_prefill_tokens * topk;
+  EXPECT_EQ(
+      moe::grouped_gemm_rows(n_prefill_rows, n_experts, n_prefill_tokens),
+      n_prefill_rows);
+
+  // decode pads every expert, bounded by kMaxPaddedRowsPerExpert
+  for (const int64_t n_tokens : {1, 8, moe::kMaxPaddedRowsPerExpert}) {
+    const int64_t rows =
+        moe::grouped_gemm_rows(n_tokens * topk, n_experts, n_tokens);
+    EXPECT_EQ(rows, n_experts * n_tokens);
+    EXPECT_LE(rows, n_experts * moe::kMaxPaddedRowsPerExpert);
+    // at most n_experts / topk times the flops of the routed rows
+    EXPECT_LE(rows * topk, n_tokens * topk * n_experts);
+  }
+
+  // experts are padded to no more than the number of rows
+  EXPECT_EQ(moe::grouped_gemm_rows(/*n_rows=*/3, n_experts, /*max_rows=*/16),
+            n_experts * 3);
+}
+
+TEST(MoETest, FusedMoE) {
+  const int64_t n_experts = 4;
+  const int64_t topk = 2;
+  const int64_t hidden_size = 16;
+  const int64_t intermediate_size = 32;
+  const auto options = torch::dtype(torch::kFloat);
+
+  const auto gate = torch::randn({n_experts, hidden_size});
+  const auto w1 = torch::randn({n_experts, intermediate_size, hidden_size});
+  const auto w3 = torch::randn({n_experts, intermediate_size, hidden_size});
+  const auto w2 = torch::randn({n_experts, hidden_size, intermediate_size});
+  std::unordered_map<std::string, torch::Tensor> state_dict_data = {
+      {"gate.weight", gate}};
+  for (int64_t e = 0; e < n_experts; ++e) {
+    const std::string prefix = "experts." + std::to_string(e) + ".";
+    state_dict_data[prefix + "w1.weight"] = w1[e];
+    state_dict_data[prefix + "w3.weight"] = w3[e];
+    state_dict_data[prefix + "w2.weight"] = w2[e];
+  }
+  StateDict state_dict(state_dict_data, /*shard_id=*/0, /*num_shards=*/1);
+
+  ParallelArgs parallel_args(0, 1, nullptr);
+  FusedMoE fused_moe(n_experts,
+                     topk,
+                     hidden_size,
+                     intermediate_size,
+                     /*renormalize=*/true,
+                     "silu",
+                     parallel_args,
+                     options);
+  fused_moe->load_state_dict(state_dict);
+  fused_moe->verify_loaded_weights("");
+
+  const auto x = torch::randn({7, hidden_size});
+  const auto output = fused_moe(x);
+  const auto expected = moe_ref(x, gate, w1, w3, w2, topk);
+  EXPECT_TRUE(torch::allclose(output, expected, /*rtol=*/1e-4, /*atol=*/1e-3));
+
+  // each rank only loads its own experts
+  ParallelArgs rank1_args(1, 2, nullptr);
+  FusedMoE rank1_moe(n_experts,
+                     topk,
+                     hidden_size,
+                     intermediate_size,
+                     /*renormalize=*/true,
+                     "silu",
+                     rank1_args,
+                     options);
+  rank1_moe->load_state_dict(state_dict);
+  rank1_moe->verify_loaded_weights("");
+  const auto params = rank1_moe->named_parameters();
+  const auto& w13 = params["w13"];
+  ASSERT_EQ(w13.size(0), 2);
+  EXPECT_TRUE(torch::equal(w13[0].slice(0, 0, intermediate_size), w1[2]));
+  EXPECT_TRUE(torch::equal(params["w2"][1], w2[3]));
+}
+
+}  // namespace llm
@@ -0,0 +1,160 @@
+#include "activation_arena.h"
+
+#include <c10/core/CPUAllocator.h>
+#include <glog/logging.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include "common/metrics.h"
+
+DEFINE_COUNTER_FAMILY(cpu_activation_allocations_total,
+                      "Total number of allocations of cpu activations");
+DEFINE_COUNTER_INSTANCE(cpu_activation_cache_hits_total,
+                        cpu_activation_allocations_total,
+                        {{"source", "cache"}});
+DEFINE_COUNTER_INSTANCE(cpu_activation_cache_misses_total,
+                        cpu_activation_allocations_total,
+                        {{"source", "system"}});
+
+namespace llm {
+namespace {
+// the same alignment as the default cpu allocator of torch
+constexpr size_t kAlignment = 64;
+
+size_t round_up(size_t n, size_t multiple) {
+  return (n + multiple - 1) / multiple * multiple;
+}
+
+void free_raw(void* ptr) { std::free(ptr); }
+
+void* aligned_alloc_or_die(size_t n) {
+  void* ptr = std::aligned_alloc(kAlignment, round_up(n, kAlignment));
+  CHECK(ptr != nullptr) << "Failed to allocate " << n << " bytes";
+  return ptr;
+}
+}  // namespace
+
+ActivationArena::ActivationArena(const Options& options) : options_(options) {}
+
+ActivationArena::~ActivationArena() {
+  release_cached();
+  CHECK_EQ(stats_.allocated_bytes, 0) << "buffers are still in use";
+}
+
+ActivationArena* ActivationArena::install(const Options& options) {
+  // never destroyed, tensors allocated from it may outlive any owner
+  static ActivationArena* arena = [&options] {
+    auto* instance = new ActivationArena(options);
+    c10::SetCPUAllocator(instance, /*priority=*/1);
+    LOG(INFO) << "Installed cpu activation arena, max cached bytes: "
+              << options.max_cached_bytes();
+    return instance;
+  }();
+  // shared by all engines in the process, e.g. the draft engine
+  CHECK(arena->options_.max_cached_bytes() == options.max_cached_bytes() &&
+        arena->options_.min_block_size() == options.min_block_size())
+      << "The cpu activation arena is already installed with different "
+         "options, max cached bytes: "
+      << arena->options_.max_cached_bytes()
+      << ", min block size: " << arena->options_.min_block_size();
+  return arena;
+}
+
+size_t ActivationArena::size_class(size_t n) {
+  if (n <= 256) {
+    return round_up(n, kAlignment);
+  }
+  // the largest power of two less than n, split into four classes
+  size_t msb = 1;
+  while (msb * 2 < n) {
+    msb *= 2;
+  }
+  return round_up(n, msb / 4);
+}
+
+c10::DataPtr ActivationArena::allocate(size_t n) {
+  const c10::Device device(c10::DeviceType::CPU);
+  if (n == 0) {
+    return {nullptr, device};
+  }
+  if (n < options_.min_block_size()) {
+    void* ptr = aligned_alloc_or_die(n);
+    return {ptr, ptr, &free_raw, device};
+  }
+
+  const size_t size = size_class(n);
+  Block* block = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = free_blocks_.find(size);
+    if (it != free_blocks_.end() && !it->second.empty()) {
+      block = it->second.back();
+      it->second.pop_back();
+      stats_.cached_bytes -= size;
+      ++stats_.num_cache_hits;
+    } else {
+      ++stats_.num_cache_misses;
+    }
+    stats_.allocated_bytes += size;
+  }
+
+  if (block != nullptr) {
+    COUNTER_INC(cpu_activation_cache_hits_total);
+  } else {
+    COUNTER_INC(cpu_activation_cache_misses_total);
+    block = new Block{aligned_alloc_or_die(size), size, this};
+  }
+  return {block->ptr, block, &ActivationArena::free_block, device};
+}
+
+void ActivationArena::copy_data(void* dest,
+                                const void* src,
+                                size_t count) const {
+  if (count > 0) {
+    std::memcpy(dest, src, count);
+  }
+}
+
+void ActivationArena::free_block(void* ctx) {
+  auto* block = static_cast<Block*>(ctx);
+  block->arena->free(block);
+}
+
+void ActivationArena::free(Block* block) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.allocated_bytes -= block->size;
+    if (stats_.cached_bytes + block->size <= options_.max_cached_bytes()) {
+      free_blocks_[block->size].push_back(block);
+      stats_.cached_bytes += block->size;
+      return;
+    }
+  }
+  // over the cache limit, return the buffer to the system
+  std::free(block->ptr);
+  delete block;
+}
+
+void ActivationArena::release_cached() {
+  std::unordered_map<size_t, std::vector<Block*>> free_blocks;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_blocks.swap(free_blocks_);
+    stats_.cached_bytes = 0;
+  }
+  for (auto& [size, blocks] : free_blocks) {
+    for (Block* block : blocks) {
+      std::free(block->ptr);
+      delete block;
+    }
+  }
+}
+
+ActivationArena::Stats ActivationArena::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+}  // namespace llm
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <c10/core/Allocator.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "common/macros.h"
+
+namespace llm {
+
+// A caching allocator for activations of forward passes on cpu. Freed buffers
+// are kept in free lists keyed by their size class and handed out again for
+// allocations of the same class. Batches padded to the same shape bucket
+// allocate the same buffers step after step, so decode steps stop going to
+// the system allocator once the arena is warmed up. Thread safe.
+class ActivationArena final : public c10::Allocator {
+ public:
+  struct Options {
+    // the maximum number of bytes kept in free lists, buffers freed beyond it
+    // are returned to the system.
+    DEFINE_ARG(size_t, max_cached_bytes) = size_t(2) << 30;
+
+    // buffers smaller than this are not cached
+    DEFINE_ARG(size_t, min_block_size) = 4096;
+  };
+
+  struct Stats {
+    // allocations served from free lists
+    uint64_t num_cache_hits = 0;
+    // allocations that went to the system
+    uint64_t num_cache_misses = 0;
+    // bytes held by buffers in use
+    size_t allocated_bytes = 0;
+    // bytes held by buffers in free lists
+    size_t cached_bytes = 0;
+  };
+
+  explicit ActivationArena(const Options& options);
+
+  // frees cached buffers, all buffers should have been returned
+  ~ActivationArena() override;
+
+  // install an arena as the allocator of cpu tensors for the rest of the
+  // process, returns the installed one. later calls return the same arena,
+  // and fail if they are given different options.
+  static ActivationArena* install(const Options& options);
+
+  c10::DataPtr allocate(size_t n) override;
+
+  void copy_data(void* dest, const void* src, size_t count) const override;
+
+  // return cached buffers to the system
+  void release_cached();
+
+  Stats stats() const;
+
+  // round the size up to its class, four classes per power of two, so that
+  // the size varying with the sequence length still hits the same buffer.
+  static size_t size_class(size_t n);
+
+ private:
+  struct Block {
+    void* ptr = nullptr;
+    size_t size = 0;
+    ActivationArena* arena = nullptr;
+  };
+
+  static void free_block(void* ctx);
+
+  void free(Block* block);
+
+  const Options options_;
+
+  mutable std::mutex mutex_;
+
+  // free buffers for each size class
+  std::unordered_map<size_t, std::vector<Block*>> free_blocks_;
+
+  Stats stats_;
+};
+
+}  // namespace llm
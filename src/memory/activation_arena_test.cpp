@@ -0,0 +1,83 @@
+#include "activation_arena.h"
+
+#include <gtest/gtest.h>
+
+namespace llm {
+
+TEST(ActivationArenaTest, SizeClass) {
+  EXPECT_EQ(ActivationArena::size_class(1), 64);
+  EXPECT_EQ(ActivationArena::size_class(100), 128);
+  EXPECT_EQ(ActivationArena::size_class(1000), 1024);
+  EXPECT_EQ(ActivationArena::size_class(1024), 1024);
+  EXPECT_EQ(ActivationArena::size_class(1025), 1280);
+  EXPECT_EQ(ActivationArena::size_class(5000), 5120);
+  // at most a quarter of the size is wasted
+  for (size_t n = 257; n < 100000; n += 97) {
+    const size_t size = ActivationArena::size_class(n);
+    EXPECT_GE(size, n);
+    EXPECT_LE(size, n + n / 4 + 64);
+  }
+}
+
+TEST(ActivationArenaTest, Reuse) {
+  ActivationArena::Options options;
+  options.min_block_size(1024);
+  ActivationArena arena(options);
+
+  void* ptr = nullptr;
+  {
+    auto data = arena.allocate(5000);
+    ptr = data.get();
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_EQ(arena.stats().allocated_bytes, 5120);
+  }
+  EXPECT_EQ(arena.stats().allocated_bytes, 0);
+  EXPECT_EQ(arena.stats().cached_bytes, 5120);
+
+  // the same size class gets the cached buffer back
+  {
+    auto data = arena.allocate(4500);
+    EXPECT_EQ(data.get(), ptr);
+    EXPECT_EQ(arena.stats().cached_bytes, 0);
+  }
+  // small buffers are not cached
+  { auto data = arena.allocate(100); }
+  const auto stats = arena.stats();
+  EXPECT_EQ(stats.num_cache_hits, 1);
+  EXPECT_EQ(stats.num_cache_misses, 1);
+  EXPECT_EQ(stats.cached_bytes, 5120);
+
+  arena.release_cached();
+  EXPECT_EQ(arena.stats().cached_bytes, 0);
+}
+
+TEST(ActivationArenaTest, MaxCachedBytes) {
+  ActivationArena::Options options;
+  options.min_block_size(1024).max_cached_bytes(8192);
+  ActivationArena arena(options);
+  {
+    auto data1 = arena.allocate(5000);
+    auto data2 = arena.allocate(5000);
+    EXPECT_NE(data1.get(), data2.get());
+  }
+  // only one of the buffers fits into the cache
+  EXPECT_EQ(arena.stats().cached_bytes, 5120);
+  EXPECT_EQ(arena.stats().allocated_bytes, 0);
+}
+
+TEST(ActivationArenaTest, InstallConflictingOptions) {
+  // run in the child process of the death test, leaving the cpu allocator of
+  // this process untouched.
+  EXPECT_DEATH(
+      {
+        ActivationArena::Options options;
+        options.max_cached_bytes(8192);
+        // the same options are fine
+        ActivationArena::install(options);
+        ActivationArena::install(options);
+        ActivationArena::install(options.max_cached_bytes(4096));
+      },
+      "different options");
+}
+
+}  // namespace llm
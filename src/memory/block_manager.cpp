@@ -12,23 +12,23 @@
 #include "request/request.h"
 
 // metrics
-DEFINE_COUNTER_FAMILY(prefix_cache_latency_seconds,
-                      "Latency of prefix cache in seconds");
-DEFINE_COUNTER_INSTANCE(prefix_cache_insert_latency_seconds,
-                        prefix_cache_latency_seconds,
-                        {{"op", "insert"}});
-DEFINE_COUNTER_INSTANCE(prefix_cache_match_latency_seconds,
-                        prefix_cache_latency_seconds,
-                        {{"op", "match"}});
-DEFINE_COUNTER_INSTANCE(prefix_cache_evict_latency_seconds,
-                        prefix_cache_latency_seconds,
-                        {{"op", "evict"}});
+DEFINE_HISTOGRAM_FAMILY(prefix_cache_latency_seconds,
+                        "Latency of prefix cache in seconds");
+DEFINE_HISTOGRAM_INSTANCE(prefix_cache_insert_latency_seconds,
+                          prefix_cache_latency_seconds,
+                          {{"op", "insert"}});
+DEFINE_HISTOGRAM_INSTANCE(prefix_cache_match_latency_seconds,
+                          prefix_cache_latency_seconds,
+                          {{"op", "match"}});
+DEFINE_HISTOGRAM_INSTANCE(prefix_cache_evict_latency_seconds,
+                          prefix_cache_latency_seconds,
+                          {{"op", "evict"}});
 
 DEFINE_COUNTER(prefix_cache_match_length_total,
                "Length of matched prefix in tokens");
 
-DEFINE_COUNTER(allocate_blocks_latency_seconds,
-               "Latency of blocks allocation in seconds");
+DEFINE_LATENCY_HISTOGRAM(allocate_blocks_latency_seconds,
+                         "Latency of blocks allocation in seconds");
 
 namespace llm {
 
@@ -47,7 +47,7 @@ bool BlockManager::allocate_blocks_for(Sequence* sequence) {
 }
 
 bool BlockManager::allocate_blocks_for(Sequence* sequence, size_t num_tokens) {
-  AUTO_COUNTER(allocate_blocks_latency_seconds);
+  AUTO_HISTOGRAM(allocate_blocks_latency_seconds);
 
   DCHECK(sequence != nullptr);
   // first try to allocate shared blocks
@@ -55,9 +55,24 @@ bool BlockManager::allocate_blocks_for(Sequence* sequence, size_t num_tokens) {
     allocate_shared_blocks_for(sequence);
   }
 
+  const size_t block_size = options_.block_size();
+  // copy on write: a decoding sequence never writes into a block shared with
+  // others, e.g. the partially filled block of beams forked from one parent.
+  const size_t num_kv_cache_tokens = sequence->num_kv_cache_tokens();
+  const size_t block_idx = num_kv_cache_tokens / block_size;
+  if (!sequence->is_prefill_stage() && num_kv_cache_tokens % block_size != 0 &&
+      block_idx < sequence->num_blocks() &&
+      sequence->blocks()[block_idx].is_shared()) {
+    if (!has_enough_blocks(1)) {
+      return false;
+    }
+    sequence->copy_on_write(block_idx, block_allocator_.allocate());
+    num_blocks_in_use_ += 1;
+    num_allocated_blocks_total_ += 1;
+  }
+
   const size_t num_blocks = sequence->num_blocks();
   // round up to the nearest block number
-  const size_t block_size = options_.block_size();
   const size_t num_blocks_needed = (num_tokens + block_size - 1) / block_size;
   if (num_blocks_needed <= num_blocks) {
     return true;
@@ -73,9 +88,25 @@ bool BlockManager::allocate_blocks_for(Sequence* sequence, size_t num_tokens) {
   sequence->append_blocks(block_ids);
 
   num_blocks_in_use_ += num_additional_blocks;
+  num_allocated_blocks_total_ += num_additional_blocks;
   return true;
 }
 
+std::vector<Block> BlockManager::allocate_blocks(uint32_t num_blocks) {
+  if (!has_enough_blocks(num_blocks)) {
+    return {};
+  }
+  num_blocks_in_use_ += num_blocks;
+  num_allocated_blocks_total_ += num_blocks;
+  return block_allocator_.allocate(num_blocks);
+}
+
+void BlockManager::release_blocks(std::vector<Block>& blocks) {
+  num_blocks_in_use_ -= blocks.size();
+  // blocks are returned to the allocator once the last reference is gone
+  blocks.clear();
+}
+
 bool BlockManager::allocate_blocks_for(std::vector<Sequence*>& sequences) {
   for (auto* sequence : sequences) {
     DCHECK(sequence != nullptr);
@@ -126,8 +157,9 @@ bool BlockManager::has_enough_blocks(uint32_t num_blocks) {
   const uint32_t n_blocks_to_evict =
       num_blocks - block_allocator_.num_free_blocks();
 
-  AUTO_COUNTER(prefix_cache_evict_latency_seconds);
+  AUTO_HISTOGRAM(prefix_cache_evict_latency_seconds);
   const uint32_t n_blocks_evicted = prefix_cache_.evict(n_blocks_to_evict);
+  num_evicted_blocks_total_ += n_blocks_evicted;
   if (n_blocks_evicted < n_blocks_to_evict) {
     return false;
   }
@@ -144,8 +176,8 @@ bool BlockManager::has_enough_blocks(uint32_t num_blocks) {
 
 void BlockManager::allocate_shared_blocks_for(Sequence* sequence) {
   // only allocate shared blocks for prefill sequences
-  if (options_.enable_prefix_cache()) {
-    AUTO_COUNTER(prefix_cache_match_latency_seconds);
+  if (options_.enable_prefix_cache() && sequence->can_share_prefix()) {
+    AUTO_HISTOGRAM(prefix_cache_match_latency_seconds);
 
     const auto tokens_ids = sequence->token_ids();
     std::vector<Block> shared_blocks = prefix_cache_.match(tokens_ids);
@@ -168,7 +200,7 @@ void BlockManager::allocate_shared_blocks_for(Sequence* sequence) {
 
 void BlockManager::cache_blocks_for(Sequence* sequence) {
   if (options_.enable_prefix_cache()) {
-    AUTO_COUNTER(prefix_cache_insert_latency_seconds);
+    AUTO_HISTOGRAM(prefix_cache_insert_latency_seconds);
 
     // only insert tokens in kv cache to the prefix cache
     const auto tokens_ids = sequence->tokens_in_kv_cache();
@@ -184,7 +216,12 @@ void BlockManager::cache_blocks_for(Sequence* sequence) {
       }
     }
   } else {
-    num_blocks_in_use_ -= sequence->num_blocks();
+    for (const auto& block : sequence->blocks()) {
+      // blocks shared by beams are counted once, by the last one
+      if (!block.is_shared()) {
+        --num_blocks_in_use_;
+      }
+    }
   }
 }
 
@@ -37,6 +37,14 @@ class BlockManager final {
   // try to allocate blloks for sequence with num_tokens
   bool allocate_blocks_for(Sequence* sequence, size_t num_tokens);
 
+  // allocate blocks that are not attached to any sequence, e.g. scratch
+  // blocks to receive kv cache from another engine. returns an empty vector
+  // if there are not enough free blocks.
+  std::vector<Block> allocate_blocks(uint32_t num_blocks);
+
+  // release blocks returned by allocate_blocks
+  void release_blocks(std::vector<Block>& blocks);
+
   // try to share blocks among sequences with the same prefix
   void allocate_shared_blocks_for(Sequence* sequence);
 
@@ -51,12 +59,25 @@ class BlockManager final {
     return prefix_cache_.num_blocks();
   }
 
+  // get the summary of blocks in the prefix cache, thread safe
+  const PrefixCacheSummary& prefix_cache_summary() const {
+    return prefix_cache_.summary();
+  }
+
   // get the number of free blocks in the block allocator
   size_t num_free_blocks() const { return block_allocator_.num_free_blocks(); }
 
   // get the effective number of blocks in use
   size_t num_blocks_in_use() const { return num_blocks_in_use_; }
 
+  // get the total number of blocks allocated from the block allocator
+  size_t num_allocated_blocks_total() const {
+    return num_allocated_blocks_total_;
+  }
+
+  // get the total number of blocks evicted from the prefix cache
+  size_t num_evicted_blocks_total() const { return num_evicted_blocks_total_; }
+
   // get the block utilization.
   double kv_cache_utilization() const {
     return static_cast<double>(num_blocks_in_use_) /
@@ -82,6 +103,10 @@ class BlockManager final {
 
   // number of blocks in use
   size_t num_blocks_in_use_ = 0;
+
+  // accumulated number of allocated and evicted blocks, for profiling
+  size_t num_allocated_blocks_total_ = 0;
+  size_t num_evicted_blocks_total_ = 0;
 };
 
 }  // namespace llm
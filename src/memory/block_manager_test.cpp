@@ -1,7 +1,10 @@
 #include "block_manager.h"
 
+#include <absl/time/clock.h>
 #include <gtest/gtest.h>
 
+#include "request/sequence.h"
+
 namespace llm {
 
 TEST(BlockManagerTest, Basic) {
@@ -12,4 +15,73 @@ TEST(BlockManagerTest, Basic) {
   // TODO: add more tests
 }
 
-}  // namespace llm
\ No newline at end of file
+TEST(BlockManagerTest, AllocateBlocks) {
+  BlockManager::Options options;
+  options.num_blocks(10).block_size(2).enable_prefix_cache(false);
+
+  BlockManager manager(options);
+  // block 0 is reserved for padding
+  EXPECT_EQ(manager.num_free_blocks(), 9);
+
+  auto blocks = manager.allocate_blocks(4);
+  EXPECT_EQ(blocks.size(), 4);
+  EXPECT_EQ(manager.num_free_blocks(), 5);
+  EXPECT_EQ(manager.num_blocks_in_use(), 4);
+
+  // not enough blocks
+  EXPECT_TRUE(manager.allocate_blocks(6).empty());
+  EXPECT_EQ(manager.num_free_blocks(), 5);
+
+  manager.release_blocks(blocks);
+  EXPECT_TRUE(blocks.empty());
+  EXPECT_EQ(manager.num_free_blocks(), 9);
+  EXPECT_EQ(manager.num_blocks_in_use(), 0);
+}
+
+TEST(BlockManagerTest, CopyOnWrite) {
+  BlockManager::Options options;
+  options.num_blocks(10).block_size(4).enable_prefix_cache(false);
+  BlockManager manager(options);
+
+  Sequence::Options seq_options;
+  seq_options.beam_search = true;
+  Sequence parent("",
+                  {1, 2, 3, 4, 5, 6},
+                  absl::Now(),
+                  /*capacity=*/20,
+                  seq_options);
+  ASSERT_TRUE(manager.allocate_blocks_for(&parent));
+  parent.commit_kv_cache(/*size=*/6);
+  parent.append_token(7);
+
+  // the forked beam shares all blocks with its parent
+  Sequence beam = parent.fork();
+  EXPECT_NE(beam.id(), parent.id());
+  EXPECT_EQ(manager.num_blocks_in_use(), 2);
+
+  // the partially filled block is copied before the beam writes into it
+  ASSERT_TRUE(manager.allocate_blocks_for(&beam));
+  ASSERT_EQ(beam.num_blocks(), 2);
+  EXPECT_EQ(beam.blocks()[0], parent.blocks()[0]);
+  EXPECT_FALSE(beam.blocks()[1] == parent.blocks()[1]);
+  EXPECT_EQ(manager.num_blocks_in_use(), 3);
+
+  // the parent owns its last block now, no copy needed even if the copy of
+  // the beam is still pending
+  ASSERT_TRUE(manager.allocate_blocks_for(&parent));
+  EXPECT_FALSE(parent.take_block_copy().has_value());
+
+  const auto copy = beam.take_block_copy();
+  ASSERT_TRUE(copy.has_value());
+  EXPECT_EQ(copy->first, parent.blocks()[1].id());
+  EXPECT_EQ(copy->second, beam.blocks()[1].id());
+  EXPECT_FALSE(beam.take_block_copy().has_value());
+
+  manager.release_blocks_for(&beam);
+  EXPECT_EQ(manager.num_blocks_in_use(), 2);
+  manager.release_blocks_for(&parent);
+  EXPECT_EQ(manager.num_blocks_in_use(), 0);
+  EXPECT_EQ(manager.num_free_blocks(), 9);
+}
+
+}  // namespace llm
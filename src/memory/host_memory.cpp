@@ -0,0 +1,204 @@
+#include "host_memory.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace llm::memory {
+namespace {
+
+std::optional<std::string> read_file(const std::string& path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    return std::nullopt;
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  return buffer.str();
+}
+
+// find the text after "key:" in lines of "key: value", e.g. "Node 0 MemFree:
+// 1024 kB" in node meminfo has the key "MemFree".
+std::optional<std::string> find_field(const std::string& text,
+                                      const std::string& key) {
+  std::istringstream stream(text);
+  std::string line;
+  const std::string pattern = key + ":";
+  while (std::getline(stream, line)) {
+    const size_t pos = line.find(pattern);
+    if (pos == std::string::npos ||
+        (pos > 0 && line[pos - 1] != ' ' && line[pos - 1] != '\t')) {
+      continue;
+    }
+    std::string value = line.substr(pos + pattern.size());
+    const size_t start = value.find_first_not_of(" \t");
+    return start == std::string::npos ? "" : value.substr(start);
+  }
+  return std::nullopt;
+}
+
+// parse a field in kB into bytes, e.g. "MemTotal:  1024 kB"
+std::optional<int64_t> find_kb_field(const std::string& text,
+                                     const std::string& key) {
+  const auto value = find_field(text, key);
+  if (!value.has_value()) {
+    return std::nullopt;
+  }
+  try {
+    return std::stoll(value.value()) * 1024;
+  } catch (const std::exception&) {
+    return std::nullopt;
+  }
+}
+
+// parse a field of "key value" lines, e.g. "inactive_file 1024" in memory.stat
+std::optional<int64_t> find_stat(const std::string& text,
+                                 const std::string& key) {
+  std::istringstream stream(text);
+  std::string name;
+  int64_t value = 0;
+  while (stream >> name >> value) {
+    if (name == key) {
+      return value;
+    }
+  }
+  return std::nullopt;
+}
+
+// read a file with a single number, "max" for no limit
+std::optional<int64_t> read_number(const std::string& path) {
+  const auto text = read_file(path);
+  if (!text.has_value()) {
+    return std::nullopt;
+  }
+  try {
+    return std::stoll(text.value());
+  } catch (const std::exception&) {
+    return std::nullopt;
+  }
+}
+
+struct CgroupMemory {
+  int64_t limit = 0;
+  int64_t usage = 0;
+};
+
+// memory limit and usage of the cgroup, usage excludes the inactive page
+// cache which can be reclaimed.
+std::optional<CgroupMemory> cgroup_memory(const std::string& root) {
+  // cgroup v2
+  const std::string v2_dir = root + "sys/fs/cgroup/";
+  if (auto limit = read_number(v2_dir + "memory.max")) {
+    CgroupMemory memory;
+    memory.limit = limit.value();
+    memory.usage = read_number(v2_dir + "memory.current").value_or(0);
+    const auto stat = read_file(v2_dir + "memory.stat").value_or("");
+    memory.usage -= find_stat(stat, "inactive_file").value_or(0);
+    return memory;
+  }
+  // cgroup v1
+  const std::string v1_dir = root + "sys/fs/cgroup/memory/";
+  if (auto limit = read_number(v1_dir + "memory.limit_in_bytes")) {
+    CgroupMemory memory;
+    memory.limit = limit.value();
+    memory.usage = read_number(v1_dir + "memory.usage_in_bytes").value_or(0);
+    const auto stat = read_file(v1_dir + "memory.stat").value_or("");
+    memory.usage -= find_stat(stat, "total_inactive_file").value_or(0);
+    return memory;
+  }
+  return std::nullopt;
+}
+
+}  // namespace
+
+std::vector<int32_t> parse_id_list(const std::string& text) {
+  std::vector<int32_t> ids;
+  std::istringstream stream(text);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    if (range.find_first_not_of(" \t\n") == std::string::npos) {
+      continue;
+    }
+    try {
+      const size_t dash = range.find('-');
+      const int32_t start = std::stoi(range.substr(0, dash));
+      const int32_t end =
+          dash == std::string::npos ? start : std::stoi(range.substr(dash + 1));
+      for (int32_t id = start; id <= end; ++id) {
+        ids.push_back(id);
+      }
+    } catch (const std::exception&) {
+      LOG(WARNING) << "Failed to parse id list: " << text;
+      return {};
+    }
+  }
+  return ids;
+}
+
+HostMemoryInfo host_memory_info(const std::string& root) {
+  HostMemoryInfo info;
+  const auto meminfo = read_file(root + "proc/meminfo").value_or("");
+  info.total = find_kb_field(meminfo, "MemTotal").value_or(0);
+  info.available = find_kb_field(meminfo, "MemAvailable").value_or(0);
+  CHECK_GT(info.total, 0) << "Failed to read the host memory info";
+
+  // a limit larger than the physical memory means no limit, e.g. cgroup v1
+  // reports a huge number.
+  if (const auto cgroup = cgroup_memory(root)) {
+    if (cgroup->limit > 0 && cgroup->limit < info.total) {
+      info.cgroup_limit = cgroup->limit;
+      info.total = cgroup->limit;
+      info.available = std::min(
+          info.available, std::max<int64_t>(cgroup->limit - cgroup->usage, 0));
+    }
+  }
+
+  // memory of the numa nodes the process is bound to, e.g. by numactl
+  const auto status = read_file(root + "proc/self/status").value_or("");
+  const auto allowed = parse_id_list(
+      find_field(status, "Mems_allowed_list").value_or(""));
+  const auto online = parse_id_list(
+      read_file(root + "sys/devices/system/node/online").value_or(""));
+  if (!allowed.empty() && !online.empty() && allowed.size() < online.size()) {
+    int64_t nodes_free = 0;
+    for (const int32_t node : allowed) {
+      const auto node_meminfo =
+          read_file(root + "sys/devices/system/node/node" +
+                    std::to_string(node) + "/meminfo")
+              .value_or("");
+      nodes_free += find_kb_field(node_meminfo, "MemFree").value_or(0);
+    }
+    info.numa_nodes = allowed;
+    info.available = std::min(info.available, nodes_free);
+  }
+  return info;
+}
+
+int64_t current_rss(const std::string& root) {
+  const auto status = read_file(root + "proc/self/status").value_or("");
+  return find_kb_field(status, "VmRSS").value_or(0);
+}
+
+int64_t peak_rss(const std::string& root) {
+  const auto status = read_file(root + "proc/self/status").value_or("");
+  return find_kb_field(status, "VmHWM").value_or(0);
+}
+
+bool reset_peak_rss(const std::string& root) {
+  std::ofstream file(root + "proc/self/clear_refs");
+  if (!file.is_open()) {
+    return false;
+  }
+  // "5" resets the peak rss, since linux 4.0
+  file << "5";
+  file.flush();
+  return file.good();
+}
+
+}  // namespace llm::memory
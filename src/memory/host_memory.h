@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace llm::memory {
+
+// memory of the host visible to the process in bytes
+struct HostMemoryInfo {
+  // physical memory, capped by the cgroup limit
+  int64_t total = 0;
+
+  // memory that can be allocated without swapping, capped by the cgroup limit
+  // minus its usage, and by the free memory of the numa nodes the process is
+  // bound to.
+  int64_t available = 0;
+
+  // the memory limit of the cgroup, 0 if unlimited
+  int64_t cgroup_limit = 0;
+
+  // numa nodes the process can allocate memory from, empty if all of them
+  std::vector<int32_t> numa_nodes;
+};
+
+// read the memory info of the host from procfs and sysfs under root, which is
+// only changed for testing.
+HostMemoryInfo host_memory_info(const std::string& root = "/");
+
+// returns the resident set size of the process in bytes
+int64_t current_rss(const std::string& root = "/");
+
+// returns the peak resident set size of the process in bytes
+int64_t peak_rss(const std::string& root = "/");
+
+// reset the peak resident set size to the current one
+// returns false if not supported by the kernel
+bool reset_peak_rss(const std::string& root = "/");
+
+// parse a list of ids, e.g. "0-2,4" to {0, 1, 2, 4}
+std::vector<int32_t> parse_id_list(const std::string& text);
+
+}  // namespace llm::memory
@@ -0,0 +1,142 @@
+#include "host_memory.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace llm::memory {
+namespace {
+
+class FakeRoot {
+ public:
+  FakeRoot() {
+    const auto* test_info =
+        ::testing::UnitTest::GetInstance()->current_test_info();
+    root_ = std::filesystem::temp_directory_path() /
+            (std::string("host_memory_test_") + test_info->name());
+    std::filesystem::remove_all(root_);
+    std::filesystem::create_directories(root_);
+  }
+
+  ~FakeRoot() { std::filesystem::remove_all(root_); }
+
+  void write(const std::string& path, const std::string& content) {
+    const auto file_path = root_ / path;
+    std::filesystem::create_directories(file_path.parent_path());
+    std::ofstream file(file_path);
+    file << content;
+  }
+
+  std::string path() const { return root_.string() + "/"; }
+
+ private:
+  std::filesystem::path root_;
+};
+
+constexpr int64_t kKB = 1024;
+
+const char* kMeminfo =
+    "MemTotal:       16384 kB\n"
+    "MemFree:         4096 kB\n"
+    "MemAvailable:   12288 kB\n"
+    "Buffers:          128 kB\n";
+
+}  // namespace
+
+TEST(HostMemoryTest, ParseIdList) {
+  EXPECT_EQ(parse_id_list("0"), std::vector<int32_t>({0}));
+  EXPECT_EQ(parse_id_list("0-2,4\n"), std::vector<int32_t>({0, 1, 2, 4}));
+  EXPECT_EQ(parse_id_list("1,3-4"), std::vector<int32_t>({1, 3, 4}));
+  EXPECT_TRUE(parse_id_list("").empty());
+  EXPECT_TRUE(parse_id_list("x-y").empty());
+}
+
+TEST(HostMemoryTest, Meminfo) {
+  FakeRoot root;
+  root.write("proc/meminfo", kMeminfo);
+
+  const auto info = host_memory_info(root.path());
+  EXPECT_EQ(info.total, 16384 * kKB);
+  EXPECT_EQ(info.available, 12288 * kKB);
+  EXPECT_EQ(info.cgroup_limit, 0);
+  EXPECT_TRUE(info.numa_nodes.empty());
+}
+
+TEST(HostMemoryTest, CgroupV2) {
+  FakeRoot root;
+  root.write("proc/meminfo", kMeminfo);
+  root.write("sys/fs/cgroup/memory.max", std::to_string(8192 * kKB) + "\n");
+  root.write("sys/fs/cgroup/memory.current",
+             std::to_string(4096 * kKB) + "\n");
+  root.write("sys/fs/cgroup/memory.stat",
+             "anon 1024\ninactive_file " + std::to_string(1024 * kKB) + "\n");
+
+  const auto info = host_memory_info(root.path());
+  EXPECT_EQ(info.cgroup_limit, 8192 * kKB);
+  EXPECT_EQ(info.total, 8192 * kKB);
+  // the inactive page cache can be reclaimed
+  EXPECT_EQ(info.available, (8192 - 4096 + 1024) * kKB);
+
+  // no limit
+  root.write("sys/fs/cgroup/memory.max", "max\n");
+  const auto unlimited = host_memory_info(root.path());
+  EXPECT_EQ(unlimited.cgroup_limit, 0);
+  EXPECT_EQ(unlimited.total, 16384 * kKB);
+  EXPECT_EQ(unlimited.available, 12288 * kKB);
+}
+
+TEST(HostMemoryTest, CgroupV1) {
+  FakeRoot root;
+  root.write("proc/meminfo", kMeminfo);
+  root.write("sys/fs/cgroup/memory/memory.limit_in_bytes",
+             std::to_string(4096 * kKB));
+  root.write("sys/fs/cgroup/memory/memory.usage_in_bytes",
+             std::to_string(1024 * kKB));
+
+  const auto info = host_memory_info(root.path());
+  EXPECT_EQ(info.cgroup_limit, 4096 * kKB);
+  EXPECT_EQ(info.total, 4096 * kKB);
+  EXPECT_EQ(info.available, 3072 * kKB);
+
+  // the limit of an unlimited cgroup is larger than the physical memory
+  root.write("sys/fs/cgroup/memory/memory.limit_in_bytes",
+             "9223372036854771712");
+  EXPECT_EQ(host_memory_info(root.path()).cgroup_limit, 0);
+}
+
+TEST(HostMemoryTest, NumaNodes) {
+  FakeRoot root;
+  root.write("proc/meminfo", kMeminfo);
+  root.write("sys/devices/system/node/online", "0-1\n");
+  root.write("sys/devices/system/node/node1/meminfo",
+             "Node 1 MemTotal:        8192 kB\n"
+             "Node 1 MemFree:         2048 kB\n");
+
+  // allowed to allocate from all nodes
+  root.write("proc/self/status", "Name:\ttest\nMems_allowed_list:\t0-1\n");
+  auto info = host_memory_info(root.path());
+  EXPECT_TRUE(info.numa_nodes.empty());
+  EXPECT_EQ(info.available, 12288 * kKB);
+
+  // bound to node 1
+  root.write("proc/self/status", "Name:\ttest\nMems_allowed_list:\t1\n");
+  info = host_memory_info(root.path());
+  EXPECT_EQ(info.numa_nodes, std::vector<int32_t>({1}));
+  EXPECT_EQ(info.available, 2048 * kKB);
+}
+
+TEST(HostMemoryTest, Rss) {
+  FakeRoot root;
+  root.write("proc/self/status",
+             "Name:\ttest\nVmHWM:\t    2048 kB\nVmRSS:\t    1024 kB\n");
+  EXPECT_EQ(current_rss(root.path()), 1024 * kKB);
+  EXPECT_EQ(peak_rss(root.path()), 2048 * kKB);
+
+  // the process itself
+  EXPECT_GT(current_rss(), 0);
+  EXPECT_GE(peak_rss(), current_rss());
+}
+
+}  // namespace llm::memory
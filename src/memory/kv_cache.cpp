@@ -6,6 +6,7 @@
 #include <torch/torch.h>
 
 #include <cstdint>
+#include <cstring>
 #include <vector>
 
 #include "kernels/kv_cache_kernels.h"
@@ -33,9 +34,46 @@ void KVCache::set_kv_cache(const torch::Tensor& slot_ids,
     // use cuda kernel
     return set_kv_cache_cuda(slot_ids, keys, values);
   }
+  if (keys.is_cpu() && key_cache_.is_contiguous() &&
+      value_cache_.is_contiguous()) {
+    return set_kv_cache_cpu(slot_ids, keys, values);
+  }
   return set_kv_cache_slow(slot_ids, keys, values);
 }
 
+void KVCache::set_kv_cache_cpu(const torch::Tensor& slot_ids,
+                               const torch::Tensor& keys,
+                               const torch::Tensor& values) {
+  CHECK(key_cache_.is_cpu() && value_cache_.is_cpu());
+  CHECK(key_cache_.is_contiguous() && value_cache_.is_contiguous());
+  const auto slot_ids_cpu = slot_ids.cpu().to(torch::kInt).contiguous();
+  const int32_t* ids = slot_ids_cpu.data_ptr<int32_t>();
+  const int64_t num_tokens = keys.size(0);
+  const auto keys_c = keys.to(key_cache_.scalar_type()).contiguous();
+  const auto values_c = values.to(value_cache_.scalar_type()).contiguous();
+
+  // slots are rows of [num_heads, head_dim] in the contiguous cache
+  const int64_t row_bytes =
+      num_kv_heads_ * head_size_ * key_cache_.element_size();
+  const auto* src_keys = static_cast<const char*>(keys_c.data_ptr());
+  const auto* src_values = static_cast<const char*>(values_c.data_ptr());
+  auto* dst_keys = static_cast<char*>(key_cache_.data_ptr());
+  auto* dst_values = static_cast<char*>(value_cache_.data_ptr());
+  for (int64_t i = 0; i < num_tokens;) {
+    // consecutive slots are contiguous even across blocks
+    int64_t j = i + 1;
+    while (j < num_tokens && ids[j] == ids[j - 1] + 1) {
+      ++j;
+    }
+    const int64_t n_bytes = (j - i) * row_bytes;
+    std::memcpy(
+        dst_keys + ids[i] * row_bytes, src_keys + i * row_bytes, n_bytes);
+    std::memcpy(
+        dst_values + ids[i] * row_bytes, src_values + i * row_bytes, n_bytes);
+    i = j;
+  }
+}
+
 void KVCache::set_kv_cache_slow(const torch::Tensor& slot_ids,
                                 const torch::Tensor& keys,
                                 const torch::Tensor& values) {
@@ -152,4 +190,77 @@ std::tuple<torch::Tensor, torch::Tensor> KVCache::get_kv_cache(
   return std::make_tuple(torch::stack(keys), torch::stack(values));
 }
 
+std::vector<KVBlockView> KVCache::get_kv_block_views(
+    const torch::Tensor& block_tables,
+    const torch::Tensor& kv_cu_seq_lens) const {
+  CHECK(key_cache_.is_cpu() && value_cache_.is_cpu())
+      << "block views are only supported for caches on cpu";
+  CHECK(key_cache_.strides() == value_cache_.strides());
+  const int64_t n_seqs = kv_cu_seq_lens.numel() - 1;
+  DCHECK(block_tables.size(0) == n_seqs);
+
+  const torch::Tensor block_tables_cpu =
+      block_tables.cpu().to(torch::kInt).contiguous();
+  const torch::Tensor kv_cu_seq_lens_cpu = kv_cu_seq_lens.cpu();
+  const int32_t* kv_cu_lens = kv_cu_seq_lens_cpu.data_ptr<int32_t>();
+  const int32_t* block_table_data = block_tables_cpu.data_ptr<int32_t>();
+  const int64_t max_n_blocks = block_tables_cpu.size(1);
+
+  const int64_t element_size = key_cache_.element_size();
+  const int64_t k_block_bytes = key_cache_.stride(0) * element_size;
+  const int64_t v_block_bytes = value_cache_.stride(0) * element_size;
+  const auto* key_data = static_cast<const char*>(key_cache_.data_ptr());
+  const auto* value_data = static_cast<const char*>(value_cache_.data_ptr());
+
+  std::vector<KVBlockView> views(n_seqs);
+  for (int64_t i = 0; i < n_seqs; ++i) {
+    auto& view = views[i];
+    view.num_tokens = kv_cu_lens[i + 1] - kv_cu_lens[i];
+    view.block_size = block_size_;
+    view.num_heads = num_kv_heads_;
+    view.token_stride = key_cache_.stride(1);
+    view.head_stride = key_cache_.stride(2);
+    view.dtype = key_cache_.scalar_type();
+    const int64_t n_blocks = (view.num_tokens + block_size_ - 1) / block_size_;
+    CHECK_LE(n_blocks, max_n_blocks);
+    const int32_t* block_ids = block_table_data + i * max_n_blocks;
+    view.key_blocks.reserve(n_blocks);
+    view.value_blocks.reserve(n_blocks);
+    for (int64_t j = 0; j < n_blocks; ++j) {
+      view.key_blocks.push_back(key_data + block_ids[j] * k_block_bytes);
+      view.value_blocks.push_back(value_data + block_ids[j] * v_block_bytes);
+    }
+  }
+  return views;
+}
+
+std::tuple<torch::Tensor, torch::Tensor> KVCache::get_kv_blocks(
+    const torch::Tensor& block_ids) const {
+  const auto ids = block_ids.to(key_cache_.device(), torch::kLong);
+  // index_select returns a copy, safe to use after the blocks are reused
+  return {key_cache_.index_select(/*dim=*/0, ids),
+          value_cache_.index_select(/*dim=*/0, ids)};
+}
+
+void KVCache::set_kv_blocks(const torch::Tensor& block_ids,
+                            const torch::Tensor& keys,
+                            const torch::Tensor& values) {
+  DCHECK_EQ(block_ids.numel(), keys.size(0));
+  DCHECK_EQ(block_ids.numel(), values.size(0));
+
+  const auto ids = block_ids.to(key_cache_.device(), torch::kLong);
+  key_cache_.index_copy_(/*dim=*/0, ids, keys.to(key_cache_.device()));
+  value_cache_.index_copy_(/*dim=*/0, ids, values.to(value_cache_.device()));
+}
+
+void KVCache::copy_blocks(const torch::Tensor& src_block_ids,
+                          const torch::Tensor& dst_block_ids) {
+  DCHECK_EQ(src_block_ids.numel(), dst_block_ids.numel());
+
+  const auto src = src_block_ids.to(key_cache_.device(), torch::kLong);
+  const auto dst = dst_block_ids.to(key_cache_.device(), torch::kLong);
+  key_cache_.index_copy_(/*dim=*/0, dst, key_cache_.index_select(0, src));
+  value_cache_.index_copy_(/*dim=*/0, dst, value_cache_.index_select(0, src));
+}
+
 }  // namespace llm
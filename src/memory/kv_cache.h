@@ -5,6 +5,30 @@
 #include <vector>
 
 namespace llm {
+
+// In-place view of the keys and values of a sequence in the kv cache, which
+// are split into blocks of block_size tokens. the key of the i-th token for
+// a head is at key_blocks[i / block_size] + (i % block_size) * token_stride +
+// head * head_stride elements, and the same for values.
+struct KVBlockView {
+  // base pointers of key and value blocks: [block_size, num_heads, head_dim]
+  std::vector<const void*> key_blocks;
+  std::vector<const void*> value_blocks;
+
+  // the number of tokens in the sequence
+  int64_t num_tokens = 0;
+
+  int64_t block_size = 0;
+
+  int64_t num_heads = 0;
+
+  // strides in elements
+  int64_t token_stride = 0;
+  int64_t head_stride = 0;
+
+  torch::ScalarType dtype = torch::kFloat;
+};
+
 // Physical memory used for key and value cache in attention layers
 // the fixed memory is allocated in the constructor for each attention layer.
 class KVCache final {
@@ -39,6 +63,32 @@ class KVCache final {
       const torch::Tensor& block_table,
       int64_t context_len) const;
 
+  // get in-place views of key and value cache for sequences without copying,
+  // only supported for caches on cpu.
+  // block_tables: [num_seqs, max_num_blocks] IntTensor
+  // kv_cu_seq_lens: [num_seqs + 1] IntTensor
+  std::vector<KVBlockView> get_kv_block_views(
+      const torch::Tensor& block_tables,
+      const torch::Tensor& kv_cu_seq_lens) const;
+
+  // get a copy of key and value cache for the given blocks
+  // block_ids: [num_blocks] IntTensor
+  // returns keys/values: [num_blocks, block_size, num_heads, head_dim]
+  std::tuple<torch::Tensor, torch::Tensor> get_kv_blocks(
+      const torch::Tensor& block_ids) const;
+
+  // set key and value cache for the given blocks
+  // block_ids: [num_blocks] IntTensor
+  // keys/values: [num_blocks, block_size, num_heads, head_dim]
+  void set_kv_blocks(const torch::Tensor& block_ids,
+                     const torch::Tensor& keys,
+                     const torch::Tensor& values);
+
+  // copy key and value cache from src blocks to dst blocks in place
+  // src_block_ids/dst_block_ids: [num_blocks] IntTensor
+  void copy_blocks(const torch::Tensor& src_block_ids,
+                   const torch::Tensor& dst_block_ids);
+
   // put following functions as public for testing/benchmarking
   void set_kv_cache_slow(const torch::Tensor& slot_ids,
                          const torch::Tensor& keys,
@@ -48,6 +98,11 @@ class KVCache final {
                          const torch::Tensor& keys,
                          const torch::Tensor& values);
 
+  // copy runs of consecutive slots with memcpy, for caches on cpu
+  void set_kv_cache_cpu(const torch::Tensor& slot_ids,
+                        const torch::Tensor& keys,
+                        const torch::Tensor& values);
+
   std::tuple<torch::Tensor, torch::Tensor> get_kv_cache(
       const torch::Tensor& slot_ids) const;
 
@@ -3,6 +3,8 @@
 #include <gtest/gtest.h>
 #include <torch/torch.h>
 
+#include <vector>
+
 namespace llm {
 
 TEST(KVCacheTest, Empty) {
@@ -105,4 +107,143 @@ TEST(KVCacheTest, Random) {
   }
 }
 
+TEST(KVCacheTest, Blocks) {
+  const int64_t num_kv_heads = 2;
+  const int64_t head_dim = 4;
+  const int64_t block_size = 4;
+  const int64_t num_blocks = 8;
+
+  const auto options = torch::dtype(torch::kFloat32).device(torch::kCPU);
+  KVCache src(torch::rand({num_blocks, block_size, num_kv_heads, head_dim},
+                          options),
+              torch::rand({num_blocks, block_size, num_kv_heads, head_dim},
+                          options));
+  KVCache dst(torch::zeros({num_blocks, block_size, num_kv_heads, head_dim},
+                           options),
+              torch::zeros({num_blocks, block_size, num_kv_heads, head_dim},
+                           options));
+
+  // copy blocks [1, 5, 3] of src into blocks [2, 7, 6] of dst
+  const auto src_ids = torch::tensor({1, 5, 3}, torch::kInt);
+  const auto dst_ids = torch::tensor({2, 7, 6}, torch::kInt);
+  auto [keys, values] = src.get_kv_blocks(src_ids);
+  EXPECT_EQ(keys.sizes(),
+            torch::IntArrayRef({3, block_size, num_kv_heads, head_dim}));
+  dst.set_kv_blocks(dst_ids, keys, values);
+
+  auto [src_keys, src_values] = src.get_kv_cache();
+  auto [dst_keys, dst_values] = dst.get_kv_cache();
+  for (int64_t i = 0; i < src_ids.numel(); ++i) {
+    const int64_t s = src_ids[i].item<int64_t>();
+    const int64_t d = dst_ids[i].item<int64_t>();
+    EXPECT_TRUE(torch::equal(src_keys[s], dst_keys[d]));
+    EXPECT_TRUE(torch::equal(src_values[s], dst_values[d]));
+  }
+  // other blocks are untouched
+  EXPECT_TRUE(torch::equal(dst_keys[0], torch::zeros_like(dst_keys[0])));
+
+  // the returned blocks are copies
+  src_keys.zero_();
+  EXPECT_FALSE(torch::equal(keys, torch::zeros_like(keys)));
+}
+
+TEST(KVCacheTest, CopyBlocks) {
+  const int64_t num_kv_heads = 2;
+  const int64_t head_dim = 4;
+  const int64_t block_size = 4;
+  const int64_t num_blocks = 8;
+
+  const auto options = torch::dtype(torch::kFloat32).device(torch::kCPU);
+  KVCache kv_cache(
+      torch::rand({num_blocks, block_size, num_kv_heads, head_dim}, options),
+      torch::rand({num_blocks, block_size, num_kv_heads, head_dim}, options));
+  auto [keys, values] = kv_cache.get_kv_cache();
+  const auto expected_keys = keys.clone();
+  const auto expected_values = values.clone();
+
+  // copy blocks [1, 1, 3] into blocks [2, 5, 6]
+  kv_cache.copy_blocks(torch::tensor({1, 1, 3}, torch::kInt),
+                       torch::tensor({2, 5, 6}, torch::kInt));
+  EXPECT_TRUE(torch::equal(keys[2], expected_keys[1]));
+  EXPECT_TRUE(torch::equal(keys[5], expected_keys[1]));
+  EXPECT_TRUE(torch::equal(values[6], expected_values[3]));
+  // source blocks and other blocks are untouched
+  EXPECT_TRUE(torch::equal(keys[1], expected_keys[1]));
+  EXPECT_TRUE(torch::equal(values[0], expected_values[0]));
+}
+
+TEST(KVCacheTest, SetKVCacheCPU) {
+  const int64_t num_kv_heads = 2;
+  const int64_t head_dim = 4;
+  const int64_t block_size = 4;
+  const int64_t num_blocks = 8;
+
+  const auto options = torch::dtype(torch::kFloat32).device(torch::kCPU);
+  const std::vector<int64_t> shape = {
+      num_blocks, block_size, num_kv_heads, head_dim};
+  KVCache kv_cache(torch::zeros(shape, options), torch::zeros(shape, options));
+  KVCache ref_kv_cache(torch::zeros(shape, options),
+                       torch::zeros(shape, options));
+
+  // runs of consecutive slots across blocks and single slots
+  const auto slot_ids =
+      torch::tensor({6, 7, 8, 9, 10, 21, 13, 14}, torch::kInt);
+  const auto keys = torch::rand({8, num_kv_heads, head_dim}, options);
+  // non-contiguous values
+  const auto values = torch::rand({8, num_kv_heads * 2, head_dim}, options)
+                          .slice(/*dim=*/1, /*start=*/0, /*end=*/num_kv_heads);
+  kv_cache.set_kv_cache_cpu(slot_ids, keys, values);
+  ref_kv_cache.set_kv_cache_slow(slot_ids, keys, values);
+
+  auto [k_cache, v_cache] = kv_cache.get_kv_cache();
+  auto [ref_k_cache, ref_v_cache] = ref_kv_cache.get_kv_cache();
+  EXPECT_TRUE(torch::equal(k_cache, ref_k_cache));
+  EXPECT_TRUE(torch::equal(v_cache, ref_v_cache));
+}
+
+TEST(KVCacheTest, BlockViews) {
+  const int64_t num_kv_heads = 2;
+  const int64_t head_dim = 4;
+  const int64_t block_size = 4;
+  const int64_t num_blocks = 8;
+
+  const auto options = torch::dtype(torch::kFloat32).device(torch::kCPU);
+  KVCache kv_cache(
+      torch::rand({num_blocks, block_size, num_kv_heads, head_dim}, options),
+      torch::rand({num_blocks, block_size, num_kv_heads, head_dim}, options));
+
+  // two sequences with 6 and 3 tokens, padded block tables
+  const auto block_tables = torch::tensor({{5, 2}, {3, 0}}, torch::kInt);
+  const auto kv_cu_seq_lens = torch::tensor({0, 6, 9}, torch::kInt);
+  const auto views =
+      kv_cache.get_kv_block_views(block_tables, kv_cu_seq_lens);
+  auto [keys, values] =
+      kv_cache.get_kv_cache(block_tables, kv_cu_seq_lens);
+
+  ASSERT_EQ(views.size(), 2);
+  EXPECT_EQ(views[0].num_tokens, 6);
+  EXPECT_EQ(views[0].key_blocks.size(), 2);
+  EXPECT_EQ(views[1].num_tokens, 3);
+  EXPECT_EQ(views[1].key_blocks.size(), 1);
+
+  // keys and values are read in place
+  int64_t token = 0;
+  for (const auto& view : views) {
+    for (int64_t i = 0; i < view.num_tokens; ++i, ++token) {
+      const int64_t offset = (i % view.block_size) * view.token_stride +
+                             /*head=*/1 * view.head_stride;
+      const float* key = static_cast<const float*>(
+                             view.key_blocks[i / view.block_size]) +
+                         offset;
+      const float* value = static_cast<const float*>(
+                               view.value_blocks[i / view.block_size]) +
+                           offset;
+      for (int64_t d = 0; d < head_dim; ++d) {
+        EXPECT_EQ(key[d], keys[token][1][d].item<float>());
+        EXPECT_EQ(value[d], values[token][1][d].item<float>());
+      }
+    }
+  }
+}
+
 }  // namespace llm
@@ -221,6 +221,10 @@ size_t PrefixCache::evict_helper(size_t n_blocks_to_evict) {
       DCHECK(n_blocks_left >= non_shared_start);
       node->token_ids.resize(n_blocks_left * block_size_);
       node->blocks.resize(n_blocks_left);
+      for (size_t i = n_blocks_left; i < n_blocks; ++i) {
+        summary_.remove(node->block_hashes[i]);
+      }
+      node->block_hashes.resize(n_blocks_left);
     }
   }
 
@@ -242,6 +246,10 @@ void PrefixCache::release_node(Node* node) {
   DCHECK(parent->children.count(node) > 0);
   parent->children.erase(node);
 
+  for (const uint64_t hash : node->block_hashes) {
+    summary_.remove(hash);
+  }
+
   // delete the node
   remove_node_from_lru(node);
   delete node;
@@ -266,6 +274,8 @@ void PrefixCache::split_node(Node* node, size_t common_prefix_length) {
 
   child->token_ids = token_ids.slice(common_prefix_length);
   child->blocks = blocks.slice(n_blocks);
+  child->block_hashes.assign(node->block_hashes.begin() + n_blocks,
+                             node->block_hashes.end());
   child->last_access_time = node->last_access_time;
   // point to parent
   child->parent = node;
@@ -278,6 +288,7 @@ void PrefixCache::split_node(Node* node, size_t common_prefix_length) {
   // truncate token_ids and blocks to the common prefix length
   node->token_ids.resize(common_prefix_length);
   node->blocks.resize(n_blocks);
+  node->block_hashes.resize(n_blocks);
   // put the new child into the children set
   node->children.insert(child);
 }
@@ -298,6 +309,14 @@ void PrefixCache::create_child(Node* node,
 
   child->token_ids = tokens;
   child->blocks = blocks;
+  // chain the hashes from the last block of the parent
+  const uint64_t prev_hash =
+      node->block_hashes.empty() ? 0 : node->block_hashes.back();
+  child->block_hashes =
+      PrefixCacheSummary::block_hashes(tokens, block_size_, prev_hash);
+  for (const uint64_t hash : child->block_hashes) {
+    summary_.add(hash);
+  }
   child->last_access_time = now;
   child->parent = node;
   node->children.insert(child);
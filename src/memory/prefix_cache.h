@@ -6,6 +6,7 @@
 
 #include "block.h"
 #include "common/slice.h"
+#include "prefix_cache_summary.h"
 
 namespace llm {
 
@@ -46,6 +47,9 @@ class PrefixCache final {
   // get the total number of nodes in the prefix tree
   size_t num_nodes() const { return num_nodes_; }
 
+  // get the summary of cached blocks, thread safe
+  const PrefixCacheSummary& summary() const { return summary_; }
+
  private:
   struct Node {
     // the token ids that the node represents
@@ -53,6 +57,8 @@ class PrefixCache final {
     std::vector<int32_t> token_ids;
     // the block ids that the node represents
     std::vector<Block> blocks;
+    // the chained hashes of the blocks, for the summary
+    std::vector<uint64_t> block_hashes;
 
     // the children nodes, used to traverse down the tree
     std::unordered_set<Node*> children;
@@ -107,6 +113,9 @@ class PrefixCache final {
 
   // the total number of nodes in the prefix tree
   size_t num_nodes_ = 0;
+
+  // the summary of cached blocks
+  PrefixCacheSummary summary_;
 };
 
 }  // namespace llm
\ No newline at end of file
@@ -0,0 +1,55 @@
+#include "prefix_cache_summary.h"
+
+#include <glog/logging.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "common/slice.h"
+
+namespace llm {
+namespace {
+// the finalizer of splitmix64 to spread the bits
+uint64_t mix(uint64_t h) {
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+}
+}  // namespace
+
+PrefixCacheSummary::PrefixCacheSummary()
+    : counts_(std::make_unique<std::atomic<uint32_t>[]>(kNumSlots)) {}
+
+std::vector<uint64_t> PrefixCacheSummary::block_hashes(
+    const Slice<int32_t>& token_ids,
+    uint32_t block_size,
+    uint64_t prev_hash) {
+  CHECK_GT(block_size, 0);
+  const size_t n_blocks = token_ids.size() / block_size;
+  std::vector<uint64_t> hashes;
+  hashes.reserve(n_blocks);
+  uint64_t hash = prev_hash;
+  for (size_t i = 0; i < n_blocks; ++i) {
+    // FNV-1a over the tokens of the block, seeded with the previous block
+    for (size_t j = i * block_size; j < (i + 1) * block_size; ++j) {
+      hash ^= static_cast<uint32_t>(token_ids[j]);
+      hash *= 0x100000001b3ULL;
+    }
+    hash = mix(hash);
+    hashes.push_back(hash);
+  }
+  return hashes;
+}
+
+size_t PrefixCacheSummary::match(const std::vector<uint64_t>& hashes) const {
+  size_t n_matched = 0;
+  while (n_matched < hashes.size() && contains(hashes[n_matched])) {
+    ++n_matched;
+  }
+  return n_matched;
+}
+
+}  // namespace llm
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "common/slice.h"
+
+namespace llm {
+
+// A lightweight summary of the blocks in a prefix cache, used to estimate the
+// prefix cache hit of a prompt without touching the prefix cache itself, e.g.
+// from other threads to route requests. Each cached block is identified by a
+// hash of its tokens chained with the hash of its previous block, so that a
+// block hash stands for the whole prefix up to the block. Hashes are counted
+// in a fixed size table, which may report false positives but never false
+// negatives. Thread safe.
+class PrefixCacheSummary final {
+ public:
+  PrefixCacheSummary();
+
+  // returns the chained hashes of full blocks in token_ids, starting from the
+  // hash of the previous block, or 0 for the first block.
+  static std::vector<uint64_t> block_hashes(const Slice<int32_t>& token_ids,
+                                            uint32_t block_size,
+                                            uint64_t prev_hash = 0);
+
+  void add(uint64_t hash) {
+    count(hash).fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void remove(uint64_t hash) {
+    count(hash).fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  bool contains(uint64_t hash) const {
+    return count(hash).load(std::memory_order_relaxed) > 0;
+  }
+
+  // returns the number of leading blocks that are likely in the cache
+  size_t match(const std::vector<uint64_t>& hashes) const;
+
+ private:
+  static constexpr size_t kNumSlots = 1 << 16;
+
+  std::atomic<uint32_t>& count(uint64_t hash) const {
+    return counts_[hash % kNumSlots];
+  }
+
+  std::unique_ptr<std::atomic<uint32_t>[]> counts_;
+};
+
+}  // namespace llm
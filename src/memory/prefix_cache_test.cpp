@@ -138,6 +138,43 @@ struct SequenceData {
   std::vector<Block> blocks;
 };
 
+TEST(PrefixCacheTest, Summary) {
+  const uint32_t block_size = 2;
+  BlockAllocator allocator(20, block_size);
+  PrefixCache cache(block_size);
+  const auto& summary = cache.summary();
+
+  const std::vector<int32_t> prompt = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+  const auto hashes = PrefixCacheSummary::block_hashes(prompt, block_size);
+  ASSERT_EQ(hashes.size(), 4);
+  EXPECT_EQ(summary.match(hashes), 0);
+
+  // a block hash depends on all tokens before it
+  const std::vector<int32_t> other = {2, 1, 3, 4};
+  EXPECT_NE(PrefixCacheSummary::block_hashes(other, block_size)[1], hashes[1]);
+
+  {
+    // insert [1, 2, 3, 4, 5, 6], then [1, 2, 3, 4, 7, 7] to split the node
+    cache.insert(std::vector<int32_t>{1, 2, 3, 4, 5, 6}, allocator.allocate(3));
+    EXPECT_EQ(summary.match(hashes), 3);
+    std::vector<int32_t> token_ids = {1, 2, 3, 4, 7, 7};
+    std::vector<Block> blocks = cache.match(token_ids);
+    blocks.push_back(allocator.allocate());
+    cache.insert(token_ids, blocks);
+    EXPECT_EQ(summary.match(hashes), 3);
+    EXPECT_EQ(
+        summary.match(PrefixCacheSummary::block_hashes(token_ids, block_size)),
+        3);
+  }
+
+  // evicted blocks are removed from the summary, from the tail
+  EXPECT_EQ(cache.evict(1), 1);
+  EXPECT_EQ(cache.evict(1), 1);
+  EXPECT_EQ(summary.match(hashes), 2);
+  EXPECT_EQ(cache.evict(2), 2);
+  EXPECT_EQ(summary.match(hashes), 0);
+}
+
 // get a sub vector
 template <typename T>
 std::vector<T> sub_vector(const std::vector<T>& data, size_t size) {
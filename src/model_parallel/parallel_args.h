@@ -19,12 +19,17 @@ struct ParallelArgs {
 
   // pointer to process group, nullptr if world size is 1
   DEFINE_PTR_ARG(ProcessGroup, process_group) = nullptr;
+
+  // whether to gather logits of all ranks. logits are left sharded along the
+  // vocab for vocab parallel sampling.
+  DEFINE_ARG(bool, gather_logits) = true;
 };
 
 inline std::ostream& operator<<(std::ostream& os, const ParallelArgs& args) {
   os << "ParallelArgs: [";
   os << "rank: " << args.rank();
   os << ", world_size: " << args.world_size();
+  os << ", gather_logits: " << args.gather_logits();
   os << "]";
   return os;
 }
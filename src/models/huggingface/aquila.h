@@ -310,13 +310,14 @@ class AquilaForCausalLMImpl : public torch::nn::Module {
     model_ = register_module(
         "model", AquilaModel(args, quant_args, parallel_args, options));
 
-    lm_head_ = register_module("lm_head",
-                               ColumnParallelLinear(args.hidden_size(),
-                                                    args.vocab_size(),
-                                                    /*bias=*/false,
-                                                    /*gather_output=*/true,
-                                                    parallel_args,
-                                                    options));
+    lm_head_ = register_module(
+        "lm_head",
+        ColumnParallelLinear(args.hidden_size(),
+                             args.vocab_size(),
+                             /*bias=*/false,
+                             /*gather_output=*/parallel_args.gather_logits(),
+                             parallel_args,
+                             options));
   }
 
   // tokens: [num_tokens]
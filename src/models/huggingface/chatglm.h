@@ -394,13 +394,14 @@ class ChatGLMForCausalLMImpl : public torch::nn::Module {
     model_ = register_module(
         "encoder", ChatGLMModel(args, quant_args, parallel_args, options));
 
-    output_layer_ = register_module("output_layer",
-                                    ColumnParallelLinear(args.hidden_size(),
-                                                         args.vocab_size(),
-                                                         /*bias=*/false,
-                                                         /*gather_output=*/true,
-                                                         parallel_args,
-                                                         options));
+    output_layer_ = register_module(
+        "output_layer",
+        ColumnParallelLinear(args.hidden_size(),
+                             args.vocab_size(),
+                             /*bias=*/false,
+                             /*gather_output=*/parallel_args.gather_logits(),
+                             parallel_args,
+                             options));
   }
 
   // tokens: [num_tokens]
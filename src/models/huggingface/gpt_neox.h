@@ -337,13 +337,14 @@ class GPTNeoXForCausalLMImpl : public torch::nn::Module {
     gpt_neox_ = register_module(
         "gpt_neox", GPTNeoXModel(args, quant_args, parallel_args, options));
 
-    embed_out_ = register_module("embed_out",
-                                 ColumnParallelLinear(args.hidden_size(),
-                                                      args.vocab_size(),
-                                                      /*bias=*/false,
-                                                      /*gather_output=*/true,
-                                                      parallel_args,
-                                                      options));
+    embed_out_ = register_module(
+        "embed_out",
+        ColumnParallelLinear(args.hidden_size(),
+                             args.vocab_size(),
+                             /*bias=*/false,
+                             /*gather_output=*/parallel_args.gather_logits(),
+                             parallel_args,
+                             options));
   }
 
   // tokens: [num_tokens]
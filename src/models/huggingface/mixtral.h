@@ -0,0 +1,254 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include "layers/attention/handler.h"
+#include "layers/embedding.h"
+#include "layers/linear.h"
+#include "layers/moe.h"
+#include "layers/normalization.h"
+#include "memory/kv_cache.h"
+#include "models/huggingface/mistral.h"
+#include "models/model_args.h"
+#include "models/model_registry.h"
+#include "models/parameters.h"
+
+// Mixtral mixture of experts model compatible with huggingface weights
+namespace llm::hf {
+
+class MixtralDecoderLayerImpl : public torch::nn::Module {
+ public:
+  MixtralDecoderLayerImpl(const ModelArgs& args,
+                          const QuantArgs& quant_args,
+                          const ParallelArgs& parallel_args,
+                          const torch::TensorOptions& options,
+                          AttentionHandler* handler) {
+    // register submodules
+    self_attn_ = register_module(
+        "self_attn",
+        MistralAttention(args, quant_args, parallel_args, options, handler));
+    CHECK(quant_args.quant_method().empty())
+        << "quantization is not supported for mixtral experts yet";
+    moe_ = register_module("block_sparse_moe",
+                           FusedMoE(args.n_experts(),
+                                    args.n_experts_per_tok(),
+                                    args.hidden_size(),
+                                    args.intermediate_size(),
+                                    /*renormalize=*/true,
+                                    args.hidden_act(),
+                                    parallel_args,
+                                    options));
+    input_layernorm_ = register_module(
+        "input_layernorm",
+        RMSNorm(args.hidden_size(), args.rms_norm_eps(), options));
+    post_attention_layernorm_ = register_module(
+        "post_attention_layernorm",
+        RMSNorm(args.hidden_size(), args.rms_norm_eps(), options));
+  }
+
+  torch::Tensor forward(torch::Tensor x,
+                        torch::Tensor positions,
+                        KVCache& kv_cache,
+                        const InputParameters& input_params) {
+    auto h =
+        x + self_attn_(input_layernorm_(x), positions, kv_cache, input_params);
+    return h + moe_(post_attention_layernorm_(h));
+  }
+
+  // load the weight from the checkpoint
+  void load_state_dict(const StateDict& state_dict) {
+    // call each submodule's load_state_dict function
+    self_attn_->load_state_dict(state_dict.select("self_attn."));
+    moe_->load_state_dict(state_dict.select("block_sparse_moe."));
+    input_layernorm_->load_state_dict(state_dict.select("input_layernorm."));
+    post_attention_layernorm_->load_state_dict(
+        state_dict.select("post_attention_layernorm."));
+  }
+
+  void verify_loaded_weights(const std::string& prefix) const {
+    self_attn_->verify_loaded_weights(prefix + "self_attn.");
+    moe_->verify_loaded_weights(prefix + "block_sparse_moe.");
+    input_layernorm_->verify_loaded_weights(prefix + "input_layernorm.");
+    post_attention_layernorm_->verify_loaded_weights(
+        prefix + "post_attention_layernorm.");
+  }
+
+ private:
+  // parameter members, must be registered
+  MistralAttention self_attn_{nullptr};
+
+  FusedMoE moe_{nullptr};
+
+  RMSNorm input_layernorm_{nullptr};
+
+  RMSNorm post_attention_layernorm_{nullptr};
+};
+TORCH_MODULE(MixtralDecoderLayer);
+
+class MixtralModelImpl : public torch::nn::Module {
+ public:
+  MixtralModelImpl(const ModelArgs& args,
+                   const QuantArgs& quant_args,
+                   const ParallelArgs& parallel_args,
+                   const torch::TensorOptions& options) {
+    // register submodules
+    embed_tokens_ = register_module(
+        "embed_tokens",
+        ParallelEmbedding(
+            args.vocab_size(), args.hidden_size(), parallel_args, options));
+
+    handler_ = AttentionHandler::create_handler_with_rope(
+        args, /*interleaved=*/false, options);
+
+    blocks_ = register_module("layers", torch::nn::ModuleList());
+    layers_.reserve(args.n_layers());
+    for (int32_t i = 0; i < args.n_layers(); i++) {
+      auto block = MixtralDecoderLayer(
+          args, quant_args, parallel_args, options, handler_.get());
+      layers_.push_back(block);
+      blocks_->push_back(block);
+    }
+    norm_ = register_module(
+        "norm", RMSNorm(args.hidden_size(), args.rms_norm_eps(), options));
+  }
+
+  // tokens: [num_tokens]
+  // positions: [num_tokens] token pos in the sequence
+  torch::Tensor forward(torch::Tensor tokens,
+                        torch::Tensor positions,
+                        std::vector<KVCache>& kv_caches,
+                        const InputParameters& input_params) {
+    auto h = embed_tokens_(tokens);
+
+    // TODO: set working space for attention handler
+    for (size_t i = 0; i < layers_.size(); i++) {
+      auto& layer = layers_[i];
+      h = layer(h, positions, kv_caches[i], input_params);
+    }
+    return norm_(h);
+  }
+
+  // load the weight from the checkpoint
+  void load_state_dict(const StateDict& state_dict) {
+    embed_tokens_->load_state_dict(state_dict.select("embed_tokens."));
+    // call each layer's load_state_dict function
+    for (int i = 0; i < layers_.size(); i++) {
+      layers_[i]->load_state_dict(
+          state_dict.select("layers." + std::to_string(i) + "."));
+    }
+    norm_->load_state_dict(state_dict.select("norm."));
+  }
+
+  void verify_loaded_weights(const std::string& prefix) const {
+    embed_tokens_->verify_loaded_weights(prefix + "embed_tokens.");
+    for (int i = 0; i < layers_.size(); i++) {
+      layers_[i]->verify_loaded_weights(prefix + "layers." + std::to_string(i) +
+                                        ".");
+    }
+    norm_->verify_loaded_weights(prefix + "norm.");
+  }
+
+ private:
+  // parameter members, must be registered
+  ParallelEmbedding embed_tokens_{nullptr};
+
+  // attention handler
+  std::unique_ptr<AttentionHandler> handler_{nullptr};
+
+  torch::nn::ModuleList blocks_{nullptr};
+  // hold same data but different type as blocks_ to avoid type cast
+  std::vector<MixtralDecoderLayer> layers_;
+
+  RMSNorm norm_{nullptr};
+};
+TORCH_MODULE(MixtralModel);
+
+class MixtralForCausalLMImpl : public torch::nn::Module {
+ public:
+  MixtralForCausalLMImpl(const ModelArgs& args,
+                         const QuantArgs& quant_args,
+                         const ParallelArgs& parallel_args,
+                         const torch::TensorOptions& options) {
+    // register submodules
+    model_ = register_module(
+        "model", MixtralModel(args, quant_args, parallel_args, options));
+
+    lm_head_ = register_module(
+        "lm_head",
+        ColumnParallelLinear(args.hidden_size(),
+                             args.vocab_size(),
+                             /*bias=*/false,
+                             /*gather_output=*/parallel_args.gather_logits(),
+                             parallel_args,
+                             options));
+  }
+
+  // tokens: [num_tokens]
+  // positions: [num_tokens] token pos in the sequence
+  // returns: [num_tokens, hidden_size]
+  torch::Tensor forward(const torch::Tensor& tokens,
+                        const torch::Tensor& positions,
+                        std::vector<KVCache>& kv_caches,
+                        const InputParameters& input_params) {
+    return model_(tokens, positions, kv_caches, input_params);
+  }
+
+  // hidden_states: [num_tokens, hidden_size]
+  // seleted_idxes: [num_tokens]
+  // returns: [num_tokens, vocab_size]
+  torch::Tensor logits(const torch::Tensor& hidden_states,
+                       const torch::Tensor& seleted_idxes) {
+    // select tokens if provided
+    auto h = hidden_states;
+    if (seleted_idxes.defined()) {
+      h = h.index_select(/*dim=*/0, seleted_idxes);
+    }
+    return lm_head_(h);
+  }
+
+  // load the weight from the checkpoint
+  void load_state_dict(const StateDict& state_dict) {
+    model_->load_state_dict(state_dict.select("model."));
+    lm_head_->load_state_dict(state_dict.select("lm_head."));
+  }
+
+  void verify_loaded_weights() const {
+    model_->verify_loaded_weights("model.");
+    lm_head_->verify_loaded_weights("lm_head.");
+  }
+
+ private:
+  // parameter members, must be registered
+  MixtralModel model_{nullptr};
+
+  ColumnParallelLinear lm_head_{nullptr};
+};
+TORCH_MODULE(MixtralForCausalLM);
+
+// register the model to make it available
+REGISTER_CAUSAL_MODEL(mixtral, MixtralForCausalLM);
+REGISTER_DEFAULT_CHAT_TEMPLATE(mixtral, MistralChatTemplate);
+REGISTER_MODEL_ARGS(mixtral, [&] {
+  LOAD_ARG_OR(model_type, "model_type", "mixtral");
+  LOAD_ARG_OR(dtype, "torch_dtype", "");
+  LOAD_ARG_OR(vocab_size, "vocab_size", 32000);
+  LOAD_ARG_OR(hidden_size, "hidden_size", 4096);
+  LOAD_ARG_OR(n_layers, "num_hidden_layers", 32);
+  LOAD_ARG_OR(n_heads, "num_attention_heads", 32);
+  LOAD_ARG(n_kv_heads, "num_key_value_heads");
+  LOAD_ARG_OR(intermediate_size, "intermediate_size", 14336);
+  LOAD_ARG_OR(hidden_act, "hidden_act", "silu");
+  LOAD_ARG_OR(max_position_embeddings, "max_position_embeddings", 32768);
+  LOAD_ARG_OR(rms_norm_eps, "rms_norm_eps", 1e-5);
+  LOAD_ARG_OR(bos_token_id, "bos_token_id", 1);
+  LOAD_ARG_OR(eos_token_id, "eos_token_id", 2);
+  LOAD_ARG_OR(rope_theta, "rope_theta", 1000000.0f);
+  LOAD_ARG_OR(n_experts, "num_local_experts", 8);
+  LOAD_ARG_OR(n_experts_per_tok, "num_experts_per_tok", 2);
+
+  LOAD_ARG_OR_FUNC(head_dim, "head_dim", [&] {
+    return args->hidden_size() / args->n_heads();
+  });
+});
+
+}  // namespace llm::hf
@@ -407,13 +407,14 @@ class MPTForCausalLMImpl : public torch::nn::Module {
         "transformer", MPTModel(args, quant_args, parallel_args, options));
 
     // TODO: share weights between wte and lm_head to save memory
-    lm_head_ = register_module("wte",
-                               ColumnParallelLinear(args.hidden_size(),
-                                                    args.vocab_size(),
-                                                    /*bias=*/!args.no_bias(),
-                                                    /*gather_output=*/true,
-                                                    parallel_args,
-                                                    options));
+    lm_head_ = register_module(
+        "wte",
+        ColumnParallelLinear(args.hidden_size(),
+                             args.vocab_size(),
+                             /*bias=*/!args.no_bias(),
+                             /*gather_output=*/parallel_args.gather_logits(),
+                             parallel_args,
+                             options));
   }
 
   // tokens: [num_tokens]
@@ -297,13 +297,14 @@ class PhiLMHeadImpl : public torch::nn::Module {
                                     /*bias=*/true,
                                     options));
 
-    linear_ = register_module("linear",
-                              ColumnParallelLinear(args.hidden_size(),
-                                                   args.vocab_size(),
-                                                   /*bias=*/true,
-                                                   /*gather_output=*/true,
-                                                   parallel_args,
-                                                   options));
+    linear_ = register_module(
+        "linear",
+        ColumnParallelLinear(args.hidden_size(),
+                             args.vocab_size(),
+                             /*bias=*/true,
+                             /*gather_output=*/parallel_args.gather_logits(),
+                             parallel_args,
+                             options));
   }
 
   torch::Tensor forward(torch::Tensor x) { return linear_(ln_(x)); }
@@ -303,13 +303,14 @@ class LlamaForCausalLMImpl : public torch::nn::Module {
     transformer_ = register_module(
         "model", LlamaTransformer(args, quant_args, parallel_args, options));
 
-    output_ = register_module("output",
-                              ColumnParallelLinear(args.hidden_size(),
-                                                   args.vocab_size(),
-                                                   /*bias=*/false,
-                                                   /*gather_output=*/true,
-                                                   parallel_args,
-                                                   options));
+    output_ = register_module(
+        "output",
+        ColumnParallelLinear(args.hidden_size(),
+                             args.vocab_size(),
+                             /*bias=*/false,
+                             /*gather_output=*/parallel_args.gather_logits(),
+                             parallel_args,
+                             options));
   }
 
   // tokens: [num_tokens]
@@ -103,6 +103,12 @@ struct ModelArgs {
 
   // Stop token ids for decoding.
   DEFINE_ARG(std::unordered_set<int32_t>, stop_token_ids);
+
+  // number of experts for mixture of experts models, 0 for dense models.
+  DEFINE_ARG(int64_t, n_experts) = 0;
+
+  // number of experts each token is routed to.
+  DEFINE_ARG(int64_t, n_experts_per_tok) = 0;
 };
 
 inline std::ostream& operator<<(std::ostream& os, const ModelArgs& args) {
@@ -134,6 +140,8 @@ inline std::ostream& operator<<(std::ostream& os, const ModelArgs& args) {
   os << ", linear_bias: " << args.linear_bias();
   os << ", qkv_bias: " << args.qkv_bias();
   os << ", residual_post_layernorm: " << args.residual_post_layernorm();
+  os << ", n_experts: " << args.n_experts();
+  os << ", n_experts_per_tok: " << args.n_experts_per_tok();
   os << "]";
   return os;
 }
@@ -14,6 +14,7 @@
 #include "huggingface/internlm.h"  // IWYU pragma: keep
 #include "huggingface/llama.h"     // IWYU pragma: keep
 #include "huggingface/mistral.h"   // IWYU pragma: keep
+#include "huggingface/mixtral.h"   // IWYU pragma: keep
 #include "huggingface/mpt.h"       // IWYU pragma: keep
 #include "huggingface/phi.h"       // IWYU pragma: keep
 #include "huggingface/qwen.h"      // IWYU pragma: keep
@@ -0,0 +1,160 @@
+#include "beam_search.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include "sequence.h"
+
+namespace llm {
+
+BeamSearch::BeamSearch(const BeamSearchOptions& options, size_t num_seqs)
+    : options_(options), num_seqs_(num_seqs) {
+  CHECK_GT(options_.num_beams, 0) << "num_beams should be greater than 0";
+  CHECK_LE(num_seqs_, options_.num_beams)
+      << "can't return more sequences than beams";
+}
+
+bool BeamSearch::step(std::deque<Sequence>& beams,
+                      const ReleaseFunc& release) {
+  if (done_ || beams.empty()) {
+    return false;
+  }
+  // wait until all beams are sampled
+  for (const auto& beam : beams) {
+    if (beam.beam_candidates().empty()) {
+      return false;
+    }
+  }
+
+  struct Candidate {
+    // sum of logprobs of the beam extended with the token
+    float cum_logprob = 0.0;
+    size_t beam_idx = 0;
+    BeamCandidate token;
+  };
+  std::vector<Candidate> candidates;
+  for (size_t i = 0; i < beams.size(); ++i) {
+    const Sequence& beam = beams[i];
+    for (const auto& token : beam.beam_candidates()) {
+      candidates.push_back({beam.cum_logprob() + token.logprob, i, token});
+    }
+  }
+  std::stable_sort(candidates.begin(),
+                   candidates.end(),
+                   [](const Candidate& a, const Candidate& b) {
+                     return a.cum_logprob > b.cum_logprob;
+                   });
+
+  // select the best candidates to keep running, finished candidates among the
+  // best num_beams ones become hypotheses.
+  const size_t num_beams = options_.num_beams;
+  std::vector<const Candidate*> selected;
+  selected.reserve(num_beams);
+  std::vector<size_t> num_children(beams.size(), 0);
+  for (size_t rank = 0;
+       rank < candidates.size() && selected.size() < num_beams;
+       ++rank) {
+    const Candidate& candidate = candidates[rank];
+    Sequence& beam = beams[candidate.beam_idx];
+    const auto& token = candidate.token;
+    if (beam.check_finished_with(token.token_id) == FinishReason::NONE) {
+      selected.push_back(&candidate);
+      ++num_children[candidate.beam_idx];
+      continue;
+    }
+    if (rank < num_beams) {
+      Sequence hypothesis = beam.fork();
+      hypothesis.append_beam_token(token.token_id, token.logprob);
+      // only tokens are needed for finished hypotheses
+      release(&hypothesis);
+      add_hypothesis(std::move(hypothesis));
+    }
+  }
+
+  // prune beams without any selected candidate
+  for (size_t i = 0; i < beams.size(); ++i) {
+    if (num_children[i] == 0) {
+      release(&beams[i]);
+    }
+  }
+
+  // extend selected beams, the last child of a beam takes over it and the
+  // others fork from it, sharing cache blocks without copying.
+  std::deque<Sequence> next_beams;
+  for (const Candidate* candidate : selected) {
+    Sequence& parent = beams[candidate->beam_idx];
+    if (--num_children[candidate->beam_idx] == 0) {
+      next_beams.push_back(std::move(parent));
+    } else {
+      next_beams.push_back(parent.fork());
+    }
+    const auto& token = candidate->token;
+    next_beams.back().append_beam_token(token.token_id, token.logprob);
+  }
+  beams = std::move(next_beams);
+
+  if (beams.empty() || is_search_done(beams)) {
+    finalize(beams, release);
+  }
+  return true;
+}
+
+float BeamSearch::score(const Sequence& sequence) const {
+  const size_t length = std::max<size_t>(sequence.num_generated_tokens(), 1);
+  return sequence.cum_logprob() /
+         std::pow(static_cast<float>(length), options_.length_penalty);
+}
+
+void BeamSearch::add_hypothesis(Sequence&& sequence) {
+  const float score = this->score(sequence);
+  if (hypotheses_.size() >= options_.num_beams &&
+      score <= hypotheses_.back().first) {
+    return;
+  }
+  // keep hypotheses sorted by score in descending order
+  const auto it = std::upper_bound(
+      hypotheses_.begin(),
+      hypotheses_.end(),
+      score,
+      [](float s, const std::pair<float, Sequence>& hypothesis) {
+        return s > hypothesis.first;
+      });
+  hypotheses_.emplace(it, score, std::move(sequence));
+  if (hypotheses_.size() > options_.num_beams) {
+    hypotheses_.pop_back();
+  }
+}
+
+bool BeamSearch::is_search_done(const std::deque<Sequence>& beams) const {
+  if (hypotheses_.size() < options_.num_beams) {
+    return false;
+  }
+  if (options_.early_stopping) {
+    return true;
+  }
+  // beams are sorted by sum of logprobs and have the same length, stop if the
+  // best one can't beat the worst hypothesis.
+  return score(beams.front()) <= hypotheses_.back().first;
+}
+
+void BeamSearch::finalize(std::deque<Sequence>& beams,
+                          const ReleaseFunc& release) {
+  for (auto& beam : beams) {
+    release(&beam);
+  }
+  beams.clear();
+
+  const size_t num_seqs = std::min(num_seqs_, hypotheses_.size());
+  for (size_t i = 0; i < num_seqs; ++i) {
+    beams.push_back(std::move(hypotheses_[i].second));
+  }
+  hypotheses_.clear();
+  done_ = true;
+}
+
+}  // namespace llm
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "sequence.h"
+
+namespace llm {
+
+// Options of beam search for a request.
+struct BeamSearchOptions {
+  // the number of beams to keep at each step
+  size_t num_beams = 1;
+
+  // exponential penalty to the length of finished hypotheses, which are
+  // scored by sum_logprobs / num_generated_tokens^length_penalty. values > 0
+  // promote longer sequences, while values < 0 encourage shorter ones.
+  float length_penalty = 1.0;
+
+  // whether to stop as soon as there are num_beams finished hypotheses.
+  // otherwise stop once no running beam can score better than them.
+  bool early_stopping = false;
+};
+
+// Beam search over the beams of a request, which are kept as its sequences.
+// At each step, once all running beams are sampled, beams are extended with
+// the best candidates across all of them. Beams selected more than once are
+// forked, sharing tokens and kv cache blocks with the parent through
+// reference counts, and beams not selected are pruned. Extended beams that
+// finish become hypotheses, and the best ones replace the beams once done.
+class BeamSearch final {
+ public:
+  // called on sequences leaving the running beams to release their blocks
+  using ReleaseFunc = std::function<void(Sequence*)>;
+
+  // num_seqs: the number of best hypotheses to return
+  BeamSearch(const BeamSearchOptions& options, size_t num_seqs);
+
+  // extend beams with the best candidates, beams are updated in place.
+  // returns false if not all beams are sampled yet.
+  bool step(std::deque<Sequence>& beams, const ReleaseFunc& release);
+
+  // whether the search is done, beams hold the best hypotheses then
+  bool is_done() const { return done_; }
+
+  // get the score of a hypothesis with length penalty
+  float score(const Sequence& sequence) const;
+
+  const BeamSearchOptions& options() const { return options_; }
+
+ private:
+  // keep the hypothesis if it is among the best num_beams ones
+  void add_hypothesis(Sequence&& sequence);
+
+  // whether no running beam can score better than finished hypotheses
+  bool is_search_done(const std::deque<Sequence>& beams) const;
+
+  // replace beams with the best hypotheses
+  void finalize(std::deque<Sequence>& beams, const ReleaseFunc& release);
+
+  BeamSearchOptions options_;
+
+  // the number of hypotheses to return
+  size_t num_seqs_ = 1;
+
+  // finished hypotheses with their scores, sorted by score in descending
+  // order, at most num_beams.
+  std::vector<std::pair<float, Sequence>> hypotheses_;
+
+  bool done_ = false;
+};
+
+}  // namespace llm
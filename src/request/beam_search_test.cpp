@@ -0,0 +1,172 @@
+#include "beam_search.h"
+
+#include <absl/time/clock.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <deque>
+#include <vector>
+
+#include "memory/block.h"
+#include "sequence.h"
+
+namespace llm {
+namespace {
+Sequence create_beam(const std::vector<int32_t>& prompt_token_ids,
+                     size_t max_tokens) {
+  Sequence::Options options;
+  options.beam_search = true;
+  options.stopping_criteria.max_tokens = max_tokens;
+  options.stopping_criteria.eos_token_id = 0;
+  options.stopping_criteria.stop_token_ids = {5};
+  Sequence sequence("",
+                    prompt_token_ids,
+                    absl::Now(),
+                    /*capacity=*/prompt_token_ids.size() + max_tokens + 1,
+                    options);
+  sequence.append_block(Block(/*id=*/1, /*size=*/16));
+  // process the prompt
+  sequence.commit_kv_cache(prompt_token_ids.size());
+  return sequence;
+}
+
+// process the last token of each beam and set its candidates
+void sample(std::deque<Sequence>& beams,
+            const std::vector<std::vector<BeamCandidate>>& candidates) {
+  ASSERT_EQ(beams.size(), candidates.size());
+  for (size_t i = 0; i < beams.size(); ++i) {
+    beams[i].commit_kv_cache(beams[i].num_tokens_to_process());
+    beams[i].set_beam_candidates(candidates[i]);
+  }
+}
+
+std::vector<int32_t> tokens(const Sequence& sequence) {
+  return sequence.token_ids();
+}
+}  // namespace
+
+TEST(BeamSearchTest, Step) {
+  BeamSearchOptions options;
+  options.num_beams = 2;
+  BeamSearch beam_search(options, /*num_seqs=*/2);
+
+  std::deque<Sequence> beams;
+  beams.push_back(create_beam({1, 2, 3}, /*max_tokens=*/3));
+  size_t num_released = 0;
+  const auto release = [&](Sequence* /*sequence*/) { ++num_released; };
+
+  // not sampled yet
+  EXPECT_FALSE(beam_search.step(beams, release));
+
+  // the only beam forks into two beams
+  sample(beams,
+         {{{10, std::log(0.5f)},
+           {11, std::log(0.3f)},
+           {0, std::log(0.1f)},
+           {12, std::log(0.1f)}}});
+  EXPECT_TRUE(beam_search.step(beams, release));
+  ASSERT_EQ(beams.size(), 2);
+  EXPECT_EQ(tokens(beams[0]), std::vector<int32_t>({1, 2, 3, 10}));
+  EXPECT_EQ(tokens(beams[1]), std::vector<int32_t>({1, 2, 3, 11}));
+  EXPECT_NE(beams[0].id(), beams[1].id());
+  EXPECT_NEAR(beams[0].cum_logprob(), std::log(0.5f), 1e-6);
+  // beams share cache blocks
+  ASSERT_EQ(beams[0].num_blocks(), 1);
+  EXPECT_EQ(beams[0].blocks()[0], beams[1].blocks()[0]);
+  EXPECT_EQ(beams[0].blocks()[0].ref_count(), 2);
+  EXPECT_EQ(num_released, 0);
+  EXPECT_FALSE(beam_search.is_done());
+
+  // the best candidate finishes, the best two unfinished ones keep running
+  sample(beams,
+         {{{0, std::log(0.9f)}, {13, std::log(0.05f)}},
+          {{14, std::log(0.9f)}, {15, std::log(0.05f)}}});
+  EXPECT_TRUE(beam_search.step(beams, release));
+  ASSERT_EQ(beams.size(), 2);
+  EXPECT_EQ(tokens(beams[0]), std::vector<int32_t>({1, 2, 3, 11, 14}));
+  EXPECT_EQ(tokens(beams[1]), std::vector<int32_t>({1, 2, 3, 10, 13}));
+  // the finished hypothesis is released
+  EXPECT_EQ(num_released, 1);
+  EXPECT_FALSE(beam_search.is_done());
+
+  // all beams reach max tokens
+  sample(beams,
+         {{{16, std::log(0.5f)}, {17, std::log(0.5f)}},
+          {{18, std::log(0.9f)}, {19, std::log(0.1f)}}});
+  EXPECT_TRUE(beam_search.step(beams, release));
+  EXPECT_TRUE(beam_search.is_done());
+
+  // the best hypotheses sorted by score
+  ASSERT_EQ(beams.size(), 2);
+  EXPECT_EQ(tokens(beams[0]), std::vector<int32_t>({1, 2, 3, 10, 0}));
+  EXPECT_EQ(tokens(beams[1]), std::vector<int32_t>({1, 2, 3, 11, 14, 16}));
+  EXPECT_TRUE(beams[0].is_finished());
+  EXPECT_EQ(beams[0].finish_reason(), FinishReason::STOP);
+  EXPECT_TRUE(beams[1].is_finished());
+  EXPECT_EQ(beams[1].finish_reason(), FinishReason::LENGTH);
+  EXPECT_NEAR(beam_search.score(beams[0]), std::log(0.45f) / 2, 1e-5);
+  EXPECT_NEAR(beam_search.score(beams[1]), std::log(0.135f) / 3, 1e-5);
+  EXPECT_FALSE(beam_search.step(beams, release));
+}
+
+TEST(BeamSearchTest, EarlyStopping) {
+  for (bool early_stopping : {true, false}) {
+    BeamSearchOptions options;
+    options.num_beams = 2;
+    options.early_stopping = early_stopping;
+    BeamSearch beam_search(options, /*num_seqs=*/1);
+
+    std::deque<Sequence> beams;
+    beams.push_back(create_beam({1, 2, 3}, /*max_tokens=*/10));
+    size_t num_released = 0;
+    const auto release = [&](Sequence* /*sequence*/) { ++num_released; };
+
+    // eos and the stop token are the best two candidates
+    sample(beams,
+           {{{0, std::log(0.4f)},
+             {5, std::log(0.3f)},
+             {10, std::log(0.2f)},
+             {11, std::log(0.1f)}}});
+    EXPECT_TRUE(beam_search.step(beams, release));
+    EXPECT_TRUE(beam_search.is_done());
+    ASSERT_EQ(beams.size(), 1);
+    EXPECT_EQ(tokens(beams[0]), std::vector<int32_t>({1, 2, 3, 0}));
+    // two hypotheses and two running beams
+    EXPECT_EQ(num_released, 4);
+  }
+}
+
+TEST(BeamSearchTest, LengthPenalty) {
+  for (float length_penalty : {1.0f, 0.0f}) {
+    BeamSearchOptions options;
+    options.num_beams = 2;
+    options.length_penalty = length_penalty;
+    BeamSearch beam_search(options, /*num_seqs=*/1);
+
+    std::deque<Sequence> beams;
+    beams.push_back(create_beam({1, 2, 3}, /*max_tokens=*/2));
+    const auto release = [](Sequence* /*sequence*/) {};
+
+    // a short hypothesis, two beams keep running
+    sample(beams,
+           {{{0, std::log(0.4f)},
+             {10, std::log(0.35f)},
+             {11, std::log(0.25f)}}});
+    EXPECT_TRUE(beam_search.step(beams, release));
+    ASSERT_EQ(beams.size(), 2);
+    EXPECT_FALSE(beam_search.is_done());
+
+    // both beams reach max tokens
+    sample(beams, {{{12, std::log(0.9f)}}, {{13, std::log(0.9f)}}});
+    EXPECT_TRUE(beam_search.step(beams, release));
+    EXPECT_TRUE(beam_search.is_done());
+    ASSERT_EQ(beams.size(), 1);
+    // log(0.315) / 2 > log(0.4) while log(0.315) < log(0.4)
+    const auto expected = length_penalty > 0
+                              ? std::vector<int32_t>({1, 2, 3, 10, 12})
+                              : std::vector<int32_t>({1, 2, 3, 0});
+    EXPECT_EQ(tokens(beams[0]), expected);
+  }
+}
+
+}  // namespace llm
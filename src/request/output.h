@@ -2,6 +2,7 @@
 
 #include <glog/logging.h>
 
+#include <cstdint>
 #include <optional>
 #include <string>
 #include <vector>
@@ -35,6 +36,33 @@ struct Usage {
   size_t num_total_tokens = 0;
 };
 
+// the logprob of a token
+struct LogProbData {
+  // the text of the token
+  std::string token;
+
+  // the id of the token
+  int32_t token_id = 0;
+
+  // the log probability of the token
+  float logprob = 0.0;
+};
+
+// the logprob of a token at a position and the most likely alternatives
+struct LogProb {
+  // the text of the token
+  std::string token;
+
+  // the id of the token
+  int32_t token_id = 0;
+
+  // the log probability of the token
+  float logprob = 0.0;
+
+  // the most likely tokens at the position, in descending order of logprob
+  std::vector<LogProbData> top_logprobs;
+};
+
 struct SequenceOutput {
   // the index of the sequence in the request.
   size_t index;
@@ -45,6 +73,12 @@ struct SequenceOutput {
 
   // the reason the sequence finished.
   std::optional<std::string> finish_reason;
+
+  // the embedding of the prompt for embedding requests.
+  std::vector<float> embedding;
+
+  // logprobs of the generated/delta tokens if requested.
+  std::optional<std::vector<LogProb>> logprobs;
 };
 
 struct RequestOutput {
@@ -61,6 +95,10 @@ struct RequestOutput {
   // the output for each sequence in the request.
   std::vector<SequenceOutput> outputs;
 
+  // logprobs of prompt tokens except the first one if requested, sent once
+  // all prompt tokens are processed.
+  std::optional<std::vector<LogProb>> prompt_logprobs;
+
   // the statistics for the request.
   std::optional<Usage> usage;
 
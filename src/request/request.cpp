@@ -25,6 +25,13 @@ Request::Request(std::string prompt,
 void Request::add_sequence() {
   Sequence::Options options;
   options.echo = this->echo;
+  options.pooling = this->pooling;
+  options.normalize_embedding = this->normalize_embedding;
+  options.beam_search = is_beam_search();
+  options.logprobs = this->logprobs;
+  options.top_logprobs = this->top_logprobs;
+  // other sequences can share the kv cache of the prompt
+  options.prompt_logprobs = this->prompt_logprobs && sequences.empty();
   options.sampling_param = this->sampling_param;
   options.stopping_criteria = this->stopping_criteria;
 
@@ -36,6 +43,10 @@ void Request::add_sequence() {
 }
 
 bool Request::is_finished() const {
+  if (is_beam_search()) {
+    return beam_search->is_done();
+  }
+
   // still need to generate more sequences
   if (sequences.size() < num_seqs) {
     return false;
@@ -47,6 +58,10 @@ bool Request::is_finished() const {
 }
 
 bool Request::should_expand_sequences() const {
+  // beams are forked by beam search
+  if (is_beam_search()) {
+    return false;
+  }
   if (sequences.size() < num_seqs) {
     CHECK(!sequences.empty());
     const auto& first_sequence = sequences.front();
@@ -58,6 +73,9 @@ bool Request::should_expand_sequences() const {
 }
 
 void Request::expand_sequences() {
+  if (is_beam_search()) {
+    return;
+  }
   while (sequences.size() < num_seqs) {
     add_sequence();
   }
@@ -5,9 +5,13 @@
 
 #include <cstdint>
 #include <deque>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
+#include "beam_search.h"
+#include "common/tracing.h"
 #include "output.h"
 #include "sampling/parameters.h"
 #include "sequence.h"
@@ -44,6 +48,8 @@ struct Request final {
 
   void expand_sequences();
 
+  bool is_beam_search() const { return beam_search != nullptr; }
+
   void cancel() { is_cancelled_.store(true, std::memory_order_relaxed); }
 
   bool is_cancelled() const {
@@ -87,6 +93,26 @@ struct Request final {
   // Whether to echo back the prompt in the output.
   bool echo = false;
 
+  // pool hidden states of the prompt into an embedding if set.
+  std::optional<PoolingType> pooling;
+
+  // whether to normalize the embedding to unit length.
+  bool normalize_embedding = true;
+
+  // whether to return logprobs of generated tokens.
+  bool logprobs = false;
+
+  // the number of most likely alternatives to return with each logprob.
+  size_t top_logprobs = 0;
+
+  // whether to return logprobs of prompt tokens, which are computed by the
+  // first sequence only.
+  bool prompt_logprobs = false;
+
+  // beam search over sequences of the request if set, which starts from one
+  // sequence and returns the best num_seqs hypotheses.
+  std::unique_ptr<BeamSearch> beam_search;
+
   // the priority of the request.
   Priority priority = Priority::NORMAL;
 
@@ -97,6 +123,25 @@ struct Request final {
   // function to call when an output is generated.
   OnOutput on_output;
 
+  // function to call with the request once it finishes, before the final
+  // output is sent.
+  std::function<void(const Request& request)> on_finish;
+
+  // the trace of the request, nullptr if the request is not sampled.
+  std::shared_ptr<RequestTrace> trace;
+
+  // the time when the request started waiting to be scheduled, only tracked
+  // for traced requests.
+  std::optional<absl::Time> waiting_since;
+
+  // prompt tokens counted as waiting by the admission control, cleared once
+  // the request is scheduled for the first time.
+  size_t num_waiting_prompt_tokens = 0;
+
+  // the error to finish the request with instead of its outputs, e.g. the
+  // engine can never run it.
+  std::optional<Status> error;
+
  private:
   // is the sequence cancelled
   std::atomic_bool is_cancelled_{false};
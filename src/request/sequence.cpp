@@ -3,7 +3,9 @@
 #include <absl/strings/match.h>
 #include <absl/time/time.h>
 
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -39,6 +41,14 @@ Sequence::Sequence(const std::string_view& prompt,
     token_ids_[num_tokens_++] = token_id;
     token_to_count_map_[token_id]++;
   }
+
+  if (options_.logprobs) {
+    logprobs_.reserve(capacity - num_prompt_tokens_);
+    top_logprobs_.reserve(capacity - num_prompt_tokens_);
+  }
+  if (options_.prompt_logprobs) {
+    prompt_logprobs_.reserve(num_prompt_tokens_ - 1);
+  }
 }
 
 void Sequence::append_token(int32_t token_id) {
@@ -125,6 +135,101 @@ std::string Sequence::decode_delta_text(const Slice<int32_t>& token_ids,
   return decoder_.decode(token_ids, tokenizer);
 }
 
+void Sequence::append_logprob(float logprob,
+                              std::vector<TokenLogprob> top_logprobs) {
+  CHECK(options_.logprobs) << "logprobs are not requested";
+  CHECK_EQ(logprobs_.size() + 1, num_generated_tokens())
+      << "logprob mismatch with generated tokens";
+  logprobs_.push_back(logprob);
+  top_logprobs_.push_back(std::move(top_logprobs));
+}
+
+void Sequence::append_prompt_logprobs(size_t start_idx,
+                                      const Slice<float>& logprobs) {
+  CHECK_GT(start_idx, 0) << "no logprob for the first prompt token";
+  CHECK_LE(start_idx + logprobs.size(), num_prompt_tokens_);
+  for (size_t i = 0; i < logprobs.size(); ++i) {
+    // prompt_logprobs_[k] is the logprob of the (k + 1)-th prompt token
+    if (start_idx + i == prompt_logprobs_.size() + 1) {
+      prompt_logprobs_.push_back(logprobs[i]);
+    }
+  }
+}
+
+std::vector<LogProb> Sequence::decode_delta_logprobs(
+    const Slice<int32_t>& token_ids,
+    const Tokenizer& tokenizer) {
+  std::vector<LogProb> logprobs;
+  const size_t end = std::min(token_ids.size() - num_prompt_tokens_,
+                              logprobs_.size());
+  for (size_t i = logprobs_output_offset_; i < end; ++i) {
+    const int32_t token_id = token_ids[num_prompt_tokens_ + i];
+    auto& logprob = logprobs.emplace_back();
+    logprob.token = tokenizer.decode({&token_id, 1},
+                                     /*skip_special_tokens=*/false);
+    logprob.token_id = token_id;
+    logprob.logprob = logprobs_[i];
+    for (const auto& top : top_logprobs_[i]) {
+      logprob.top_logprobs.push_back(
+          {tokenizer.decode({&top.token_id, 1},
+                            /*skip_special_tokens=*/false),
+           top.token_id,
+           top.logprob});
+    }
+  }
+  logprobs_output_offset_ = std::max(logprobs_output_offset_, end);
+  return logprobs;
+}
+
+std::optional<std::vector<LogProb>> Sequence::decode_prompt_logprobs(
+    const Tokenizer& tokenizer) {
+  if (prompt_logprobs_decoded_ || !has_prompt_logprobs()) {
+    return std::nullopt;
+  }
+  prompt_logprobs_decoded_ = true;
+  std::vector<LogProb> logprobs;
+  logprobs.reserve(prompt_logprobs_.size());
+  for (size_t i = 0; i < prompt_logprobs_.size(); ++i) {
+    const int32_t token_id = token_ids_[i + 1];
+    auto& logprob = logprobs.emplace_back();
+    logprob.token = tokenizer.decode({&token_id, 1},
+                                     /*skip_special_tokens=*/false);
+    logprob.token_id = token_id;
+    logprob.logprob = prompt_logprobs_[i];
+  }
+  return logprobs;
+}
+
+void Sequence::append_beam_token(int32_t token_id, float logprob) {
+  CHECK(is_beam()) << "not a beam";
+  append_token(token_id);
+  cum_logprob_ += logprob;
+  if (options_.logprobs) {
+    // alternatives are the best candidates sampled for the beam
+    const size_t n = std::min(options_.top_logprobs, beam_candidates_.size());
+    append_logprob(logprob,
+                   {beam_candidates_.begin(), beam_candidates_.begin() + n});
+  }
+  beam_candidates_.clear();
+}
+
+FinishReason Sequence::check_finished_with(int32_t token_id) {
+  CHECK(num_tokens_ < token_ids_.size())
+      << "exceed the token capacity of the sequence";
+  // put the token right after the end without appending it
+  token_ids_[num_tokens_] = token_id;
+  const Slice<int32_t> token_ids(token_ids_, num_tokens_ + 1);
+  return options_.stopping_criteria.check_finished(token_ids,
+                                                   num_prompt_tokens_);
+}
+
+Sequence Sequence::fork() const {
+  DCHECK_LT(block_copy_src_, 0) << "fork with a pending block copy";
+  Sequence sequence(*this);
+  sequence.id_ = next_id_.fetch_add(1);
+  return sequence;
+}
+
 void Sequence::append_blocks(const std::vector<Block>& new_blocks) {
   blocks_.insert(blocks_.end(), new_blocks.begin(), new_blocks.end());
 }
@@ -158,11 +263,36 @@ void Sequence::set_shared_blocks(std::vector<Block>&& shared_blocks) {
             num_shared_tokens);
 }
 
+void Sequence::copy_on_write(size_t block_idx, Block new_block) {
+  CHECK_LT(block_idx, blocks_.size());
+  CHECK_LT(block_copy_src_, 0) << "a block copy is pending";
+  block_copy_src_ = blocks_[block_idx].id();
+  block_copy_dst_ = new_block.id();
+  blocks_[block_idx] = std::move(new_block);
+}
+
+std::optional<std::pair<int32_t, int32_t>> Sequence::take_block_copy() {
+  if (block_copy_src_ < 0) {
+    return std::nullopt;
+  }
+  const std::pair<int32_t, int32_t> copy = {block_copy_src_, block_copy_dst_};
+  block_copy_src_ = -1;
+  block_copy_dst_ = -1;
+  return copy;
+}
+
 // release all cache blocks
 void Sequence::release_blocks() {
   // reset the kv cache position to 0
   std::fill(num_kv_cache_tokens_.begin(), num_kv_cache_tokens_.end(), 0);
   blocks_.clear();
+  // the kv cache is recomputed, drop the pending copy
+  block_copy_src_ = -1;
+  block_copy_dst_ = -1;
+  // the prompt is processed again after preemption, pool from scratch
+  if (!is_finished_) {
+    embedding_.clear();
+  }
 }
 
 size_t Sequence::kv_cache_capacity() const {
@@ -190,7 +320,56 @@ std::vector<int32_t> Sequence::kv_cache_slots(int32_t pos_start,
   return slots;
 }
 
+void Sequence::append_embedding(const Slice<float>& pooled) {
+  CHECK(is_embedding()) << "not an embedding sequence";
+  CHECK(!is_finished_) << "cannot append embedding to a finished sequence";
+  if (embedding_.empty()) {
+    embedding_.resize(pooled.size(), 0.0f);
+  }
+  CHECK_EQ(embedding_.size(), pooled.size()) << "embedding size mismatch";
+  for (size_t i = 0; i < pooled.size(); ++i) {
+    embedding_[i] += pooled[i];
+  }
+
+  if (!is_prefill_stage()) {
+    // all prompt tokens are pooled
+    is_finished_ = true;
+    finish_reason_ = FinishReason::STOP;
+  }
+}
+
+std::vector<float> Sequence::embedding() const {
+  if (!is_embedding() || !is_finished_) {
+    return {};
+  }
+  std::vector<float> embedding = embedding_;
+  if (options_.pooling == PoolingType::MEAN) {
+    const float scale = 1.0f / static_cast<float>(num_prompt_tokens_);
+    for (auto& value : embedding) {
+      value *= scale;
+    }
+  }
+  if (options_.normalize_embedding) {
+    double sum_of_squares = 0;
+    for (const auto value : embedding) {
+      sum_of_squares += static_cast<double>(value) * value;
+    }
+    // avoid dividing by zero for an all zero embedding
+    const float norm = static_cast<float>(
+        std::max(std::sqrt(sum_of_squares), static_cast<double>(1e-12)));
+    for (auto& value : embedding) {
+      value /= norm;
+    }
+  }
+  return embedding;
+}
+
 bool Sequence::is_finished() const {
+  // embedding sequences finish once the prompt is pooled
+  if (is_embedding()) {
+    return is_finished_;
+  }
+
   // return the cached finish status
   if (!finish_status_invalidated_) {
     return is_finished_;
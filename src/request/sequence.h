@@ -5,7 +5,9 @@
 #include <atomic>
 #include <cstdint>
 #include <functional>
+#include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "common/slice.h"
@@ -31,6 +33,25 @@ enum class EngineType : int8_t {
   COUNT = 2,
 };
 
+// How hidden states of prompt tokens are pooled into an embedding.
+enum class PoolingType : int8_t {
+  // the hidden state of the last token
+  LAST = 0,
+  // the mean of hidden states of all tokens
+  MEAN = 1,
+  // the hidden state of the first token
+  CLS = 2,
+};
+
+// A token and its logprob.
+struct TokenLogprob {
+  int32_t token_id = 0;
+  float logprob = 0.0;
+};
+
+// A candidate token to extend a beam with, and its logprob.
+using BeamCandidate = TokenLogprob;
+
 // The sequence encapsulates all the necessary
 // information for a sequence, including the prompt, the token ids, and the
 // current position in generating tokens, etc.
@@ -48,6 +69,28 @@ class Sequence final {
 
     // whether to echo the prompt tokens back
     bool echo = false;
+
+    // pool hidden states of the prompt into an embedding instead of
+    // generating tokens if set.
+    std::optional<PoolingType> pooling;
+
+    // whether to normalize the embedding to unit length
+    bool normalize_embedding = true;
+
+    // whether the sequence is a beam of beam search, which is extended with
+    // candidates selected across all beams of the request instead of its
+    // sampled tokens.
+    bool beam_search = false;
+
+    // whether to keep logprobs of generated tokens
+    bool logprobs = false;
+
+    // the number of most likely alternatives to keep with the logprob of
+    // each generated token
+    size_t top_logprobs = 0;
+
+    // whether to compute logprobs of prompt tokens during prefill
+    bool prompt_logprobs = false;
   };
 
   Sequence(const std::string_view& prompt,
@@ -127,6 +170,92 @@ class Sequence final {
   // the token would be discarded if the sequence is still in prefill stage
   void append_token(int32_t token_id);
 
+  // whether the sequence is for embedding, which finishes after prefill
+  bool is_embedding() const { return options_.pooling.has_value(); }
+
+  // get the pooling type of the embedding sequence
+  PoolingType pooling_type() const {
+    CHECK(is_embedding()) << "not an embedding sequence";
+    return options_.pooling.value();
+  }
+
+  // whether the sequence can start from kv cache shared by other sequences.
+  // hidden states of cached tokens are not kept, so only pooling the last
+  // token can skip them, and logprobs of prompt tokens need all of them.
+  bool can_share_prefix() const {
+    if (options_.prompt_logprobs) {
+      return false;
+    }
+    return !is_embedding() || options_.pooling == PoolingType::LAST;
+  }
+
+  // accumulate the hidden states pooled in one step, the sequence finishes
+  // once all prompt tokens are processed.
+  void append_embedding(const Slice<float>& pooled);
+
+  // get the final embedding, empty if not finished
+  std::vector<float> embedding() const;
+
+  // whether to keep logprobs of generated tokens
+  bool need_logprobs() const { return options_.logprobs; }
+
+  // the number of alternatives to keep with the logprob of each token
+  size_t num_top_logprobs() const { return options_.top_logprobs; }
+
+  // whether to compute logprobs of prompt tokens
+  bool need_prompt_logprobs() const { return options_.prompt_logprobs; }
+
+  // set the logprob of the last generated token and the most likely
+  // alternatives at its position
+  void append_logprob(float logprob, std::vector<TokenLogprob> top_logprobs);
+
+  // set logprobs of prompt tokens from the token at start_idx, the logprob of
+  // the first prompt token is not defined. logprobs already set are skipped,
+  // e.g. when the prompt is processed again after preemption.
+  void append_prompt_logprobs(size_t start_idx, const Slice<float>& logprobs);
+
+  // whether logprobs of all prompt tokens are computed
+  bool has_prompt_logprobs() const {
+    return options_.prompt_logprobs &&
+           prompt_logprobs_.size() + 1 == num_prompt_tokens_;
+  }
+
+  // decode logprobs of generated tokens since the last call till the end of
+  // token_ids. not thread safe
+  std::vector<LogProb> decode_delta_logprobs(const Slice<int32_t>& token_ids,
+                                             const Tokenizer& tokenizer);
+
+  // decode logprobs of prompt tokens except the first one, only once after
+  // all of them are computed. not thread safe
+  std::optional<std::vector<LogProb>> decode_prompt_logprobs(
+      const Tokenizer& tokenizer);
+
+  // whether the sequence is a beam of beam search
+  bool is_beam() const { return options_.beam_search; }
+
+  // set candidates to extend the beam with, sorted by logprob
+  void set_beam_candidates(std::vector<BeamCandidate> candidates) {
+    beam_candidates_ = std::move(candidates);
+  }
+
+  // get candidates sampled for the beam, empty if not sampled yet
+  const std::vector<BeamCandidate>& beam_candidates() const {
+    return beam_candidates_;
+  }
+
+  // append the token selected by beam search and accumulate its logprob
+  void append_beam_token(int32_t token_id, float logprob);
+
+  // get the sum of logprobs of tokens selected by beam search
+  float cum_logprob() const { return cum_logprob_; }
+
+  // check whether the sequence would finish if the token were appended
+  FinishReason check_finished_with(int32_t token_id);
+
+  // create a new sequence with its own id that shares tokens and cache blocks
+  // with this one, used to fork beams.
+  Sequence fork() const;
+
   // validate draft tokens with accepted tokens for speculative decoding
   // N.B. take int64_t as input to be compatible with torch::Tensor
   // returns the number of accepted tokens, including the resampled token
@@ -141,9 +270,20 @@ class Sequence final {
   // set shared cache blocks from prefix cache
   void set_shared_blocks(std::vector<Block>&& shared_blocks);
 
+  // replace the shared block at the index with a new block to write into, the
+  // kv cache of the shared block is copied into the new one first.
+  void copy_on_write(size_t block_idx, Block new_block);
+
+  // take the pending copy of kv cache as (src, dst) block ids, if any
+  std::optional<std::pair<int32_t, int32_t>> take_block_copy();
+
   // release all cache blocks
   void release_blocks();
 
+  // swap cache blocks with the given ones while keeping the kv cache position,
+  // used to run the sequence on another engine with its own kv cache.
+  void swap_blocks(std::vector<Block>& blocks) { blocks_.swap(blocks); }
+
   // returns allocated cache blocks
   Slice<Block> blocks() const { return blocks_; }
 
@@ -200,7 +340,7 @@ class Sequence final {
 
  private:
   // global unique id for the sequence
-  const int64_t id_;
+  int64_t id_;
 
   // last token generation time
   absl::Time last_token_time_;
@@ -226,6 +366,30 @@ class Sequence final {
   // the count of each token id
   std::unordered_map<int32_t, int32_t> token_to_count_map_;
 
+  // sum of pooled hidden states for embedding sequences
+  std::vector<float> embedding_;
+
+  // candidates to extend the beam with
+  std::vector<BeamCandidate> beam_candidates_;
+
+  // sum of logprobs of tokens selected by beam search
+  float cum_logprob_ = 0.0;
+
+  // logprobs of generated tokens and the most likely alternatives at their
+  // positions. space is reserved upfront so that outputs can be decoded
+  // while tokens are appended.
+  std::vector<float> logprobs_;
+  std::vector<std::vector<TokenLogprob>> top_logprobs_;
+
+  // the number of generated tokens whose logprobs are decoded
+  size_t logprobs_output_offset_ = 0;
+
+  // logprobs of prompt tokens except the first one
+  std::vector<float> prompt_logprobs_;
+
+  // whether logprobs of prompt tokens are decoded
+  bool prompt_logprobs_decoded_ = false;
+
   // the length of the prompt tokens
   size_t num_prompt_tokens_ = 0;
 
@@ -237,6 +401,13 @@ class Sequence final {
   // physical blocks that hold the kv cache.
   std::vector<Block> blocks_;
 
+  // ids of the shared block to copy kv cache from and the block replacing it,
+  // pending until the next forward. no reference is kept to the shared block,
+  // so other beams holding it can write into it without copying. the copy
+  // runs before the forward, prior to any write into the shared block.
+  int32_t block_copy_src_ = -1;
+  int32_t block_copy_dst_ = -1;
+
   // is the sequence finished
   mutable bool is_finished_ = false;
 
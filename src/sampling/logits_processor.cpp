@@ -22,6 +22,13 @@ std::unique_ptr<LogitsProcessor> LogitsProcessor::create(
         params.repetition_penalties));
   }
 
+  if (params.logit_bias_token_ids.defined()) {
+    processors.push_back(std::make_unique<LogitBiasLogitsProcessor>(
+        params.logit_bias_offsets,
+        params.logit_bias_token_ids,
+        params.logit_bias_values));
+  }
+
   if (params.temperatures.defined()) {
     processors.push_back(
         std::make_unique<TemperatureLogitsProcessor>(params.temperatures));
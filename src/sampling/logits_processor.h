@@ -35,6 +35,15 @@ inline void apply_repetition_penalty(torch::Tensor& logits,
   logits.scatter_(/*dim=*/1, /*index=*/unique_token_ids, /*src=*/score);
 }
 
+inline void apply_logit_bias(torch::Tensor& logits,
+                             const torch::Tensor& rows,
+                             const torch::Tensor& token_ids,
+                             const torch::Tensor& biases) {
+  // logits: [num_seqs, vocab_size]
+  // rows, token_ids and biases: [num_biases]
+  logits.index_put_({rows, token_ids}, biases, /*accumulate=*/true);
+}
+
 inline void apply_frequency_presence_penalty(
     torch::Tensor& logits,
     const torch::Tensor& unique_token_ids,
@@ -57,7 +66,8 @@ inline void apply_frequency_presence_penalty(
 // supported logits processors:
 // 1. frequency and presence penalty
 // 2. repetition penalty
-// 3. temperature
+// 3. logit bias
+// 4. temperature
 
 // inspired by transformers LogistProcessor:
 // https://github.com/huggingface/transformers/blob/main/src/transformers/generation/logits_process.py#L44
@@ -187,6 +197,43 @@ class RepetitionPenaltyLogitsProcessor : public LogitsProcessor {
   torch::Tensor penalties_;
 };
 
+// adds sparse biases to logits of each sequence with one scatter-add, banned
+// tokens have -inf biases. biases are given in CSR format, biases of the i-th
+// sequence are in [offsets[i], offsets[i + 1]) of token_ids and biases.
+class LogitBiasLogitsProcessor : public LogitsProcessor {
+ public:
+  LogitBiasLogitsProcessor(const torch::Tensor& offsets,
+                           const torch::Tensor& token_ids,
+                           const torch::Tensor& biases)
+      : token_ids_(token_ids), biases_(biases) {
+    CHECK(offsets.defined() && token_ids.defined() && biases.defined());
+    CHECK_EQ(token_ids.numel(), biases.numel());
+    num_seqs_ = offsets.numel() - 1;
+    // the row of each bias, output size is given to avoid a device sync
+    rows_ = torch::repeat_interleave(offsets.diff(),
+                                     /*output_size=*/token_ids.numel());
+  }
+
+  torch::Tensor forward(
+      const torch::Tensor& logits,
+      const torch::Tensor& /*unique_token_ids*/,
+      const torch::Tensor& /*unique_token_counts*/,
+      const torch::Tensor& /*unique_token_lens*/) const override {
+    CHECK_EQ(logits.size(0), num_seqs_);
+    torch::Tensor logits_ = logits;
+    detail::apply_logit_bias(
+        logits_, rows_, token_ids_, biases_.to(logits_.dtype()));
+    return logits_;
+  }
+
+ private:
+  int64_t num_seqs_ = 0;
+  // [num_biases]
+  torch::Tensor rows_;
+  torch::Tensor token_ids_;
+  torch::Tensor biases_;
+};
+
 class TemperatureLogitsProcessor : public LogitsProcessor {
  public:
   // Constructor
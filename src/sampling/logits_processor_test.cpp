@@ -8,6 +8,8 @@
 #include <torch/torch.h>
 #include <torch/types.h>
 
+#include <limits>
+
 namespace llm {
 torch::Tensor unique_randint(int64_t low,
                              int64_t high,
@@ -243,6 +245,34 @@ TEST(LogitsProcessorTest, RepetitionPenaltyKernel) {
                               /*atol=*/1e-03));
 }
 
+TEST(LogitsProcessorTest, LogitBias) {
+  // Test LogitBiasLogitsProcessor
+  torch::ScalarType dtype(torch::kFloat32);
+  torch::Device device(torch::kCPU);
+  auto options = torch::dtype(dtype).device(device);
+  const float kInf = std::numeric_limits<float>::infinity();
+  // no biases for the second sequence
+  const auto offsets = torch::tensor({0, 2, 2, 3}, torch::kLong);
+  const auto bias_token_ids = torch::tensor({1, 5, 3}, torch::kLong);
+  const auto biases = torch::tensor({2.0f, -kInf, -1.5f}, torch::kFloat);
+  LogitBiasLogitsProcessor processor(offsets, bias_token_ids, biases);
+
+  int64_t batch_size = 3;
+  int64_t vocab_size = 8;
+  const auto logits = torch::randn({batch_size, vocab_size}, options);
+  auto desired_logits = logits.clone();
+  desired_logits[0][1] += 2.0f;
+  desired_logits[0][5] = -kInf;
+  desired_logits[2][3] -= 1.5f;
+
+  torch::Tensor token_ids;
+  torch::Tensor token_counts;
+  torch::Tensor tokens_ids_lens;
+  auto output = logits.clone();
+  output = processor(output, token_ids, token_counts, tokens_ids_lens);
+  EXPECT_TRUE(torch::equal(output, desired_logits));
+}
+
 TEST(LogitsProcessorTest, TopK) {
   // Set the random seed
   torch::manual_seed(100);
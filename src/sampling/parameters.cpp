@@ -31,6 +31,9 @@ void SamplingParameters::init(
   std::vector<float> temperatures;
   std::vector<float> top_p;
   std::vector<int64_t> top_k;
+  std::vector<int64_t> logit_bias_offsets = {0};
+  std::vector<int64_t> logit_bias_token_ids;
+  std::vector<float> logit_bias_values;
   for (const auto* p : sampling_params) {
     frequency_penalties.push_back(p->frequency_penalty);
     presence_penalties.push_back(p->presence_penalty);
@@ -38,6 +41,12 @@ void SamplingParameters::init(
     temperatures.push_back(p->temperature);
     top_p.push_back(p->top_p);
     top_k.push_back(p->top_k);
+    for (const auto& [token_id, bias] : p->logit_bias) {
+      logit_bias_token_ids.push_back(token_id);
+      logit_bias_values.push_back(bias);
+    }
+    logit_bias_offsets.push_back(
+        static_cast<int64_t>(logit_bias_token_ids.size()));
   }
 
   bool need_token_stats = false;
@@ -76,6 +85,13 @@ void SamplingParameters::init(
     this->top_p = torch::tensor(top_p, torch::kFloat32);
   }
 
+  if (!logit_bias_token_ids.empty()) {
+    this->logit_bias_offsets = torch::tensor(logit_bias_offsets, torch::kLong);
+    this->logit_bias_token_ids =
+        torch::tensor(logit_bias_token_ids, torch::kLong);
+    this->logit_bias_values = torch::tensor(logit_bias_values, torch::kFloat);
+  }
+
   this->selected_token_idxes = torch::tensor(selected_token_idxes, torch::kInt);
   if (need_token_stats) {
     this->unique_token_ids =
@@ -94,6 +110,7 @@ void SamplingParameters::init(
     const bool sample = p->do_sample || p->temperature != 0.0 ||
                         p->top_p != 1.0 || p->top_k > 0;
     do_sample.push_back(sample ? 1 : 0);
+    this->num_top_tokens = std::max(this->num_top_tokens, p->num_top_tokens);
   }
   this->sample_idxes = torch::tensor(sample_idxes, torch::kInt);
   this->do_sample = torch::tensor(do_sample, torch::kBool);
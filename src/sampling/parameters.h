@@ -2,6 +2,7 @@
 #include <torch/torch.h>
 
 #include <cstdint>
+#include <utility>
 #include <vector>
 
 #include "common/tensor_helper.h"
@@ -19,11 +20,18 @@ struct SamplingParameter {
   float top_p = 1.0;
   int64_t top_k = -1;
 
+  // sparse biases added to logits of tokens, banned tokens have -inf biases.
+  std::vector<std::pair<int32_t, float>> logit_bias;
+
   // ############### following parameters are used for sampling ###############
   bool do_sample = false;
 
   // not used for now
   uint64_t seed = 0;
+
+  // number of most likely tokens to return with their logprobs for each
+  // sampled token, e.g. candidates to extend beams for beam search.
+  int64_t num_top_tokens = 0;
 };
 
 // SamplingParameters is used to specify sampling parameters for a batch of
@@ -56,8 +64,13 @@ struct SamplingParameters {
     params.unique_token_counts = safe_to(unique_token_counts, device);
     params.unique_token_ids_lens = safe_to(unique_token_ids_lens, device);
 
+    params.logit_bias_offsets = safe_to(logit_bias_offsets, device);
+    params.logit_bias_token_ids = safe_to(logit_bias_token_ids, device);
+    params.logit_bias_values = safe_to(logit_bias_values, options);
+
     params.sample_idxes = safe_to(sample_idxes, device);
     params.do_sample = safe_to(do_sample, device);
+    params.num_top_tokens = num_top_tokens;
 
     return params;
   }
@@ -97,6 +110,17 @@ struct SamplingParameters {
   // [num_tokens] IntTensor
   torch::Tensor unique_token_ids_lens;
 
+  // sparse logit biases in CSR format, biases of the i-th token are in
+  // [offsets[i], offsets[i + 1]) of token ids and values.
+  // [num_tokens + 1] LongTensor
+  torch::Tensor logit_bias_offsets;
+
+  // [num_biases] LongTensor
+  torch::Tensor logit_bias_token_ids;
+
+  // [num_biases] FloatTensor
+  torch::Tensor logit_bias_values;
+
   // ############### following parameters are used for sampling ###############
   // the last index of the selected tokens for sampling.
   // [num_seqs] IntTensor
@@ -105,17 +129,29 @@ struct SamplingParameters {
   // whether to sample for each sequence.
   // [num_seqs] BoolTensor
   torch::Tensor do_sample;
+
+  // the max number of top tokens to return for sequences in the batch
+  int64_t num_top_tokens = 0;
 };
 
 struct SampleOutput {
   // [num_seq] LongTensor
   torch::Tensor next_tokens;
 
-  // [num_seq] FloatTensor
+  // [num_seq, vocab_size] FloatTensor
   torch::Tensor probs;
 
+  // logprobs of next tokens
   // [num_seq] FloatTensor
   torch::Tensor logprobs;
+
+  // the most likely tokens and their logprobs in descending order, only
+  // returned if num_top_tokens > 0
+  // [num_seq, num_top_tokens] LongTensor
+  torch::Tensor top_tokens;
+
+  // [num_seq, num_top_tokens] FloatTensor
+  torch::Tensor top_logprobs;
 };
 
 }  // namespace llm
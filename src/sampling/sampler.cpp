@@ -3,10 +3,13 @@
 #include <glog/logging.h>
 #include <torch/torch.h>
 
+#include <algorithm>
+
 #include "sampling/parameters.h"
 namespace llm {
 
-Sampler::Sampler(const torch::Tensor& do_sample) {
+Sampler::Sampler(const torch::Tensor& do_sample, int64_t num_top_tokens)
+    : num_top_tokens_(num_top_tokens) {
   CHECK(do_sample.defined());
   do_sample_ = do_sample;
   all_random_sample_ = do_sample.all().item<bool>();
@@ -25,7 +28,13 @@ SampleOutput Sampler::forward(const torch::Tensor& logits) const {
 
   SampleOutput output;
   output.probs = probs;
-  output.logprobs = logprobs;
+
+  if (num_top_tokens_ > 0) {
+    const int64_t k = std::min(num_top_tokens_, logprobs.size(-1));
+    auto [top_logprobs, top_tokens] = logprobs.topk(k, /*dim=*/-1);
+    output.top_tokens = top_tokens;
+    output.top_logprobs = top_logprobs;
+  }
 
   if (all_random_sample_) {
     output.next_tokens = random_sample(probs);
@@ -37,6 +46,10 @@ SampleOutput Sampler::forward(const torch::Tensor& logits) const {
     auto greedy = greedy_sample(probs);
     output.next_tokens = torch::where(do_sample_, random, greedy);
   }
+  // only keep logprobs of the sampled tokens
+  output.logprobs =
+      logprobs.gather(/*dim=*/-1, output.next_tokens.unsqueeze(/*dim=*/-1))
+          .squeeze(/*dim=*/-1);
 
   return output;
 }
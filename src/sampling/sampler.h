@@ -9,7 +9,9 @@ namespace llm {
 
 class Sampler final {
  public:
-  Sampler(const torch::Tensor& do_sample);
+  // num_top_tokens: the number of most likely tokens to return with their
+  // logprobs, 0 to disable
+  Sampler(const torch::Tensor& do_sample, int64_t num_top_tokens = 0);
 
   // operator() allows us to use the module as a function.
   template <typename... Args>
@@ -30,6 +32,7 @@ class Sampler final {
  private:
   // [batch_size]
   torch::Tensor do_sample_;
+  int64_t num_top_tokens_ = 0;
   bool all_random_sample_ = true;
   bool all_greedy_sample_ = true;
 };
@@ -52,4 +52,28 @@ TEST(SamplerTest, Random) {
       torch::allclose(target_prob, sample_prob, /*rtol=*/1e-2, /*atol=*/1e-3));
 }
 
+TEST(SamplerTest, TopTokens) {
+  const auto logits = torch::tensor({{1.0f, 4.0f, 2.0f, 3.0f},
+                                     {0.5f, 0.1f, 0.2f, 0.3f}});
+  const auto do_sample = torch::tensor({false, false});
+
+  Sampler sampler(do_sample, /*num_top_tokens=*/2);
+  const auto output = sampler.forward(logits);
+  EXPECT_TRUE(torch::equal(output.top_tokens,
+                           torch::tensor({{1, 3}, {0, 3}}, torch::kLong)));
+  const auto expected = logits.log_softmax(/*dim=*/-1)
+                            .gather(/*dim=*/1, output.top_tokens);
+  EXPECT_TRUE(torch::allclose(output.top_logprobs, expected));
+
+  // logprobs of the sampled tokens
+  const auto expected_logprobs =
+      logits.log_softmax(/*dim=*/-1)
+          .gather(/*dim=*/1, output.next_tokens.unsqueeze(/*dim=*/1))
+          .squeeze(/*dim=*/1);
+  EXPECT_TRUE(torch::allclose(output.logprobs, expected_logprobs));
+
+  // no top tokens by default
+  EXPECT_FALSE(Sampler(do_sample).forward(logits).top_tokens.defined());
+}
+
 }  // namespace llm
@@ -0,0 +1,204 @@
+#include "vocab_parallel_sampler.h"
+
+#include <glog/logging.h>
+#include <torch/torch.h>
+
+#include <algorithm>
+#include <limits>
+#include <tuple>
+#include <vector>
+
+#include "logits_processor.h"
+#include "model_parallel/process_group.h"
+
+namespace llm {
+
+VocabParallelSampler::VocabParallelSampler(const SamplingParameters& params,
+                                           const ParallelArgs& parallel_args)
+    : params_(params), parallel_args_(parallel_args) {
+  CHECK(params_.do_sample.defined());
+  all_greedy_sample_ = !params_.do_sample.any().item<bool>();
+}
+
+bool VocabParallelSampler::is_supported(const SamplingParameters& params) {
+  // top tokens are selected from the full vocab
+  if (params.num_top_tokens > 0) {
+    return false;
+  }
+  if (!params.top_p.defined()) {
+    return true;
+  }
+  if (!params.top_k.defined()) {
+    return false;
+  }
+  // any top p without top k needs the full vocab
+  return !(params.top_p.ne(1.0) & params.top_k.le(0)).any().item<bool>();
+}
+
+SampleOutput VocabParallelSampler::forward(const torch::Tensor& logits) const {
+  CHECK_EQ(logits.size(0), params_.selected_token_idxes.size(0));
+  const auto processed = process_logits(logits);
+  const auto sample_logits =
+      processed.index_select(/*dim=*/0, params_.sample_idxes);
+
+  auto [next_tokens, logprobs] = select(sample_logits.to(torch::kFloat32));
+  SampleOutput output;
+  output.next_tokens = next_tokens;
+  output.logprobs = logprobs;
+  return output;
+}
+
+torch::Tensor VocabParallelSampler::process_logits(
+    const torch::Tensor& logits) const {
+  // top k and top p are applied to candidates of all shards in select()
+  SamplingParameters params = params_;
+  params.top_k = torch::Tensor();
+  params.top_p = torch::Tensor();
+  if (!params.unique_token_ids.defined() &&
+      !params.logit_bias_token_ids.defined()) {
+    auto processor = LogitsProcessor::create(params);
+    return processor->forward(logits,
+                              params.unique_token_ids,
+                              params.unique_token_counts,
+                              params.unique_token_ids_lens);
+  }
+
+  // map token ids into the shard, tokens of other shards go to an extra
+  // column that is dropped afterwards.
+  const int64_t shard_size = logits.size(1);
+  const int64_t start = parallel_args_.rank() * shard_size;
+  const auto to_shard = [&](const torch::Tensor& token_ids) {
+    if (!token_ids.defined()) {
+      return token_ids;
+    }
+    auto ids = token_ids - start;
+    return ids.masked_fill(ids.lt(0).logical_or(ids.ge(shard_size)),
+                           shard_size);
+  };
+  params.logit_bias_token_ids = to_shard(params.logit_bias_token_ids);
+  auto processor = LogitsProcessor::create(params);
+  auto padded = torch::cat(
+      {logits, torch::zeros({logits.size(0), 1}, logits.options())},
+      /*dim=*/1);
+  padded = processor->forward(padded,
+                              to_shard(params.unique_token_ids),
+                              params.unique_token_counts,
+                              params.unique_token_ids_lens);
+  return padded.slice(/*dim=*/1, /*start=*/0, /*end=*/shard_size);
+}
+
+std::tuple<torch::Tensor, torch::Tensor> VocabParallelSampler::select(
+    const torch::Tensor& logits) const {
+  const int64_t n_seqs = logits.size(0);
+  const int64_t shard_size = logits.size(1);
+  const int64_t start = parallel_args_.rank() * shard_size;
+  const int64_t world_size = parallel_args_.world_size();
+  const float filter_value = -std::numeric_limits<float>::infinity();
+
+  torch::Tensor top_k;
+  torch::Tensor top_p;
+  int64_t k = 1;
+  if (params_.top_k.defined()) {
+    top_k = params_.top_k.index_select(/*dim=*/0, params_.sample_idxes);
+    k = std::max<int64_t>(k, top_k.max().item<int64_t>());
+    if (params_.top_p.defined()) {
+      top_p = params_.top_p.index_select(/*dim=*/0, params_.sample_idxes);
+    }
+  }
+  k = std::min(k, shard_size);
+
+  // candidates of this shard, the top k tokens and the winner of the race
+  const auto [values, idxes] = logits.topk(k, /*dim=*/-1);
+  const auto lse = logits.logsumexp(/*dim=*/-1, /*keepdim=*/true);
+  torch::Tensor perturbed = values;
+  torch::Tensor race_idxes = idxes.slice(/*dim=*/1, 0, 1);
+  torch::Tensor race_values = values.slice(/*dim=*/1, 0, 1);
+  if (!all_greedy_sample_) {
+    // each rank draws its own noise for tokens of its shard
+    perturbed = values - torch::empty_like(values).exponential_(1).log();
+    const auto race =
+        logits - torch::empty_like(logits).exponential_(1).log();
+    race_idxes = race.argmax(/*dim=*/-1, /*keepdim=*/true);
+    race_values = race.gather(/*dim=*/1, race_idxes);
+  }
+  const auto race_logits = logits.gather(/*dim=*/1, race_idxes);
+
+  // exchange candidates of all shards: [n_seqs, world_size, ...]
+  // layout: values[k], perturbed[k], lse, race value, race logit
+  const auto all_values = gather(torch::cat(
+      {values, perturbed, lse, race_values, race_logits}, /*dim=*/1));
+  // layout: ids[k], race id
+  const auto all_ids =
+      gather(torch::cat({idxes, race_idxes}, /*dim=*/1) + start);
+
+  const auto flatten = [&](const torch::Tensor& t, int64_t offset) {
+    return t.slice(/*dim=*/2, offset, offset + k)
+        .reshape({n_seqs, world_size * k});
+  };
+  const auto cand_values = flatten(all_values, 0);
+  const auto cand_perturbed = flatten(all_values, k);
+  const auto cand_ids = flatten(all_ids, 0);
+  const auto global_lse = all_values.select(/*dim=*/2, 2 * k)
+                              .logsumexp(/*dim=*/1, /*keepdim=*/true);
+
+  // greedy: the max of all shards
+  const auto [greedy_values, greedy_pos] =
+      cand_values.max(/*dim=*/1, /*keepdim=*/true);
+  auto next_tokens = cand_ids.gather(/*dim=*/1, greedy_pos);
+  auto next_values = greedy_values;
+
+  if (!all_greedy_sample_) {
+    // random sample from the full vocab: the winner of all races
+    const auto race_pos = all_values.select(/*dim=*/2, 2 * k + 1)
+                              .argmax(/*dim=*/1, /*keepdim=*/true);
+    auto sampled = all_ids.select(/*dim=*/2, k).gather(/*dim=*/1, race_pos);
+    auto sampled_values =
+        all_values.select(/*dim=*/2, 2 * k + 2).gather(/*dim=*/1, race_pos);
+
+    if (top_k.defined()) {
+      // random sample from the top k of all candidates
+      const auto [sorted, order] =
+          cand_values.sort(/*dim=*/-1, /*descending=*/true);
+      auto mask = torch::arange(world_size * k, sorted.device())
+                      .expand_as(sorted)
+                      .ge(top_k.unsqueeze(1));
+      if (top_p.defined()) {
+        const auto probs =
+            sorted.masked_fill(mask, filter_value).softmax(/*dim=*/-1);
+        mask = mask.logical_or((probs.cumsum(/*dim=*/-1) - probs) >
+                               top_p.unsqueeze(1));
+      }
+      const auto pos = cand_perturbed.gather(/*dim=*/1, order)
+                           .masked_fill(mask, filter_value)
+                           .argmax(/*dim=*/1, /*keepdim=*/true);
+      const auto top_k_pos = order.gather(/*dim=*/1, pos);
+      const auto use_top_k = top_k.gt(0).unsqueeze(1);
+      sampled = torch::where(
+          use_top_k, cand_ids.gather(/*dim=*/1, top_k_pos), sampled);
+      sampled_values = torch::where(
+          use_top_k, cand_values.gather(/*dim=*/1, top_k_pos), sampled_values);
+    }
+
+    const auto do_sample = params_.do_sample.unsqueeze(1);
+    next_tokens = torch::where(do_sample, sampled, next_tokens);
+    next_values = torch::where(do_sample, sampled_values, next_values);
+  }
+  return {next_tokens.squeeze(/*dim=*/1),
+          (next_values - global_lse).squeeze(/*dim=*/1)};
+}
+
+torch::Tensor VocabParallelSampler::gather(const torch::Tensor& input) const {
+  const int32_t world_size = parallel_args_.world_size();
+  if (world_size == 1) {
+    return input.unsqueeze(/*dim=*/1);
+  }
+  std::vector<torch::Tensor> outputs(world_size);
+  for (int32_t i = 0; i < world_size; ++i) {
+    outputs[i] = torch::empty_like(input);
+  }
+  // blocking call
+  parallel_args_.process_group()->allgather(input.contiguous(), outputs);
+  return torch::stack(outputs, /*dim=*/1);
+}
+
+}  // namespace llm
@@ -0,0 +1,53 @@
+#pragma once
+#include <torch/torch.h>
+
+#include <tuple>
+
+#include "model_parallel/parallel_args.h"
+#include "parameters.h"
+
+namespace llm {
+
+// Samples next tokens from logits sharded along the vocab across ranks,
+// without gathering the full logits. Each rank applies penalties and
+// temperatures to its own shard, then ranks exchange the top k candidates,
+// the log-sum-exp and a sampled candidate of each shard, and all ranks run
+// the same final selection on the reduced set.
+// Random sampling uses the exponential race, i.e. argmax(logits - log(q))
+// with q ~ Exp(1), which can be computed per shard and then reduced.
+class VocabParallelSampler final {
+ public:
+  VocabParallelSampler(const SamplingParameters& params,
+                       const ParallelArgs& parallel_args);
+
+  // whether next tokens can be sampled from the sharded logits. top p is only
+  // supported together with top k, which bounds the candidates. top tokens
+  // are not supported.
+  static bool is_supported(const SamplingParameters& params);
+
+  // logits: [num_tokens, vocab_size / world_size], the shard of this rank
+  // returns next tokens for sample_idxes with their logprobs, probs of the
+  // full vocab are not available.
+  SampleOutput forward(const torch::Tensor& logits) const;
+
+ private:
+  // apply penalties and temperatures to the shard
+  torch::Tensor process_logits(const torch::Tensor& logits) const;
+
+  // select next tokens from the candidates of all shards
+  // logits: [num_seqs, vocab_size / world_size]
+  // returns: next tokens [num_seqs] and their logprobs [num_seqs]
+  std::tuple<torch::Tensor, torch::Tensor> select(
+      const torch::Tensor& logits) const;
+
+  // gather the tensor from all ranks, returns [n, world_size, ...]
+  torch::Tensor gather(const torch::Tensor& input) const;
+
+  SamplingParameters params_;
+
+  ParallelArgs parallel_args_;
+
+  bool all_greedy_sample_ = true;
+};
+
+}  // namespace llm
@@ -0,0 +1,213 @@
+#include "vocab_parallel_sampler.h"
+
+#include <gtest/gtest.h>
+#include <torch/torch.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "logits_processor.h"
+#include "model_parallel/process_group.h"
+
+namespace llm {
+
+namespace {
+// A process group for threads on cpu that exchange tensors through memory.
+class LocalProcessGroup final : public ProcessGroup {
+ public:
+  struct State {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<torch::Tensor> slots;
+    int arrived = 0;
+    int generation = 0;
+  };
+
+  LocalProcessGroup(int rank, int world_size, std::shared_ptr<State> state)
+      : ProcessGroup(rank, world_size, torch::kCPU), state_(std::move(state)) {
+  }
+
+  void allreduce(torch::Tensor& input) override {
+    state_->slots[rank()] = input.clone();
+    barrier();
+    auto sum = torch::zeros_like(input);
+    for (const auto& slot : state_->slots) {
+      sum += slot;
+    }
+    barrier();
+    input.copy_(sum);
+  }
+
+  void allgather(torch::Tensor input,
+                 std::vector<torch::Tensor>& outputs) override {
+    state_->slots[rank()] = input.clone();
+    barrier();
+    for (int i = 0; i < world_size(); ++i) {
+      outputs[i].copy_(state_->slots[i]);
+    }
+    barrier();
+  }
+
+ private:
+  void barrier() {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    const int generation = state_->generation;
+    if (++state_->arrived == world_size()) {
+      state_->arrived = 0;
+      ++state_->generation;
+      state_->cv.notify_all();
+    } else {
+      state_->cv.wait(lock,
+                      [&] { return state_->generation != generation; });
+    }
+  }
+
+  std::shared_ptr<State> state_;
+};
+
+// run the sampler on each rank with its shard of logits, returns outputs of
+// all ranks
+std::vector<SampleOutput> sample(const SamplingParameters& params,
+                                 const torch::Tensor& logits,
+                                 int world_size) {
+  auto state = std::make_shared<LocalProcessGroup::State>();
+  state->slots.resize(world_size);
+  const auto shards = logits.chunk(world_size, /*dim=*/-1);
+  std::vector<SampleOutput> outputs(world_size);
+  std::vector<std::thread> threads;
+  for (int rank = 0; rank < world_size; ++rank) {
+    threads.emplace_back([&, rank] {
+      LocalProcessGroup pg(rank, world_size, state);
+      ParallelArgs parallel_args(rank, world_size, &pg);
+      VocabParallelSampler sampler(params, parallel_args);
+      outputs[rank] = sampler.forward(shards[rank].clone());
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return outputs;
+}
+
+SamplingParameters create_params(const SamplingParameter& param,
+                                 size_t num_seqs) {
+  std::vector<const SamplingParameter*> params(num_seqs, &param);
+  std::vector<int32_t> idxes;
+  std::vector<std::vector<int64_t>> unique_token_ids;
+  std::vector<std::vector<int32_t>> unique_token_counts;
+  std::vector<int32_t> unique_token_lens;
+  for (size_t i = 0; i < num_seqs; ++i) {
+    idxes.push_back(static_cast<int32_t>(i));
+    // tokens spread across all shards
+    unique_token_ids.push_back({1, 17, 40, 63});
+    unique_token_counts.push_back({1, 2, 1, 3});
+    unique_token_lens.push_back(4);
+  }
+  SamplingParameters sampling_params;
+  sampling_params.init(params,
+                       idxes,
+                       idxes,
+                       unique_token_ids,
+                       unique_token_counts,
+                       unique_token_lens);
+  return sampling_params;
+}
+
+// the distribution of next tokens from the full logits
+torch::Tensor full_probs(const SamplingParameters& params,
+                         const torch::Tensor& logits) {
+  auto processor = LogitsProcessor::create(params);
+  const auto processed = processor->forward(logits.clone(),
+                                            params.unique_token_ids,
+                                            params.unique_token_counts,
+                                            params.unique_token_ids_lens);
+  return processed.softmax(/*dim=*/-1);
+}
+}  // namespace
+
+TEST(VocabParallelSamplerTest, IsSupported) {
+  SamplingParameter param;
+  EXPECT_TRUE(VocabParallelSampler::is_supported(create_params(param, 2)));
+  param.top_p = 0.9;
+  EXPECT_FALSE(VocabParallelSampler::is_supported(create_params(param, 2)));
+  param.top_k = 10;
+  EXPECT_TRUE(VocabParallelSampler::is_supported(create_params(param, 2)));
+}
+
+TEST(VocabParallelSamplerTest, Greedy) {
+  torch::manual_seed(0);
+  const int64_t vocab_size = 64;
+  SamplingParameter param;
+  param.temperature = 0.0;
+  param.frequency_penalty = 0.5;
+  param.presence_penalty = 0.2;
+  param.repetition_penalty = 1.2;
+  const auto params = create_params(param, /*num_seqs=*/8);
+  const auto logits = torch::randn({8, vocab_size});
+
+  auto processor = LogitsProcessor::create(params);
+  const auto processed = processor->forward(logits.clone(),
+                                            params.unique_token_ids,
+                                            params.unique_token_counts,
+                                            params.unique_token_ids_lens);
+  const auto expected = processed.argmax(/*dim=*/-1);
+  const auto expected_logprobs =
+      processed.log_softmax(/*dim=*/-1)
+          .gather(/*dim=*/1, expected.unsqueeze(1))
+          .squeeze(1);
+
+  for (int world_size : {1, 2, 4}) {
+    const auto outputs = sample(params, logits, world_size);
+    for (const auto& output : outputs) {
+      EXPECT_TRUE(torch::equal(output.next_tokens, expected));
+      EXPECT_TRUE(torch::allclose(output.logprobs, expected_logprobs));
+    }
+  }
+}
+
+TEST(VocabParallelSamplerTest, RandomSample) {
+  torch::manual_seed(0);
+  const int64_t vocab_size = 64;
+  const int64_t num_seqs = 50000;
+  const int world_size = 4;
+  const auto row = torch::randn({1, vocab_size});
+  const auto logits = row.expand({num_seqs, vocab_size}).contiguous();
+
+  for (int64_t top_k : {-1, 5}) {
+    SamplingParameter param;
+    param.temperature = 0.8;
+    param.frequency_penalty = 0.5;
+    param.presence_penalty = 0.2;
+    param.top_k = top_k;
+    const auto params = create_params(param, num_seqs);
+
+    const auto outputs = sample(params, logits, world_size);
+    // all ranks select the same tokens
+    for (const auto& output : outputs) {
+      EXPECT_TRUE(torch::equal(output.next_tokens, outputs[0].next_tokens));
+    }
+
+    // the frequencies of tokens follow the distribution of the full logits
+    const auto counts = torch::bincount(outputs[0].next_tokens,
+                                        /*weights=*/{},
+                                        vocab_size);
+    const auto freqs = counts.to(torch::kFloat) / num_seqs;
+    const auto probs = full_probs(create_params(param, 1), row)[0];
+    if (top_k > 0) {
+      const auto [top_probs, top_ids] = probs.topk(top_k);
+      // only top k tokens are sampled
+      const auto top_freqs = freqs.index_select(/*dim=*/0, top_ids);
+      EXPECT_NEAR(top_freqs.sum().item<float>(), 1.0, 1e-6);
+      const auto expected = top_probs / top_probs.sum();
+      EXPECT_TRUE(torch::allclose(
+          top_freqs, expected, /*rtol=*/0, /*atol=*/0.01));
+    } else {
+      EXPECT_TRUE(torch::allclose(freqs, probs, /*rtol=*/0, /*atol=*/0.01));
+    }
+  }
+}
+
+}  // namespace llm
@@ -0,0 +1,156 @@
+#include "admission_controller.h"
+
+#include <glog/logging.h>
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "common/metrics.h"
+
+DEFINE_COUNTER_FAMILY(admission_decisions_total,
+                      "Total number of admission decisions for requests");
+DEFINE_COUNTER_INSTANCE(admission_admitted_total,
+                        admission_decisions_total,
+                        {{"decision", "admitted"}});
+DEFINE_COUNTER_INSTANCE(admission_rejected_queue_wait_total,
+                        admission_decisions_total,
+                        {{"decision", "rejected_queue_wait"}});
+DEFINE_COUNTER_INSTANCE(admission_rejected_kv_demand_total,
+                        admission_decisions_total,
+                        {{"decision", "rejected_kv_demand"}});
+
+DEFINE_GAUGE(admission_prefill_throughput,
+             "Estimated prompt tokens processed per second");
+
+namespace llm {
+namespace {
+// weight of the latest step in the moving average of the throughput
+constexpr double kThroughputWeight = 0.2;
+
+size_t index_of(Priority priority) { return static_cast<size_t>(priority); }
+}  // namespace
+
+AdmissionController::AdmissionController(const Options& options)
+    : options_(options) {}
+
+Status AdmissionController::admit(Priority priority,
+                                  int64_t num_prompt_tokens,
+                                  int64_t kv_demand) const {
+  // always admit a request with nothing ahead of it, however large it is, so
+  // that it can't be rejected forever.
+  const double max_wait = max_queue_wait(priority);
+  const double throughput = prefill_throughput();
+  const int64_t tokens_ahead = waiting_prompt_tokens(priority);
+  if (max_wait > 0 && throughput > 0 && tokens_ahead > 0) {
+    const double wait = (tokens_ahead + num_prompt_tokens) / throughput;
+    if (wait > max_wait) {
+      COUNTER_INC(admission_rejected_queue_wait_total);
+      std::stringstream ss;
+      ss << "Server is overloaded, estimated queue wait " << wait
+         << "s exceeds " << max_wait << "s, please retry later";
+      return {StatusCode::UNAVAILABLE, ss.str()};
+    }
+  }
+
+  const double max_demand = max_kv_demand(priority);
+  const int64_t demand_ahead = this->kv_demand(priority);
+  if (max_demand > 0 && options_.kv_cache_capacity() > 0 &&
+      demand_ahead > 0) {
+    const double ratio = static_cast<double>(demand_ahead + kv_demand) /
+                         options_.kv_cache_capacity();
+    if (ratio > max_demand) {
+      COUNTER_INC(admission_rejected_kv_demand_total);
+      std::stringstream ss;
+      ss << "Not enough kv cache, demand " << ratio
+         << "x of the capacity exceeds " << max_demand
+         << "x, please retry later";
+      return {StatusCode::RESOURCE_EXHAUSTED, ss.str()};
+    }
+  }
+  COUNTER_INC(admission_admitted_total);
+  return {};
+}
+
+void AdmissionController::on_add(Priority priority,
+                                 int64_t num_prompt_tokens,
+                                 int64_t kv_demand) {
+  const size_t idx = index_of(priority);
+  waiting_prompt_tokens_[idx].fetch_add(num_prompt_tokens,
+                                        std::memory_order_relaxed);
+  kv_demand_[idx].fetch_add(kv_demand, std::memory_order_relaxed);
+}
+
+void AdmissionController::on_start(Priority priority,
+                                   int64_t num_prompt_tokens) {
+  waiting_prompt_tokens_[index_of(priority)].fetch_sub(
+      num_prompt_tokens, std::memory_order_relaxed);
+}
+
+void AdmissionController::on_finish(Priority priority,
+                                    int64_t num_waiting_prompt_tokens,
+                                    int64_t kv_demand) {
+  const size_t idx = index_of(priority);
+  waiting_prompt_tokens_[idx].fetch_sub(num_waiting_prompt_tokens,
+                                        std::memory_order_relaxed);
+  kv_demand_[idx].fetch_sub(kv_demand, std::memory_order_relaxed);
+}
+
+void AdmissionController::on_step(int64_t num_prefill_tokens, double seconds) {
+  // decode-only steps say nothing about how fast prompts are processed
+  if (num_prefill_tokens <= 0 || seconds <= 0) {
+    return;
+  }
+  const double step_throughput = num_prefill_tokens / seconds;
+  const double old_throughput = prefill_throughput();
+  const double throughput =
+      old_throughput > 0
+          ? old_throughput +
+                kThroughputWeight * (step_throughput - old_throughput)
+          : step_throughput;
+  prefill_throughput_.store(throughput, std::memory_order_relaxed);
+  GAUGE_SET(admission_prefill_throughput, throughput);
+}
+
+int64_t AdmissionController::waiting_prompt_tokens(Priority priority) const {
+  int64_t tokens = 0;
+  for (size_t i = 0; i <= index_of(priority); ++i) {
+    tokens += waiting_prompt_tokens_[i].load(std::memory_order_relaxed);
+  }
+  return tokens;
+}
+
+int64_t AdmissionController::kv_demand(Priority priority) const {
+  int64_t demand = 0;
+  for (size_t i = 0; i <= index_of(priority); ++i) {
+    demand += kv_demand_[i].load(std::memory_order_relaxed);
+  }
+  return demand;
+}
+
+double AdmissionController::max_queue_wait(Priority priority) const {
+  switch (priority) {
+    case Priority::HIGH:
+      return options_.max_queue_wait_high();
+    case Priority::NORMAL:
+      return options_.max_queue_wait_normal();
+    case Priority::LOW:
+      return options_.max_queue_wait_low();
+  }
+  return 0.0;
+}
+
+double AdmissionController::max_kv_demand(Priority priority) const {
+  switch (priority) {
+    case Priority::HIGH:
+      return options_.max_kv_demand_high();
+    case Priority::NORMAL:
+      return options_.max_kv_demand_normal();
+    case Priority::LOW:
+      return options_.max_kv_demand_low();
+  }
+  return 0.0;
+}
+
+}  // namespace llm
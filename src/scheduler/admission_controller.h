@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "common/macros.h"
+#include "request/output.h"
+#include "request/status.h"
+
+namespace llm {
+
+// Admission control of online requests before they are queued. It tracks the
+// load admitted into the scheduler for each priority: prompt tokens waiting to
+// be scheduled and the kv cache tokens unfinished requests may grow to. A new
+// request is rejected with a retryable status when, counting the load of its
+// own and higher priorities, either the estimated wait for its prompt or the
+// kv cache demand exceeds the threshold of its priority. Lower priorities are
+// given tighter thresholds to shed them first, keeping the latency of admitted
+// requests bounded under overload. Thread safe.
+class AdmissionController final {
+ public:
+  struct Options {
+    // the max estimated seconds a prompt waits to be scheduled, for each
+    // priority. 0 for no limit.
+    DEFINE_ARG(double, max_queue_wait_high) = 0.0;
+    DEFINE_ARG(double, max_queue_wait_normal) = 0.0;
+    DEFINE_ARG(double, max_queue_wait_low) = 0.0;
+
+    // the max ratio of kv cache demand, prompt tokens plus max tokens of all
+    // sequences, to the kv cache capacity, for each priority. 0 for no limit.
+    DEFINE_ARG(double, max_kv_demand_high) = 0.0;
+    DEFINE_ARG(double, max_kv_demand_normal) = 0.0;
+    DEFINE_ARG(double, max_kv_demand_low) = 0.0;
+
+    // the capacity of the kv cache in tokens
+    DEFINE_ARG(int64_t, kv_cache_capacity) = 0;
+  };
+
+  explicit AdmissionController(const Options& options);
+
+  // returns ok if a request could be admitted under the current load,
+  // otherwise a retryable error status with the reason.
+  Status admit(Priority priority,
+               int64_t num_prompt_tokens,
+               int64_t kv_demand) const;
+
+  // a request is added into the scheduler
+  void on_add(Priority priority, int64_t num_prompt_tokens, int64_t kv_demand);
+
+  // the prompt of a request is scheduled for the first time
+  void on_start(Priority priority, int64_t num_prompt_tokens);
+
+  // a request is finished, with its prompt tokens still waiting if it never
+  // started.
+  void on_finish(Priority priority,
+                 int64_t num_waiting_prompt_tokens,
+                 int64_t kv_demand);
+
+  // update the prefill throughput with a finished step. not thread safe,
+  // called by the scheduler thread only.
+  void on_step(int64_t num_prefill_tokens, double seconds);
+
+  // prompt tokens processed per second, 0 if not measured yet
+  double prefill_throughput() const {
+    return prefill_throughput_.load(std::memory_order_relaxed);
+  }
+
+  // waiting prompt tokens of the priority and higher ones
+  int64_t waiting_prompt_tokens(Priority priority) const;
+
+  // kv cache demand in tokens of the priority and higher ones
+  int64_t kv_demand(Priority priority) const;
+
+ private:
+  static constexpr size_t kNumPriorities = 3;
+
+  double max_queue_wait(Priority priority) const;
+
+  double max_kv_demand(Priority priority) const;
+
+  const Options options_;
+
+  std::array<std::atomic<int64_t>, kNumPriorities> waiting_prompt_tokens_{};
+
+  std::array<std::atomic<int64_t>, kNumPriorities> kv_demand_{};
+
+  // moving average of prompt tokens per second of steps with prefill
+  std::atomic<double> prefill_throughput_{0.0};
+};
+
+}  // namespace llm
@@ -0,0 +1,93 @@
+#include "admission_controller.h"
+
+#include <gtest/gtest.h>
+
+namespace llm {
+
+TEST(AdmissionControllerTest, NoLimits) {
+  AdmissionController controller(AdmissionController::Options{});
+  controller.on_step(/*num_prefill_tokens=*/100, /*seconds=*/1.0);
+  controller.on_add(Priority::NORMAL, 100000, 100000);
+  EXPECT_TRUE(controller.admit(Priority::LOW, 100000, 100000).ok());
+}
+
+TEST(AdmissionControllerTest, PrefillThroughput) {
+  AdmissionController controller(AdmissionController::Options{});
+  EXPECT_EQ(controller.prefill_throughput(), 0.0);
+  controller.on_step(/*num_prefill_tokens=*/1000, /*seconds=*/0.5);
+  EXPECT_DOUBLE_EQ(controller.prefill_throughput(), 2000.0);
+  // decode-only steps are ignored
+  controller.on_step(/*num_prefill_tokens=*/0, /*seconds=*/0.5);
+  EXPECT_DOUBLE_EQ(controller.prefill_throughput(), 2000.0);
+  // moving towards the latest steps
+  controller.on_step(/*num_prefill_tokens=*/1000, /*seconds=*/1.0);
+  EXPECT_LT(controller.prefill_throughput(), 2000.0);
+  EXPECT_GT(controller.prefill_throughput(), 1000.0);
+}
+
+TEST(AdmissionControllerTest, QueueWait) {
+  AdmissionController::Options options;
+  options.max_queue_wait_high(0.0)
+      .max_queue_wait_normal(2.0)
+      .max_queue_wait_low(1.0);
+  AdmissionController controller(options);
+
+  // no throughput measured yet
+  controller.on_add(Priority::NORMAL, 5000, 5000);
+  EXPECT_TRUE(controller.admit(Priority::NORMAL, 100, 100).ok());
+
+  // 1000 tokens per second, 5000 tokens waiting
+  controller.on_step(/*num_prefill_tokens=*/1000, /*seconds=*/1.0);
+  EXPECT_EQ(controller.waiting_prompt_tokens(Priority::NORMAL), 5000);
+  auto status = controller.admit(Priority::NORMAL, 100, 100);
+  EXPECT_EQ(status.code(), StatusCode::UNAVAILABLE);
+  EXPECT_EQ(controller.admit(Priority::LOW, 100, 100).code(),
+            StatusCode::UNAVAILABLE);
+  // no limit for high priority, which doesn't wait for normal ones either
+  EXPECT_TRUE(controller.admit(Priority::HIGH, 100, 100).ok());
+  EXPECT_EQ(controller.waiting_prompt_tokens(Priority::HIGH), 0);
+
+  // the prompt is scheduled, 1000 tokens waiting
+  controller.on_start(Priority::NORMAL, 4000);
+  EXPECT_TRUE(controller.admit(Priority::NORMAL, 100, 100).ok());
+  // but too long for low priority
+  EXPECT_EQ(controller.admit(Priority::LOW, 100, 100).code(),
+            StatusCode::UNAVAILABLE);
+
+  // low priority requests wait behind normal ones
+  controller.on_finish(Priority::NORMAL, 1000, 5000);
+  controller.on_add(Priority::LOW, 500, 500);
+  EXPECT_TRUE(controller.admit(Priority::LOW, 100, 100).ok());
+  EXPECT_EQ(controller.waiting_prompt_tokens(Priority::NORMAL), 0);
+  EXPECT_EQ(controller.waiting_prompt_tokens(Priority::LOW), 500);
+}
+
+TEST(AdmissionControllerTest, KVDemand) {
+  AdmissionController::Options options;
+  options.max_kv_demand_high(4.0)
+      .max_kv_demand_normal(2.0)
+      .max_kv_demand_low(1.0)
+      .kv_cache_capacity(1000);
+  AdmissionController controller(options);
+
+  // nothing ahead, admitted however large it is
+  EXPECT_TRUE(controller.admit(Priority::LOW, 10, 5000).ok());
+
+  controller.on_add(Priority::NORMAL, 100, 1500);
+  EXPECT_EQ(controller.kv_demand(Priority::HIGH), 0);
+  EXPECT_EQ(controller.kv_demand(Priority::LOW), 1500);
+  EXPECT_TRUE(controller.admit(Priority::NORMAL, 10, 400).ok());
+  EXPECT_EQ(controller.admit(Priority::NORMAL, 10, 600).code(),
+            StatusCode::RESOURCE_EXHAUSTED);
+  EXPECT_EQ(controller.admit(Priority::LOW, 10, 100).code(),
+            StatusCode::RESOURCE_EXHAUSTED);
+  EXPECT_TRUE(controller.admit(Priority::HIGH, 10, 3000).ok());
+
+  // the demand is released once the request finishes
+  controller.on_start(Priority::NORMAL, 100);
+  controller.on_finish(Priority::NORMAL, 0, 1500);
+  EXPECT_EQ(controller.kv_demand(Priority::LOW), 0);
+  EXPECT_TRUE(controller.admit(Priority::LOW, 10, 5000).ok());
+}
+
+}  // namespace llm
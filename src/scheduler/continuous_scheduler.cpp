@@ -5,9 +5,14 @@
 #include <folly/MPMCQueue.h>
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cstdint>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "common/metrics.h"
 #include "common/timer.h"
@@ -29,7 +34,8 @@ DEFINE_GAUGE(num_blocks_in_prefix_cache,
 DEFINE_GAUGE(num_free_blocks, "Number of free blocks in the block allocator");
 DEFINE_GAUGE(num_blocks_in_use, "Effective number of blocks in use");
 
-DEFINE_COUNTER(scheduling_latency_seconds, "Latency of scheduling in seconds");
+DEFINE_LATENCY_HISTOGRAM(scheduling_latency_seconds,
+                         "Latency of scheduling in seconds");
 
 DEFINE_COUNTER_FAMILY(num_processing_tokens_total,
                       "Total number of processing tokens");
@@ -41,18 +47,43 @@ DEFINE_COUNTER_INSTANCE(num_generated_tokens_total,
                         {{"type", "generated"}});
 
 namespace llm {
-
+namespace {
 constexpr size_t kRequestQueueSize = 100000;
 
+// kv cache tokens a request may grow to, the prompt is shared by sequences
+int64_t kv_demand_of(const Request& request) {
+  const int64_t num_prompt_tokens = request.num_prompt_tokens();
+  const int64_t max_tokens = request.seq_capacity - num_prompt_tokens;
+  return num_prompt_tokens + request.num_seqs * max_tokens;
+}
+}  // namespace
+
 ContinuousScheduler::ContinuousScheduler(Engine* engine, const Options& options)
-    : options_(options), engine_(engine), request_queue_(kRequestQueueSize) {
+    : options_(options),
+      engine_(engine),
+      request_queue_(kRequestQueueSize),
+      step_profiler_(options.num_step_records()) {
   CHECK(engine_ != nullptr);
+  CHECK_GT(options_.num_decode_steps(), 0);
   block_manager_ = engine_->block_manager();
   CHECK(block_manager_ != nullptr);
 
   enable_prefix_cache_ = block_manager_->options().enable_prefix_cache();
 
   response_handler_ = std::make_unique<ResponseHandler>(engine_->tokenizer());
+
+  const auto& block_options = block_manager_->options();
+  AdmissionController::Options admission_options;
+  admission_options.max_queue_wait_high(options_.max_queue_wait_high())
+      .max_queue_wait_normal(options_.max_queue_wait_normal())
+      .max_queue_wait_low(options_.max_queue_wait_low())
+      .max_kv_demand_high(options_.max_kv_demand_high())
+      .max_kv_demand_normal(options_.max_kv_demand_normal())
+      .max_kv_demand_low(options_.max_kv_demand_low())
+      .kv_cache_capacity(static_cast<int64_t>(block_options.num_blocks()) *
+                         block_options.block_size());
+  admission_controller_ =
+      std::make_unique<AdmissionController>(admission_options);
 }
 
 ContinuousScheduler::~ContinuousScheduler() {
@@ -81,17 +112,48 @@ bool ContinuousScheduler::schedule(std::unique_ptr<Request>& request) {
   CHECK(request != nullptr);
   CHECK(!request->sequences.empty());
 
+  // count the load before the request is visible to the scheduler thread
+  const int64_t num_prompt_tokens = request->num_prompt_tokens();
+  const int64_t kv_demand = kv_demand_of(*request);
+  request->num_waiting_prompt_tokens = num_prompt_tokens;
+  admission_controller_->on_add(
+      request->priority, num_prompt_tokens, kv_demand);
+
   if (request_queue_.write(request.get())) {
     // take over the ownership of the request
     request.release();
+    num_requests_.fetch_add(1, std::memory_order_relaxed);
     return true;
   }
   // queue is full
+  admission_controller_->on_finish(
+      request->priority, num_prompt_tokens, kv_demand);
+  request->num_waiting_prompt_tokens = 0;
   return false;
 }
 
+Status ContinuousScheduler::admit(const Request& request) const {
+  return admission_controller_->admit(
+      request.priority, request.num_prompt_tokens(), kv_demand_of(request));
+}
+
+void ContinuousScheduler::finish_request(Request* request) {
+  block_manager_->release_blocks_for(request);
+  admission_controller_->on_finish(request->priority,
+                                   request->num_waiting_prompt_tokens,
+                                   kv_demand_of(*request));
+  // release the ownership of the request
+  response_handler_->on_request_finish(std::unique_ptr<Request>(request));
+  num_requests_.fetch_sub(1, std::memory_order_relaxed);
+}
+
 Batch ContinuousScheduler::build_sequence_batch() {
   Timer timer;
+  const absl::Time start_time = absl::Now();
+  const size_t num_allocated_blocks_total =
+      block_manager_->num_allocated_blocks_total();
+  const size_t num_evicted_blocks_total =
+      block_manager_->num_evicted_blocks_total();
 
   // propogate new requests to priority_queue_
   Request* request = nullptr;
@@ -99,6 +161,10 @@ Batch ContinuousScheduler::build_sequence_batch() {
   while (request_queue_.read(request)) {
     CHECK(request != nullptr);
 
+    if (request->trace) {
+      request->waiting_since = request->created_time;
+    }
+
     // expand sequences to the target number if prefix cache is disabled.
     if (!enable_prefix_cache_) {
       // expand sequences to the target number
@@ -114,9 +180,7 @@ Batch ContinuousScheduler::build_sequence_batch() {
        ++it) {
     Request* request = *it;
     if (request->is_finished() || request->is_cancelled()) {
-      block_manager_->release_blocks_for(request);
-      // release the ownership of the request
-      response_handler_->on_request_finish(std::unique_ptr<Request>(request));
+      finish_request(request);
       continue;
     }
 
@@ -183,6 +247,10 @@ Batch ContinuousScheduler::build_sequence_batch() {
       if (sequence.is_finished()) {
         continue;
       }
+      // skip beams waiting for the other beams to be sampled
+      if (!sequence.beam_candidates().empty()) {
+        continue;
+      }
       // no budget left
       if (allocated_tokens + options_.num_speculative_tokens() >=
               remaining_token_budget ||
@@ -234,6 +302,10 @@ Batch ContinuousScheduler::build_sequence_batch() {
       if (request_to_preempt != request) {
         ++num_preempted_requests;
         block_manager_->release_blocks_for(request_to_preempt);
+        if (request_to_preempt->trace) {
+          request_to_preempt->trace->add_event("preempt");
+          request_to_preempt->waiting_since = absl::Now();
+        }
       }
       continue;
     }
@@ -277,14 +349,28 @@ Batch ContinuousScheduler::build_sequence_batch() {
     // no enough memory to schedule single sequence, just finish the request
     Request* request = priority_queue_.top();
     priority_queue_.pop();
-    block_manager_->release_blocks_for(request);
-    // release the ownership of the request
-    response_handler_->on_request_finish(std::unique_ptr<Request>(request));
+    finish_request(request);
+  }
+
+  for (Request* request : running_requests_) {
+    // the prompt of the request is no longer waiting
+    if (request->num_waiting_prompt_tokens > 0) {
+      admission_controller_->on_start(request->priority,
+                                      request->num_waiting_prompt_tokens);
+      request->num_waiting_prompt_tokens = 0;
+    }
+    // record the time spent waiting for traced requests
+    if (request->waiting_since.has_value()) {
+      request->trace->add_span(
+          "queue", request->waiting_since.value(), absl::Now());
+      request->waiting_since.reset();
+    }
   }
 
   // update the batch
   size_t num_prompt_tokens = 0;
   size_t num_generated_tokens = 0;
+  size_t num_prefill_seqs = 0;
   Batch batch;
   for (const SequenceData& seq_data : new_batch) {
     const size_t token_budget = seq_data.token_budget;
@@ -299,14 +385,69 @@ Batch ContinuousScheduler::build_sequence_batch() {
     const size_t generated_tokens = token_budget - prompt_tokens;
     num_prompt_tokens += prompt_tokens;
     num_generated_tokens += generated_tokens;
+    if (prompt_tokens > 0) {
+      ++num_prefill_seqs;
+    }
 
     batch.add(sequence, token_budget);
   }
 
+  // run several decode steps in one round for decode-only batches, with kv
+  // cache slots reserved for the tokens sampled in all steps
+  if (options_.num_decode_steps() > 1 &&
+      options_.num_speculative_tokens() == 0 && num_prefill_seqs == 0 &&
+      !batch.empty()) {
+    // no more steps than any sequence may still take, which would reserve
+    // slots for dropped tokens and run positions beyond the context length
+    size_t num_decode_steps = options_.num_decode_steps();
+    for (const SequenceData& seq_data : new_batch) {
+      const Sequence* sequence = seq_data.sequence;
+      if (!Batch::support_decode_steps(*sequence)) {
+        num_decode_steps = 1;
+        break;
+      }
+      num_decode_steps = std::min(
+          num_decode_steps,
+          std::max<size_t>(Batch::max_decode_steps(*sequence), 1));
+    }
+    for (const SequenceData& seq_data : new_batch) {
+      if (num_decode_steps == 1) {
+        break;
+      }
+      Sequence* sequence = seq_data.sequence;
+      // blocks reserved for a failed round are used in later steps
+      if (!block_manager_->allocate_blocks_for(
+              sequence, sequence->num_tokens() + num_decode_steps - 1)) {
+        num_decode_steps = 1;
+      }
+    }
+    batch.set_num_decode_steps(static_cast<uint32_t>(num_decode_steps));
+    num_generated_tokens *= num_decode_steps;
+  }
+
+  num_batch_tokens_ = num_prompt_tokens + num_generated_tokens;
+
+  // start profiling the step, timings are filled in after execution
+  current_step_ = StepRecord();
+  current_step_.start_time_us = absl::ToUnixMicros(start_time);
+  current_step_.num_prefill_seqs = num_prefill_seqs;
+  current_step_.num_decode_seqs = new_batch.size() - num_prefill_seqs;
+  current_step_.num_prefill_tokens = num_prompt_tokens;
+  current_step_.num_decode_tokens = num_generated_tokens;
+  current_step_.num_running_requests = running_requests_.size();
+  current_step_.num_waiting_requests = priority_queue_.size();
+  current_step_.schedule_us = timer.elapsed_microseconds();
+  current_step_.num_allocated_blocks =
+      block_manager_->num_allocated_blocks_total() - num_allocated_blocks_total;
+  current_step_.num_evicted_blocks =
+      block_manager_->num_evicted_blocks_total() - num_evicted_blocks_total;
+  current_step_.num_preempted_requests = num_preempted_requests;
+  current_step_.num_free_blocks = block_manager_->num_free_blocks();
+
   // update metrics before returning
   if (!batch.empty()) {
     // only update the scheduling latency when there are requests to process
-    COUNTER_ADD(scheduling_latency_seconds, timer.elapsed_seconds());
+    HISTOGRAM_OBSERVE(scheduling_latency_seconds, timer.elapsed_seconds());
   }
 
   COUNTER_ADD(num_prompt_tokens_total, num_prompt_tokens);
@@ -356,10 +497,7 @@ void ContinuousScheduler::step(const absl::Duration& timeout) {
     return;
   }
 
-  engine_->execute_model(batch);
-
-  // process request output in batch
-  process_batch_output();
+  execute(batch);
 }
 
 void ContinuousScheduler::run_until_complete() {
@@ -377,17 +515,106 @@ void ContinuousScheduler::run_until_complete() {
     }
 
     // run inference for the batch
-    engine_->execute_model(batch);
-
-    // process request output in batch
-    process_batch_output();
+    execute(batch);
   }
 
   // wait for all responses to be processed
   response_handler_->wait_for_complete();
 }
 
+void ContinuousScheduler::execute(Batch& batch) {
+  const absl::Time start_time = absl::Now();
+  const ModelOutput output = engine_->execute_model(batch);
+  handle_failed_sequences(output.failed_sequences);
+  trace_step(batch, start_time);
+
+  // process request output in batch
+  Timer timer;
+  process_batch_output();
+
+  // record the profile of the step
+  const auto to_micros = [](double seconds) {
+    return static_cast<int64_t>(seconds * 1e6);
+  };
+  const ExecutionStats& stats = output.stats;
+  current_step_.num_padding_seqs = stats.num_padding_seqs;
+  current_step_.prepare_input_us = to_micros(stats.prepare_input_seconds);
+  current_step_.h2d_us = to_micros(stats.h2d_seconds);
+  current_step_.forward_us = to_micros(stats.forward_seconds);
+  current_step_.logits_us = to_micros(stats.logits_seconds);
+  current_step_.sampling_us = to_micros(stats.sampling_seconds);
+  current_step_.output_us = to_micros(stats.process_output_seconds) +
+                            timer.elapsed_microseconds();
+  current_step_.total_us =
+      absl::ToUnixMicros(absl::Now()) - current_step_.start_time_us;
+  step_profiler_.record(current_step_);
+  admission_controller_->on_step(current_step_.num_prefill_tokens,
+                                 current_step_.total_us / 1e6);
+}
+
+void ContinuousScheduler::handle_failed_sequences(
+    const std::vector<std::pair<const Sequence*, Status>>& failed_sequences) {
+  if (failed_sequences.empty()) {
+    return;
+  }
+  std::unordered_map<const Sequence*, const Status*> statuses;
+  for (const auto& [sequence, status] : failed_sequences) {
+    statuses[sequence] = &status;
+  }
+
+  std::vector<Request*> running_requests;
+  running_requests.reserve(running_requests_.size());
+  for (Request* request : running_requests_) {
+    // a permanent failure of any sequence fails the whole request
+    const Status* error = nullptr;
+    bool deferred = false;
+    for (const Sequence& sequence : request->sequences) {
+      const auto it = statuses.find(&sequence);
+      if (it == statuses.end()) {
+        continue;
+      }
+      if (it->second->code() == StatusCode::UNAVAILABLE) {
+        deferred = true;
+      } else {
+        error = it->second;
+        break;
+      }
+    }
+
+    if (error != nullptr) {
+      LOG(ERROR) << "Failed to run the request: " << error->message();
+      request->error = *error;
+      preemptable_requests_.erase(std::remove(preemptable_requests_.begin(),
+                                              preemptable_requests_.end(),
+                                              request),
+                                  preemptable_requests_.end());
+      finish_request(request);
+      continue;
+    }
+    if (deferred) {
+      // release its blocks for others, it is scheduled again from scratch
+      ++current_step_.num_preempted_requests;
+      block_manager_->release_blocks_for(request);
+      if (request->trace) {
+        request->trace->add_event("preempt");
+        request->waiting_since = absl::Now();
+      }
+    }
+    running_requests.push_back(request);
+  }
+  running_requests_ = std::move(running_requests);
+}
+
 void ContinuousScheduler::process_batch_output() {
+  // extend beams once all beams of the request are sampled
+  for (Request* request : running_requests_) {
+    if (request->is_beam_search()) {
+      request->beam_search->step(request->sequences, [this](Sequence* beam) {
+        block_manager_->release_blocks_for(beam);
+      });
+    }
+  }
+
   // process request output in batch
   for (Request* request : running_requests_) {
     if (request->is_streaming()) {
@@ -396,6 +623,47 @@ void ContinuousScheduler::process_batch_output() {
   }
 }
 
+void ContinuousScheduler::trace_step(const Batch& batch,
+                                     absl::Time start_time) {
+  const absl::Time end_time = absl::Now();
+  const bool has_traced_requests = std::any_of(
+      running_requests_.begin(),
+      running_requests_.end(),
+      [](const Request* request) { return request->trace != nullptr; });
+  if (!has_traced_requests) {
+    return;
+  }
+
+  // only requests with sequences in the batch take part in the step
+  std::unordered_set<const Sequence*> batch_sequences;
+  batch_sequences.reserve(batch.size());
+  for (size_t i = 0; i < batch.size(); ++i) {
+    batch_sequences.insert(batch[i]);
+  }
+  std::vector<Request*> batch_requests;
+  for (Request* request : running_requests_) {
+    const bool in_batch = std::any_of(
+        request->sequences.begin(),
+        request->sequences.end(),
+        [&](const Sequence& seq) { return batch_sequences.count(&seq) > 0; });
+    if (in_batch) {
+      batch_requests.push_back(request);
+    }
+  }
+
+  for (Request* request : batch_requests) {
+    if (request->trace) {
+      request->trace->add_span(
+          "step",
+          start_time,
+          end_time,
+          {{"batch_size", static_cast<int64_t>(batch.size())},
+           {"num_batch_tokens", static_cast<int64_t>(num_batch_tokens_)},
+           {"num_requests", static_cast<int64_t>(batch_requests.size())}});
+    }
+  }
+}
+
 bool ContinuousScheduler::allocate_blocks_for(Sequence* sequence,
                                               size_t token_budget,
                                               size_t* actual_tokens) {
@@ -5,13 +5,17 @@
 
 #include <memory>
 #include <queue>
+#include <utility>
+#include <vector>
 
 #include "common/macros.h"
 #include "engine/batch.h"
+#include "admission_controller.h"
 #include "memory/block_manager.h"
 #include "request/request.h"
 #include "response_handler.h"
 #include "scheduler.h"
+#include "step_profiler.h"
 
 namespace llm {
 class Engine;
@@ -29,6 +33,26 @@ class ContinuousScheduler final : public Scheduler {
 
     // the number of speculative tokens per step
     DEFINE_ARG(int32_t, num_speculative_tokens) = 0;
+
+    // the number of decode steps to run back to back for decode-only
+    // batches, amortizing the scheduling and host overhead over the steps
+    DEFINE_ARG(int32_t, num_decode_steps) = 1;
+
+    // the number of latest steps to keep for profiling
+    DEFINE_ARG(size_t, num_step_records) = 1024;
+
+    // the max estimated seconds a prompt waits to be scheduled before new
+    // requests are rejected, for each priority. 0 for no limit.
+    DEFINE_ARG(double, max_queue_wait_high) = 0.0;
+    DEFINE_ARG(double, max_queue_wait_normal) = 0.0;
+    DEFINE_ARG(double, max_queue_wait_low) = 0.0;
+
+    // the max ratio of kv cache demand of unfinished requests to the kv cache
+    // capacity before new requests are rejected, for each priority. 0 for no
+    // limit.
+    DEFINE_ARG(double, max_kv_demand_high) = 0.0;
+    DEFINE_ARG(double, max_kv_demand_normal) = 0.0;
+    DEFINE_ARG(double, max_kv_demand_low) = 0.0;
   };
 
   ContinuousScheduler(Engine* engine, const Options& options);
@@ -39,6 +63,9 @@ class ContinuousScheduler final : public Scheduler {
   // may return false if the queue is full
   bool schedule(std::unique_ptr<Request>& request) override;
 
+  // check the request against the admission control, thread safe
+  Status admit(const Request& request) const override;
+
   // step the scheduler forward by one step
   // may get blocked if there are no requests to process
   void step(const absl::Duration& timeout) override;
@@ -56,15 +83,29 @@ class ContinuousScheduler final : public Scheduler {
     CHECK_GT(old_value, 0) << "pending requests underflow";
   }
 
+  size_t num_requests() const override {
+    return num_requests_.load(std::memory_order_relaxed);
+  }
+
+  const StepProfiler* step_profiler() const override {
+    return &step_profiler_;
+  }
+
  private:
   Batch wait_for_batch(const absl::Duration& timeout);
 
   // build a batch of requests from the priority queue
   Batch build_sequence_batch();
 
+  // run the batch and process its output
+  void execute(Batch& batch);
+
   // process the batch output
   void process_batch_output();
 
+  // record a step span for traced requests in the batch
+  void trace_step(const Batch& batch, absl::Time start_time);
+
   // allocate blocks for a sequence, honoring the tokens budget.
   // * for prefill sequence, the allocated_tokens will be within
   // [1, num_prompt_tokens - num_tokens_in_kv_cache].
@@ -75,6 +116,14 @@ class ContinuousScheduler final : public Scheduler {
                            size_t token_budget,
                            size_t* actual_tokens);
 
+  // release a finished request and its load on the admission control
+  void finish_request(Request* request);
+
+  // preempt requests with sequences the engine may run later, and fail the
+  // ones with sequences it can never run.
+  void handle_failed_sequences(
+      const std::vector<std::pair<const Sequence*, Status>>& failed_sequences);
+
   const Options options_;
 
   // the engine to run the batch
@@ -108,8 +157,22 @@ class ContinuousScheduler final : public Scheduler {
 
   bool enable_prefix_cache_ = false;
 
+  // the number of tokens in the last built batch
+  size_t num_batch_tokens_ = 0;
+
+  // the profile of the current step, filled in while building and running it
+  StepRecord current_step_;
+
+  StepProfiler step_profiler_;
+
+  // sheds requests when the load exceeds the thresholds
+  std::unique_ptr<AdmissionController> admission_controller_;
+
   // the number of requests that are waiting to be scheduled
   std::atomic<size_t> pending_requests_{0};
+
+  // the number of requests owned by the scheduler
+  std::atomic<size_t> num_requests_{0};
 };
 
 }  // namespace llm
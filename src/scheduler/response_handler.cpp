@@ -6,6 +6,8 @@
 
 #include <cstdint>
 #include <memory>
+#include <optional>
+#include <vector>
 
 #include "common/metrics.h"
 #include "request/request.h"
@@ -18,23 +20,23 @@ DEFINE_int32(streaming_token_buffer_size,
              "number of tokens to buffer before streaming to client");
 
 // metrics
-DEFINE_COUNTER_FAMILY(detokenization_latency_seconds,
-                      "Latency of detokenization in seconds");
-DEFINE_COUNTER_INSTANCE(stream_decode_latency_seconds,
-                        detokenization_latency_seconds,
-                        {{"mode", "stream"}});
-DEFINE_COUNTER_INSTANCE(non_stream_decode_latency_seconds,
-                        detokenization_latency_seconds,
-                        {{"mode", "non-stream"}});
-
-DEFINE_COUNTER_FAMILY(responsing_latency_seconds,
-                      "Latency of responding in seconds");
-DEFINE_COUNTER_INSTANCE(stream_responsing_latency_seconds,
-                        responsing_latency_seconds,
-                        {{"mode", "stream"}});
-DEFINE_COUNTER_INSTANCE(non_stream_responsing_latency_seconds,
-                        responsing_latency_seconds,
-                        {{"mode", "non-stream"}});
+DEFINE_HISTOGRAM_FAMILY(detokenization_latency_seconds,
+                        "Latency of detokenization in seconds");
+DEFINE_HISTOGRAM_INSTANCE(stream_decode_latency_seconds,
+                          detokenization_latency_seconds,
+                          {{"mode", "stream"}});
+DEFINE_HISTOGRAM_INSTANCE(non_stream_decode_latency_seconds,
+                          detokenization_latency_seconds,
+                          {{"mode", "non-stream"}});
+
+DEFINE_HISTOGRAM_FAMILY(responsing_latency_seconds,
+                        "Latency of responding in seconds");
+DEFINE_HISTOGRAM_INSTANCE(stream_responsing_latency_seconds,
+                          responsing_latency_seconds,
+                          {{"mode", "stream"}});
+DEFINE_HISTOGRAM_INSTANCE(non_stream_responsing_latency_seconds,
+                          responsing_latency_seconds,
+                          {{"mode", "non-stream"}});
 
 DEFINE_HISTOGRAM(
     end_2_end_latency_seconds,
@@ -61,7 +63,14 @@ void ResponseHandler::on_request_finish(std::unique_ptr<Request> request) {
   // schedule the response handling
   response_threadpool_.schedule([tokenizer = tokenizer_.get(),
                                  request = std::move(request)]() {
-    AUTO_COUNTER(non_stream_responsing_latency_seconds);
+    if (request->error.has_value()) {
+      RequestOutput req_output(Status(request->error.value()));
+      req_output.finished = true;
+      request->on_output(req_output);
+      return;
+    }
+
+    AUTO_HISTOGRAM(non_stream_responsing_latency_seconds);
 
     RequestOutput req_output;
     // summarize statistics for all sequences
@@ -77,20 +86,41 @@ void ResponseHandler::on_request_finish(std::unique_ptr<Request> request) {
     // update the metrics for the request
     HISTOGRAM_OBSERVE(end_2_end_latency_seconds, request->elapsed_seconds());
 
+    RequestTrace* trace = request->trace.get();
     if (!request->is_streaming()) {
+      ScopedSpan span(trace, "detokenize");
       auto& outputs = req_output.outputs;
       outputs.reserve(request->sequences.size());
       for (size_t i = 0; i < request->sequences.size(); ++i) {
         Sequence& seq = request->sequences[i];
         const auto finish_reason = seq.finish_reason();
+        if (seq.is_embedding()) {
+          // no text for embedding sequences
+          auto& output = outputs.emplace_back();
+          output.index = i;
+          output.finish_reason = to_string(finish_reason);
+          output.embedding = seq.embedding();
+          continue;
+        }
         // generate the final output
-        AUTO_COUNTER(non_stream_decode_latency_seconds);
+        AUTO_HISTOGRAM(non_stream_decode_latency_seconds);
         auto output = seq.decode_delta_text(seq.token_ids(), *tokenizer);
         outputs.push_back({i, std::move(output), to_string(finish_reason)});
+        if (seq.need_logprobs()) {
+          outputs.back().logprobs =
+              seq.decode_delta_logprobs(seq.token_ids(), *tokenizer);
+        }
+        if (seq.need_prompt_logprobs() && !req_output.prompt_logprobs) {
+          req_output.prompt_logprobs = seq.decode_prompt_logprobs(*tokenizer);
+        }
       }
     }
+    if (request->on_finish) {
+      request->on_finish(*request);
+    }
     req_output.status = Status(StatusCode::OK);
     req_output.finished = true;
+    ScopedSpan span(trace, "respond");
     request->on_output(req_output);
   });
 }
@@ -126,28 +156,45 @@ void ResponseHandler::on_request_stream(Request* request) {
                                  indexes = std::move(indexes),
                                  token_ids = std::move(token_ids),
                                  tokenizer = tokenizer_.get()]() {
-    AUTO_COUNTER(stream_responsing_latency_seconds);
+    AUTO_HISTOGRAM(stream_responsing_latency_seconds);
 
+    RequestTrace* trace = request->trace.get();
     RequestOutput req_output;
-    for (size_t i = 0; i < indexes.size(); ++i) {
-      const size_t index = indexes[i];
-      Sequence& seq = request->sequences[index];
-      if (seq.no_delta_text_decoded()) {
-        HISTOGRAM_OBSERVE(time_to_first_token_latency_seconds,
-                          seq.inter_token_latency(absl::Now()));
-      } else {
-        HISTOGRAM_OBSERVE(inter_token_latency_seconds,
-                          seq.inter_token_latency(absl::Now()));
-      }
-      const auto finish_reason = seq.finish_reason();
-      AUTO_COUNTER(stream_decode_latency_seconds);
-      auto delta = seq.decode_delta_text(token_ids[i], *tokenizer);
-      if (!delta.empty() || finish_reason != FinishReason::NONE) {
-        req_output.outputs.push_back(
-            {index, std::move(delta), to_string(finish_reason)});
+    {
+      ScopedSpan span(trace, "detokenize");
+      for (size_t i = 0; i < indexes.size(); ++i) {
+        const size_t index = indexes[i];
+        Sequence& seq = request->sequences[index];
+        if (seq.no_delta_text_decoded()) {
+          HISTOGRAM_OBSERVE(time_to_first_token_latency_seconds,
+                            seq.inter_token_latency(absl::Now()));
+        } else {
+          HISTOGRAM_OBSERVE(inter_token_latency_seconds,
+                            seq.inter_token_latency(absl::Now()));
+        }
+        const auto finish_reason = seq.finish_reason();
+        AUTO_HISTOGRAM(stream_decode_latency_seconds);
+        auto delta = seq.decode_delta_text(token_ids[i], *tokenizer);
+        std::optional<std::vector<LogProb>> logprobs;
+        if (seq.need_logprobs()) {
+          logprobs = seq.decode_delta_logprobs(token_ids[i], *tokenizer);
+        }
+        if (seq.need_prompt_logprobs()) {
+          // sent with the first delta since the prompt is processed by then
+          req_output.prompt_logprobs = seq.decode_prompt_logprobs(*tokenizer);
+        }
+        if (!delta.empty() || finish_reason != FinishReason::NONE ||
+            (logprobs.has_value() && !logprobs->empty())) {
+          auto& output = req_output.outputs.emplace_back();
+          output.index = index;
+          output.text = std::move(delta);
+          output.finish_reason = to_string(finish_reason);
+          output.logprobs = std::move(logprobs);
+        }
       }
     }
 
+    ScopedSpan span(trace, "respond");
     if (!request->on_output(req_output)) {
       // cancel the request if on_stream returns false
       request->cancel();
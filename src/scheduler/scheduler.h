@@ -6,6 +6,8 @@
 #include <string>
 
 #include "request/request.h"
+#include "request/status.h"
+#include "step_profiler.h"
 
 namespace llm {
 
@@ -41,6 +43,11 @@ class Scheduler {
   // false otherwise and the ownership of the request is not transferred.
   virtual bool schedule(std::unique_ptr<Request>& request) = 0;
 
+  // check if a request could be admitted under the current load before
+  // scheduling it, returns a retryable error status to shed it otherwise.
+  // thread safe.
+  virtual Status admit(const Request& request) const { return {}; }
+
   // step the scheduler forward by one step
   // may get blocked if there are no requests to process
   // not thread safe
@@ -56,6 +63,13 @@ class Scheduler {
   // inc/dec pending requests
   virtual void inc_pending_requests(size_t count) {}
   virtual void dec_pending_requests() {}
+
+  // the number of requests owned by the scheduler, including waiting and
+  // running ones. thread safe.
+  virtual size_t num_requests() const { return 0; }
+
+  // profiles of the latest steps, nullptr if not supported. thread safe.
+  virtual const StepProfiler* step_profiler() const { return nullptr; }
 };
 
 }  // namespace llm
@@ -0,0 +1,100 @@
+#include "step_profiler.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <nlohmann/json.hpp>
+#include <type_traits>
+
+namespace llm {
+
+static_assert(std::is_trivially_copyable_v<StepRecord>,
+              "StepRecord is copied by seqlock readers");
+static_assert(offsetof(StepRecord, step_id) == 0,
+              "step_id is checked in the first word");
+
+StepProfiler::StepProfiler(size_t capacity)
+    : capacity_(std::max<size_t>(capacity, 1)),
+      slots_(std::make_unique<Slot[]>(capacity_)) {}
+
+void StepProfiler::record(StepRecord record) {
+  const uint64_t step_id = num_records_.load(std::memory_order_relaxed);
+  record.step_id = step_id;
+
+  std::array<uint64_t, kNumWords> words{};
+  std::memcpy(words.data(), &record, sizeof(record));
+
+  Slot& slot = slots_[step_id % capacity_];
+  const uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+  // mark the slot as being written
+  slot.seq.store(seq + 1, std::memory_order_relaxed);
+  // release stores keep the mark above ordered before the new content
+  for (size_t i = 0; i < kNumWords; ++i) {
+    slot.words[i].store(words[i], std::memory_order_release);
+  }
+  // publish the slot
+  slot.seq.store(seq + 2, std::memory_order_release);
+  num_records_.store(step_id + 1, std::memory_order_release);
+}
+
+std::vector<StepRecord> StepProfiler::latest(size_t n) const {
+  const uint64_t num_records = num_records_.load(std::memory_order_acquire);
+  const uint64_t count = std::min<uint64_t>({n, num_records, capacity_});
+
+  std::vector<StepRecord> records;
+  records.reserve(count);
+  for (uint64_t step_id = num_records - count; step_id < num_records;
+       ++step_id) {
+    const Slot& slot = slots_[step_id % capacity_];
+    const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq % 2 != 0) {
+      // being overwritten by the writer
+      continue;
+    }
+    std::array<uint64_t, kNumWords> words{};
+    for (size_t i = 0; i < kNumWords; ++i) {
+      words[i] = slot.words[i].load(std::memory_order_acquire);
+    }
+    // skip the slot if it has been changed during copying
+    if (slot.seq.load(std::memory_order_relaxed) != seq ||
+        words[0] != step_id) {
+      continue;
+    }
+    StepRecord record;
+    std::memcpy(&record, words.data(), sizeof(record));
+    records.push_back(record);
+  }
+  return records;
+}
+
+std::string StepProfiler::to_json(size_t n) const {
+  auto steps = nlohmann::json::array();
+  for (const auto& r : latest(n)) {
+    nlohmann::json step;
+    step["step_id"] = r.step_id;
+    step["start_time_us"] = r.start_time_us;
+    step["batch"] = {{"num_prefill_seqs", r.num_prefill_seqs},
+                     {"num_decode_seqs", r.num_decode_seqs},
+                     {"num_prefill_tokens", r.num_prefill_tokens},
+                     {"num_decode_tokens", r.num_decode_tokens},
+                     {"num_padding_seqs", r.num_padding_seqs},
+                     {"num_running_requests", r.num_running_requests},
+                     {"num_waiting_requests", r.num_waiting_requests}};
+    step["time_us"] = {{"schedule", r.schedule_us},
+                       {"prepare_input", r.prepare_input_us},
+                       {"h2d", r.h2d_us},
+                       {"forward", r.forward_us},
+                       {"logits", r.logits_us},
+                       {"sampling", r.sampling_us},
+                       {"output", r.output_us},
+                       {"total", r.total_us}};
+    step["kv_cache"] = {{"num_allocated_blocks", r.num_allocated_blocks},
+                        {"num_evicted_blocks", r.num_evicted_blocks},
+                        {"num_preempted_requests", r.num_preempted_requests},
+                        {"num_free_blocks", r.num_free_blocks}};
+    steps.push_back(std::move(step));
+  }
+  return steps.dump(/*indent=*/2);
+}
+
+}  // namespace llm
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llm {
+
+// Profile of one engine step. It must stay trivially copyable.
+struct StepRecord {
+  // assigned by the profiler, increasing from 0
+  uint64_t step_id = 0;
+
+  // unix time in microseconds when the step started
+  int64_t start_time_us = 0;
+
+  // batch composition
+  uint32_t num_prefill_seqs = 0;
+  uint32_t num_decode_seqs = 0;
+  uint32_t num_prefill_tokens = 0;
+  uint32_t num_decode_tokens = 0;
+  // sequences padded to match a captured cuda graph
+  uint32_t num_padding_seqs = 0;
+  uint32_t num_running_requests = 0;
+  uint32_t num_waiting_requests = 0;
+
+  // time split in microseconds
+  int64_t schedule_us = 0;
+  int64_t prepare_input_us = 0;
+  int64_t h2d_us = 0;
+  int64_t forward_us = 0;
+  int64_t logits_us = 0;
+  int64_t sampling_us = 0;
+  // appending sampled tokens and streaming outputs
+  int64_t output_us = 0;
+  int64_t total_us = 0;
+
+  // kv cache blocks
+  uint32_t num_allocated_blocks = 0;
+  uint32_t num_evicted_blocks = 0;
+  uint32_t num_preempted_requests = 0;
+  uint32_t num_free_blocks = 0;
+};
+
+// A ring buffer of the latest step records. There is a single writer, the
+// scheduler thread, and any number of lock-free readers. Each slot is guarded
+// by a sequence number which is odd while the slot is being written, readers
+// skip slots that are overwritten during copying. The record is stored as
+// atomic words so that the racy copy is still well defined.
+class StepProfiler final {
+ public:
+  explicit StepProfiler(size_t capacity);
+
+  // add a record, overwriting the oldest one if full. not thread safe.
+  void record(StepRecord record);
+
+  // returns up to n latest records, oldest first. thread safe.
+  std::vector<StepRecord> latest(size_t n) const;
+
+  // the latest n records as a json array
+  std::string to_json(size_t n) const;
+
+  size_t capacity() const { return capacity_; }
+
+ private:
+  static constexpr size_t kNumWords =
+      (sizeof(StepRecord) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+  struct Slot {
+    std::atomic<uint64_t> seq{0};
+    std::array<std::atomic<uint64_t>, kNumWords> words{};
+  };
+
+  const size_t capacity_;
+
+  std::unique_ptr<Slot[]> slots_;
+
+  // the number of records written so far
+  std::atomic<uint64_t> num_records_{0};
+};
+
+}  // namespace llm
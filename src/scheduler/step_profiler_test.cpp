@@ -0,0 +1,97 @@
+#include "step_profiler.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <nlohmann/json.hpp>
+#include <thread>
+
+namespace llm {
+
+TEST(StepProfilerTest, RingBuffer) {
+  StepProfiler profiler(/*capacity=*/4);
+  EXPECT_TRUE(profiler.latest(10).empty());
+
+  for (uint32_t i = 0; i < 3; ++i) {
+    StepRecord record;
+    record.num_decode_seqs = i;
+    profiler.record(record);
+  }
+  auto records = profiler.latest(10);
+  ASSERT_EQ(records.size(), 3);
+  for (uint32_t i = 0; i < 3; ++i) {
+    EXPECT_EQ(records[i].step_id, i);
+    EXPECT_EQ(records[i].num_decode_seqs, i);
+  }
+
+  // overwrite the oldest records
+  for (uint32_t i = 3; i < 10; ++i) {
+    StepRecord record;
+    record.num_decode_seqs = i;
+    profiler.record(record);
+  }
+  records = profiler.latest(10);
+  ASSERT_EQ(records.size(), 4);
+  for (uint32_t i = 0; i < 4; ++i) {
+    EXPECT_EQ(records[i].step_id, 6 + i);
+    EXPECT_EQ(records[i].num_decode_seqs, 6 + i);
+  }
+
+  // only the latest n records
+  records = profiler.latest(2);
+  ASSERT_EQ(records.size(), 2);
+  EXPECT_EQ(records[0].step_id, 8);
+  EXPECT_EQ(records[1].step_id, 9);
+}
+
+TEST(StepProfilerTest, ToJson) {
+  StepProfiler profiler(/*capacity=*/8);
+  StepRecord record;
+  record.num_prefill_seqs = 2;
+  record.num_prefill_tokens = 100;
+  record.forward_us = 1500;
+  record.num_allocated_blocks = 7;
+  profiler.record(record);
+
+  const auto steps = nlohmann::json::parse(profiler.to_json(8));
+  ASSERT_TRUE(steps.is_array());
+  ASSERT_EQ(steps.size(), 1);
+  EXPECT_EQ(steps[0]["step_id"], 0);
+  EXPECT_EQ(steps[0]["batch"]["num_prefill_seqs"], 2);
+  EXPECT_EQ(steps[0]["batch"]["num_prefill_tokens"], 100);
+  EXPECT_EQ(steps[0]["time_us"]["forward"], 1500);
+  EXPECT_EQ(steps[0]["kv_cache"]["num_allocated_blocks"], 7);
+}
+
+TEST(StepProfilerTest, ConcurrentReaders) {
+  StepProfiler profiler(/*capacity=*/16);
+  std::atomic<bool> done{false};
+
+  // readers should never see a torn record
+  std::thread reader([&]() {
+    while (!done.load()) {
+      uint64_t last_step_id = 0;
+      bool first = true;
+      for (const auto& record : profiler.latest(16)) {
+        EXPECT_EQ(record.num_decode_seqs, record.step_id);
+        EXPECT_EQ(record.total_us, static_cast<int64_t>(record.step_id));
+        if (!first) {
+          EXPECT_GT(record.step_id, last_step_id);
+        }
+        first = false;
+        last_step_id = record.step_id;
+      }
+    }
+  });
+
+  for (uint32_t i = 0; i < 100000; ++i) {
+    StepRecord record;
+    record.num_decode_seqs = i;
+    record.total_us = i;
+    profiler.record(record);
+  }
+  done.store(true);
+  reader.join();
+}
+
+}  // namespace llm
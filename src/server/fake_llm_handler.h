@@ -0,0 +1,122 @@
+#pragma once
+
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "handlers/llm_handler.h"
+
+namespace llm {
+
+// A fake LLMHandler for benchmarking the serving stack without a model. It
+// emits one token for all active streams every interval, mimicking the decode
+// loop of the engine.
+class FakeLLMHandler final : public LLMHandler {
+ public:
+  FakeLLMHandler(size_t num_threads, size_t num_tokens, absl::Duration interval)
+      : shards_(num_threads), num_tokens_(num_tokens), interval_(interval) {
+    for (size_t i = 0; i < num_threads; ++i) {
+      threads_.emplace_back([this, i]() { generation_loop(&shards_[i]); });
+    }
+  }
+
+  ~FakeLLMHandler() override {
+    stop_.store(true, std::memory_order_relaxed);
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  void schedule_async(std::string /*prompt*/,
+                      SamplingParams /*sp*/,
+                      Priority /*priority*/,
+                      bool /*stream*/,
+                      OutputCallback callback,
+                      std::shared_ptr<RequestTrace> /*trace*/) override {
+    const size_t idx = next_shard_.fetch_add(1) % shards_.size();
+    auto& shard = shards_[idx];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.pending.push_back({std::move(callback), 0});
+  }
+
+  void schedule_chat_async(std::vector<Message> /*messages*/,
+                           SamplingParams sp,
+                           Priority priority,
+                           bool stream,
+                           OutputCallback callback,
+                           std::shared_ptr<RequestTrace> trace) override {
+    schedule_async("",
+                   std::move(sp),
+                   priority,
+                   stream,
+                   std::move(callback),
+                   std::move(trace));
+  }
+
+ private:
+  struct Stream {
+    OutputCallback callback;
+    size_t num_generated_tokens;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::vector<Stream> pending;
+  };
+
+  void generation_loop(Shard* shard) {
+    std::vector<Stream> streams;
+    while (!stop_.load(std::memory_order_relaxed)) {
+      const absl::Time deadline = absl::Now() + interval_;
+      {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        std::move(shard->pending.begin(),
+                  shard->pending.end(),
+                  std::back_inserter(streams));
+        shard->pending.clear();
+      }
+
+      // emit one token for each stream
+      size_t num_active = 0;
+      for (auto& stream : streams) {
+        const bool last = ++stream.num_generated_tokens >= num_tokens_;
+        RequestOutput output;
+        output.outputs.push_back(
+            {0, "token ", last ? std::optional<std::string>("length")
+                               : std::nullopt});
+        bool ok = stream.callback(output);
+        if (ok && last) {
+          RequestOutput final_output;
+          final_output.status = Status(StatusCode::OK);
+          final_output.finished = true;
+          final_output.usage = Usage{0, num_tokens_, num_tokens_};
+          stream.callback(final_output);
+          ok = false;
+        }
+        if (ok) {
+          streams[num_active++] = std::move(stream);
+        }
+      }
+      streams.resize(num_active);
+      absl::SleepFor(deadline - absl::Now());
+    }
+  }
+
+  std::vector<Shard> shards_;
+  std::vector<std::thread> threads_;
+  std::atomic<size_t> next_shard_{0};
+  std::atomic_bool stop_{false};
+  size_t num_tokens_;
+  absl::Duration interval_;
+};
+
+}  // namespace llm
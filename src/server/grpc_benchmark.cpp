@@ -0,0 +1,204 @@
+// Load generator for the grpc server. It starts the grpc server in process
+// with a fake LLMHandler that streams tokens at a fixed pace, then opens a
+// large number of concurrent streaming completion rpcs and reports the
+// throughput and latency observed by the clients.
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <grpcpp/grpcpp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "completion.grpc.pb.h"
+#include "fake_llm_handler.h"
+#include "grpc_server.h"
+#include "handlers/chat_handler.h"
+#include "handlers/completion_handler.h"
+#include "handlers/llm_handler.h"
+#include "handlers/models_handler.h"
+
+DEFINE_int32(port, 8890, "Port for grpc server.");
+DEFINE_int32(num_server_threads, 4, "Number of grpc server completion queues.");
+DEFINE_int32(num_client_threads, 4, "Number of client threads and channels.");
+DEFINE_int32(num_streams, 10000, "Number of concurrent streaming rpcs.");
+DEFINE_int32(num_tokens, 64, "Number of tokens to generate for each stream.");
+DEFINE_int32(token_interval_ms, 20, "Interval between two tokens.");
+DEFINE_int32(num_generator_threads,
+             2,
+             "Number of threads generating tokens in the fake handler.");
+
+namespace llm {
+namespace {
+
+const std::string kModel = "fake-model";
+
+// latency statistics collected by clients
+struct Stats {
+  std::mutex mutex;
+  std::vector<double> ttft_ms;
+  std::vector<double> e2e_ms;
+  size_t num_responses = 0;
+  size_t num_failures = 0;
+};
+
+// state machine of an async streaming rpc
+class ClientStream {
+ public:
+  ClientStream(proto::Completion::Stub* stub,
+               grpc::CompletionQueue* cq,
+               Stats* stats,
+               std::atomic<size_t>* num_finished)
+      : stats_(stats), num_finished_(num_finished) {
+    proto::CompletionRequest request;
+    request.set_model(kModel);
+    request.set_prompt("hello");
+    request.set_stream(true);
+    start_ = absl::Now();
+    reader_ = stub->PrepareAsyncComplete(&context_, request, cq);
+    reader_->StartCall(this);
+  }
+
+  // returns false if the stream is done and can be deleted
+  bool proceed(bool ok) {
+    if (state_ == State::READ && ok) {
+      if (num_responses_++ == 0) {
+        ttft_ = absl::Now() - start_;
+      }
+    }
+    if (state_ == State::FINISH) {
+      std::lock_guard<std::mutex> lock(stats_->mutex);
+      stats_->num_responses += num_responses_;
+      if (status_.ok()) {
+        stats_->ttft_ms.push_back(absl::ToDoubleMilliseconds(ttft_));
+        stats_->e2e_ms.push_back(
+            absl::ToDoubleMilliseconds(absl::Now() - start_));
+      } else {
+        ++stats_->num_failures;
+      }
+      num_finished_->fetch_add(1);
+      return false;
+    }
+    if (ok) {
+      state_ = State::READ;
+      reader_->Read(&response_, this);
+    } else {
+      state_ = State::FINISH;
+      reader_->Finish(&status_, this);
+    }
+    return true;
+  }
+
+ private:
+  enum class State { START, READ, FINISH };
+  State state_ = State::START;
+
+  grpc::ClientContext context_;
+  proto::CompletionResponse response_;
+  std::unique_ptr<grpc::ClientAsyncReader<proto::CompletionResponse>> reader_;
+  grpc::Status status_;
+
+  absl::Time start_;
+  absl::Duration ttft_;
+  size_t num_responses_ = 0;
+
+  Stats* stats_;
+  std::atomic<size_t>* num_finished_;
+};
+
+double percentile(std::vector<double>& values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  const size_t idx = std::min(values.size() - 1,
+                              static_cast<size_t>(p * values.size()));
+  std::nth_element(values.begin(), values.begin() + idx, values.end());
+  return values[idx];
+}
+
+}  // namespace
+}  // namespace llm
+
+int main(int argc, char* argv[]) {
+  using namespace llm;
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  // start grpc server with the fake handler
+  FakeLLMHandler llm_handler(FLAGS_num_generator_threads,
+                             FLAGS_num_tokens,
+                             absl::Milliseconds(FLAGS_token_interval_ms));
+  const std::vector<std::string> models = {kModel};
+  GrpcServer grpc_server(
+      std::make_unique<CompletionHandler>(&llm_handler, models),
+      std::make_unique<ChatHandler>(&llm_handler, models),
+      std::make_unique<ModelsHandler>(models));
+  GrpcServer::Options options;
+  options.port = FLAGS_port;
+  options.num_threads = FLAGS_num_server_threads;
+  CHECK(grpc_server.start(options)) << "failed to start grpc server";
+
+  // one channel (connection) and completion queue for each client thread
+  const std::string address = "localhost:" + std::to_string(FLAGS_port);
+  Stats stats;
+  std::atomic<size_t> num_finished{0};
+  std::vector<std::unique_ptr<grpc::CompletionQueue>> cqs;
+  std::vector<std::unique_ptr<proto::Completion::Stub>> stubs;
+  for (int32_t i = 0; i < FLAGS_num_client_threads; ++i) {
+    grpc::ChannelArguments args;
+    args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+    stubs.push_back(proto::Completion::NewStub(grpc::CreateCustomChannel(
+        address, grpc::InsecureChannelCredentials(), args)));
+    cqs.push_back(std::make_unique<grpc::CompletionQueue>());
+  }
+
+  const absl::Time start = absl::Now();
+  std::vector<std::thread> client_threads;
+  for (int32_t i = 0; i < FLAGS_num_client_threads; ++i) {
+    client_threads.emplace_back([&, i]() {
+      void* tag = nullptr;
+      bool ok = false;
+      while (cqs[i]->Next(&tag, &ok)) {
+        auto* stream = static_cast<ClientStream*>(tag);
+        if (!stream->proceed(ok)) {
+          delete stream;
+        }
+      }
+    });
+  }
+  for (int32_t i = 0; i < FLAGS_num_streams; ++i) {
+    const size_t idx = i % FLAGS_num_client_threads;
+    new ClientStream(stubs[idx].get(), cqs[idx].get(), &stats, &num_finished);
+  }
+
+  // wait for all streams to finish
+  while (num_finished.load() < static_cast<size_t>(FLAGS_num_streams)) {
+    absl::SleepFor(absl::Milliseconds(10));
+  }
+  const double elapsed = absl::ToDoubleSeconds(absl::Now() - start);
+  for (auto& cq : cqs) {
+    cq->Shutdown();
+  }
+  for (auto& thread : client_threads) {
+    thread.join();
+  }
+  grpc_server.stop();
+
+  std::cout << "streams: " << FLAGS_num_streams
+            << ", failures: " << stats.num_failures
+            << ", elapsed: " << elapsed << "s\n"
+            << "responses/s: " << stats.num_responses / elapsed << "\n"
+            << "ttft ms p50: " << percentile(stats.ttft_ms, 0.5)
+            << ", p99: " << percentile(stats.ttft_ms, 0.99) << "\n"
+            << "e2e ms p50: " << percentile(stats.e2e_ms, 0.5)
+            << ", p99: " << percentile(stats.e2e_ms, 0.99) << "\n";
+  return 0;
+}
@@ -14,6 +14,7 @@ namespace llm {
 GrpcServer::~GrpcServer() { stop(); }
 
 bool GrpcServer::start(const Options& options) {
+  CHECK_GT(options.num_threads, 0) << "num_threads must be positive";
   std::string server_address =
       absl::StrFormat("%s:%d", options.address, options.port);
 
@@ -26,13 +27,34 @@ bool GrpcServer::start(const Options& options) {
   builder.RegisterService(&completion_service_);
   builder.RegisterService(&chat_service_);
   builder.RegisterService(models_handler_.get());
-  // Get hold of the completion queue used for the asynchronous communication
+  if (embedding_handler_ != nullptr) {
+    builder.RegisterService(&embedding_service_);
+  }
+  // Get hold of the completion queues used for the asynchronous communication
   // with the gRPC runtime.
-  cq_ = builder.AddCompletionQueue();
+  for (int32_t i = 0; i < options.num_threads; ++i) {
+    cqs_.push_back(builder.AddCompletionQueue());
+  }
   // Finally assemble the server.
   grpc_server_ = builder.BuildAndStart();
-  LOG(INFO) << "Started grpc server on " << server_address;
+  if (!grpc_server_) {
+    LOG(ERROR) << "Failed to start grpc server on " << server_address;
+    cqs_.clear();
+    return false;
+  }
+  LOG(INFO) << "Started grpc server on " << server_address << " with "
+            << options.num_threads << " completion queues";
+
+  // Proceed to the server's main loop, one thread for each completion queue.
+  for (auto& cq : cqs_) {
+    register_calls(cq.get());
+    handler_threads_.emplace_back(
+        [this, cq = cq.get()]() { handle_rpcs(cq); });
+  }
+  return true;
+}
 
+void GrpcServer::register_calls(grpc::ServerCompletionQueue* cq) {
   // Spawn a new CallData instance for complete request
   {
     auto on_register =
@@ -49,7 +71,7 @@ bool GrpcServer::start(const Options& options) {
       completion_handler_->complete_async(call_data);
     };
     // Spawn new CallData instances to serve new clients
-    new CompletionCallData(cq_.get(), on_register, on_request);
+    new CompletionCallData(cq, on_register, on_request);
   }
 
   // Spawn a new CallData instance for chat request
@@ -67,42 +89,59 @@ bool GrpcServer::start(const Options& options) {
     auto on_request = [this](ChatCallData* call_data) {
       chat_handler_->chat_async(call_data);
     };
-    new ChatCallData(cq_.get(), on_register, on_request);
+    new ChatCallData(cq, on_register, on_request);
   }
 
-  // Proceed to the server's main loop.
-  handler_thread_ = std::make_unique<std::thread>([this]() { handle_rpcs(); });
-  return true;
+  // Spawn a new CallData instance for embedding request
+  if (embedding_handler_ != nullptr) {
+    auto on_register =
+        [this](grpc::ServerContext* context,
+               proto::EmbeddingRequest* request,
+               grpc::ServerAsyncWriter<proto::EmbeddingResponse>* responder,
+               grpc::ServerCompletionQueue* new_call_cq,
+               grpc::ServerCompletionQueue* notification_cq,
+               void* tag) {
+          embedding_service_.RequestEmbed(
+              context, request, responder, new_call_cq, notification_cq, tag);
+        };
+    auto on_request = [this](EmbeddingCallData* call_data) {
+      embedding_handler_->embed_async(call_data);
+    };
+    new EmbeddingCallData(cq, on_register, on_request);
+  }
 }
 
 void GrpcServer::stop() {
   if (grpc_server_) {
     grpc_server_->Shutdown();
   }
-  // Always shutdown the completion queue after the server.
-  if (cq_) {
-    cq_->Shutdown();
+  // Always shutdown the completion queues after the server.
+  for (auto& cq : cqs_) {
+    cq->Shutdown();
   }
 
-  // wait for the handler thread to drain event queue
-  if (handler_thread_ && handler_thread_->joinable()) {
-    handler_thread_->join();
+  // wait for the handler threads to drain event queues
+  for (auto& thread : handler_threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
   }
 
   // release resources
   grpc_server_.reset();
-  cq_.reset();
-  handler_thread_.reset();
+  cqs_.clear();
+  handler_threads_.clear();
 }
 
-// This can be run in multiple threads if needed.
-void GrpcServer::handle_rpcs() {
+// Each completion queue is drained by its own thread, so all the events of a
+// call are processed sequentially on the same thread.
+void GrpcServer::handle_rpcs(grpc::ServerCompletionQueue* cq) {
   void* tag = nullptr;  // uniquely identifies a request.
   bool rpc_ok = false;
 
   // Block waiting to read the next event from the completion queue.
-  // returns if there is any kind of event or cq_ is shutting down.
-  while (cq_->Next(&tag, &rpc_ok)) {
+  // returns if there is any kind of event or cq is shutting down.
+  while (cq->Next(&tag, &rpc_ok)) {
     CallData* call_data = static_cast<CallData*>(tag);
     if (!call_data->proceed(rpc_ok)) {
       // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
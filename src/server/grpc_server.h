@@ -4,9 +4,11 @@
 
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "handlers/chat_handler.h"
 #include "handlers/completion_handler.h"
+#include "handlers/embedding_handler.h"
 #include "handlers/models_handler.h"
 
 namespace llm {
@@ -16,14 +18,20 @@ class GrpcServer final {
   struct Options {
     std::string address = "localhost";
     int32_t port = 8888;
+    // number of completion queues, each one is polled by its own thread.
+    // calls are pinned to the completion queue they are registered on.
+    int32_t num_threads = 4;
   };
 
+  // the embedding service is only registered if the handler is provided
   GrpcServer(std::unique_ptr<CompletionHandler> completion_handler,
              std::unique_ptr<ChatHandler> chat_handler,
-             std::unique_ptr<ModelsHandler> models_handler)
+             std::unique_ptr<ModelsHandler> models_handler,
+             std::unique_ptr<EmbeddingHandler> embedding_handler = nullptr)
       : completion_handler_(std::move(completion_handler)),
         chat_handler_(std::move(chat_handler)),
-        models_handler_(std::move(models_handler)) {}
+        models_handler_(std::move(models_handler)),
+        embedding_handler_(std::move(embedding_handler)) {}
 
   ~GrpcServer();
 
@@ -32,7 +40,10 @@ class GrpcServer final {
   void stop();
 
  private:
-  void handle_rpcs();
+  // register pending calls for all services on the completion queue
+  void register_calls(grpc::ServerCompletionQueue* cq);
+
+  void handle_rpcs(grpc::ServerCompletionQueue* cq);
 
   // handler for completion requests
   std::unique_ptr<CompletionHandler> completion_handler_;
@@ -43,16 +54,21 @@ class GrpcServer final {
   // handler for models requests
   std::unique_ptr<ModelsHandler> models_handler_;
 
+  // handler for embedding requests, optional
+  std::unique_ptr<EmbeddingHandler> embedding_handler_;
+
   // registed service
   proto::Completion::AsyncService completion_service_;
   proto::Chat::AsyncService chat_service_;
+  proto::Embeddings::AsyncService embedding_service_;
 
   // grpc server
   std::unique_ptr<grpc::Server> grpc_server_;
-  // completion queue: the producer-consumer queue where for asynchronous server
-  std::unique_ptr<grpc::ServerCompletionQueue> cq_;
-  // thread for handling rpcs
-  std::unique_ptr<std::thread> handler_thread_;
+  // completion queues: the producer-consumer queues where for asynchronous
+  // server notifications.
+  std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+  // threads for handling rpcs, one for each completion queue
+  std::vector<std::thread> handler_threads_;
 };
 
 }  // namespace llm
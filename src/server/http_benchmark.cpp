@@ -0,0 +1,264 @@
+// Load test for openai compatible http endpoints. It sends streaming
+// completion requests with a fixed concurrency to one or more targets, e.g.
+// the native http server and the grpc gateway, and compares the latency
+// observed by clients.
+//
+// To compare against the gateway without a model, start the fake servers:
+//   http_benchmark --fake_server --targets=
+//   gateway --grpc-server=127.0.0.1:8891 --http-server=0.0.0.0:8080
+//   http_benchmark --targets=native=localhost:9991,gateway=localhost:8080
+#include <absl/strings/str_split.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <csignal>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fake_llm_handler.h"
+#include "grpc_server.h"
+#include "handlers/chat_handler.h"
+#include "handlers/completion_handler.h"
+#include "handlers/models_handler.h"
+#include "http_server.h"
+#include "openai_http_handler.h"
+
+DEFINE_string(targets,
+              "native=localhost:9991",
+              "comma separated list of name=host:port to benchmark");
+DEFINE_string(model, "fake-model", "model name sent with requests.");
+DEFINE_string(prompt, "hello", "prompt sent with requests.");
+DEFINE_int32(max_tokens, 64, "max tokens for each request.");
+DEFINE_int32(num_requests, 1000, "number of requests for each target.");
+DEFINE_int32(concurrency, 64, "number of concurrent requests.");
+
+DEFINE_bool(fake_server,
+            false,
+            "start http and grpc servers with a fake handler in process.");
+DEFINE_int32(fake_http_port, 9991, "http port of the fake server.");
+DEFINE_int32(fake_grpc_port, 8891, "grpc port of the fake server.");
+DEFINE_int32(fake_token_interval_ms, 10, "token interval of the fake server.");
+
+namespace llm {
+namespace {
+
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+struct Stats {
+  std::mutex mutex;
+  std::vector<double> ttft_ms;
+  std::vector<double> itl_ms;
+  std::vector<double> e2e_ms;
+  size_t num_failures = 0;
+};
+
+// a blocking http/1.1 client that reuses its connection between requests
+class Client {
+ public:
+  Client(std::string host, std::string port)
+      : host_(std::move(host)), port_(std::move(port)) {}
+
+  // send a streaming completion request and record the latency
+  bool run_once(Stats* stats) {
+    if (!stream_) {
+      tcp::resolver resolver(ioc_);
+      stream_ = std::make_unique<beast::tcp_stream>(ioc_);
+      beast::error_code ec;
+      stream_->connect(resolver.resolve(host_, port_), ec);
+      if (ec) {
+        stream_.reset();
+        return false;
+      }
+    }
+
+    const nlohmann::json body = {{"model", FLAGS_model},
+                                 {"prompt", FLAGS_prompt},
+                                 {"max_tokens", FLAGS_max_tokens},
+                                 {"stream", true}};
+    http::request<http::string_body> req{
+        http::verb::post, "/v1/completions", 11};
+    req.set(http::field::host, host_);
+    req.set(http::field::content_type, "application/json");
+    req.keep_alive(true);
+    req.body() = body.dump();
+    req.prepare_payload();
+
+    const absl::Time start = absl::Now();
+    std::optional<absl::Time> last_chunk;
+    std::vector<double> itl_ms;
+    double ttft_ms = 0;
+
+    beast::error_code ec;
+    http::write(*stream_, req, ec);
+    http::response_parser<http::string_body> parser;
+    parser.body_limit(boost::none);
+    // each chunk carries one or more events
+    auto on_chunk = [&](uint64_t /*remain*/,
+                        beast::string_view chunk,
+                        beast::error_code& /*ec*/) -> size_t {
+      const absl::Time now = absl::Now();
+      if (!last_chunk.has_value()) {
+        ttft_ms = absl::ToDoubleMilliseconds(now - start);
+      } else {
+        itl_ms.push_back(absl::ToDoubleMilliseconds(now - *last_chunk));
+      }
+      last_chunk = now;
+      return chunk.size();
+    };
+    parser.on_chunk_body(on_chunk);
+    beast::flat_buffer buffer;
+    if (!ec) {
+      http::read(*stream_, buffer, parser, ec);
+    }
+    if (ec || parser.get().result() != http::status::ok) {
+      stream_.reset();
+      return false;
+    }
+    if (!parser.get().keep_alive()) {
+      stream_.reset();
+    }
+
+    std::lock_guard<std::mutex> lock(stats->mutex);
+    stats->ttft_ms.push_back(ttft_ms);
+    stats->itl_ms.insert(stats->itl_ms.end(), itl_ms.begin(), itl_ms.end());
+    stats->e2e_ms.push_back(absl::ToDoubleMilliseconds(absl::Now() - start));
+    return true;
+  }
+
+ private:
+  std::string host_;
+  std::string port_;
+  net::io_context ioc_;
+  std::unique_ptr<beast::tcp_stream> stream_;
+};
+
+double percentile(std::vector<double>& values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  const size_t idx = std::min(values.size() - 1,
+                              static_cast<size_t>(p * values.size()));
+  std::nth_element(values.begin(), values.begin() + idx, values.end());
+  return values[idx];
+}
+
+void run_target(const std::string& name, const std::string& address) {
+  const std::vector<std::string> host_port = absl::StrSplit(address, ':');
+  CHECK_EQ(host_port.size(), 2) << "invalid address: " << address;
+
+  Stats stats;
+  std::atomic<int32_t> next_request{0};
+  const absl::Time start = absl::Now();
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < FLAGS_concurrency; ++i) {
+    threads.emplace_back([&]() {
+      Client client(host_port[0], host_port[1]);
+      while (next_request.fetch_add(1) < FLAGS_num_requests) {
+        if (!client.run_once(&stats)) {
+          std::lock_guard<std::mutex> lock(stats.mutex);
+          ++stats.num_failures;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const double elapsed = absl::ToDoubleSeconds(absl::Now() - start);
+
+  std::cout << "[" << name << "] " << address
+            << " requests: " << FLAGS_num_requests
+            << ", failures: " << stats.num_failures
+            << ", requests/s: " << FLAGS_num_requests / elapsed << "\n"
+            << "  ttft ms p50: " << percentile(stats.ttft_ms, 0.5)
+            << ", p99: " << percentile(stats.ttft_ms, 0.99) << "\n"
+            << "  itl  ms p50: " << percentile(stats.itl_ms, 0.5)
+            << ", p99: " << percentile(stats.itl_ms, 0.99) << "\n"
+            << "  e2e  ms p50: " << percentile(stats.e2e_ms, 0.5)
+            << ", p99: " << percentile(stats.e2e_ms, 0.99) << "\n";
+}
+
+}  // namespace
+}  // namespace llm
+
+int main(int argc, char* argv[]) {
+  using namespace llm;
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  // block signals before spawning threads so that they can be waited on
+  const bool serve_forever = FLAGS_fake_server && FLAGS_targets.empty();
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  if (serve_forever) {
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  }
+
+  // optionally serve both the native http endpoint and the grpc endpoint (for
+  // the gateway) with a fake handler
+  std::unique_ptr<FakeLLMHandler> llm_handler;
+  std::unique_ptr<OpenAIHttpHandler> openai_handler;
+  std::unique_ptr<HttpServer> http_server;
+  std::unique_ptr<GrpcServer> grpc_server;
+  if (FLAGS_fake_server) {
+    llm_handler = std::make_unique<FakeLLMHandler>(
+        /*num_threads=*/2,
+        FLAGS_max_tokens,
+        absl::Milliseconds(FLAGS_fake_token_interval_ms));
+    const std::vector<std::string> models = {FLAGS_model};
+    openai_handler =
+        std::make_unique<OpenAIHttpHandler>(llm_handler.get(), models);
+    http_server = std::make_unique<HttpServer>();
+    CHECK(openai_handler->register_endpoints(http_server.get()));
+    CHECK(http_server->start(FLAGS_fake_http_port, /*num_threads=*/4));
+
+    grpc_server = std::make_unique<GrpcServer>(
+        std::make_unique<CompletionHandler>(llm_handler.get(), models),
+        std::make_unique<ChatHandler>(llm_handler.get(), models),
+        std::make_unique<ModelsHandler>(models));
+    GrpcServer::Options options;
+    options.address = "0.0.0.0";
+    options.port = FLAGS_fake_grpc_port;
+    CHECK(grpc_server->start(options));
+  }
+
+  for (const auto& target : absl::StrSplit(FLAGS_targets, ',')) {
+    if (target.empty()) {
+      continue;
+    }
+    const std::vector<std::string> name_address = absl::StrSplit(target, '=');
+    CHECK_EQ(name_address.size(), 2) << "invalid target: " << target;
+    run_target(name_address[0], name_address[1]);
+  }
+
+  // keep serving until interrupted when there is no target to benchmark
+  if (serve_forever) {
+    int signal = 0;
+    sigwait(&signals, &signal);
+  }
+
+  if (grpc_server) {
+    grpc_server->stop();
+  }
+  if (http_server) {
+    http_server->stop();
+  }
+  return 0;
+}
@@ -1,80 +1,395 @@
 #include "http_server.h"
 
+#include <absl/strings/str_format.h>
 #include <glog/logging.h>
 
+#include <atomic>
 #include <boost/asio.hpp>
 #include <boost/beast.hpp>
+#include <chrono>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
 #include <utility>
 
 namespace llm {
 
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+namespace net = boost::asio;
+
+namespace {
+// close idle keep-alive connections after this timeout
+constexpr auto kIdleTimeout = std::chrono::seconds(60);
+
+// max number of writes waiting to be sent to a client, a client that can't
+// keep up with the stream is considered gone.
+constexpr size_t kMaxPendingWrites = 4096;
+
+template <typename Body>
+std::string serialize(http::response<Body>& res) {
+  res.prepare_payload();
+  std::ostringstream os;
+  os << res;
+  return os.str();
+}
+
+// wrap data into a chunk of chunked transfer encoding
+std::string to_chunk(const std::string& data) {
+  return absl::StrFormat("%x\r\n%s\r\n", data.size(), data);
+}
+
+}  // namespace
+
+// A session serves all requests of a connection sequentially. All member
+// functions run on the strand of the connection, except post_write.
+class HttpServer::Session : public std::enable_shared_from_this<Session> {
+ public:
+  Session(tcp::socket&& socket, HttpServer* server)
+      : stream_(std::move(socket)), server_(server) {}
+
+  void start() {
+    net::dispatch(stream_.get_executor(),
+                  [self = shared_from_this()]() { self->do_read(); });
+  }
+
+  const Request& request() const { return request_; }
+
+  bool keep_alive() const { return keep_alive_; }
+
+  bool is_open() const { return !closed_.load(std::memory_order_relaxed); }
+
+  // queue data to be sent to the client, can be called from any thread.
+  // 'last' marks the end of the current response.
+  bool post_write(std::string data, bool last) {
+    if (!is_open()) {
+      return false;
+    }
+    if (num_pending_writes_.fetch_add(1, std::memory_order_relaxed) >=
+        kMaxPendingWrites) {
+      LOG(WARNING) << "Client is too slow, closing the connection";
+      closed_.store(true, std::memory_order_relaxed);
+    }
+    net::post(stream_.get_executor(),
+              [self = shared_from_this(), data = std::move(data), last]() {
+                self->queue_write(std::move(data), last);
+              });
+    return is_open();
+  }
+
+  // send a complete response on the strand
+  template <typename Body>
+  void write_response(http::response<Body>& res) {
+    num_pending_writes_.fetch_add(1, std::memory_order_relaxed);
+    queue_write(serialize(res), /*last=*/true);
+  }
+
+ private:
+  void do_read() {
+    // reset the request for each read
+    request_ = {};
+    stream_.expires_after(kIdleTimeout);
+    http::async_read(
+        stream_,
+        buffer_,
+        request_,
+        [self = shared_from_this()](beast::error_code ec, size_t /*bytes*/) {
+          self->on_read(ec);
+        });
+  }
+
+  void on_read(beast::error_code ec) {
+    if (ec == http::error::end_of_stream) {
+      do_close();
+      return;
+    }
+    if (ec) {
+      if (ec != beast::error::timeout && ec != net::error::operation_aborted) {
+        LOG(ERROR) << "Error in reading request: " << ec.message();
+      }
+      closed_.store(true, std::memory_order_relaxed);
+      return;
+    }
+    // no timeout for long running responses
+    stream_.expires_never();
+    keep_alive_ = request_.keep_alive();
+    try {
+      server_->handle_request(shared_from_this());
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "Exception in processing request: " << e.what();
+      http::response<http::string_body> res{
+          http::status::internal_server_error, request_.version()};
+      res.keep_alive(false);
+      keep_alive_ = false;
+      write_response(res);
+    }
+  }
+
+  void queue_write(std::string data, bool last) {
+    if (closed_.load(std::memory_order_relaxed)) {
+      num_pending_writes_.fetch_sub(1, std::memory_order_relaxed);
+      if (!writing_) {
+        do_close();
+      }
+      return;
+    }
+    write_queue_.push_back(std::move(data));
+    response_done_ = response_done_ || last;
+    if (!writing_) {
+      do_write();
+    }
+  }
+
+  void do_write() {
+    if (write_queue_.empty()) {
+      writing_ = false;
+      if (response_done_) {
+        response_done_ = false;
+        // read the next request for keep-alive connections
+        if (keep_alive_) {
+          do_read();
+        } else {
+          do_close();
+        }
+      }
+      return;
+    }
+    writing_ = true;
+    net::async_write(
+        stream_,
+        net::buffer(write_queue_.front()),
+        [self = shared_from_this()](beast::error_code ec, size_t /*bytes*/) {
+          self->on_write(ec);
+        });
+  }
+
+  void on_write(beast::error_code ec) {
+    num_pending_writes_.fetch_sub(1, std::memory_order_relaxed);
+    if (ec) {
+      // client has disconnected
+      closed_.store(true, std::memory_order_relaxed);
+      num_pending_writes_.fetch_sub(write_queue_.size() - 1,
+                                    std::memory_order_relaxed);
+      write_queue_.clear();
+      writing_ = false;
+      return;
+    }
+    write_queue_.pop_front();
+    do_write();
+  }
+
+  void do_close() {
+    closed_.store(true, std::memory_order_relaxed);
+    beast::error_code ec;
+    stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
+  }
+
+  beast::tcp_stream stream_;
+  beast::flat_buffer buffer_;
+  Request request_;
+  HttpServer* server_;
+
+  // whether to keep the connection alive after the current response
+  bool keep_alive_ = false;
+
+  // pending writes of the current connection
+  std::deque<std::string> write_queue_;
+  bool writing_ = false;
+  bool response_done_ = false;
+
+  std::atomic<size_t> num_pending_writes_{0};
+  std::atomic<bool> closed_{false};
+};
+
+// Channel for replying to asynchronous requests, it holds the session alive
+// until the response is finished.
+class HttpServer::SessionChannel final : public HttpServer::Channel {
+ public:
+  SessionChannel(std::shared_ptr<Session> session,
+                 unsigned version,
+                 bool keep_alive)
+      : session_(std::move(session)),
+        version_(version),
+        keep_alive_(keep_alive) {}
+
+  ~SessionChannel() override {
+    if (!finished_) {
+      LOG(ERROR) << "Request is not replied, sending internal error";
+      send_response(static_cast<int>(http::status::internal_server_error),
+                    "",
+                    "text/plain");
+    }
+  }
+
+  bool send_response(int status_code,
+                     std::string body,
+                     const std::string& mime_type) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (finished_) {
+      return false;
+    }
+    finished_ = true;
+    if (headers_sent_) {
+      // event stream has started, end the stream instead
+      return session_->post_write(to_chunk(""), /*last=*/true);
+    }
+
+    http::response<http::string_body> res{
+        static_cast<http::status>(status_code), version_};
+    res.set(http::field::content_type, mime_type);
+    res.keep_alive(keep_alive_);
+    res.body() = std::move(body);
+    return session_->post_write(serialize(res), /*last=*/true);
+  }
+
+  bool send_event(const std::string& data) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (finished_) {
+      return false;
+    }
+    std::string chunk;
+    if (!headers_sent_) {
+      chunk = event_stream_headers();
+      headers_sent_ = true;
+    }
+    chunk += to_chunk(absl::StrFormat("data: %s\n\n", data));
+    return session_->post_write(std::move(chunk), /*last=*/false);
+  }
+
+  bool finish() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (finished_) {
+      return false;
+    }
+    finished_ = true;
+    std::string chunk;
+    if (!headers_sent_) {
+      chunk = event_stream_headers();
+      headers_sent_ = true;
+    }
+    // the last chunk of chunked transfer encoding
+    chunk += to_chunk("");
+    return session_->post_write(std::move(chunk), /*last=*/true);
+  }
+
+  bool is_open() const override { return session_->is_open(); }
+
+ private:
+  std::string event_stream_headers() const {
+    http::response<http::empty_body> res{http::status::ok, version_};
+    res.set(http::field::content_type, "text/event-stream");
+    res.set(http::field::cache_control, "no-cache");
+    res.keep_alive(keep_alive_);
+    res.chunked(true);
+    std::ostringstream os;
+    os << res.base();
+    return os.str();
+  }
+
+  std::shared_ptr<Session> session_;
+  unsigned version_;
+  bool keep_alive_;
+
+  std::mutex mutex_;
+  bool headers_sent_ = false;
+  bool finished_ = false;
+};
+
+HttpServer::~HttpServer() { stop(); }
+
 bool HttpServer::register_uri(const std::string& uri,
                               HttpServer::Handler handler) {
-  if (endpoints_.count(uri) != 0) {
+  if (endpoints_.count(uri) != 0 || async_endpoints_.count(uri) != 0) {
     return false;
   }
   endpoints_[uri] = handler;
   return true;
 }
 
-void HttpServer::async_accept(tcp::acceptor& acceptor) {
-  // create a new socket
-  const auto socket = std::make_shared<tcp::socket>(*io_context_);
-  acceptor.async_accept(
-      *socket, [this, &acceptor, socket](boost::system::error_code ec) {
-        // loop to accept new incoming connections
-        async_accept(acceptor);
+bool HttpServer::register_async_uri(const std::string& uri,
+                                    HttpServer::AsyncHandler handler) {
+  if (endpoints_.count(uri) != 0 || async_endpoints_.count(uri) != 0) {
+    return false;
+  }
+  async_endpoints_[uri] = handler;
+  return true;
+}
 
+void HttpServer::async_accept() {
+  // each connection gets its own strand
+  acceptor_->async_accept(
+      net::make_strand(*io_context_),
+      [this](beast::error_code ec, tcp::socket socket) {
+        if (ec == net::error::operation_aborted) {
+          // the server is stopping
+          return;
+        }
         if (!ec) {
-          try {
-            // handle the request
-            handle_request(*socket);
-          } catch (const std::exception& e) {
-            LOG(ERROR) << "Exception in processing request: " << e.what();
-          }
+          std::make_shared<Session>(std::move(socket), this)->start();
         } else {
           LOG(ERROR) << "Error in accepting connection: " << ec.message();
         }
+        // loop to accept new incoming connections
+        async_accept();
       });
 }
 
-void HttpServer::handle_request(tcp::socket& socket) {
-  // process the request
-  boost::beast::flat_buffer buffer;
-  boost::beast::http::request<boost::beast::http::string_body> req;
-  boost::beast::http::read(socket, buffer, req);
-  boost::beast::http::response<boost::beast::http::string_body> res;
+void HttpServer::handle_request(const std::shared_ptr<Session>& session) {
+  const auto& req = session->request();
+  // ignore the query string
+  std::string target(req.target());
+  if (const auto pos = target.find('?'); pos != std::string::npos) {
+    target.resize(pos);
+  }
+
+  if (auto it = async_endpoints_.find(target); it != async_endpoints_.end()) {
+    auto channel = std::make_shared<SessionChannel>(
+        session, req.version(), session->keep_alive());
+    it->second(req, std::move(channel));
+    return;
+  }
+
+  http::response<http::string_body> res;
   res.version(req.version());
-  res.keep_alive(req.keep_alive());
-  const std::string target = req.target();
+  res.keep_alive(session->keep_alive());
   auto it = endpoints_.find(target);
   if (it == endpoints_.end()) {
-    res.result(boost::beast::http::status::not_found);
+    res.result(http::status::not_found);
     res.body() = "The resource '" + target + "' was not found.";
-    res.set(boost::beast::http::field::content_type, "text/plain");
+    res.set(http::field::content_type, "text/plain");
   } else {
     auto& handler = it->second;
     Transport transport(&res);
     if (!handler(transport)) {
-      res.result(boost::beast::http::status::internal_server_error);
+      res.result(http::status::internal_server_error);
       res.body() = "An error occurred processing the request.";
-      res.set(boost::beast::http::field::content_type, "text/plain");
+      res.set(http::field::content_type, "text/plain");
     }
   }
-  boost::beast::http::write(socket, res);
-  socket.shutdown(tcp::socket::shutdown_send);
+  session->write_response(res);
 }
 
 bool HttpServer::start(uint16_t port, int32_t num_threads) {
-  io_context_ = std::make_unique<boost::asio::io_context>(num_threads);
+  io_context_ = std::make_unique<net::io_context>(num_threads);
+  try {
+    const tcp::endpoint endpoint{tcp::v4(), port};
+    acceptor_ = std::make_unique<tcp::acceptor>(*io_context_);
+    acceptor_->open(endpoint.protocol());
+    acceptor_->set_option(net::socket_base::reuse_address(true));
+    acceptor_->bind(endpoint);
+    acceptor_->listen(net::socket_base::max_listen_connections);
+  } catch (const std::exception& e) {
+    LOG(ERROR) << "Failed to listen on port " << port << ": " << e.what();
+    acceptor_.reset();
+    return false;
+  }
+  async_accept();
 
-  thread_ = std::thread([this, port] {
-    tcp::acceptor acceptor{*io_context_, tcp::endpoint{tcp::v4(), port}};
-    async_accept(acceptor);
-    io_context_->run();
-  });
+  for (int32_t i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this] { io_context_->run(); });
+  }
   LOG(INFO) << "Started http server on 0.0.0.0:" << port;
   return true;
 }
@@ -84,11 +399,16 @@ void HttpServer::stop() {
   if (io_context_) {
     io_context_->stop();
   }
-  // wait for thread to finish
-  if (thread_.joinable()) {
-    thread_.join();
+  // wait for threads to finish
+  for (auto& thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
   }
+  threads_.clear();
+  acceptor_.reset();
   endpoints_.clear();
+  async_endpoints_.clear();
 }
 
 bool HttpServer::Transport::send_string(const std::string& data,
@@ -104,4 +424,4 @@ bool HttpServer::Transport::send_status(int status_code) {
   return true;
 }
 
-}  // namespace llm
\ No newline at end of file
+}  // namespace llm
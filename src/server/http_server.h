@@ -8,20 +8,32 @@
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace llm {
 using tcp = boost::asio::ip::tcp;
-// a simple http server based on civetweb for serving model metrics and health
-// check endpoints
+// an asynchronous http/1.1 server based on boost beast with keep-alive
+// connections. besides simple endpoints like metrics and health check, it
+// supports long running requests that reply with server-sent events.
 class HttpServer {
  public:
   class Transport;
+  class Channel;
+  using Request = boost::beast::http::request<boost::beast::http::string_body>;
   using Handler = std::function<bool(Transport&)>;
+  // handler for long running requests, the handler must reply through the
+  // channel, which can outlive the handler call and be used from any thread.
+  using AsyncHandler =
+      std::function<void(const Request& request, std::shared_ptr<Channel>)>;
 
   HttpServer() = default;
 
+  ~HttpServer();
+
   bool register_uri(const std::string& uri, Handler handler);
 
+  bool register_async_uri(const std::string& uri, AsyncHandler handler);
+
   bool start(uint16_t port, int32_t num_threads);
 
   void stop();
@@ -52,16 +64,49 @@ class HttpServer {
     bool send_status(int status_code);
   };
 
+  /**
+   * Reply channel for asynchronous handlers. Either send a complete response
+   * with send_response(), or stream server-sent events with send_event() and
+   * end the stream with finish(). All methods are thread safe, and return
+   * false if the client has disconnected or is too slow to keep up.
+   */
+  class Channel {
+   public:
+    virtual ~Channel() = default;
+
+    // send a complete response and finish the request
+    virtual bool send_response(
+        int status_code,
+        std::string body,
+        const std::string& mime_type = "application/json") = 0;
+
+    // send data as a server-sent event, headers are sent with the first event
+    virtual bool send_event(const std::string& data) = 0;
+
+    // finish the event stream
+    virtual bool finish() = 0;
+
+    // returns true if the connection is still open
+    virtual bool is_open() const = 0;
+  };
+
  private:
-  void async_accept(tcp::acceptor& acceptor);
-  void handle_request(tcp::socket& socket);
+  class Session;
+  class SessionChannel;
+
+  void async_accept();
+
+  // dispatch the request to the registered handler
+  void handle_request(const std::shared_ptr<Session>& session);
 
   // hold the ownership of all request handlers
   std::unordered_map<std::string, Handler> endpoints_;
+  std::unordered_map<std::string, AsyncHandler> async_endpoints_;
 
-  // io_context and thread for running the server
+  // io_context and threads for running the server
   std::unique_ptr<boost::asio::io_context> io_context_;
-  std::thread thread_;
+  std::unique_ptr<tcp::acceptor> acceptor_;
+  std::vector<std::thread> threads_;
 };
 
-}  // namespace llm
\ No newline at end of file
+}  // namespace llm
@@ -1,5 +1,6 @@
 #include <absl/strings/numbers.h>
 #include <absl/strings/str_split.h>
+#include <absl/strings/strip.h>
 #include <folly/init/Init.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -12,16 +13,29 @@
 #include <optional>
 
 #include "common/metrics.h"
+#include "common/tracing.h"
 #include "grpc_server.h"
 #include "handlers/chat_handler.h"
 #include "handlers/completion_handler.h"
+#include "handlers/embedding_handler.h"
 #include "handlers/llm_handler.h"
 #include "handlers/models_handler.h"
 #include "http_server.h"
+#include "openai_http_handler.h"
 using namespace llm;
 
 DEFINE_int32(http_port, 9999, "Port for http server.");
+DEFINE_int32(http_num_threads, 4, "Number of threads for http server.");
+DEFINE_int32(openai_http_port,
+             8000,
+             "Port for the OpenAI compatible http api, 0 to disable it.");
+DEFINE_int32(openai_http_num_threads,
+             4,
+             "Number of threads for the OpenAI compatible http api.");
 DEFINE_int32(grpc_port, 8888, "Port for grpc server.");
+DEFINE_int32(grpc_num_threads,
+             4,
+             "Number of completion queues and polling threads for grpc server.");
 
 DEFINE_string(model_id, "", "hf model name.");
 
@@ -40,6 +54,21 @@ DEFINE_string(
     "Device to run the draft model on, e.g. cpu, cuda:0, cuda:0,cuda:1, or "
     "auto to use all available gpus.");
 
+DEFINE_string(prefill_device,
+              "",
+              "Experimental: device to run prefill on with a separate engine, "
+              "e.g. cpu, cuda:1. Empty to run prefill and decode together.");
+
+DEFINE_int32(num_replicas,
+             1,
+             "Number of data parallel replicas, devices are split evenly "
+             "among replicas.");
+
+DEFINE_int32(max_chat_sessions,
+             1024,
+             "Max number of chat sessions to keep token ids of the last turn "
+             "for, 0 to disable.");
+
 static constexpr int64_t GB = int64_t(1024) * 1024 * 1024;
 
 DEFINE_int32(block_size, 16, "slots per block, value must be multiple of 16");
@@ -58,6 +87,10 @@ DEFINE_bool(enable_cuda_graph,
             true,
             "Enable CUDA Graph to optimize model execution.");
 
+DEFINE_int64(max_cpu_activation_cache_size,
+             2 * GB,
+             "max bytes of activation buffers cached on cpu, 0 to disable.");
+
 DEFINE_int64(cuda_graph_max_seq_len,
              2048,
              "max sequence length used to capture cuda graphs");
@@ -71,12 +104,58 @@ DEFINE_string(
     "",
     "batch sizes to capture cuda graphs for draft model, comma separated list");
 
+DEFINE_bool(enable_vocab_parallel_sampling,
+            false,
+            "Sample from logits sharded along the vocab across devices "
+            "without gathering the full logits.");
+
 DEFINE_int32(max_tokens_per_batch, 512, "max number of tokens per batch");
 
 DEFINE_int32(max_seqs_per_batch, 128, "max number of sequences per batch");
 
 DEFINE_int32(num_speculative_tokens, 0, "number of speculative tokens");
 
+DEFINE_int32(num_decode_steps,
+             1,
+             "number of decode steps to run back to back for decode batches");
+
+DEFINE_double(max_queue_wait_high,
+              0.0,
+              "max estimated seconds a prompt waits to be scheduled before new "
+              "high priority requests are rejected, 0 for no limit");
+DEFINE_double(max_queue_wait_normal,
+              0.0,
+              "max estimated seconds a prompt waits to be scheduled before new "
+              "normal priority requests are rejected, 0 for no limit");
+DEFINE_double(max_queue_wait_low,
+              0.0,
+              "max estimated seconds a prompt waits to be scheduled before new "
+              "low priority requests are rejected, 0 for no limit");
+
+DEFINE_double(max_kv_demand_high,
+              0.0,
+              "max ratio of kv cache demand to its capacity before new high "
+              "priority requests are rejected, 0 for no limit");
+DEFINE_double(max_kv_demand_normal,
+              0.0,
+              "max ratio of kv cache demand to its capacity before new normal "
+              "priority requests are rejected, 0 for no limit");
+DEFINE_double(max_kv_demand_low,
+              0.0,
+              "max ratio of kv cache demand to its capacity before new low "
+              "priority requests are rejected, 0 for no limit");
+
+DEFINE_string(trace_output,
+              "",
+              "file to write request traces to, tracing is disabled if empty.");
+
+DEFINE_string(trace_format, "chrome", "format of request traces, chrome/otlp.");
+
+DEFINE_double(trace_sample_rate,
+              0.01,
+              "fraction of requests to trace. requests with a traceparent "
+              "follow the sampling decision of the caller.");
+
 // NOLINTNEXTLINE
 static std::atomic<uint32_t> signal_received{0};
 void shutdown_handler(int signal) {
@@ -128,6 +207,15 @@ int main(int argc, char** argv) {
     FLAGS_model_id = std::filesystem::path(FLAGS_model_path).filename();
   }
 
+  if (!FLAGS_trace_output.empty()) {
+    LOG(INFO) << "Writing request traces to " << FLAGS_trace_output;
+    Tracer::Options tracer_options;
+    tracer_options.sample_rate(FLAGS_trace_sample_rate);
+    Tracer::set_global(std::make_shared<Tracer>(
+        tracer_options,
+        create_trace_exporter(FLAGS_trace_format, FLAGS_trace_output)));
+  }
+
   HttpServer http_server;
   http_server.register_uri("/gflags",
                            [](HttpServer::Transport& transport) -> bool {
@@ -161,47 +249,106 @@ int main(int argc, char** argv) {
       .devices(FLAGS_device)
       .draft_model_path(FLAGS_draft_model_path)
       .draft_devices(FLAGS_draft_device)
+      .prefill_devices(FLAGS_prefill_device)
+      .num_replicas(FLAGS_num_replicas)
+      .max_chat_sessions(FLAGS_max_chat_sessions)
       .block_size(FLAGS_block_size)
       .max_cache_size(FLAGS_max_cache_size)
       .max_memory_utilization(FLAGS_max_memory_utilization)
       .enable_prefix_cache(FLAGS_enable_prefix_cache)
       .enable_cuda_graph(FLAGS_enable_cuda_graph)
+      .max_cpu_activation_cache_size(FLAGS_max_cpu_activation_cache_size)
       .cuda_graph_max_seq_len(FLAGS_cuda_graph_max_seq_len)
       .cuda_graph_batch_sizes(parse_batch_sizes(FLAGS_cuda_graph_batch_sizes))
       .draft_cuda_graph_batch_sizes(
           parse_batch_sizes(FLAGS_draft_cuda_graph_batch_sizes))
+      .enable_vocab_parallel_sampling(FLAGS_enable_vocab_parallel_sampling)
       .max_tokens_per_batch(FLAGS_max_tokens_per_batch)
       .max_seqs_per_batch(FLAGS_max_seqs_per_batch)
-      .num_speculative_tokens(FLAGS_num_speculative_tokens);
+      .num_speculative_tokens(FLAGS_num_speculative_tokens)
+      .num_decode_steps(FLAGS_num_decode_steps)
+      .max_queue_wait_high(FLAGS_max_queue_wait_high)
+      .max_queue_wait_normal(FLAGS_max_queue_wait_normal)
+      .max_queue_wait_low(FLAGS_max_queue_wait_low)
+      .max_kv_demand_high(FLAGS_max_kv_demand_high)
+      .max_kv_demand_normal(FLAGS_max_kv_demand_normal)
+      .max_kv_demand_low(FLAGS_max_kv_demand_low);
 
   auto llm_handler = std::make_unique<LLMHandler>(options);
   llm_handler->start();
 
+  // profiles of the latest engine steps, /debug/steps?n=<num steps>
+  http_server.register_async_uri(
+      "/debug/steps",
+      [handler = llm_handler.get()](const HttpServer::Request& request,
+                                    std::shared_ptr<HttpServer::Channel>
+                                        channel) {
+        const StepProfiler* profiler = handler->step_profiler();
+        if (profiler == nullptr) {
+          channel->send_response(
+              404, "step profiler is not available\n", "text/plain");
+          return;
+        }
+        size_t num_steps = profiler->capacity();
+        const std::string target(request.target());
+        if (const auto pos = target.find('?'); pos != std::string::npos) {
+          for (absl::string_view param :
+               absl::StrSplit(target.substr(pos + 1), '&')) {
+            size_t n = 0;
+            if (absl::ConsumePrefix(&param, "n=") &&
+                absl::SimpleAtoi(param, &n)) {
+              num_steps = n;
+            }
+          }
+        }
+        channel->send_response(
+            200, profiler->to_json(num_steps), "application/json");
+      });
+
   // supported models
   std::vector<std::string> models = {FLAGS_model_id};
   auto completion_handler =
       std::make_unique<CompletionHandler>(llm_handler.get(), models);
   auto chat_handler = std::make_unique<ChatHandler>(llm_handler.get(), models);
   auto models_handler = std::make_unique<ModelsHandler>(models);
+  auto embedding_handler =
+      std::make_unique<EmbeddingHandler>(llm_handler.get(), models);
+
+  // serve openai compatible apis over http directly, on a port of their own
+  // apart from the instrument endpoints.
+  OpenAIHttpHandler openai_handler(llm_handler.get(), models);
+  HttpServer openai_http_server;
+  CHECK(openai_handler.register_endpoints(&openai_http_server))
+      << "Failed to register openai endpoints";
 
   // start grpc server
   GrpcServer grpc_server(std::move(completion_handler),
                          std::move(chat_handler),
-                         std::move(models_handler));
+                         std::move(models_handler),
+                         std::move(embedding_handler));
   GrpcServer::Options grpc_options;
   grpc_options.address = "0.0.0.0";
   grpc_options.port = FLAGS_grpc_port;
+  grpc_options.num_threads = FLAGS_grpc_num_threads;
 
   if (!grpc_server.start(grpc_options)) {
     LOG(ERROR) << "failed to start grpc server on port " << FLAGS_grpc_port;
     return -1;
   }
 
-  if (!http_server.start(FLAGS_http_port, /*num_threads=*/2)) {
+  if (!http_server.start(FLAGS_http_port, FLAGS_http_num_threads)) {
     LOG(ERROR) << "Failed to start http server on port " << FLAGS_http_port;
     return -1;
   }
 
+  if (FLAGS_openai_http_port > 0 &&
+      !openai_http_server.start(FLAGS_openai_http_port,
+                                FLAGS_openai_http_num_threads)) {
+    LOG(ERROR) << "Failed to start openai http server on port "
+               << FLAGS_openai_http_port;
+    return -1;
+  }
+
   // install graceful shutdown handler
   (void)signal(SIGINT, shutdown_handler);
   (void)signal(SIGTERM, shutdown_handler);
@@ -213,6 +360,9 @@ int main(int argc, char** argv) {
   // stop grpc server and http server
   grpc_server.stop();
   http_server.stop();
+  openai_http_server.stop();
   llm_handler->stop();
+  // export pending traces
+  Tracer::set_global(nullptr);
   return 0;
 }
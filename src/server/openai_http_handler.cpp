@@ -0,0 +1,450 @@
+#include "openai_http_handler.h"
+
+#include <absl/strings/ascii.h>
+#include <absl/strings/numbers.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <glog/logging.h>
+
+#include <boost/beast/http.hpp>
+#include <cstdint>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "request/output.h"
+#include "handlers/uuid.h"
+
+namespace llm {
+
+namespace {
+using json = nlohmann::json;
+namespace http = boost::beast::http;
+
+// NOLINTNEXTLINE
+thread_local ShortUUID short_uuid;
+
+int to_http_status(StatusCode code) {
+  switch (code) {
+    case StatusCode::OK:
+      return static_cast<int>(http::status::ok);
+    case StatusCode::CANCELLED:
+      // client closed request
+      return 499;
+    case StatusCode::INVALID_ARGUMENT:
+      return static_cast<int>(http::status::bad_request);
+    case StatusCode::DEADLINE_EXCEEDED:
+      return static_cast<int>(http::status::gateway_timeout);
+    case StatusCode::RESOURCE_EXHAUSTED:
+      return static_cast<int>(http::status::too_many_requests);
+    case StatusCode::UNAUTHENTICATED:
+      return static_cast<int>(http::status::unauthorized);
+    case StatusCode::UNAVAILABLE:
+      return static_cast<int>(http::status::service_unavailable);
+    case StatusCode::UNIMPLEMENTED:
+      return static_cast<int>(http::status::not_implemented);
+    case StatusCode::UNKNOWN:
+    default:
+      return static_cast<int>(http::status::internal_server_error);
+  }
+}
+
+json error_json(int http_status, const std::string& message) {
+  json error;
+  error["message"] = message;
+  error["type"] = http_status < 500 ? "invalid_request_error" : "server_error";
+  error["code"] = http_status;
+  return json{{"error", std::move(error)}};
+}
+
+void send_error(HttpServer::Channel* channel,
+                http::status http_status,
+                const std::string& message) {
+  const int code = static_cast<int>(http_status);
+  channel->send_response(code, error_json(code, message).dump());
+}
+
+json usage_json(const Usage& usage) {
+  return json{{"prompt_tokens", usage.num_prompt_tokens},
+              {"completion_tokens", usage.num_generated_tokens},
+              {"total_tokens", usage.num_total_tokens}};
+}
+
+json finish_reason_json(const std::optional<std::string>& finish_reason) {
+  return finish_reason.has_value() ? json(finish_reason.value()) : json();
+}
+
+// logprobs in the format of the legacy completions api
+json completion_logprobs_json(
+    const std::optional<std::vector<LogProb>>& logprobs) {
+  if (!logprobs.has_value()) {
+    return json();
+  }
+  auto tokens = json::array();
+  auto token_logprobs = json::array();
+  auto top_logprobs = json::array();
+  for (const auto& logprob : logprobs.value()) {
+    tokens.push_back(logprob.token);
+    token_logprobs.push_back(logprob.logprob);
+    auto top = json::object();
+    for (const auto& data : logprob.top_logprobs) {
+      top[data.token] = data.logprob;
+    }
+    top_logprobs.push_back(std::move(top));
+  }
+  return json{{"tokens", std::move(tokens)},
+              {"token_logprobs", std::move(token_logprobs)},
+              {"top_logprobs", std::move(top_logprobs)}};
+}
+
+// logprobs in the format of the chat completions api
+json chat_logprobs_json(const std::optional<std::vector<LogProb>>& logprobs) {
+  if (!logprobs.has_value()) {
+    return json();
+  }
+  auto content = json::array();
+  for (const auto& logprob : logprobs.value()) {
+    auto top_logprobs = json::array();
+    for (const auto& data : logprob.top_logprobs) {
+      top_logprobs.push_back({{"token", data.token},
+                              {"logprob", data.logprob}});
+    }
+    content.push_back({{"token", logprob.token},
+                       {"logprob", logprob.logprob},
+                       {"top_logprobs", std::move(top_logprobs)}});
+  }
+  return json{{"content", std::move(content)}};
+}
+
+Priority to_priority(const std::string& priority) {
+  const auto lower = absl::AsciiStrToLower(priority);
+  if (lower == "high") {
+    return Priority::HIGH;
+  }
+  if (lower == "low") {
+    return Priority::LOW;
+  }
+  return Priority::NORMAL;
+}
+
+// parse the json body of a POST request, send error to client on failure
+bool parse_body(const HttpServer::Request& request,
+                HttpServer::Channel* channel,
+                json* body) {
+  if (request.method() != http::verb::post) {
+    send_error(channel, http::status::method_not_allowed, "Only POST allowed");
+    return false;
+  }
+  *body = json::parse(request.body(), /*cb=*/nullptr, /*allow_exceptions=*/false);
+  if (body->is_discarded() || !body->is_object()) {
+    send_error(channel, http::status::bad_request, "Invalid json body");
+    return false;
+  }
+  return true;
+}
+
+template <typename T>
+void get_if_present(const json& body, const char* key, T* value) {
+  if (auto it = body.find(key); it != body.end() && !it->is_null()) {
+    it->get_to(*value);
+  }
+}
+
+// throws json::exception if any field has an unexpected type
+SamplingParams to_sampling_params(const json& body) {
+  SamplingParams sp;
+  get_if_present(body, "max_tokens", &sp.max_tokens);
+  get_if_present(body, "n", &sp.n);
+  get_if_present(body, "echo", &sp.echo);
+  get_if_present(body, "frequency_penalty", &sp.frequency_penalty);
+  get_if_present(body, "presence_penalty", &sp.presence_penalty);
+  get_if_present(body, "repetition_penalty", &sp.repetition_penalty);
+  get_if_present(body, "temperature", &sp.temperature);
+  get_if_present(body, "top_p", &sp.top_p);
+  get_if_present(body, "top_k", &sp.top_k);
+  get_if_present(body, "skip_special_tokens", &sp.skip_special_tokens);
+  get_if_present(body, "ignore_eos", &sp.ignore_eos);
+  if (auto it = body.find("stop"); it != body.end() && !it->is_null()) {
+    // stop can be either a string or a list of strings
+    if (it->is_string()) {
+      sp.stop = std::vector<std::string>{it->get<std::string>()};
+    } else {
+      sp.stop = it->get<std::vector<std::string>>();
+    }
+  }
+  if (auto it = body.find("stop_token_ids");
+      it != body.end() && !it->is_null()) {
+    sp.stop_token_ids = it->get<std::vector<int32_t>>();
+  }
+  get_if_present(body, "num_beams", &sp.num_beams);
+  get_if_present(body, "length_penalty", &sp.length_penalty);
+  get_if_present(body, "early_stopping", &sp.early_stopping);
+  if (auto it = body.find("logit_bias"); it != body.end() && !it->is_null()) {
+    // keys are token ids as strings, invalid ones are rejected as out of vocab
+    std::unordered_map<int32_t, float> logit_bias;
+    for (const auto& [key, bias] : it->items()) {
+      int32_t token_id = -1;
+      if (!absl::SimpleAtoi(key, &token_id)) {
+        token_id = -1;
+      }
+      logit_bias[token_id] = bias.get<float>();
+    }
+    sp.logit_bias = std::move(logit_bias);
+  }
+  if (auto it = body.find("banned_token_ids");
+      it != body.end() && !it->is_null()) {
+    sp.banned_token_ids = it->get<std::vector<int32_t>>();
+  }
+  if (auto it = body.find("session_id"); it != body.end() && !it->is_null()) {
+    sp.session_id = it->get<std::string>();
+  }
+  return sp;
+}
+
+// common fields of a response
+json response_json(const char* object,
+                   const std::string& request_id,
+                   int64_t created_time,
+                   const std::string& model) {
+  return json{{"id", request_id},
+              {"object", object},
+              {"created", created_time},
+              {"model", model}};
+}
+
+// send error to client, either as a http error or as an event if the event
+// stream has started
+bool send_status_error(HttpServer::Channel* channel,
+                       bool stream_started,
+                       const Status& status) {
+  const int code = to_http_status(status.code());
+  if (stream_started) {
+    channel->send_event(error_json(code, status.message()).dump());
+    channel->finish();
+    return false;
+  }
+  channel->send_response(code, error_json(code, status.message()).dump());
+  return false;
+}
+
+}  // namespace
+
+OpenAIHttpHandler::OpenAIHttpHandler(LLMHandler* llm_handler,
+                                     const std::vector<std::string>& models)
+    : llm_handler_(llm_handler), models_(models.begin(), models.end()) {
+  CHECK(llm_handler_ != nullptr);
+  CHECK(!models_.empty());
+}
+
+bool OpenAIHttpHandler::register_endpoints(HttpServer* http_server) {
+  return http_server->register_async_uri(
+             "/v1/completions",
+             [this](const HttpServer::Request& request,
+                    std::shared_ptr<HttpServer::Channel> channel) {
+               complete_async(request, std::move(channel));
+             }) &&
+         http_server->register_async_uri(
+             "/v1/chat/completions",
+             [this](const HttpServer::Request& request,
+                    std::shared_ptr<HttpServer::Channel> channel) {
+               chat_async(request, std::move(channel));
+             });
+}
+
+void OpenAIHttpHandler::complete_async(
+    const HttpServer::Request& request,
+    std::shared_ptr<HttpServer::Channel> channel) {
+  json body;
+  if (!parse_body(request, channel.get(), &body)) {
+    return;
+  }
+
+  std::string model;
+  std::string prompt;
+  std::string priority;
+  bool stream = false;
+  SamplingParams sp;
+  try {
+    get_if_present(body, "model", &model);
+    get_if_present(body, "prompt", &prompt);
+    get_if_present(body, "priority", &priority);
+    get_if_present(body, "stream", &stream);
+    sp = to_sampling_params(body);
+    // the number of alternatives to return with logprobs of chosen tokens
+    if (auto it = body.find("logprobs"); it != body.end() && !it->is_null()) {
+      sp.logprobs = true;
+      sp.top_logprobs = it->get<uint32_t>();
+    }
+    get_if_present(body, "prompt_logprobs", &sp.prompt_logprobs);
+  } catch (const json::exception& e) {
+    send_error(channel.get(), http::status::bad_request, e.what());
+    return;
+  }
+  // check if model is supported
+  if (!models_.contains(model)) {
+    send_error(channel.get(), http::status::not_found, "Model not supported");
+    return;
+  }
+
+  // schedule the request
+  llm_handler_->schedule_async(
+      std::move(prompt),
+      std::move(sp),
+      to_priority(priority),
+      stream,
+      [channel = std::move(channel),
+       model,
+       stream,
+       stream_started = false,
+       request_id = "cmpl-" + short_uuid.random(),
+       created_time = absl::ToUnixSeconds(absl::Now())](
+          const RequestOutput& req_output) mutable -> bool {
+        if (req_output.status.has_value() && !req_output.status->ok()) {
+          return send_status_error(
+              channel.get(), stream_started, req_output.status.value());
+        }
+
+        auto response =
+            response_json("text_completion", request_id, created_time, model);
+        auto choices = json::array();
+        for (const auto& output : req_output.outputs) {
+          choices.push_back(
+              {{"index", output.index},
+               {"text", output.text},
+               {"logprobs", completion_logprobs_json(output.logprobs)},
+               {"finish_reason", finish_reason_json(output.finish_reason)}});
+        }
+        response["choices"] = std::move(choices);
+        if (req_output.prompt_logprobs.has_value()) {
+          response["prompt_logprobs"] =
+              completion_logprobs_json(req_output.prompt_logprobs);
+        }
+        if (req_output.usage.has_value()) {
+          response["usage"] = usage_json(req_output.usage.value());
+        }
+
+        if (!stream) {
+          // only one output is expected for non-streaming request
+          return channel->send_response(
+              static_cast<int>(http::status::ok), response.dump());
+        }
+
+        stream_started = true;
+        if (!channel->send_event(response.dump())) {
+          return false;
+        }
+        if (req_output.finished) {
+          return channel->send_event("[DONE]") && channel->finish();
+        }
+        return true;
+      });
+}
+
+void OpenAIHttpHandler::chat_async(
+    const HttpServer::Request& request,
+    std::shared_ptr<HttpServer::Channel> channel) {
+  json body;
+  if (!parse_body(request, channel.get(), &body)) {
+    return;
+  }
+
+  std::string model;
+  std::string priority;
+  bool stream = false;
+  std::vector<Message> messages;
+  SamplingParams sp;
+  try {
+    get_if_present(body, "model", &model);
+    get_if_present(body, "priority", &priority);
+    get_if_present(body, "stream", &stream);
+    sp = to_sampling_params(body);
+    get_if_present(body, "logprobs", &sp.logprobs);
+    get_if_present(body, "top_logprobs", &sp.top_logprobs);
+    for (const auto& message : body.value("messages", json::array())) {
+      messages.emplace_back(message.value("role", ""),
+                            message.value("content", ""));
+    }
+  } catch (const json::exception& e) {
+    send_error(channel.get(), http::status::bad_request, e.what());
+    return;
+  }
+  // check if model is supported
+  if (!models_.contains(model)) {
+    send_error(channel.get(), http::status::not_found, "Model not supported");
+    return;
+  }
+
+  // schedule the request
+  llm_handler_->schedule_chat_async(
+      std::move(messages),
+      std::move(sp),
+      to_priority(priority),
+      stream,
+      [channel = std::move(channel),
+       model,
+       stream,
+       stream_started = false,
+       first_message_sent = std::unordered_set<size_t>(),
+       request_id = "chatcmpl-" + short_uuid.random(),
+       created_time = absl::ToUnixSeconds(absl::Now())](
+          const RequestOutput& req_output) mutable -> bool {
+        if (req_output.status.has_value() && !req_output.status->ok()) {
+          return send_status_error(
+              channel.get(), stream_started, req_output.status.value());
+        }
+
+        if (!stream) {
+          auto response = response_json(
+              "chat.completion", request_id, created_time, model);
+          auto choices = json::array();
+          for (const auto& output : req_output.outputs) {
+            choices.push_back(
+                {{"index", output.index},
+                 {"message", {{"role", "assistant"}, {"content", output.text}}},
+                 {"logprobs", chat_logprobs_json(output.logprobs)},
+                 {"finish_reason", finish_reason_json(output.finish_reason)}});
+          }
+          response["choices"] = std::move(choices);
+          if (req_output.usage.has_value()) {
+            response["usage"] = usage_json(req_output.usage.value());
+          }
+          return channel->send_response(static_cast<int>(http::status::ok),
+                                        response.dump());
+        }
+
+        auto response = response_json(
+            "chat.completion.chunk", request_id, created_time, model);
+        auto choices = json::array();
+        for (const auto& output : req_output.outputs) {
+          json delta = {{"content", output.text}};
+          // send role with the first message of each choice
+          if (first_message_sent.insert(output.index).second) {
+            delta["role"] = "assistant";
+          }
+          choices.push_back(
+              {{"index", output.index},
+               {"delta", std::move(delta)},
+               {"logprobs", chat_logprobs_json(output.logprobs)},
+               {"finish_reason", finish_reason_json(output.finish_reason)}});
+        }
+        response["choices"] = std::move(choices);
+        if (req_output.usage.has_value()) {
+          response["usage"] = usage_json(req_output.usage.value());
+        }
+
+        stream_started = true;
+        if (!channel->send_event(response.dump())) {
+          return false;
+        }
+        if (req_output.finished) {
+          return channel->send_event("[DONE]") && channel->finish();
+        }
+        return true;
+      });
+}
+
+}  // namespace llm
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <absl/container/flat_hash_set.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "handlers/llm_handler.h"
+#include "http_server.h"
+
+namespace llm {
+
+// Serves OpenAI compatible completion and chat endpoints over http, streaming
+// responses are sent as server-sent events.
+// following: https://platform.openai.com/docs/api-reference
+class OpenAIHttpHandler final {
+ public:
+  OpenAIHttpHandler(LLMHandler* llm_handler,
+                    const std::vector<std::string>& models);
+
+  // register /v1/completions and /v1/chat/completions to the http server,
+  // which should be a dedicated one for the api.
+  bool register_endpoints(HttpServer* http_server);
+
+  // POST /v1/completions
+  void complete_async(const HttpServer::Request& request,
+                      std::shared_ptr<HttpServer::Channel> channel);
+
+  // POST /v1/chat/completions
+  void chat_async(const HttpServer::Request& request,
+                  std::shared_ptr<HttpServer::Channel> channel);
+
+ private:
+  // llm handler
+  LLMHandler* llm_handler_;
+
+  // models that are supported by this handler
+  absl::flat_hash_set<std::string> models_;
+};
+
+}  // namespace llm
@@ -11,17 +11,17 @@
 #include "engine/parameters.h"
 #include "rejection_sampler.h"
 
-DEFINE_COUNTER_FAMILY(speculative_execution_latency_seconds,
-                      "Execution latency in seconds");
-DEFINE_COUNTER_INSTANCE(draft_execution_latency_seconds,
-                        speculative_execution_latency_seconds,
-                        {{"stage", "draft"}});
-DEFINE_COUNTER_INSTANCE(target_execution_latency_seconds,
-                        speculative_execution_latency_seconds,
-                        {{"stage", "target"}});
-DEFINE_COUNTER_INSTANCE(validation_latency_seconds,
-                        speculative_execution_latency_seconds,
-                        {{"stage", "validation"}});
+DEFINE_HISTOGRAM_FAMILY(speculative_execution_latency_seconds,
+                        "Execution latency in seconds");
+DEFINE_HISTOGRAM_INSTANCE(draft_execution_latency_seconds,
+                          speculative_execution_latency_seconds,
+                          {{"stage", "draft"}});
+DEFINE_HISTOGRAM_INSTANCE(target_execution_latency_seconds,
+                          speculative_execution_latency_seconds,
+                          {{"stage", "target"}});
+DEFINE_HISTOGRAM_INSTANCE(validation_latency_seconds,
+                          speculative_execution_latency_seconds,
+                          {{"stage", "validation"}});
 
 namespace llm {
 
@@ -74,8 +74,7 @@ bool SpeculativeEngine::init(const std::string& model_weights_path,
   }
 
   // warmup the model
-  if (!engine_->capture_cuda_graphs() ||
-      !draft_engine_->capture_cuda_graphs()) {
+  if (!engine_->warmup_model() || !draft_engine_->warmup_model()) {
     return false;
   }
 
@@ -168,18 +167,18 @@ ModelOutput SpeculativeEngine::execute_model(Batch& batch) {
     auto draft_output = draft_engine_->execute_model(batch);
     draft_outputs.push_back(draft_output);
   }
-  COUNTER_ADD(draft_execution_latency_seconds, timer.elapsed_seconds());
+  HISTOGRAM_OBSERVE(draft_execution_latency_seconds, timer.elapsed_seconds());
 
   // run the target model to get the verification scores
   timer.reset();
   batch.set_engine_type(EngineType::LLM);
   ModelOutput output = engine_->execute_model(batch);
-  COUNTER_ADD(target_execution_latency_seconds, timer.elapsed_seconds());
+  HISTOGRAM_OBSERVE(target_execution_latency_seconds, timer.elapsed_seconds());
 
   // verify the proposals with target and update the batch
   timer.reset();
   validate(batch, draft_outputs, output);
-  COUNTER_ADD(validation_latency_seconds, timer.elapsed_seconds());
+  HISTOGRAM_OBSERVE(validation_latency_seconds, timer.elapsed_seconds());
 
   return output;
 }
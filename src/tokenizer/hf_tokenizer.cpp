@@ -2,6 +2,11 @@
 
 #include <glog/logging.h>
 
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "huggingface/tokenizers.h"
 
 namespace llm {
@@ -11,49 +16,131 @@ std::unique_ptr<HFTokenizer> HFTokenizer::from_file(
   TokenizerHandle handle = tokenizer_from_file(tokenizer_file_path.c_str());
   CHECK(handle != nullptr) << "Failed to load tokenizer from file: "
                            << tokenizer_file_path;
-  return std::make_unique<HFTokenizer>(tokenizer_file_path, handle);
+  return std::make_unique<HFTokenizer>(handle);
 }
 
-HFTokenizer::HFTokenizer(const std::string& tokenizer_file_path,
-                         TokenizerHandle handle)
-    : tokenizer_file_path_(tokenizer_file_path), handle_(handle) {
+HFTokenizer::HFTokenizer(TokenizerHandle handle)
+    : handle_(handle, tokenizer_free) {
   CHECK(handle_ != nullptr);
 }
 
+HFTokenizer::HFTokenizer(std::shared_ptr<void> handle)
+    : handle_(std::move(handle)) {}
+
 std::unique_ptr<Tokenizer> HFTokenizer::clone() const {
-  return from_file(tokenizer_file_path_);
+  // the handle is thread-safe, no need to reload the tokenizer
+  return std::unique_ptr<HFTokenizer>(new HFTokenizer(handle_));
 }
 
-HFTokenizer::~HFTokenizer() { tokenizer_free(handle_); }
-
 bool HFTokenizer::encode(const std::string_view& text,
                          std::vector<int32_t>* ids) const {
-  tokenizer_encode(
-      handle_, text.data(), text.size(), /*add_special_tokens=*/true);
-  const uint32_t* data = nullptr;
+  uint32_t* data = nullptr;
   size_t len = 0;
-  tokenizer_get_encode_ids(handle_, &data, &len);
+  if (!tokenizer_encode(handle_.get(),
+                        text.data(),
+                        text.size(),
+                        /*add_special_tokens=*/true,
+                        &data,
+                        &len)) {
+    return false;
+  }
   ids->reserve(len);
   for (size_t i = 0; i < len; ++i) {
     ids->push_back(static_cast<int32_t>(data[i]));
   }
+  tokenizer_free_ids(data, len);
+  return true;
+}
+
+bool HFTokenizer::batch_encode(const std::vector<std::string_view>& texts,
+                               std::vector<std::vector<int32_t>>* ids) const {
+  std::vector<const char*> data;
+  std::vector<size_t> lens;
+  data.reserve(texts.size());
+  lens.reserve(texts.size());
+  for (const auto& text : texts) {
+    data.push_back(text.data());
+    lens.push_back(text.size());
+  }
+
+  uint32_t* out_ids = nullptr;
+  size_t out_len = 0;
+  size_t* offsets = nullptr;
+  if (!tokenizer_encode_batch(handle_.get(),
+                              data.data(),
+                              lens.data(),
+                              texts.size(),
+                              /*add_special_tokens=*/true,
+                              &out_ids,
+                              &out_len,
+                              &offsets)) {
+    return false;
+  }
+  ids->resize(texts.size());
+  for (size_t i = 0; i < texts.size(); ++i) {
+    auto& seq_ids = (*ids)[i];
+    seq_ids.assign(out_ids + offsets[i], out_ids + offsets[i + 1]);
+  }
+  tokenizer_free_ids(out_ids, out_len);
+  tokenizer_free_offsets(offsets, texts.size() + 1);
   return true;
 }
 
 std::string HFTokenizer::decode(const Slice<int32_t>& ids,
                                 bool skip_special_tokens) const {
-  tokenizer_decode(handle_,
-                   reinterpret_cast<const uint32_t*>(ids.data()),
-                   ids.size(),
-                   skip_special_tokens);
-  const char* data = nullptr;
+  char* data = nullptr;
+  size_t len = 0;
+  if (!tokenizer_decode(handle_.get(),
+                        reinterpret_cast<const uint32_t*>(ids.data()),
+                        ids.size(),
+                        skip_special_tokens,
+                        &data,
+                        &len)) {
+    LOG(ERROR) << "Failed to decode " << ids.size() << " tokens";
+    return {};
+  }
+  std::string text(data, len);
+  tokenizer_free_str(data, len);
+  return text;
+}
+
+bool HFTokenizer::batch_decode(const std::vector<Slice<int32_t>>& tokens,
+                               bool skip_special_tokens,
+                               std::vector<std::string>* texts) const {
+  std::vector<const uint32_t*> ids;
+  std::vector<size_t> lens;
+  ids.reserve(tokens.size());
+  lens.reserve(tokens.size());
+  for (const auto& t : tokens) {
+    ids.push_back(reinterpret_cast<const uint32_t*>(t.data()));
+    lens.push_back(t.size());
+  }
+
+  char* data = nullptr;
   size_t len = 0;
-  tokenizer_get_decode_str(handle_, &data, &len);
-  return {data, len};
+  size_t* offsets = nullptr;
+  if (!tokenizer_decode_batch(handle_.get(),
+                              ids.data(),
+                              lens.data(),
+                              tokens.size(),
+                              skip_special_tokens,
+                              &data,
+                              &len,
+                              &offsets)) {
+    return false;
+  }
+  texts->clear();
+  texts->reserve(tokens.size());
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    texts->emplace_back(data + offsets[i], offsets[i + 1] - offsets[i]);
+  }
+  tokenizer_free_str(data, len);
+  tokenizer_free_offsets(offsets, tokens.size() + 1);
+  return true;
 }
 
 size_t HFTokenizer::vocab_size() const {
-  return tokenizer_vocab_size(handle_, /*with_added_tokens=*/true);
+  return tokenizer_vocab_size(handle_.get(), /*with_added_tokens=*/true);
 }
 
 }  // namespace llm
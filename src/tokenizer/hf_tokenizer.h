@@ -1,17 +1,18 @@
 #pragma once
 
+#include <memory>
+
 #include "tokenizer.h"
 #include "huggingface/tokenizers.h"
 
 namespace llm {
 
 // a tokenizer that uses hf/tokenizers
-// not thread-safe, can't be used in multiple threads.
+// thread-safe, results are returned in buffers owned by the caller, so clones
+// share the same handle without reloading the tokenizer.
 class HFTokenizer : public Tokenizer {
  public:
-  HFTokenizer(const std::string& tokenizer_file_path, TokenizerHandle handle);
-
-  ~HFTokenizer() override;
+  explicit HFTokenizer(TokenizerHandle handle);
 
   bool encode(const std::string_view& text,
               std::vector<int32_t>* ids) const override;
@@ -19,6 +20,15 @@ class HFTokenizer : public Tokenizer {
   std::string decode(const Slice<int32_t>& ids,
                      bool skip_special_tokens) const override;
 
+  // encode texts in parallel with one call into hf/tokenizers
+  bool batch_encode(const std::vector<std::string_view>& texts,
+                    std::vector<std::vector<int32_t>>* ids) const override;
+
+  // decode token ids in parallel with one call into hf/tokenizers
+  bool batch_decode(const std::vector<Slice<int32_t>>& tokens,
+                    bool skip_special_tokens,
+                    std::vector<std::string>* texts) const override;
+
   size_t vocab_size() const override;
 
   std::unique_ptr<Tokenizer> clone() const override;
@@ -26,9 +36,10 @@ class HFTokenizer : public Tokenizer {
   static std::unique_ptr<HFTokenizer> from_file(const std::string& path);
 
  private:
-  std::string tokenizer_file_path_;
+  explicit HFTokenizer(std::shared_ptr<void> handle);
 
-  TokenizerHandle handle_ = nullptr;
+  // shared by clones, freed with the last one
+  std::shared_ptr<void> handle_;
 };
 
 }  // namespace llm
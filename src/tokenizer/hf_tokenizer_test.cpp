@@ -0,0 +1,70 @@
+#include "hf_tokenizer.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace llm {
+
+TEST(HFTokenizerTest, EncodeDecodeTest) {
+  auto tokenizer = HFTokenizer::from_file("data/tokenizer.json");
+  EXPECT_EQ(tokenizer->vocab_size(), 5);
+  std::vector<int> ids;
+  ASSERT_TRUE(tokenizer->encode("hello, world!", &ids));
+  const std::vector<int> desired_ids = {1, 3, 2, 4};
+  EXPECT_EQ(ids, desired_ids);
+  // unknown words
+  ids.clear();
+  ASSERT_TRUE(tokenizer->encode("hello foo", &ids));
+  EXPECT_EQ(ids, std::vector<int>({1, 0}));
+
+  const auto text = tokenizer->decode(desired_ids,
+                                      /*skip_special_tokens=*/false);
+  EXPECT_EQ(text, "hello , world !");
+}
+
+TEST(HFTokenizerTest, BatchEncodeDecodeTest) {
+  auto tokenizer = HFTokenizer::from_file("data/tokenizer.json");
+  const std::vector<std::string_view> texts = {
+      "hello world", "", "world, hello!"};
+  std::vector<std::vector<int32_t>> ids;
+  ASSERT_TRUE(tokenizer->batch_encode(texts, &ids));
+  ASSERT_EQ(ids.size(), 3);
+  EXPECT_EQ(ids[0], std::vector<int32_t>({1, 2}));
+  EXPECT_TRUE(ids[1].empty());
+  EXPECT_EQ(ids[2], std::vector<int32_t>({2, 3, 1, 4}));
+
+  std::vector<std::string> decoded;
+  ASSERT_TRUE(tokenizer->batch_decode(
+      {ids[0], ids[1], ids[2]}, /*skip_special_tokens=*/false, &decoded));
+  EXPECT_EQ(decoded,
+            std::vector<std::string>({"hello world", "", "world , hello !"}));
+}
+
+TEST(HFTokenizerTest, ConcurrentEncodeTest) {
+  auto tokenizer = HFTokenizer::from_file("data/tokenizer.json");
+  // clones share the handle, which can be used by multiple threads
+  auto clone = tokenizer->clone();
+  std::vector<std::thread> threads;
+  std::vector<std::vector<int>> ids(8);
+  for (size_t i = 0; i < ids.size(); ++i) {
+    const Tokenizer* t = i % 2 == 0 ? tokenizer.get() : clone.get();
+    threads.emplace_back([t, &ids, i] {
+      for (int j = 0; j < 100; ++j) {
+        ids[i].clear();
+        EXPECT_TRUE(t->encode("hello, world!", &ids[i]));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& seq_ids : ids) {
+    EXPECT_EQ(seq_ids, std::vector<int>({1, 3, 2, 4}));
+  }
+}
+
+}  // namespace llm
@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace llm {
@@ -32,6 +33,31 @@ class Tokenizer {
   virtual std::string decode(const Slice<int32_t>& tokens,
                              bool skip_special_tokens) const = 0;
 
+  // encode a batch of texts, returns false if any of them fails.
+  // tokenizers may override it to encode texts in parallel.
+  virtual bool batch_encode(const std::vector<std::string_view>& texts,
+                            std::vector<std::vector<int32_t>>* ids) const {
+    ids->resize(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i) {
+      if (!encode(texts[i], &(*ids)[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // decode a batch of token ids, returns false if any of them fails.
+  virtual bool batch_decode(const std::vector<Slice<int32_t>>& tokens,
+                            bool skip_special_tokens,
+                            std::vector<std::string>* texts) const {
+    texts->clear();
+    texts->reserve(tokens.size());
+    for (const auto& t : tokens) {
+      texts->push_back(decode(t, skip_special_tokens));
+    }
+    return true;
+  }
+
   virtual size_t vocab_size() const = 0;
 
   virtual std::unique_ptr<Tokenizer> clone() const = 0;